@@ -650,6 +650,24 @@ static inline void tiler_unpin_block(tiler_blk_handle handle)
 }
 #endif
 
+typedef bool (*tiler_reclaim_fn)(void);
+
+/**
+ * Sets the function TILER calls when there is no room left in the
+ * container for a block, so that a user keeping freed blocks around for
+ * reuse can release them.  The allocation is retried if it returns true.
+ * It is called with TILER unlocked, and may free blocks.
+ *
+ * @param fn		Function releasing cached blocks, or NULL
+ */
+#if defined(CONFIG_TI_TILER)
+void tiler_set_reclaim(tiler_reclaim_fn fn);
+#else
+static inline void tiler_set_reclaim(tiler_reclaim_fn fn)
+{
+}
+#endif
+
 /**
  * Gives memory requirements for a given container allocation
  *
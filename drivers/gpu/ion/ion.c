@@ -26,6 +26,7 @@
 #include <linux/rbtree.h>
 #include <linux/sched.h>
 #include <linux/slab.h>
+#include <linux/spinlock.h>
 #include <linux/seq_file.h>
 #include <linux/uaccess.h>
 #include <linux/debugfs.h>
@@ -41,6 +42,10 @@
  * @lock:		lock protecting the buffers & heaps trees
  * @heaps:		list of all the heaps in the system
  * @user_clients:	list of all the clients created from userspace
+ * @map_lru:		buffers with an unused kernel mapping or scatterlist,
+ *			least recently unmapped first
+ * @map_lru_cnt:	number of buffers on map_lru
+ * @map_lru_lock:	lock protecting map_lru and map_lru_cnt
  */
 struct ion_device {
 	struct miscdevice dev;
@@ -52,14 +57,25 @@ struct ion_device {
 	struct rb_root user_clients;
 	struct rb_root kernel_clients;
 	struct dentry *debug_root;
+	struct list_head map_lru;
+	int map_lru_cnt;
+	spinlock_t map_lru_lock;
 };
 
+/*
+ * Unused kernel mappings and scatterlists are kept so that map/unmap
+ * cycles do not remap a buffer each time, but only for this many of the
+ * most recently unmapped buffers, as they pin vmalloc space.
+ */
+#define ION_MAP_CACHE_MAX	16
+
 /**
  * struct ion_client - a process/hw block local address space
  * @ref:		for reference counting the client
  * @node:		node in the tree of all clients
  * @dev:		backpointer to ion device
  * @handles:		an rb tree of all the handles in this client
+ * @handles_by_buffer:	the same handles, ordered by their buffer
  * @lock:		lock protecting the tree of handles
  * @heap_mask:		mask of all supported heaps
  * @name:		used for debugging
@@ -74,6 +90,7 @@ struct ion_client {
 	struct rb_node node;
 	struct ion_device *dev;
 	struct rb_root handles;
+	struct rb_root handles_by_buffer;
 	struct mutex lock;
 	unsigned int heap_mask;
 	const char *name;
@@ -88,6 +105,7 @@ struct ion_client {
  * @client:		back pointer to the client the buffer resides in
  * @buffer:		pointer to the buffer
  * @node:		node in the client's handle rbtree
+ * @buffer_node:	node in the client's handles_by_buffer rbtree
  * @kmap_cnt:		count of times this client has mapped to kernel
  * @dmap_cnt:		count of times this client has mapped for dma
  * @usermap_cnt:	count of times this client has mapped for userspace
@@ -100,6 +118,7 @@ struct ion_handle {
 	struct ion_client *client;
 	struct ion_buffer *buffer;
 	struct rb_node node;
+	struct rb_node buffer_node;
 	unsigned int kmap_cnt;
 	unsigned int dmap_cnt;
 	unsigned int usermap_cnt;
@@ -155,16 +174,37 @@ static struct ion_buffer *ion_buffer_create(struct ion_heap *heap,
 	}
 	buffer->dev = dev;
 	buffer->size = len;
+	/* heaps may have cleared the memory through the cache */
+	buffer->cpu_dirty_end = len;
 	mutex_init(&buffer->lock);
+	INIT_LIST_HEAD(&buffer->map_lru);
 	ion_buffer_add(dev, buffer);
 	return buffer;
 }
 
+static void ion_map_lru_del(struct ion_buffer *buffer)
+{
+	struct ion_device *dev = buffer->dev;
+
+	spin_lock(&dev->map_lru_lock);
+	if (!list_empty(&buffer->map_lru)) {
+		list_del_init(&buffer->map_lru);
+		dev->map_lru_cnt--;
+	}
+	spin_unlock(&dev->map_lru_lock);
+}
+
 static void ion_buffer_destroy(struct kref *kref)
 {
 	struct ion_buffer *buffer = container_of(kref, struct ion_buffer, ref);
 	struct ion_device *dev = buffer->dev;
 
+	ion_map_lru_del(buffer);
+	/* unused mappings may still be cached, see ion_map_lru_add */
+	if (buffer->vaddr)
+		buffer->heap->ops->unmap_kernel(buffer->heap, buffer);
+	if (buffer->sglist)
+		buffer->heap->ops->unmap_dma(buffer->heap, buffer);
 	buffer->heap->ops->free(buffer);
 	mutex_lock(&dev->lock);
 	rb_erase(&buffer->node, &dev->buffers);
@@ -192,6 +232,7 @@ static struct ion_handle *ion_handle_create(struct ion_client *client,
 		return ERR_PTR(-ENOMEM);
 	kref_init(&handle->ref);
 	rb_init_node(&handle->node);
+	rb_init_node(&handle->buffer_node);
 	handle->client = client;
 	ion_buffer_get(buffer);
 	handle->buffer = buffer;
@@ -209,6 +250,9 @@ static void ion_handle_destroy(struct kref *kref)
 	ion_buffer_put(handle->buffer);
 	if (!RB_EMPTY_NODE(&handle->node))
 		rb_erase(&handle->node, &handle->client->handles);
+	if (!RB_EMPTY_NODE(&handle->buffer_node))
+		rb_erase(&handle->buffer_node,
+			 &handle->client->handles_by_buffer);
 	kfree(handle);
 }
 
@@ -230,12 +274,16 @@ static int ion_handle_put(struct ion_handle *handle)
 static struct ion_handle *ion_handle_lookup(struct ion_client *client,
 					    struct ion_buffer *buffer)
 {
-	struct rb_node *n;
+	struct rb_node *n = client->handles_by_buffer.rb_node;
 
-	for (n = rb_first(&client->handles); n; n = rb_next(n)) {
+	while (n) {
 		struct ion_handle *handle = rb_entry(n, struct ion_handle,
-						     node);
-		if (handle->buffer == buffer)
+						     buffer_node);
+		if (buffer < handle->buffer)
+			n = n->rb_left;
+		else if (buffer > handle->buffer)
+			n = n->rb_right;
+		else
 			return handle;
 	}
 	return NULL;
@@ -278,6 +326,21 @@ static void ion_handle_add(struct ion_client *client, struct ion_handle *handle)
 
 	rb_link_node(&handle->node, parent, p);
 	rb_insert_color(&handle->node, &client->handles);
+
+	p = &client->handles_by_buffer.rb_node;
+	parent = NULL;
+	while (*p) {
+		parent = *p;
+		entry = rb_entry(parent, struct ion_handle, buffer_node);
+
+		if (handle->buffer < entry->buffer)
+			p = &(*p)->rb_left;
+		else
+			p = &(*p)->rb_right;
+	}
+
+	rb_link_node(&handle->buffer_node, parent, p);
+	rb_insert_color(&handle->buffer_node, &client->handles_by_buffer);
 }
 
 struct ion_handle *ion_alloc(struct ion_client *client, size_t len,
@@ -355,6 +418,73 @@ EXPORT_SYMBOL(ion_free);
 static void ion_client_get(struct ion_client *client);
 static int ion_client_put(struct ion_client *client);
 
+/* buffer->lock must be held */
+static void ion_buffer_unmap_unused(struct ion_buffer *buffer)
+{
+	if (buffer->vaddr && !buffer->kmap_cnt) {
+		buffer->heap->ops->unmap_kernel(buffer->heap, buffer);
+		buffer->vaddr = NULL;
+	}
+	if (buffer->sglist && !buffer->dmap_cnt) {
+		buffer->heap->ops->unmap_dma(buffer->heap, buffer);
+		buffer->sglist = NULL;
+	}
+}
+
+/*
+ * buffer->lock must be held, and the last user of the kernel mapping or
+ * the scatterlist of the buffer just unmapped it
+ */
+static void ion_map_lru_add(struct ion_buffer *buffer)
+{
+	struct ion_device *dev = buffer->dev;
+
+	spin_lock(&dev->map_lru_lock);
+	if (list_empty(&buffer->map_lru))
+		dev->map_lru_cnt++;
+	list_move_tail(&buffer->map_lru, &dev->map_lru);
+	spin_unlock(&dev->map_lru_lock);
+}
+
+/* buffer->lock must be held, the buffer was just mapped */
+static void ion_map_lru_used(struct ion_buffer *buffer)
+{
+	if ((!buffer->vaddr || buffer->kmap_cnt) &&
+	    (!buffer->sglist || buffer->dmap_cnt))
+		ion_map_lru_del(buffer);
+}
+
+/*
+ * Tears down the unused mappings of the least recently unmapped buffers
+ * beyond ION_MAP_CACHE_MAX.  Must be called without any buffer->lock held.
+ */
+static void ion_map_lru_trim(struct ion_device *dev)
+{
+	struct ion_buffer *buffer;
+
+	spin_lock(&dev->map_lru_lock);
+	while (dev->map_lru_cnt > ION_MAP_CACHE_MAX) {
+		buffer = list_first_entry(&dev->map_lru, struct ion_buffer,
+					  map_lru);
+		list_del_init(&buffer->map_lru);
+		dev->map_lru_cnt--;
+		/* ion_buffer_destroy() unmaps a buffer on its way out */
+		if (!atomic_inc_not_zero(&buffer->ref.refcount))
+			continue;
+		spin_unlock(&dev->map_lru_lock);
+
+		mutex_lock(&buffer->lock);
+		/* unmapped again meanwhile, it is the most recent one now */
+		if (list_empty(&buffer->map_lru))
+			ion_buffer_unmap_unused(buffer);
+		mutex_unlock(&buffer->lock);
+		ion_buffer_put(buffer);
+
+		spin_lock(&dev->map_lru_lock);
+	}
+	spin_unlock(&dev->map_lru_lock);
+}
+
 static bool _ion_map(int *buffer_cnt, int *handle_cnt)
 {
 	bool map;
@@ -434,14 +564,17 @@ void *ion_map_kernel(struct ion_client *client, struct ion_handle *handle)
 		return ERR_PTR(-ENODEV);
 	}
 
-	if (_ion_map(&buffer->kmap_cnt, &handle->kmap_cnt)) {
+	if (_ion_map(&buffer->kmap_cnt, &handle->kmap_cnt) &&
+	    !buffer->vaddr) {
 		vaddr = buffer->heap->ops->map_kernel(buffer->heap, buffer);
 		if (IS_ERR_OR_NULL(vaddr))
 			_ion_unmap(&buffer->kmap_cnt, &handle->kmap_cnt);
-		buffer->vaddr = vaddr;
+		else
+			buffer->vaddr = vaddr;
 	} else {
 		vaddr = buffer->vaddr;
 	}
+	ion_map_lru_used(buffer);
 	mutex_unlock(&buffer->lock);
 	mutex_unlock(&client->lock);
 	return vaddr;
@@ -471,14 +604,17 @@ struct scatterlist *ion_map_dma(struct ion_client *client,
 		mutex_unlock(&client->lock);
 		return ERR_PTR(-ENODEV);
 	}
-	if (_ion_map(&buffer->dmap_cnt, &handle->dmap_cnt)) {
+	if (_ion_map(&buffer->dmap_cnt, &handle->dmap_cnt) &&
+	    !buffer->sglist) {
 		sglist = buffer->heap->ops->map_dma(buffer->heap, buffer);
 		if (IS_ERR_OR_NULL(sglist))
 			_ion_unmap(&buffer->dmap_cnt, &handle->dmap_cnt);
-		buffer->sglist = sglist;
+		else
+			buffer->sglist = sglist;
 	} else {
 		sglist = buffer->sglist;
 	}
+	ion_map_lru_used(buffer);
 	mutex_unlock(&buffer->lock);
 	mutex_unlock(&client->lock);
 	return sglist;
@@ -492,12 +628,12 @@ void ion_unmap_kernel(struct ion_client *client, struct ion_handle *handle)
 	mutex_lock(&client->lock);
 	buffer = handle->buffer;
 	mutex_lock(&buffer->lock);
-	if (_ion_unmap(&buffer->kmap_cnt, &handle->kmap_cnt)) {
-		buffer->heap->ops->unmap_kernel(buffer->heap, buffer);
-		buffer->vaddr = NULL;
-	}
+	/* the mapping stays cached for the next user while there is room */
+	if (_ion_unmap(&buffer->kmap_cnt, &handle->kmap_cnt))
+		ion_map_lru_add(buffer);
 	mutex_unlock(&buffer->lock);
 	mutex_unlock(&client->lock);
+	ion_map_lru_trim(client->dev);
 }
 EXPORT_SYMBOL(ion_unmap_kernel);
 
@@ -508,12 +644,12 @@ void ion_unmap_dma(struct ion_client *client, struct ion_handle *handle)
 	mutex_lock(&client->lock);
 	buffer = handle->buffer;
 	mutex_lock(&buffer->lock);
-	if (_ion_unmap(&buffer->dmap_cnt, &handle->dmap_cnt)) {
-		buffer->heap->ops->unmap_dma(buffer->heap, buffer);
-		buffer->sglist = NULL;
-	}
+	/* the scatterlist stays cached for the next user while there is room */
+	if (_ion_unmap(&buffer->dmap_cnt, &handle->dmap_cnt))
+		ion_map_lru_add(buffer);
 	mutex_unlock(&buffer->lock);
 	mutex_unlock(&client->lock);
+	ion_map_lru_trim(client->dev);
 }
 EXPORT_SYMBOL(ion_unmap_dma);
 
@@ -561,6 +697,118 @@ end:
 }
 EXPORT_SYMBOL(ion_import);
 
+/* grow [*start, *end) to also cover [s, e) */
+static void ion_range_add(size_t *start, size_t *end, size_t s, size_t e)
+{
+	if (*start == *end) {
+		*start = s;
+		*end = e;
+	} else {
+		*start = min(*start, s);
+		*end = max(*end, e);
+	}
+}
+
+/*
+ * remove [s, e) from [*start, *end), a hole in the middle is not tracked
+ * and leaves the range as it is
+ */
+static void ion_range_clear(size_t *start, size_t *end, size_t s, size_t e)
+{
+	if (s <= *start && e >= *end)
+		*start = *end = 0;
+	else if (s <= *start && e > *start)
+		*start = e;
+	else if (e >= *end && s < *end)
+		*end = s;
+}
+
+/* buffer->lock must be held */
+static void ion_buffer_sync(struct ion_buffer *buffer, size_t offset,
+			    size_t len, size_t dirty_start, size_t dirty_end,
+			    bool force, enum dma_data_direction dir)
+{
+	struct ion_heap *heap = buffer->heap;
+	size_t start = offset, end = offset + len;
+
+	if (!force) {
+		start = max(start, dirty_start);
+		end = min(end, dirty_end);
+		if (start > end)
+			start = end;
+	}
+	if (start != end)
+		heap->ops->sync(heap, buffer, start, end - start, dir);
+	atomic_long_add(end - start, &heap->synced_bytes);
+	atomic_long_add(len - (end - start), &heap->skipped_bytes);
+}
+
+int ion_sync(struct ion_client *client, struct ion_handle *handle,
+	     size_t offset, size_t len, unsigned int flags)
+{
+	unsigned int dir = flags & (ION_SYNC_FOR_CPU | ION_SYNC_FOR_DEVICE);
+	bool force = flags & ION_SYNC_FORCE;
+	struct ion_buffer *buffer;
+
+	mutex_lock(&client->lock);
+	if (!ion_handle_validate(client, handle)) {
+		pr_err("%s: invalid handle passed to sync.\n", __func__);
+		mutex_unlock(&client->lock);
+		return -EINVAL;
+	}
+	buffer = handle->buffer;
+	ion_buffer_get(buffer);
+	mutex_unlock(&client->lock);
+
+	if (offset > buffer->size)
+		goto err;
+	if (!len)
+		len = buffer->size - offset;
+	if (len > buffer->size - offset)
+		goto err;
+	if (dir != ION_SYNC_FOR_CPU && dir != ION_SYNC_FOR_DEVICE)
+		goto err;
+
+	mutex_lock(&buffer->lock);
+	/* writes through a user mapping are only known if announced */
+	if (buffer->umap_cnt && !(flags & ION_SYNC_TRACKED))
+		force = true;
+	if (dir == ION_SYNC_FOR_DEVICE) {
+		if (buffer->heap->ops->sync)
+			ion_buffer_sync(buffer, offset, len,
+					buffer->cpu_dirty_start,
+					buffer->cpu_dirty_end,
+					force || buffer->vaddr,
+					DMA_TO_DEVICE);
+		ion_range_clear(&buffer->cpu_dirty_start,
+				&buffer->cpu_dirty_end, offset, offset + len);
+		if (flags & ION_SYNC_WRITE)
+			ion_range_add(&buffer->dev_dirty_start,
+				      &buffer->dev_dirty_end,
+				      offset, offset + len);
+	} else {
+		if (buffer->heap->ops->sync)
+			ion_buffer_sync(buffer, offset, len,
+					buffer->dev_dirty_start,
+					buffer->dev_dirty_end, force,
+					DMA_FROM_DEVICE);
+		ion_range_clear(&buffer->dev_dirty_start,
+				&buffer->dev_dirty_end, offset, offset + len);
+		if (flags & ION_SYNC_WRITE)
+			ion_range_add(&buffer->cpu_dirty_start,
+				      &buffer->cpu_dirty_end,
+				      offset, offset + len);
+	}
+	mutex_unlock(&buffer->lock);
+	ion_buffer_put(buffer);
+	return 0;
+
+err:
+	ion_buffer_put(buffer);
+	return -EINVAL;
+}
+EXPORT_SYMBOL(ion_sync);
+
 static const struct file_operations ion_share_fops;
 
 struct ion_handle *ion_import_fd(struct ion_client *client, int fd)
@@ -693,6 +941,7 @@ struct ion_client *ion_client_create(struct ion_device *dev,
 
 	client->dev = dev;
 	client->handles = RB_ROOT;
+	client->handles_by_buffer = RB_ROOT;
 	mutex_init(&client->lock);
 	client->name = name;
 	client->heap_mask = heap_mask;
@@ -785,6 +1034,10 @@ static int ion_share_release(struct inode *inode, struct file* file)
 	struct ion_buffer *buffer = file->private_data;
 
 	pr_debug("%s: %d\n", __func__, __LINE__);
+	mutex_lock(&buffer->lock);
+	if (buffer->share_file == file)
+		buffer->share_file = NULL;
+	mutex_unlock(&buffer->lock);
 	/* drop the reference to the buffer -- this prevents the
 	   buffer from going away because the client holding it exited
 	   while it was being passed */
@@ -800,6 +1053,9 @@ static void ion_vma_open(struct vm_area_struct *vma)
 	struct ion_client *client;
 
 	pr_debug("%s: %d\n", __func__, __LINE__);
+	mutex_lock(&buffer->lock);
+	buffer->umap_cnt++;
+	mutex_unlock(&buffer->lock);
 	/* check that the client still exists and take a reference so
 	   it can't go away until this vma is closed */
 	client = ion_client_lookup(buffer->dev, current->group_leader);
@@ -821,6 +1077,9 @@ static void ion_vma_close(struct vm_area_struct *vma)
 	struct ion_client *client;
 
 	pr_debug("%s: %d\n", __func__, __LINE__);
+	mutex_lock(&buffer->lock);
+	buffer->umap_cnt--;
+	mutex_unlock(&buffer->lock);
 	/* this indicates the client is gone, nothing to do here */
 	if (!handle)
 		return;
@@ -890,6 +1149,8 @@ static int ion_share_mmap(struct file *file, struct vm_area_struct *vma)
 	mutex_lock(&buffer->lock);
 	/* now map it to userspace */
 	ret = buffer->heap->ops->map_user(buffer->heap, buffer, vma);
+	if (!ret)
+		buffer->umap_cnt++;
 	mutex_unlock(&buffer->lock);
 	if (ret) {
 		pr_err("%s: failure mapping buffer to userspace\n",
@@ -938,6 +1199,35 @@ static const struct file_operations ion_share_fops = {
 	.mmap		= ion_share_mmap,
 };
 
+/*
+ * ion_share_file - returns a new reference to the share file of 'buffer',
+ * creating the file if the buffer has none.  Every fd shared for a buffer
+ * refers to the same file, which holds one reference to the buffer.
+ */
+static struct file *ion_share_file(struct ion_buffer *buffer)
+{
+	struct file *file;
+
+	mutex_lock(&buffer->lock);
+	file = buffer->share_file;
+	/* the file may be on its way to ion_share_release() */
+	if (file && !atomic_long_inc_not_zero(&file->f_count))
+		file = NULL;
+	if (!file) {
+		file = anon_inode_getfile("ion_share_fd", &ion_share_fops,
+					  buffer, O_RDWR);
+		if (IS_ERR_OR_NULL(file)) {
+			mutex_unlock(&buffer->lock);
+			return ERR_PTR(-ENFILE);
+		}
+		ion_buffer_get(buffer);
+		buffer->share_file = file;
+	}
+	mutex_unlock(&buffer->lock);
+	return file;
+}
+
+/* client->lock must be held and the handle validated */
 static int ion_ioctl_share(struct file *parent, struct ion_client *client,
 			   struct ion_handle *handle)
 {
@@ -947,19 +1237,31 @@ static int ion_ioctl_share(struct file *parent, struct ion_client *client,
 	if (fd < 0)
 		return -ENFILE;
 
-	file = anon_inode_getfile("ion_share_fd", &ion_share_fops,
-				  handle->buffer, O_RDWR);
-	if (IS_ERR_OR_NULL(file))
-		goto err;
-	ion_buffer_get(handle->buffer);
+	file = ion_share_file(handle->buffer);
+	if (IS_ERR(file)) {
+		put_unused_fd(fd);
+		return PTR_ERR(file);
+	}
 	fd_install(fd, file);
 
 	return fd;
+}
 
-err:
-	put_unused_fd(fd);
-	return -ENFILE;
+int ion_share_fd(struct ion_client *client, struct ion_handle *handle)
+{
+	int fd;
+
+	mutex_lock(&client->lock);
+	if (!ion_handle_validate(client, handle)) {
+		pr_err("%s: invalid handle passed to share_fd.\n", __func__);
+		mutex_unlock(&client->lock);
+		return -EINVAL;
+	}
+	fd = ion_ioctl_share(NULL, client, handle);
+	mutex_unlock(&client->lock);
+	return fd;
 }
+EXPORT_SYMBOL(ion_share_fd);
 
 static long ion_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 {
@@ -1041,6 +1343,15 @@ static long ion_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 			return -EFAULT;
 		return dev->custom_ioctl(client, data.cmd, data.arg);
 	}
+	case ION_IOC_SYNC:
+	{
+		struct ion_sync_data data;
+
+		if (copy_from_user(&data, (void __user *)arg, sizeof(data)))
+			return -EFAULT;
+		return ion_sync(client, data.handle, data.offset, data.len,
+				data.flags);
+	}
 	case ION_IOC_MAP_GRALLOC:
 	{
 		struct ion_map_gralloc_to_ionhandle_data data;
@@ -1141,6 +1452,13 @@ static int ion_debug_heap_show(struct seq_file *s, void *unused)
 		seq_printf(s, "%16.s %16u %16u\n", client->name, client->pid,
 			   size);
 	}
+
+	if (heap->ops->sync)
+		seq_printf(s, "\nsync: %lu bytes synced, %lu bytes skipped\n",
+			   atomic_long_read(&heap->synced_bytes),
+			   atomic_long_read(&heap->skipped_bytes));
+	if (heap->ops->debug_show)
+		heap->ops->debug_show(heap, s);
 	return 0;
 }
 
@@ -1219,6 +1537,8 @@ struct ion_device *ion_device_create(long (*custom_ioctl)
 	idev->heaps = RB_ROOT;
 	idev->user_clients = RB_ROOT;
 	idev->kernel_clients = RB_ROOT;
+	INIT_LIST_HEAD(&idev->map_lru);
+	spin_lock_init(&idev->map_lru_lock);
 	return idev;
 }
 
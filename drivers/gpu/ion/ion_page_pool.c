@@ -0,0 +1,212 @@
+/*
+ * drivers/gpu/ion/ion_page_pool.c
+ *
+ * Copyright (C) 2011 Google, Inc.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#include <linux/highmem.h>
+#include <linux/list.h>
+#include <linux/mm.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/workqueue.h>
+#include "ion_priv.h"
+
+/* all pools, walked by the shrinker */
+static LIST_HEAD(ion_page_pools);
+static DEFINE_MUTEX(ion_page_pools_lock);
+
+static void ion_page_pool_zero(struct ion_page_pool *pool, struct page *page)
+{
+	int i;
+
+	for (i = 0; i < (1 << pool->order); i++)
+		clear_highpage(page + i);
+}
+
+/*
+ * freed pages are zeroed here rather than in ion_page_pool_free so that
+ * neither the free nor the next allocation has to wait for it
+ */
+static void ion_page_pool_zero_work(struct work_struct *work)
+{
+	struct ion_page_pool *pool = container_of(work, struct ion_page_pool,
+						  zero_work);
+	struct page *page;
+
+	spin_lock(&pool->lock);
+	while (!list_empty(&pool->dirty)) {
+		page = list_first_entry(&pool->dirty, struct page, lru);
+		list_del(&page->lru);
+		pool->dirty_count--;
+		spin_unlock(&pool->lock);
+
+		ion_page_pool_zero(pool, page);
+
+		spin_lock(&pool->lock);
+		list_add_tail(&page->lru, &pool->clean);
+		pool->clean_count++;
+	}
+	spin_unlock(&pool->lock);
+}
+
+struct page *ion_page_pool_alloc(struct ion_page_pool *pool, bool *cached)
+{
+	struct page *page = NULL;
+	bool dirty = false;
+
+	spin_lock(&pool->lock);
+	if (pool->clean_count) {
+		page = list_first_entry(&pool->clean, struct page, lru);
+		pool->clean_count--;
+	} else if (pool->dirty_count) {
+		page = list_first_entry(&pool->dirty, struct page, lru);
+		pool->dirty_count--;
+		dirty = true;
+	}
+	if (page)
+		list_del(&page->lru);
+	spin_unlock(&pool->lock);
+
+	*cached = page != NULL;
+	if (!page)
+		return alloc_pages(pool->gfp_mask | __GFP_ZERO, pool->order);
+	if (dirty)
+		ion_page_pool_zero(pool, page);
+	return page;
+}
+
+void ion_page_pool_free(struct ion_page_pool *pool, struct page *page)
+{
+	spin_lock(&pool->lock);
+	list_add_tail(&page->lru, &pool->dirty);
+	pool->dirty_count++;
+	spin_unlock(&pool->lock);
+
+	schedule_work(&pool->zero_work);
+}
+
+/* number of pages held by 'pool', in units of 0-order pages */
+static int ion_page_pool_total(struct ion_page_pool *pool)
+{
+	return (pool->clean_count + pool->dirty_count) << pool->order;
+}
+
+/*
+ * ion_page_pool_shrink - frees up to 'nr_to_scan' 0-order pages worth of
+ * pooled pages, those still waiting to be zeroed first. Returns the number
+ * of 0-order pages left in the pool.
+ */
+int ion_page_pool_shrink(struct ion_page_pool *pool, int nr_to_scan)
+{
+	struct page *page;
+	int total;
+
+	spin_lock(&pool->lock);
+	while (nr_to_scan > 0) {
+		if (pool->dirty_count) {
+			page = list_first_entry(&pool->dirty, struct page, lru);
+			pool->dirty_count--;
+		} else if (pool->clean_count) {
+			page = list_first_entry(&pool->clean, struct page, lru);
+			pool->clean_count--;
+		} else {
+			break;
+		}
+		list_del(&page->lru);
+		spin_unlock(&pool->lock);
+
+		__free_pages(page, pool->order);
+		nr_to_scan -= 1 << pool->order;
+
+		spin_lock(&pool->lock);
+	}
+	total = ion_page_pool_total(pool);
+	spin_unlock(&pool->lock);
+
+	return total;
+}
+
+static int ion_page_pool_shrinker(struct shrinker *s,
+				  struct shrink_control *sc)
+{
+	struct ion_page_pool *pool;
+	int nr_to_scan = sc->nr_to_scan;
+	int total = 0;
+
+	mutex_lock(&ion_page_pools_lock);
+	list_for_each_entry(pool, &ion_page_pools, list) {
+		if (nr_to_scan > 0) {
+			int before = ion_page_pool_total(pool);
+			int after = ion_page_pool_shrink(pool, nr_to_scan);
+
+			nr_to_scan -= before - after;
+			total += after;
+		} else {
+			total += ion_page_pool_total(pool);
+		}
+	}
+	mutex_unlock(&ion_page_pools_lock);
+
+	return total;
+}
+
+static struct shrinker ion_page_pool_shrinker_info = {
+	.shrink = ion_page_pool_shrinker,
+	.seeks = DEFAULT_SEEKS,
+};
+
+struct ion_page_pool *ion_page_pool_create(gfp_t gfp_mask, unsigned int order)
+{
+	struct ion_page_pool *pool;
+
+	pool = kzalloc(sizeof(struct ion_page_pool), GFP_KERNEL);
+	if (!pool)
+		return NULL;
+	spin_lock_init(&pool->lock);
+	INIT_LIST_HEAD(&pool->clean);
+	INIT_LIST_HEAD(&pool->dirty);
+	INIT_WORK(&pool->zero_work, ion_page_pool_zero_work);
+	pool->gfp_mask = gfp_mask;
+	pool->order = order;
+
+	mutex_lock(&ion_page_pools_lock);
+	if (list_empty(&ion_page_pools))
+		register_shrinker(&ion_page_pool_shrinker_info);
+	list_add_tail(&pool->list, &ion_page_pools);
+	mutex_unlock(&ion_page_pools_lock);
+
+	return pool;
+}
+
+void ion_page_pool_destroy(struct ion_page_pool *pool)
+{
+	mutex_lock(&ion_page_pools_lock);
+	list_del(&pool->list);
+	if (list_empty(&ion_page_pools))
+		unregister_shrinker(&ion_page_pool_shrinker_info);
+	mutex_unlock(&ion_page_pools_lock);
+
+	cancel_work_sync(&pool->zero_work);
+	ion_page_pool_shrink(pool, INT_MAX);
+	kfree(pool);
+}
+
+void ion_page_pool_stats(struct ion_page_pool *pool, int *clean, int *dirty)
+{
+	spin_lock(&pool->lock);
+	*clean = pool->clean_count;
+	*dirty = pool->dirty_count;
+	spin_unlock(&pool->lock);
+}
@@ -17,12 +17,17 @@
 #ifndef _ION_PRIV_H
 #define _ION_PRIV_H
 
+#include <linux/dma-mapping.h>
 #include <linux/kref.h>
 #include <linux/mm_types.h>
 #include <linux/mutex.h>
 #include <linux/rbtree.h>
+#include <linux/spinlock.h>
+#include <linux/workqueue.h>
 #include <linux/ion.h>
 
+struct seq_file;
+
 struct ion_mapping;
 
 struct ion_dma_mapping {
@@ -54,6 +59,21 @@ struct ion_buffer *ion_handle_buffer(struct ion_handle *handle);
  * @vaddr:		the kenrel mapping if kmap_cnt is not zero
  * @dmap_cnt:		number of times the buffer is mapped for dma
  * @sglist:		the scatterlist for the buffer is dmap_cnt is not zero
+ * @cpu_dirty_start:	start of the bytes the cpu may have written since they
+ *			were last synced for a device
+ * @cpu_dirty_end:	end of those bytes, none if equal to the start
+ * @dev_dirty_start:	start of the bytes a device may have written since
+ *			they were last synced for the cpu
+ * @dev_dirty_end:	end of those bytes, none if equal to the start
+ * @share_file:		the file every fd shared for this buffer refers to,
+ *			NULL if there is none
+ * @map_lru:		node in the device list of buffers with an unused
+ *			kernel mapping or scatterlist
+ * @umap_cnt:		number of user space mappings of the buffer
+ *
+ * The dirty ranges, @share_file and @umap_cnt are protected by @lock.  The kernel
+ * mapping and the scatterlist are kept after their last user unmaps them,
+ * until the buffer is freed or drops off the end of the device map_lru.
 */
 struct ion_buffer {
 	struct kref ref;
@@ -71,6 +91,13 @@ struct ion_buffer {
 	void *vaddr;
 	int dmap_cnt;
 	struct scatterlist *sglist;
+	size_t cpu_dirty_start;
+	size_t cpu_dirty_end;
+	size_t dev_dirty_start;
+	size_t dev_dirty_end;
+	struct file *share_file;
+	struct list_head map_lru;
+	int umap_cnt;
 };
 
 /**
@@ -84,6 +111,11 @@ struct ion_buffer {
  * @map_kernel		map memory to the kernel
  * @unmap_kernel	unmap memory to the kernel
  * @map_user		map memory to userspace
+ * @debug_show		print heap specific statistics into the heap's
+ *			debugfs file (optional)
+ * @sync		do cache maintenance on part of a buffer, DMA_TO_DEVICE
+ *			cleans and DMA_FROM_DEVICE invalidates (optional, heaps
+ *			whose mappings are uncached do not need it)
  */
 struct ion_heap_ops {
 	int (*allocate) (struct ion_heap *heap,
@@ -99,6 +131,9 @@ struct ion_heap_ops {
 	void (*unmap_kernel) (struct ion_heap *heap, struct ion_buffer *buffer);
 	int (*map_user) (struct ion_heap *mapper, struct ion_buffer *buffer,
 			 struct vm_area_struct *vma);
+	void (*debug_show) (struct ion_heap *heap, struct seq_file *s);
+	void (*sync) (struct ion_heap *heap, struct ion_buffer *buffer,
+		      size_t offset, size_t len, enum dma_data_direction dir);
 };
 
 /**
@@ -111,6 +146,8 @@ struct ion_heap_ops {
  *			allocating.  These are specified by platform data and
  *			MUST be unique
  * @name:		used for debugging
+ * @synced_bytes:	bytes ion_sync() did cache maintenance for
+ * @skipped_bytes:	bytes ion_sync() found clean and skipped
  *
  * Represents a pool of memory from which buffers can be made.  In some
  * systems the only heap is regular system memory allocated via vmalloc.
@@ -124,6 +161,8 @@ struct ion_heap {
 	struct ion_heap_ops *ops;
 	int id;
 	const char *name;
+	atomic_long_t synced_bytes;
+	atomic_long_t skipped_bytes;
 };
 
 /**
@@ -175,6 +214,44 @@ ion_phys_addr_t ion_carveout_allocate(struct ion_heap *heap, unsigned long size,
 				      unsigned long align);
 void ion_carveout_free(struct ion_heap *heap, ion_phys_addr_t addr,
 		       unsigned long size);
+/**
+ * struct ion_page_pool - recycles pages of one order for a heap
+ * @order:		order of the pages in the pool
+ * @gfp_mask:		used when the pool is empty
+ * @lock:		protects the lists and counts
+ * @clean:		zeroed pages, ready to be handed out
+ * @clean_count:	number of pages on @clean
+ * @dirty:		freed pages waiting for @zero_work
+ * @dirty_count:	number of pages on @dirty
+ * @zero_work:		zeroes the @dirty pages and moves them to @clean
+ * @list:		entry in the list of pools walked by the shrinker
+ *
+ * Pages handed out by a pool are always zeroed.  Freed pages are kept
+ * until the shrinker asks for them back.
+ */
+struct ion_page_pool {
+	unsigned int order;
+	gfp_t gfp_mask;
+	spinlock_t lock;
+	struct list_head clean;
+	int clean_count;
+	struct list_head dirty;
+	int dirty_count;
+	struct work_struct zero_work;
+	struct list_head list;
+};
+
+struct ion_page_pool *ion_page_pool_create(gfp_t gfp_mask, unsigned int order);
+void ion_page_pool_destroy(struct ion_page_pool *pool);
+/**
+ * ion_page_pool_alloc - returns a zeroed page, @cached tells whether it
+ * came from the pool rather than from the page allocator
+ */
+struct page *ion_page_pool_alloc(struct ion_page_pool *pool, bool *cached);
+void ion_page_pool_free(struct ion_page_pool *pool, struct page *page);
+int ion_page_pool_shrink(struct ion_page_pool *pool, int nr_to_scan);
+void ion_page_pool_stats(struct ion_page_pool *pool, int *clean, int *dirty);
+
 /**
  * The carveout heap returns physical addresses, since 0 may be a valid
  * physical address, this is used to indicate allocation failed
@@ -14,56 +14,162 @@
  *
  */
 
+#include <linux/dma-mapping.h>
 #include <linux/err.h>
+#include <linux/highmem.h>
 #include <linux/ion.h>
+#include <linux/ktime.h>
+#include <linux/log2.h>
 #include <linux/mm.h>
 #include <linux/scatterlist.h>
+#include <linux/seq_file.h>
 #include <linux/slab.h>
+#include <linux/spinlock.h>
 #include <linux/vmalloc.h>
 #include "ion_priv.h"
 
+/*
+ * Buffers are built from the highest of these orders that still fits, so
+ * large buffers need few scatterlist entries and little page table setup.
+ * Each order has its own page pool, pages come back to it when buffers are
+ * freed and are zeroed in the background before they are reused.
+ */
+static const unsigned int orders[] = {8, 4, 0};
+#define NUM_ORDERS ARRAY_SIZE(orders)
+
+/* alloc_lat[] is a log2 histogram of allocation times in microseconds */
+#define ION_SYSTEM_HEAP_LAT_BUCKETS	16
+
+struct ion_system_heap {
+	struct ion_heap heap;
+	struct ion_page_pool *pools[NUM_ORDERS];
+	spinlock_t stats_lock;
+	unsigned long alloc_lat[ION_SYSTEM_HEAP_LAT_BUCKETS];
+	unsigned long pool_hits[NUM_ORDERS];
+	unsigned long pool_misses[NUM_ORDERS];
+};
+
+/*
+ * struct ion_system_buffer - the pages of a system heap buffer, linked
+ * through page->lru with the index of their pool in page_private
+ */
+struct ion_system_buffer {
+	struct list_head pages;
+	int nchunks;
+};
+
+#define chunk_order(page)	(orders[page_private(page)])
+
+static void ion_system_heap_free_pages(struct ion_system_heap *sheap,
+				       struct ion_system_buffer *sbuf)
+{
+	struct page *page, *tmp;
+
+	list_for_each_entry_safe(page, tmp, &sbuf->pages, lru) {
+		struct ion_page_pool *pool = sheap->pools[page_private(page)];
+
+		list_del(&page->lru);
+		set_page_private(page, 0);
+		ion_page_pool_free(pool, page);
+	}
+}
+
 static int ion_system_heap_allocate(struct ion_heap *heap,
 				     struct ion_buffer *buffer,
 				     unsigned long size, unsigned long align,
 				     unsigned long flags)
 {
-	buffer->priv_virt = vmalloc_user(size);
-	if (!buffer->priv_virt)
+	struct ion_system_heap *sheap =
+		container_of(heap, struct ion_system_heap, heap);
+	unsigned int hits[NUM_ORDERS] = {0}, misses[NUM_ORDERS] = {0};
+	struct ion_system_buffer *sbuf;
+	unsigned long remaining = PAGE_ALIGN(size);
+	unsigned int max_order = orders[0];
+	ktime_t start = ktime_get();
+	s64 us;
+	unsigned int lat;
+	int i;
+
+	sbuf = kzalloc(sizeof(struct ion_system_buffer), GFP_KERNEL);
+	if (!sbuf)
 		return -ENOMEM;
+	INIT_LIST_HEAD(&sbuf->pages);
+
+	while (remaining) {
+		struct page *page = NULL;
+		bool cached;
+
+		for (i = 0; i < NUM_ORDERS; i++) {
+			if (orders[i] > max_order ||
+			    remaining < (PAGE_SIZE << orders[i]))
+				continue;
+			page = ion_page_pool_alloc(sheap->pools[i], &cached);
+			if (page)
+				break;
+		}
+		if (!page)
+			goto err;
+
+		if (cached)
+			hits[i]++;
+		else
+			misses[i]++;
+		set_page_private(page, i);
+		list_add_tail(&page->lru, &sbuf->pages);
+		sbuf->nchunks++;
+		remaining -= PAGE_SIZE << orders[i];
+		/* larger orders failed already, do not try them again */
+		max_order = orders[i];
+	}
+
+	buffer->priv_virt = sbuf;
+
+	us = ktime_to_us(ktime_sub(ktime_get(), start));
+	lat = us < 1 ? 0 : min_t(unsigned int, ilog2(us) + 1,
+				 ION_SYSTEM_HEAP_LAT_BUCKETS - 1);
+	spin_lock(&sheap->stats_lock);
+	sheap->alloc_lat[lat]++;
+	for (i = 0; i < NUM_ORDERS; i++) {
+		sheap->pool_hits[i] += hits[i];
+		sheap->pool_misses[i] += misses[i];
+	}
+	spin_unlock(&sheap->stats_lock);
 	return 0;
+
+err:
+	ion_system_heap_free_pages(sheap, sbuf);
+	kfree(sbuf);
+	return -ENOMEM;
 }
 
 void ion_system_heap_free(struct ion_buffer *buffer)
 {
-	vfree(buffer->priv_virt);
+	struct ion_system_heap *sheap =
+		container_of(buffer->heap, struct ion_system_heap, heap);
+	struct ion_system_buffer *sbuf = buffer->priv_virt;
+
+	ion_system_heap_free_pages(sheap, sbuf);
+	kfree(sbuf);
 }
 
 struct scatterlist *ion_system_heap_map_dma(struct ion_heap *heap,
 					    struct ion_buffer *buffer)
 {
-	struct scatterlist *sglist;
+	struct ion_system_buffer *sbuf = buffer->priv_virt;
+	struct scatterlist *sglist, *sg;
 	struct page *page;
-	int i;
-	int npages = PAGE_ALIGN(buffer->size) / PAGE_SIZE;
-	void *vaddr = buffer->priv_virt;
 
-	sglist = vmalloc(npages * sizeof(struct scatterlist));
+	sglist = vmalloc(sbuf->nchunks * sizeof(struct scatterlist));
 	if (!sglist)
 		return ERR_PTR(-ENOMEM);
-	memset(sglist, 0, npages * sizeof(struct scatterlist));
-	sg_init_table(sglist, npages);
-	for (i = 0; i < npages; i++) {
-		page = vmalloc_to_page(vaddr);
-		if (!page)
-			goto end;
-		sg_set_page(&sglist[i], page, PAGE_SIZE, 0);
-		vaddr += PAGE_SIZE;
+	sg_init_table(sglist, sbuf->nchunks);
+	sg = sglist;
+	list_for_each_entry(page, &sbuf->pages, lru) {
+		sg_set_page(sg, page, PAGE_SIZE << chunk_order(page), 0);
+		sg = sg_next(sg);
 	}
 	/* XXX do cache maintenance for dma? */
 	return sglist;
-end:
-	vfree(sglist);
-	return NULL;
 }
 
 void ion_system_heap_unmap_dma(struct ion_heap *heap,
@@ -77,18 +183,118 @@ void ion_system_heap_unmap_dma(struct ion_heap *heap,
 void *ion_system_heap_map_kernel(struct ion_heap *heap,
 				 struct ion_buffer *buffer)
 {
-	return buffer->priv_virt;
+	struct ion_system_buffer *sbuf = buffer->priv_virt;
+	int npages = PAGE_ALIGN(buffer->size) / PAGE_SIZE;
+	struct page **pages, *page;
+	void *vaddr;
+	int i, j = 0;
+
+	pages = vmalloc(npages * sizeof(struct page *));
+	if (!pages)
+		return ERR_PTR(-ENOMEM);
+	list_for_each_entry(page, &sbuf->pages, lru)
+		for (i = 0; i < (1 << chunk_order(page)); i++)
+			pages[j++] = page + i;
+
+	vaddr = vmap(pages, npages, VM_MAP, PAGE_KERNEL);
+	vfree(pages);
+	if (!vaddr)
+		return ERR_PTR(-ENOMEM);
+	return vaddr;
 }
 
 void ion_system_heap_unmap_kernel(struct ion_heap *heap,
 				  struct ion_buffer *buffer)
 {
+	vunmap(buffer->vaddr);
 }
 
 int ion_system_heap_map_user(struct ion_heap *heap, struct ion_buffer *buffer,
 			     struct vm_area_struct *vma)
 {
-	return remap_vmalloc_range(vma, buffer->priv_virt, vma->vm_pgoff);
+	struct ion_system_buffer *sbuf = buffer->priv_virt;
+	unsigned long addr = vma->vm_start;
+	unsigned long offset = vma->vm_pgoff;
+	struct page *page;
+	int ret;
+
+	list_for_each_entry(page, &sbuf->pages, lru) {
+		unsigned long npages = 1 << chunk_order(page);
+		unsigned long len;
+
+		if (offset >= npages) {
+			offset -= npages;
+			continue;
+		}
+		len = min((npages - offset) << PAGE_SHIFT,
+			  vma->vm_end - addr);
+		ret = remap_pfn_range(vma, addr, page_to_pfn(page) + offset,
+				      len, vma->vm_page_prot);
+		if (ret)
+			return ret;
+		addr += len;
+		offset = 0;
+		if (addr >= vma->vm_end)
+			break;
+	}
+	return 0;
+}
+
+void ion_system_heap_sync(struct ion_heap *heap, struct ion_buffer *buffer,
+			  size_t offset, size_t len,
+			  enum dma_data_direction dir)
+{
+	struct ion_system_buffer *sbuf = buffer->priv_virt;
+	size_t end = offset + len, pos = 0;
+	struct page *page;
+
+	list_for_each_entry(page, &sbuf->pages, lru) {
+		size_t size = PAGE_SIZE << chunk_order(page);
+		size_t s = max(offset, pos), e = min(end, pos + size);
+
+		if (s < e) {
+			if (dir == DMA_TO_DEVICE)
+				__dma_page_cpu_to_dev(page, s - pos, e - s,
+						      dir);
+			else
+				__dma_page_dev_to_cpu(page, s - pos, e - s,
+						      dir);
+		}
+		pos += size;
+		if (pos >= end)
+			break;
+	}
+}
+
+static void ion_system_heap_debug_show(struct ion_heap *heap,
+				       struct seq_file *s)
+{
+	struct ion_system_heap *sheap =
+		container_of(heap, struct ion_system_heap, heap);
+	unsigned long lat[ION_SYSTEM_HEAP_LAT_BUCKETS];
+	unsigned long hits[NUM_ORDERS], misses[NUM_ORDERS];
+	int clean, dirty;
+	int i;
+
+	spin_lock(&sheap->stats_lock);
+	memcpy(lat, sheap->alloc_lat, sizeof(lat));
+	memcpy(hits, sheap->pool_hits, sizeof(hits));
+	memcpy(misses, sheap->pool_misses, sizeof(misses));
+	spin_unlock(&sheap->stats_lock);
+
+	seq_printf(s, "\n%8s %10s %10s %10s %10s\n", "order", "hits",
+		   "misses", "clean", "dirty");
+	for (i = 0; i < NUM_ORDERS; i++) {
+		ion_page_pool_stats(sheap->pools[i], &clean, &dirty);
+		seq_printf(s, "%8u %10lu %10lu %10d %10d\n", orders[i],
+			   hits[i], misses[i], clean, dirty);
+	}
+
+	/* each row counts allocations taking at least that many usecs */
+	seq_printf(s, "\n%8s %10s\n", "usec", "allocs");
+	seq_printf(s, "%8s %10lu\n", "0", lat[0]);
+	for (i = 1; i < ION_SYSTEM_HEAP_LAT_BUCKETS; i++)
+		seq_printf(s, "%8lu %10lu\n", 1UL << (i - 1), lat[i]);
 }
 
 static struct ion_heap_ops vmalloc_ops = {
@@ -99,23 +305,52 @@ static struct ion_heap_ops vmalloc_ops = {
 	.map_kernel = ion_system_heap_map_kernel,
 	.unmap_kernel = ion_system_heap_unmap_kernel,
 	.map_user = ion_system_heap_map_user,
+	.debug_show = ion_system_heap_debug_show,
+	.sync = ion_system_heap_sync,
 };
 
 struct ion_heap *ion_system_heap_create(struct ion_platform_heap *unused)
 {
-	struct ion_heap *heap;
+	struct ion_system_heap *sheap;
+	int i;
 
-	heap = kzalloc(sizeof(struct ion_heap), GFP_KERNEL);
-	if (!heap)
+	sheap = kzalloc(sizeof(struct ion_system_heap), GFP_KERNEL);
+	if (!sheap)
 		return ERR_PTR(-ENOMEM);
-	heap->ops = &vmalloc_ops;
-	heap->type = ION_HEAP_TYPE_SYSTEM;
-	return heap;
+	spin_lock_init(&sheap->stats_lock);
+
+	for (i = 0; i < NUM_ORDERS; i++) {
+		gfp_t gfp_flags = GFP_HIGHUSER | __GFP_NOWARN;
+
+		/* high orders are opportunistic, do not reclaim for them */
+		if (orders[i])
+			gfp_flags = (gfp_flags | __GFP_NORETRY |
+				     __GFP_NO_KSWAPD) & ~__GFP_WAIT;
+		sheap->pools[i] = ion_page_pool_create(gfp_flags, orders[i]);
+		if (!sheap->pools[i])
+			goto err;
+	}
+
+	sheap->heap.ops = &vmalloc_ops;
+	sheap->heap.type = ION_HEAP_TYPE_SYSTEM;
+	return &sheap->heap;
+
+err:
+	while (--i >= 0)
+		ion_page_pool_destroy(sheap->pools[i]);
+	kfree(sheap);
+	return ERR_PTR(-ENOMEM);
 }
 
 void ion_system_heap_destroy(struct ion_heap *heap)
 {
-	kfree(heap);
+	struct ion_system_heap *sheap =
+		container_of(heap, struct ion_system_heap, heap);
+	int i;
+
+	for (i = 0; i < NUM_ORDERS; i++)
+		ion_page_pool_destroy(sheap->pools[i]);
+	kfree(sheap);
 }
 
 static int ion_system_contig_heap_allocate(struct ion_heap *heap,
@@ -157,6 +392,17 @@ struct scatterlist *ion_system_contig_heap_map_dma(struct ion_heap *heap,
 	return sglist;
 }
 
+void *ion_system_contig_heap_map_kernel(struct ion_heap *heap,
+					struct ion_buffer *buffer)
+{
+	return buffer->priv_virt;
+}
+
+void ion_system_contig_heap_unmap_kernel(struct ion_heap *heap,
+					 struct ion_buffer *buffer)
+{
+}
+
 int ion_system_contig_heap_map_user(struct ion_heap *heap,
 				    struct ion_buffer *buffer,
 				    struct vm_area_struct *vma)
@@ -168,15 +414,30 @@ int ion_system_contig_heap_map_user(struct ion_heap *heap,
 
 }
 
+void ion_system_contig_heap_sync(struct ion_heap *heap,
+				 struct ion_buffer *buffer,
+				 size_t offset, size_t len,
+				 enum dma_data_direction dir)
+{
+	struct page *page = virt_to_page(buffer->priv_virt);
+
+	offset += offset_in_page(buffer->priv_virt);
+	if (dir == DMA_TO_DEVICE)
+		__dma_page_cpu_to_dev(page, offset, len, dir);
+	else
+		__dma_page_dev_to_cpu(page, offset, len, dir);
+}
+
 static struct ion_heap_ops kmalloc_ops = {
 	.allocate = ion_system_contig_heap_allocate,
 	.free = ion_system_contig_heap_free,
 	.phys = ion_system_contig_heap_phys,
 	.map_dma = ion_system_contig_heap_map_dma,
 	.unmap_dma = ion_system_heap_unmap_dma,
-	.map_kernel = ion_system_heap_map_kernel,
-	.unmap_kernel = ion_system_heap_unmap_kernel,
+	.map_kernel = ion_system_contig_heap_map_kernel,
+	.unmap_kernel = ion_system_contig_heap_unmap_kernel,
 	.map_user = ion_system_contig_heap_map_user,
+	.sync = ion_system_contig_heap_sync,
 };
 
 struct ion_heap *ion_system_contig_heap_create(struct ion_platform_heap *unused)
@@ -19,9 +19,13 @@
 #include <linux/genalloc.h>
 #include <linux/io.h>
 #include <linux/ion.h>
+#include <linux/list.h>
 #include <linux/mm.h>
+#include <linux/moduleparam.h>
+#include <linux/mutex.h>
 #include <linux/omap_ion.h>
 #include <linux/scatterlist.h>
+#include <linux/seq_file.h>
 #include <linux/slab.h>
 #include <linux/vmalloc.h>
 #include <mach/tiler.h>
@@ -54,8 +58,128 @@ struct omap_tiler_info {
 	u32 tiler_start;		/* start addr in tiler -- if not page
 					   aligned this may not equal the
 					   first entry onf tiler_addrs */
+	struct ion_heap *heap;		/* heap of the physical pages */
+	int fmt;			/* geometry of the allocation, */
+	size_t w;			/* used as the key of the cache */
+	size_t h;
+	struct list_head cache;		/* entry in the cache once freed */
 };
 
+/*
+ * Freed allocations stay pinned in a cache, most recently freed first, so
+ * that an allocation with the same geometry from the same heap needs
+ * neither TILER space, physical pages nor DMM programming.  Cached
+ * allocations are released when the cache grows above its limit, or when
+ * TILER space or carveout pages run out, for TILER users outside ION too.
+ * They are not released under memory pressure: carveout pages are of no
+ * use to the rest of the system.
+ */
+static uint cache_limit = CONFIG_ION_OMAP_TILER_CACHE;
+module_param_named(cache, cache_limit, uint, 0644);
+MODULE_PARM_DESC(cache, "Freed tiler allocations kept for reuse (MBytes)");
+
+static LIST_HEAD(omap_tiler_cache);
+static DEFINE_MUTEX(omap_tiler_cache_lock);
+static u32 omap_tiler_cache_pages;
+static unsigned long omap_tiler_cache_hits;
+static unsigned long omap_tiler_cache_misses;
+static unsigned long omap_tiler_cache_evictions;
+static int omap_tiler_heaps;
+
+static void omap_tiler_release(struct omap_tiler_info *info)
+{
+	tiler_unpin_block(info->tiler_handle);
+	tiler_free_block_area(info->tiler_handle);
+
+	if (info->lump) {
+		ion_carveout_free(info->heap, info->phys_addrs[0],
+				  info->n_phys_pages*PAGE_SIZE);
+	} else {
+		int i;
+		for (i = 0; i < info->n_phys_pages; i++)
+			ion_carveout_free(info->heap,
+					  info->phys_addrs[i], PAGE_SIZE);
+	}
+
+	kfree(info);
+}
+
+static void omap_tiler_release_list(struct list_head *list)
+{
+	struct omap_tiler_info *info, *tmp;
+
+	list_for_each_entry_safe(info, tmp, list, cache) {
+		list_del(&info->cache);
+		omap_tiler_release(info);
+	}
+}
+
+/*
+ * omap_tiler_cache_evict - moves the least recently freed allocations of
+ * 'heap' (of any heap if NULL) from the cache to 'list', until at least
+ * 'nr_pages' pages or the whole cache are taken.  Returns the number of
+ * pages taken.  Must hold omap_tiler_cache_lock.
+ */
+static u32 omap_tiler_cache_evict(struct ion_heap *heap, u32 nr_pages,
+				  struct list_head *list)
+{
+	struct omap_tiler_info *info, *tmp;
+	u32 evicted = 0;
+
+	list_for_each_entry_safe_reverse(info, tmp, &omap_tiler_cache, cache) {
+		if (evicted >= nr_pages)
+			break;
+		if (heap && info->heap != heap)
+			continue;
+		list_move(&info->cache, list);
+		omap_tiler_cache_pages -= info->n_phys_pages;
+		omap_tiler_cache_evictions++;
+		evicted += info->n_phys_pages;
+	}
+	return evicted;
+}
+
+/* releases cached allocations to make room for a new one */
+static bool omap_tiler_cache_flush(struct ion_heap *heap)
+{
+	LIST_HEAD(list);
+	u32 evicted;
+
+	mutex_lock(&omap_tiler_cache_lock);
+	evicted = omap_tiler_cache_evict(heap, UINT_MAX, &list);
+	mutex_unlock(&omap_tiler_cache_lock);
+
+	omap_tiler_release_list(&list);
+	return evicted;
+}
+
+static struct omap_tiler_info *omap_tiler_cache_get(struct ion_heap *heap,
+				struct omap_ion_tiler_alloc_data *data)
+{
+	struct omap_tiler_info *info;
+
+	mutex_lock(&omap_tiler_cache_lock);
+	list_for_each_entry(info, &omap_tiler_cache, cache) {
+		if (info->heap == heap && info->fmt == data->fmt &&
+		    info->w == data->w && info->h == data->h) {
+			list_del(&info->cache);
+			omap_tiler_cache_pages -= info->n_phys_pages;
+			omap_tiler_cache_hits++;
+			mutex_unlock(&omap_tiler_cache_lock);
+			return info;
+		}
+	}
+	omap_tiler_cache_misses++;
+	mutex_unlock(&omap_tiler_cache_lock);
+	return NULL;
+}
+
+/* called by TILER when its container is full */
+static bool omap_tiler_cache_reclaim(void)
+{
+	return omap_tiler_cache_flush(NULL);
+}
+
 int omap_tiler_alloc(struct ion_heap *heap,
 		     struct ion_client *client,
 		     struct omap_ion_tiler_alloc_data *data)
@@ -86,6 +210,10 @@ int omap_tiler_alloc(struct ion_heap *heap,
 
 	BUG_ON(!n_phys_pages || !n_tiler_pages);
 
+	info = omap_tiler_cache_get(heap, data);
+	if (info)
+		goto map;
+
 	info = kzalloc(sizeof(struct omap_tiler_info) +
 		       sizeof(u32) * n_phys_pages +
 		       sizeof(u32) * n_tiler_pages, GFP_KERNEL);
@@ -96,7 +224,12 @@ int omap_tiler_alloc(struct ion_heap *heap,
 	info->n_tiler_pages = n_tiler_pages;
 	info->phys_addrs = (u32 *)(info + 1);
 	info->tiler_addrs = info->phys_addrs + n_phys_pages;
+	info->heap = heap;
+	info->fmt = data->fmt;
+	info->w = data->w;
+	info->h = data->h;
 
+	/* TILER releases the cache through omap_tiler_cache_reclaim() */
 	info->tiler_handle = tiler_alloc_block_area(data->fmt, data->w, data->h,
 						    &info->tiler_start,
 						    info->tiler_addrs);
@@ -108,6 +241,8 @@ int omap_tiler_alloc(struct ion_heap *heap,
 	}
 
 	addr = ion_carveout_allocate(heap, n_phys_pages*PAGE_SIZE, 0);
+	if (addr == ION_CARVEOUT_ALLOCATE_FAIL && omap_tiler_cache_flush(heap))
+		addr = ion_carveout_allocate(heap, n_phys_pages*PAGE_SIZE, 0);
 	if (addr == ION_CARVEOUT_ALLOCATE_FAIL) {
 		for (i = 0; i < n_phys_pages; i++) {
 			addr = ion_carveout_allocate(heap, PAGE_SIZE, 0);
@@ -133,6 +268,7 @@ int omap_tiler_alloc(struct ion_heap *heap,
 		goto err_alloc;
 	}
 
+map:
 	data->stride = tiler_block_vstride(info->tiler_handle);
 
 	/* create an ion handle  for the allocation */
@@ -141,7 +277,8 @@ int omap_tiler_alloc(struct ion_heap *heap,
 		ret = PTR_ERR(handle);
 		pr_err("%s: failure to allocate handle to manage tiler"
 		       " allocation\n", __func__);
-		goto err;
+		omap_tiler_release(info);
+		return ret;
 	}
 
 	buffer = ion_handle_buffer(handle);
@@ -150,8 +287,6 @@ int omap_tiler_alloc(struct ion_heap *heap,
 	data->handle = handle;
 	return 0;
 
-err:
-	tiler_unpin_block(info->tiler_handle);
 err_alloc:
 	tiler_free_block_area(info->tiler_handle);
 	if (info->lump)
@@ -167,21 +302,23 @@ err_nomem:
 void omap_tiler_heap_free(struct ion_buffer *buffer)
 {
 	struct omap_tiler_info *info = buffer->priv_virt;
-
-	tiler_unpin_block(info->tiler_handle);
-	tiler_free_block_area(info->tiler_handle);
-
-	if (info->lump) {
-		ion_carveout_free(buffer->heap, info->phys_addrs[0],
-				  info->n_phys_pages*PAGE_SIZE);
-	} else {
-		int i;
-		for (i = 0; i < info->n_phys_pages; i++)
-			ion_carveout_free(buffer->heap,
-					  info->phys_addrs[i], PAGE_SIZE);
+	u32 limit = cache_limit << (20 - PAGE_SHIFT);
+	LIST_HEAD(list);
+
+	mutex_lock(&omap_tiler_cache_lock);
+	if (info->n_phys_pages <= limit) {
+		list_add(&info->cache, &omap_tiler_cache);
+		omap_tiler_cache_pages += info->n_phys_pages;
+		info = NULL;
 	}
-
-	kfree(info);
+	if (omap_tiler_cache_pages > limit)
+		omap_tiler_cache_evict(NULL, omap_tiler_cache_pages - limit,
+				       &list);
+	mutex_unlock(&omap_tiler_cache_lock);
+
+	if (info)
+		omap_tiler_release(info);
+	omap_tiler_release_list(&list);
 }
 
 static int omap_tiler_phys(struct ion_heap *heap,
@@ -233,16 +370,40 @@ int omap_tiler_heap_map_user(struct ion_heap *heap, struct ion_buffer *buffer,
 	return 0;
 }
 
+static void omap_tiler_heap_debug_show(struct ion_heap *heap,
+				       struct seq_file *s)
+{
+	struct omap_tiler_info *info;
+	u32 buffers = 0, pages = 0;
+
+	mutex_lock(&omap_tiler_cache_lock);
+	list_for_each_entry(info, &omap_tiler_cache, cache) {
+		if (info->heap != heap)
+			continue;
+		buffers++;
+		pages += info->n_phys_pages;
+	}
+	seq_printf(s, "\ncache: %u buffers, %u pages (limit %u for all "
+		   "tiler heaps)\n", buffers, pages,
+		   cache_limit << (20 - PAGE_SHIFT));
+	seq_printf(s, "cache hits: %lu misses: %lu evictions: %lu\n",
+		   omap_tiler_cache_hits, omap_tiler_cache_misses,
+		   omap_tiler_cache_evictions);
+	mutex_unlock(&omap_tiler_cache_lock);
+}
+
 static struct ion_heap_ops omap_tiler_ops = {
 	.allocate = omap_tiler_heap_allocate,
 	.free = omap_tiler_heap_free,
 	.phys = omap_tiler_phys,
 	.map_user = omap_tiler_heap_map_user,
+	.debug_show = omap_tiler_heap_debug_show,
 };
 
 struct ion_heap *omap_tiler_heap_create(struct ion_platform_heap *data)
 {
 	struct ion_heap *heap;
+	bool first;
 
 	heap = ion_carveout_heap_create(data);
 	if (!heap)
@@ -251,10 +412,27 @@ struct ion_heap *omap_tiler_heap_create(struct ion_platform_heap *data)
 	heap->type = OMAP_ION_HEAP_TYPE_TILER;
 	heap->name = data->name;
 	heap->id = data->id;
+
+	mutex_lock(&omap_tiler_cache_lock);
+	first = !omap_tiler_heaps++;
+	mutex_unlock(&omap_tiler_cache_lock);
+
+	/* TILER calls omap_tiler_cache_reclaim() under the lock this takes */
+	if (first)
+		tiler_set_reclaim(omap_tiler_cache_reclaim);
 	return heap;
 }
 
 void omap_tiler_heap_destroy(struct ion_heap *heap)
 {
+	bool last;
+
+	mutex_lock(&omap_tiler_cache_lock);
+	last = !--omap_tiler_heaps;
+	mutex_unlock(&omap_tiler_cache_lock);
+
+	if (last)
+		tiler_set_reclaim(NULL);
+	omap_tiler_cache_flush(heap);
 	kfree(heap);
 }
@@ -0,0 +1,42 @@
+/*
+ * _tcm_bita.h
+ *
+ * BItmap Tiler Allocator (BiTA) private structures.
+ *
+ * Copyright (C) 2011 Texas Instruments, Inc.
+ *
+ * This package is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * THIS PACKAGE IS PROVIDED ``AS IS'' AND WITHOUT ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, WITHOUT LIMITATION, THE IMPLIED
+ * WARRANTIES OF MERCHANTIBILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ */
+
+#ifndef _TCM_BITA_H
+#define _TCM_BITA_H
+
+#include "../tcm.h"
+
+/*
+ * The container is kept as one bitmap with a bit set for every busy slot,
+ * in 1D (raster) slot order.  As the container width is a multiple of
+ * BITS_PER_LONG, each row starts on a word boundary and can be used as a
+ * bitmap of its own.
+ *
+ * For every row the length of its longest free run is also kept, so that
+ * rows that cannot hold an area of a given width are skipped without
+ * looking at their bits.
+ */
+struct bita_pvt {
+	struct mutex mtx;
+	struct tcm_pt div_pt;	/* divider point splitting container */
+	unsigned long *map;	/* busy slots */
+	u16 *run;		/* longest free run in each row */
+	unsigned long *mask;	/* busy columns of the rows being scanned */
+	u16 row_longs;		/* words in a row of map */
+};
+
+#endif
@@ -0,0 +1,429 @@
+/*
+ * tcm-bita.c
+ *
+ * BItmap Tiler Allocator (BiTA): 2D and 1D allocation(reservation) algorithm
+ *
+ * BiTA follows the placement policy of SiTA: 32 and 64-aligned areas are
+ * placed toward the top-left corner, 1-aligned areas toward the top-right
+ * corner and 1D areas from the bottom-right corner backwards.  It keeps the
+ * container as a bitmap instead of a map of areas, so candidate positions
+ * are found a machine word at a time, and rows too fragmented for an area
+ * are skipped using their longest free run.
+ *
+ * Copyright (C) 2011 Texas Instruments, Inc.
+ *
+ * This package is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * THIS PACKAGE IS PROVIDED ``AS IS'' AND WITHOUT ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, WITHOUT LIMITATION, THE IMPLIED
+ * WARRANTIES OF MERCHANTIBILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ */
+#include <linux/bitmap.h>
+#include <linux/slab.h>
+
+#include "_tcm-bita.h"
+#include "tcm-bita.h"
+
+#define TCM_ALG_NAME "tcm_bita"
+#include "tcm-utils.h"
+
+#define ALIGN_DOWN(value, align) ((value) & ~((align) - 1))
+
+/*********************************************
+ *	TCM API - BiTA Implementation
+ *********************************************/
+static s32 bita_reserve_2d(struct tcm *tcm, u16 h, u16 w, u8 align,
+			   struct tcm_area *area);
+static s32 bita_reserve_1d(struct tcm *tcm, u32 slots, struct tcm_area *area);
+static s32 bita_free(struct tcm *tcm, struct tcm_area *area);
+static void bita_deinit(struct tcm *tcm);
+
+/*********************************************
+ *	Support Infrastructure Methods
+ *********************************************/
+
+/* bitmap of row 'y' */
+static inline unsigned long *row_map(struct bita_pvt *pvt, u16 y)
+{
+	return pvt->map + y * pvt->row_longs;
+}
+
+/* returns the length of the longest free run in a row */
+static u16 longest_run(unsigned long *row, u16 width)
+{
+	s32 x = 0, end;
+	u16 run = 0;
+
+	while (x < width) {
+		x = find_next_zero_bit(row, width, x);
+		if (x >= width)
+			break;
+		end = find_next_bit(row, width, x);
+		if (end - x > run)
+			run = end - x;
+		x = end;
+	}
+	return run;
+}
+
+/* marks an area busy or free, and updates the free runs of its rows */
+static void fill_area(struct tcm *tcm, struct tcm_area *area, bool busy)
+{
+	struct bita_pvt *pvt = (struct bita_pvt *)tcm->pvt;
+	s32 y, start, len;
+
+	PA(2, "fill area", area);
+
+	for (y = area->p0.y; y <= area->p1.y; y++) {
+		if (area->is2d) {
+			start = area->p0.x;
+			len = area->p1.x - area->p0.x + 1;
+		} else {
+			/* 1D areas span rows in raster order */
+			start = y == area->p0.y ? area->p0.x : 0;
+			len = (y == area->p1.y ? area->p1.x + 1 : tcm->width) -
+			      start;
+		}
+
+		if (busy)
+			bitmap_set(row_map(pvt, y), start, len);
+		else
+			bitmap_clear(row_map(pvt, y), start, len);
+		pvt->run[y] = longest_run(row_map(pvt, y), tcm->width);
+	}
+}
+
+/* checks that every slot of an area is busy */
+static bool is_area_busy(struct tcm *tcm, struct tcm_area *area)
+{
+	struct bita_pvt *pvt = (struct bita_pvt *)tcm->pvt;
+	s32 y, start, end;
+
+	for (y = area->p0.y; y <= area->p1.y; y++) {
+		if (area->is2d) {
+			start = area->p0.x;
+			end = area->p1.x + 1;
+		} else {
+			start = y == area->p0.y ? area->p0.x : 0;
+			end = y == area->p1.y ? area->p1.x + 1 : tcm->width;
+		}
+		if (find_next_zero_bit(row_map(pvt, y), end, start) < end)
+			return false;
+	}
+	return true;
+}
+
+/**
+ * Finds the position of a free run of 'w' columns in a mask of busy
+ * columns between columns x0 and x1 (inclusive).
+ *
+ * @param r2l	if set, the rightmost position is returned, otherwise the
+ *		leftmost one
+ *
+ * @return the column of the run, or -1 if no run fits.
+ */
+static s32 fit_in_mask(unsigned long *mask, u16 x0, u16 x1, u16 w, u16 align,
+		       bool r2l)
+{
+	s32 x = x0, end, pos, best = -1;
+
+	while (x <= x1) {
+		x = find_next_zero_bit(mask, x1 + 1, x);
+		if (x > x1)
+			break;
+		end = find_next_bit(mask, x1 + 1, x);
+
+		if (!r2l) {
+			pos = ALIGN(x, align);
+			if (pos + w <= end)
+				return pos;
+		} else if (end - w >= x) {
+			pos = ALIGN_DOWN(end - w, align);
+			if (pos >= x)
+				best = pos;
+		}
+		x = end;
+	}
+	return best;
+}
+
+/**
+ * Finds the topmost place for a 2D area of given size inside a scan field.
+ * On the first row that has room, the leftmost (or with r2l, the rightmost)
+ * place is taken.
+ *
+ * @param w	width of desired area
+ * @param h	height of desired area
+ * @param align	desired area alignment
+ * @param field	area to scan (inclusive, p0 is the top-left corner)
+ * @param r2l	prefer the right side of the field
+ * @param area	pointer to the area that will be set to the found position
+ *
+ * @return 0 on success, non-0 error value on failure.
+ */
+static s32 scan_field(struct tcm *tcm, u16 w, u16 h, u16 align,
+		      struct tcm_area *field, bool r2l, struct tcm_area *area)
+{
+	struct bita_pvt *pvt = (struct bita_pvt *)tcm->pvt;
+	s32 x, y, k;
+
+	PA(2, "scan_field:", field);
+
+	/* check if allocation would fit in scan area */
+	if (field->p1.x < field->p0.x || field->p1.y < field->p0.y ||
+	    w > field->p1.x - field->p0.x + 1 ||
+	    h > field->p1.y - field->p0.y + 1)
+		return -ENOSPC;
+
+	for (y = field->p0.y; y + h - 1 <= field->p1.y; y++) {
+		/*
+		 * skip to below the lowest row of the candidate band that is
+		 * too fragmented anywhere for the width
+		 */
+		for (k = y + h - 1; k >= y; k--)
+			if (pvt->run[k] < w)
+				break;
+		if (k >= y) {
+			y = k;
+			continue;
+		}
+
+		/* columns that are busy in any row of the band */
+		bitmap_copy(pvt->mask, row_map(pvt, y), tcm->width);
+		for (k = y + 1; k < y + h; k++)
+			bitmap_or(pvt->mask, pvt->mask, row_map(pvt, k),
+				  tcm->width);
+
+		x = fit_in_mask(pvt->mask, field->p0.x, field->p1.x, w, align,
+				r2l);
+		if (x >= 0) {
+			P3("found: %d,%d", x, y);
+			assign(area, x, y, x + w - 1, y + h - 1);
+			return 0;
+		}
+	}
+
+	return -ENOSPC;
+}
+
+/*********************************************
+ *	Utility Methods
+ *********************************************/
+struct tcm *bita_init(u16 width, u16 height, struct tcm_pt *attr)
+{
+	struct tcm *tcm;
+	struct bita_pvt *pvt;
+	s32 i;
+
+	/* rows must start on a word boundary */
+	if (width == 0 || height == 0 || width % BITS_PER_LONG)
+		return NULL;
+
+	tcm = kzalloc(sizeof(*tcm), GFP_KERNEL);
+	pvt = kzalloc(sizeof(*pvt), GFP_KERNEL);
+	if (!tcm || !pvt)
+		goto error;
+
+	/* Updating the pointers to BiTA implementation APIs */
+	tcm->height = height;
+	tcm->width = width;
+	tcm->reserve_2d = bita_reserve_2d;
+	tcm->reserve_1d = bita_reserve_1d;
+	tcm->free = bita_free;
+	tcm->deinit = bita_deinit;
+	tcm->pvt = (void *)pvt;
+
+	mutex_init(&(pvt->mtx));
+
+	pvt->row_longs = BITS_TO_LONGS(width);
+	pvt->map = kzalloc(pvt->row_longs * height * sizeof(*pvt->map),
+			   GFP_KERNEL);
+	pvt->mask = kmalloc(pvt->row_longs * sizeof(*pvt->mask), GFP_KERNEL);
+	pvt->run = kmalloc(height * sizeof(*pvt->run), GFP_KERNEL);
+	if (!pvt->map || !pvt->mask || !pvt->run)
+		goto error;
+
+	/* all rows are free */
+	for (i = 0; i < height; i++)
+		pvt->run[i] = width;
+
+	if (attr && attr->x <= tcm->width && attr->y <= tcm->height) {
+		pvt->div_pt.x = attr->x;
+		pvt->div_pt.y = attr->y;
+
+	} else {
+		/* Defaulting to 3:1 ratio on width for 2D area split */
+		/* Defaulting to 3:1 ratio on height for 2D and 1D split */
+		pvt->div_pt.x = (tcm->width * 3) / 4;
+		pvt->div_pt.y = (tcm->height * 3) / 4;
+	}
+
+	return tcm;
+
+error:
+	if (pvt) {
+		kfree(pvt->map);
+		kfree(pvt->mask);
+		kfree(pvt->run);
+	}
+	kfree(tcm);
+	kfree(pvt);
+	return NULL;
+}
+
+static void bita_deinit(struct tcm *tcm)
+{
+	struct bita_pvt *pvt = (struct bita_pvt *)tcm->pvt;
+
+	mutex_destroy(&(pvt->mtx));
+
+	kfree(pvt->map);
+	kfree(pvt->mask);
+	kfree(pvt->run);
+	kfree(pvt);
+	kfree(tcm);
+}
+
+/**
+ * Reserve a 1D area in the container.  The area is placed at the end of
+ * the last free run that is long enough, so 1D areas grow backwards from
+ * the bottom-right corner.
+ *
+ * @param num_slots	size of 1D area
+ * @param area		pointer to the area that will be populated with the
+ *			reserved area
+ *
+ * @return 0 on success, non-0 error value on failure.
+ */
+static s32 bita_reserve_1d(struct tcm *tcm, u32 num_slots,
+			   struct tcm_area *area)
+{
+	struct bita_pvt *pvt = (struct bita_pvt *)tcm->pvt;
+	s32 size = tcm->width * tcm->height;
+	s32 x = 0, end, start = -1;
+
+	mutex_lock(&(pvt->mtx));
+
+	/* the rows are contiguous, so search the whole map as one bitmap */
+	while (x < size) {
+		x = find_next_zero_bit(pvt->map, size, x);
+		if (x >= size)
+			break;
+		end = find_next_bit(pvt->map, size, x);
+		if (end - x >= num_slots)
+			start = end - num_slots;
+		x = end;
+	}
+
+	if (start < 0) {
+		mutex_unlock(&(pvt->mtx));
+		return -ENOSPC;
+	}
+
+	assign(area, start % tcm->width, start / tcm->width,
+	       (start + num_slots - 1) % tcm->width,
+	       (start + num_slots - 1) / tcm->width);
+
+	/* update map */
+	fill_area(tcm, area, true);
+
+	mutex_unlock(&(pvt->mtx));
+	return 0;
+}
+
+/**
+ * Reserve a 2D area in the container
+ *
+ * @param w	width
+ * @param h	height
+ * @param area	pointer to the area that will be populated with the reserved
+ *		area
+ *
+ * @return 0 on success, non-0 error value on failure.
+ */
+static s32 bita_reserve_2d(struct tcm *tcm, u16 h, u16 w, u8 align,
+			   struct tcm_area *area)
+{
+	s32 ret;
+	struct tcm_area field = {0};
+	u16 boundary_x, boundary_y;
+	bool r2l;
+	struct bita_pvt *pvt = (struct bita_pvt *)tcm->pvt;
+
+	/* not supporting more than 64 as alignment */
+	if (align > 64)
+		return -EINVAL;
+
+	/* we prefer 1, 32 and 64 as alignment */
+	align = align <= 1 ? 1 : align <= 32 ? 32 : 64;
+
+	if (align > 1) {
+		/* prefer top-left corner */
+		boundary_x = pvt->div_pt.x - 1;
+		boundary_y = pvt->div_pt.y - 1;
+
+		/* expand width and height if needed */
+		if (w > pvt->div_pt.x)
+			boundary_x = tcm->width - 1;
+		if (h > pvt->div_pt.y)
+			boundary_y = tcm->height - 1;
+
+		assign(&field, 0, 0, boundary_x, boundary_y);
+		r2l = false;
+	} else {
+		/* prefer top-right corner */
+		boundary_x = pvt->div_pt.x;
+		boundary_y = pvt->div_pt.y - 1;
+
+		/* expand width and height if needed */
+		if (w > (tcm->width - pvt->div_pt.x))
+			boundary_x = 0;
+		if (h > pvt->div_pt.y)
+			boundary_y = tcm->height - 1;
+
+		assign(&field, boundary_x, 0, tcm->width - 1, boundary_y);
+		r2l = true;
+	}
+
+	mutex_lock(&(pvt->mtx));
+	ret = scan_field(tcm, w, h, align, &field, r2l, area);
+
+	/* scan whole container if failed, but do not scan 2x */
+	if (ret && (field.p0.x || field.p1.x != tcm->width - 1 ||
+		    field.p1.y != tcm->height - 1)) {
+		assign(&field, 0, 0, tcm->width - 1, tcm->height - 1);
+		ret = scan_field(tcm, w, h, align, &field, r2l, area);
+	}
+
+	if (!ret)
+		/* update map */
+		fill_area(tcm, area, true);
+
+	mutex_unlock(&(pvt->mtx));
+	return ret;
+}
+
+/**
+ * Unreserve a previously allocated 2D or 1D area
+ * @param area	area to be freed
+ * @return 0 - success
+ */
+static s32 bita_free(struct tcm *tcm, struct tcm_area *area)
+{
+	struct bita_pvt *pvt = (struct bita_pvt *)tcm->pvt;
+
+	mutex_lock(&(pvt->mtx));
+
+	/* check that this is in fact an existing area */
+	WARN_ON(!is_area_busy(tcm, area));
+
+	/* Clear the contents of the associated tiles in the map */
+	fill_area(tcm, area, false);
+
+	mutex_unlock(&(pvt->mtx));
+
+	return 0;
+}
@@ -0,0 +1,40 @@
+/*
+ * tcm_bita.h
+ *
+ * BItmap Tiler Allocator (BiTA) interface.
+ *
+ * Copyright (C) 2011 Texas Instruments, Inc.
+ *
+ * This package is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * THIS PACKAGE IS PROVIDED ``AS IS'' AND WITHOUT ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, WITHOUT LIMITATION, THE IMPLIED
+ * WARRANTIES OF MERCHANTIBILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ */
+
+#ifndef TCM_BITA_H
+#define TCM_BITA_H
+
+#include "../tcm.h"
+
+/**
+ * Create a BiTA tiler container manager.  It places areas like SiTA does,
+ * but finds them using a bitmap of the container instead of scanning the
+ * map of areas slot by slot.
+ *
+ * @param width  Container width, must be a multiple of BITS_PER_LONG
+ * @param height Container height
+ * @param attr   preferred division point between 64-aligned
+ *		 allocation (top left), 32-aligned allocations
+ *		 (top right), and page mode allocations (bottom)
+ *
+ * @return TCM instance
+ */
+struct tcm *bita_init(u16 width, u16 height, struct tcm_pt *attr);
+
+TCM_INIT(bita_init, struct tcm_pt);
+
+#endif /* TCM_BITA_H */
@@ -38,10 +38,12 @@
 #include "tmm.h"
 #include "_tiler.h"
 #include "tcm/tcm-sita.h"		/* TCM algorithm */
+#include "tcm/tcm-bita.h"		/* bitmap TCM algorithm */
 
 static bool ssptr_id = CONFIG_TILER_SSPTR_ID;
 static uint granularity = CONFIG_TILER_GRANULARITY;
 static uint tiler_alloc_debug;
+static bool use_bita = CONFIG_TILER_BITA;
 
 /*
  * We can only change ssptr_id if there are no blocks allocated, so that
@@ -54,6 +56,8 @@ module_param_named(grain, granularity, uint, 0644);
 MODULE_PARM_DESC(grain, "Granularity (bytes)");
 module_param_named(alloc_debug, tiler_alloc_debug, uint, 0644);
 MODULE_PARM_DESC(alloc_debug, "Allocation debug flag");
+module_param_named(bita, use_bita, bool, 0444);
+MODULE_PARM_DESC(bita, "Use the bitmap container manager (BiTA)");
 
 static struct dentry *dbgfs;
 static struct dentry *dbg_map;
@@ -1087,6 +1091,146 @@ static void fill_block_info(struct mem_info *i, struct tiler_block_info *blk)
 	blk->key = i->blk.key;
 }
 
+/*
+ *  Fragmentation statistics
+ *  ==========================================================================
+ */
+
+/* free space in the container */
+struct tiler_frag {
+	u32 free;		/* free slots */
+	u16 w, h;		/* largest free rectangle */
+};
+
+/* per-mille of the free slots that are outside the largest free rectangle */
+static u32 frag_index(struct tiler_frag *f)
+{
+	return f->free ? 1000 - f->w * f->h * 1000 / f->free : 0;
+}
+
+/* marks the slots of an area in a bitmap of the container */
+static void frag_fill(unsigned long *map, struct tcm_area *area)
+{
+	struct tcm_area slice, area_s;
+	u32 y;
+
+	tcm_for_each_slice(slice, *area, area_s)
+		for (y = slice.p0.y; y <= slice.p1.y; y++)
+			bitmap_set(map, y * tiler.width + slice.p0.x,
+				   tcm_awidth(slice));
+}
+
+/*
+ * (must have mutex) measures the free space in the container.  Like the
+ * allocation map, this only accounts for areas of allocated blocks.
+ */
+static s32 _m_get_frag(struct tiler_frag *f)
+{
+	unsigned long *map;
+	u16 *height, *stack;
+	struct mem_info *mi;
+	u32 x, y, h, w, top;
+	s32 res = -ENOMEM;
+
+	memset(f, 0, sizeof(*f));
+
+	map = kzalloc(BITS_TO_LONGS(tiler.width * tiler.height) *
+		      sizeof(*map), GFP_KERNEL);
+	height = kzalloc(tiler.width * sizeof(*height), GFP_KERNEL);
+	stack = kmalloc((tiler.width + 1) * sizeof(*stack), GFP_KERNEL);
+	if (!map || !height || !stack)
+		goto done;
+
+	list_for_each_entry(mi, &blocks, global)
+		frag_fill(map, mi->area.is2d ?
+			  &((struct area_info *) mi->parent)->area : &mi->area);
+
+	for (y = 0; y < tiler.height; y++) {
+		/* height of free slots ending in this row */
+		for (x = 0; x < tiler.width; x++) {
+			if (test_bit(y * tiler.width + x, map)) {
+				height[x] = 0;
+			} else {
+				height[x]++;
+				f->free++;
+			}
+		}
+
+		/* largest rectangle under these heights */
+		for (x = top = 0; x <= tiler.width; x++) {
+			h = x < tiler.width ? height[x] : 0;
+			while (top && height[stack[top - 1]] >= h) {
+				u32 ht = height[stack[--top]];
+
+				w = top ? x - stack[top - 1] - 1 : x;
+				if (ht * w > f->w * f->h) {
+					f->w = w;
+					f->h = ht;
+				}
+			}
+			stack[top++] = x;
+		}
+	}
+	res = 0;
+done:
+	kfree(map);
+	kfree(height);
+	kfree(stack);
+	return res;
+}
+
+static int frag_show(struct seq_file *s, void *unused)
+{
+	struct tiler_frag f;
+	s32 res;
+
+	mutex_lock(&mtx);
+	res = _m_get_frag(&f);
+	mutex_unlock(&mtx);
+	if (res)
+		return res;
+
+	seq_printf(s, "free: %u\nlargest: %u*%u\nfrag: %u\n", f.free, f.w,
+		   f.h, frag_index(&f));
+	return 0;
+}
+
+static int frag_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, frag_show, inode->i_private);
+}
+
+static const struct file_operations frag_fops = {
+	.open           = frag_open,
+	.read           = seq_read,
+	.llseek         = seq_lseek,
+	.release        = single_release,
+};
+
+/* releases blocks a user keeps for reuse, see tiler_set_reclaim() */
+static DEFINE_MUTEX(reclaim_mtx);
+static tiler_reclaim_fn reclaim;
+
+void tiler_set_reclaim(tiler_reclaim_fn fn)
+{
+	mutex_lock(&reclaim_mtx);
+	reclaim = fn;
+	mutex_unlock(&reclaim_mtx);
+}
+EXPORT_SYMBOL(tiler_set_reclaim);
+
+/* whether blocks were released to make room in the container */
+static bool do_reclaim(void)
+{
+	bool freed = false;
+
+	mutex_lock(&reclaim_mtx);
+	if (reclaim)
+		freed = reclaim();
+	mutex_unlock(&reclaim_mtx);
+	return freed;
+}
+
 /*
  *  Block operations
  *  ==========================================================================
@@ -1162,6 +1306,9 @@ static struct mem_info *alloc_block_area(enum tiler_fmt fmt, u32 width,
 
 	/* reserve area in tiler container */
 	mi = alloc_area(fmt, width, height, gi);
+	if (!mi && do_reclaim())
+		mi = alloc_area(fmt, width, height, gi);
+
 	if (!mi) {
 		mutex_lock(&mtx);
 		gi->refs--;
@@ -1512,7 +1659,7 @@ static s32 __init tiler_init(void)
 	s32 r = -1;
 	struct device *device = NULL;
 	struct tcm_pt div_pt;
-	struct tcm *sita = NULL;
+	struct tcm *tcm_shared = NULL;
 	struct tmm *tmm_pat = NULL;
 	struct pat_area area = {0};
 
@@ -1561,12 +1708,17 @@ static s32 __init tiler_init(void)
 	/* Allocate tiler container manager (we share 1 on OMAP4) */
 	div_pt.x = tiler.width;   /* hardcoded default */
 	div_pt.y = (3 * tiler.height) / 4;
-	sita = sita_init(tiler.width, tiler.height, (void *)&div_pt);
+	if (use_bita)
+		tcm_shared = bita_init(tiler.width, tiler.height,
+				       (void *)&div_pt);
+	else
+		tcm_shared = sita_init(tiler.width, tiler.height,
+				       (void *)&div_pt);
 
-	tcm[TILFMT_8BIT]  = sita;
-	tcm[TILFMT_16BIT] = sita;
-	tcm[TILFMT_32BIT] = sita;
-	tcm[TILFMT_PAGE]  = sita;
+	tcm[TILFMT_8BIT]  = tcm_shared;
+	tcm[TILFMT_16BIT] = tcm_shared;
+	tcm[TILFMT_32BIT] = tcm_shared;
+	tcm[TILFMT_PAGE]  = tcm_shared;
 
 	/* Allocate tiler memory manager (must have 1 unique TMM per TCM ) */
 	tmm_pat = tmm_pat_init(0, dmac_va, dmac_pa);
@@ -1584,7 +1736,7 @@ static s32 __init tiler_init(void)
 	tiler.nv12_packed = tcm[TILFMT_8BIT] == tcm[TILFMT_16BIT];
 #endif
 
-	if (!sita || !tmm_pat) {
+	if (!tcm_shared || !tmm_pat) {
 		r = -ENOMEM;
 		goto error;
 	}
@@ -1632,10 +1784,13 @@ static s32 __init tiler_init(void)
 	INIT_LIST_HEAD(&orphan_onedim);
 
 	dbgfs = debugfs_create_dir("tiler", NULL);
-	if (IS_ERR_OR_NULL(dbgfs))
+	if (IS_ERR_OR_NULL(dbgfs)) {
 		dev_warn(device, "failed to create debug files.\n");
-	else
+	} else {
 		dbg_map = debugfs_create_dir("map", dbgfs);
+		debugfs_create_file("frag", S_IRUGO, dbgfs, NULL,
+				    &frag_fops);
+	}
 	if (!IS_ERR_OR_NULL(dbg_map)) {
 		int i;
 		for (i = 0; i < ARRAY_SIZE(debugfs_maps); i++)
@@ -1650,7 +1805,7 @@ error:
 #ifdef CONFIG_TILER_ENABLE_USERSPACE
 		kfree(tiler_device);
 #endif
-		tcm_deinit(sita);
+		tcm_deinit(tcm_shared);
 		tmm_deinit(tmm_pat);
 		dma_free_coherent(NULL, tiler.width * tiler.height *
 					sizeof(*dmac_va), dmac_va, dmac_pa);
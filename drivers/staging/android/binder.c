@@ -31,12 +31,81 @@
 #include <linux/sched.h>
 #include <linux/seq_file.h>
 #include <linux/slab.h>
+#include <linux/spinlock.h>
 #include <linux/uaccess.h>
 #include <linux/vmalloc.h>
 
 #include "binder.h"
 
-static DEFINE_MUTEX(binder_lock);
+#define CREATE_TRACE_POINTS
+#include <trace/events/binder.h>
+
+/*
+ * Locking:
+ *
+ * There is no global lock on the transaction path. Each object is
+ * protected by the lock of the proc or node it belongs to:
+ *
+ * proc->outer_lock (mutex) protects the threads tree and the refs trees
+ * of a proc, and the strong and weak counts of its refs. Refs are created
+ * under it, so it may be held across allocations.
+ *
+ * node->lock protects the refcounts of a node (internal_strong_refs,
+ * local_strong_refs, local_weak_refs), the has and pending flags that
+ * mirror them in user space, the refs list, ref->death of those refs,
+ * async_todo with has_async_transaction, the latency samples and
+ * node->proc, which is cleared when the owner dies.
+ *
+ * proc->inner_lock protects everything that both ends of a transaction
+ * touch: the todo lists of the proc and its threads, the transaction
+ * stacks, looper state and return errors of its threads, the nodes tree,
+ * delivered_death, thread and node accounting, tmp_ref and is_dead. A
+ * work item is protected by the inner lock of the proc whose list it is
+ * on. node->tmp_refs is protected by the inner lock of node->proc, or by
+ * binder_dead_nodes_lock once the node is dead, so that a lookup in the
+ * nodes tree can pin a node without its lock. Changing node->proc or
+ * dropping a count that may free the node takes both locks.
+ *
+ * t->lock protects t->from, t->to_proc and t->to_thread, which are
+ * cleared when those threads exit. They are written with t->lock and the
+ * inner lock of the proc on that side held, so either is enough to read
+ * them. t->buffer and buffer->transaction belong to the inner lock of
+ * t->to_proc.
+ *
+ * proc->buffer_lock protects the buffer allocator of one proc: the address
+ * ordered buffer list, the free and allocated trees, free_async_space and
+ * the pages backing the buffers. A sender allocates and fills the target
+ * buffer of a transaction, and BC_FREE_BUFFER returns its pages, with only
+ * this lock held. proc->files_lock protects proc->files.
+ *
+ * Objects used without their lock are pinned: a proc with proc->tmp_ref,
+ * a thread with thread->tmp_ref and a node with node->tmp_refs. A released
+ * proc or thread is marked is_dead and only freed once its last temporary
+ * reference is dropped; nothing new is queued to a dead proc or thread.
+ * A dead thread pins its proc.
+ *
+ * Lock order:
+ *   binder_context_mgr_node_lock, binder_procs_lock, proc->files_lock
+ *     proc->outer_lock
+ *       node->lock
+ *         proc->inner_lock, binder_dead_nodes_lock
+ *           t->lock
+ *
+ *   proc->buffer_lock
+ *     mmap_sem of proc->tsk
+ *       binder_lru_lock
+ *
+ * At most one outer lock, one node lock and one inner lock are held at a
+ * time, so a transaction never holds the locks of both procs at once. The
+ * inner locks, node locks and t->lock are spinlocks, nothing sleeps or
+ * touches user memory under them. proc->buffer_lock is never taken with
+ * any of the other proc or node locks held. binder_deferred_lock and
+ * binder_mmap_lock nest inside everything else. The page pool shrinker
+ * holds binder_lru_lock and only trylocks the others.
+ */
+static DEFINE_MUTEX(binder_procs_lock);
+static DEFINE_MUTEX(binder_context_mgr_node_lock);
+static DEFINE_SPINLOCK(binder_dead_nodes_lock);
 static DEFINE_MUTEX(binder_deferred_lock);
 static DEFINE_MUTEX(binder_mmap_lock);
 
@@ -44,11 +113,16 @@ static HLIST_HEAD(binder_procs);
 static HLIST_HEAD(binder_deferred_list);
 static HLIST_HEAD(binder_dead_nodes);
 
+/* unused but still mapped buffer pages of all procs, oldest first */
+static LIST_HEAD(binder_lru);
+static DEFINE_SPINLOCK(binder_lru_lock);
+static int binder_lru_count;
+
 static struct dentry *binder_debugfs_dir_entry_root;
 static struct dentry *binder_debugfs_dir_entry_proc;
 static struct binder_node *binder_context_mgr_node;
 static uid_t binder_context_mgr_uid = -1;
-static int binder_last_id;
+static atomic_t binder_last_id;
 static struct workqueue_struct *binder_deferred_workqueue;
 
 #define BINDER_DEBUG_ENTRY(name) \
@@ -81,6 +155,15 @@ BINDER_DEBUG_ENTRY(proc);
 
 #define BINDER_SMALL_BUF_SIZE (PAGE_SIZE * 64)
 
+/*
+ * Free buffers smaller than BINDER_FREE_CLASSES << BINDER_FREE_CLASS_SHIFT
+ * bytes are kept on per size class lists instead of the free_buffers tree,
+ * so the small parcels that make up most traffic are allocated in O(1).
+ */
+#define BINDER_FREE_CLASS_SHIFT 5
+#define BINDER_FREE_CLASSES     16
+#define BINDER_FREE_CLASS_MAX   (BINDER_FREE_CLASSES << BINDER_FREE_CLASS_SHIFT)
+
 enum {
 	BINDER_DEBUG_USER_ERROR             = 1U << 0,
 	BINDER_DEBUG_FAILED_TRANSACTION     = 1U << 1,
@@ -103,9 +186,6 @@ static uint32_t binder_debug_mask = BINDER_DEBUG_USER_ERROR |
 	BINDER_DEBUG_FAILED_TRANSACTION | BINDER_DEBUG_DEAD_TRANSACTION;
 module_param_named(debug_mask, binder_debug_mask, uint, S_IWUSR | S_IRUGO);
 
-static int binder_debug_no_lock;
-module_param_named(proc_no_lock, binder_debug_no_lock, bool, S_IWUSR | S_IRUGO);
-
 static DECLARE_WAIT_QUEUE_HEAD(binder_user_error_wait);
 static int binder_stop_on_user_error;
 
@@ -147,24 +227,58 @@ enum binder_stat_types {
 };
 
 struct binder_stats {
-	int br[_IOC_NR(BR_FAILED_REPLY) + 1];
-	int bc[_IOC_NR(BC_DEAD_BINDER_DONE) + 1];
-	int obj_created[BINDER_STAT_COUNT];
-	int obj_deleted[BINDER_STAT_COUNT];
+	atomic_t br[_IOC_NR(BR_FAILED_REPLY) + 1];
+	atomic_t bc[_IOC_NR(BC_DEAD_BINDER_DONE) + 1];
+	atomic_t obj_created[BINDER_STAT_COUNT];
+	atomic_t obj_deleted[BINDER_STAT_COUNT];
 };
 
 static struct binder_stats binder_stats;
 
 static inline void binder_stats_deleted(enum binder_stat_types type)
 {
-	binder_stats.obj_deleted[type]++;
+	atomic_inc(&binder_stats.obj_deleted[type]);
 }
 
 static inline void binder_stats_created(enum binder_stat_types type)
 {
-	binder_stats.obj_created[type]++;
+	atomic_inc(&binder_stats.obj_created[type]);
 }
 
+/*
+ * Transaction latency, split in the time a transaction waits on the
+ * target todo list (queue), the time the target takes to reply
+ * (service) and the time until the caller picks up the reply (round
+ * trip). Samples are kept per node, under node->lock, and per node
+ * owning proc, under its inner_lock. Bucket i counts samples below
+ * 32us << i, the last one everything slower.
+ */
+enum {
+	BINDER_LAT_QUEUE,
+	BINDER_LAT_SERVICE,
+	BINDER_LAT_ROUND_TRIP,
+	BINDER_LAT_STAGES
+};
+
+static const char * const binder_lat_stage_strings[] = {
+	"queue",
+	"service",
+	"round_trip"
+};
+
+#define BINDER_LAT_BUCKETS 12
+#define BINDER_LAT_BUCKET_SHIFT 5
+
+struct binder_lat_hist {
+	unsigned int count[BINDER_LAT_BUCKETS];
+	unsigned int max_us;
+	u64 total_us;
+};
+
+struct binder_lat_stats {
+	struct binder_lat_hist stage[BINDER_LAT_STAGES];
+};
+
 struct binder_transaction_log_entry {
 	int debug_id;
 	int call_type;
@@ -184,11 +298,18 @@ struct binder_transaction_log {
 };
 static struct binder_transaction_log binder_transaction_log;
 static struct binder_transaction_log binder_transaction_log_failed;
+static DEFINE_SPINLOCK(binder_transaction_log_lock);
 
+/*
+ * The lock only hands out slots. Entries are filled in without it, so with
+ * concurrent transactions a slot may be reused while it is still written.
+ */
 static struct binder_transaction_log_entry *binder_transaction_log_add(
 	struct binder_transaction_log *log)
 {
 	struct binder_transaction_log_entry *e;
+
+	spin_lock(&binder_transaction_log_lock);
 	e = &log->entry[log->next];
 	memset(e, 0, sizeof(*e));
 	log->next++;
@@ -196,6 +317,7 @@ static struct binder_transaction_log_entry *binder_transaction_log_add(
 		log->next = 0;
 		log->full = 1;
 	}
+	spin_unlock(&binder_transaction_log_lock);
 	return e;
 }
 
@@ -213,6 +335,7 @@ struct binder_work {
 
 struct binder_node {
 	int debug_id;
+	spinlock_t lock;
 	struct binder_work work;
 	union {
 		struct rb_node rb_node;
@@ -223,8 +346,10 @@ struct binder_node {
 	int internal_strong_refs;
 	int local_weak_refs;
 	int local_strong_refs;
+	int tmp_refs;
 	void __user *ptr;
 	void __user *cookie;
+	struct binder_lat_stats *lat;
 	unsigned has_strong_ref:1;
 	unsigned pending_strong_ref:1;
 	unsigned has_weak_ref:1;
@@ -259,8 +384,11 @@ struct binder_ref {
 
 struct binder_buffer {
 	struct list_head entry; /* free and allocated entries by addesss */
-	struct rb_node rb_node; /* free entry by size or allocated entry */
-				/* by address */
+	union {
+		struct rb_node rb_node; /* free entry by size or allocated */
+					/* entry by address */
+		struct list_head class_entry; /* small free entry */
+	};
 	unsigned free:1;
 	unsigned allow_user_free:1;
 	unsigned async_transaction:1;
@@ -280,6 +408,12 @@ enum binder_deferred_state {
 	BINDER_DEFERRED_RELEASE      = 0x04,
 };
 
+struct binder_lru_page {
+	struct list_head lru;	/* on binder_lru while no buffer uses it */
+	struct page *page_ptr;
+	struct binder_proc *proc;
+};
+
 struct binder_proc {
 	struct hlist_node proc_node;
 	struct rb_root threads;
@@ -293,20 +427,28 @@ struct binder_proc {
 	struct files_struct *files;
 	struct hlist_node deferred_work_node;
 	int deferred_work;
+	int tmp_ref;
+	int is_dead;
+	struct mutex outer_lock;
+	spinlock_t inner_lock;
+	struct mutex files_lock;
 	void *buffer;
 	ptrdiff_t user_buffer_offset;
 
+	struct mutex buffer_lock;
 	struct list_head buffers;
 	struct rb_root free_buffers;
+	struct list_head free_classes[BINDER_FREE_CLASSES];
 	struct rb_root allocated_buffers;
 	size_t free_async_space;
 
-	struct page **pages;
+	struct binder_lru_page *pages;
 	size_t buffer_size;
 	uint32_t buffer_free;
 	struct list_head todo;
 	wait_queue_head_t wait;
 	struct binder_stats stats;
+	struct binder_lat_stats lat;
 	struct list_head delivered_death;
 	int max_threads;
 	int requested_threads;
@@ -338,10 +480,13 @@ struct binder_thread {
 		/* we are also waiting on */
 	wait_queue_head_t wait;
 	struct binder_stats stats;
+	atomic_t tmp_ref;
+	int is_dead;
 };
 
 struct binder_transaction {
 	int debug_id;
+	spinlock_t lock;
 	struct binder_work work;
 	struct binder_thread *from;
 	struct binder_transaction *from_parent;
@@ -357,10 +502,17 @@ struct binder_transaction {
 	long	priority;
 	long	saved_priority;
 	uid_t	sender_euid;
+
+	/* call submit time, replies inherit it from the call */
+	ktime_t	start_time;
+	ktime_t	dequeue_time;
+	/* node a sync call went to, pinned with tmp_refs until the reply */
+	struct binder_node *stats_node;
 };
 
 static void
 binder_defer_work(struct binder_proc *proc, enum binder_deferred_state defer);
+static void binder_free_proc(struct binder_proc *proc);
 
 /*
  * copied from get_unused_fd_flags
@@ -544,6 +696,12 @@ static void binder_insert_free_buffer(struct binder_proc *proc,
 		     "binder: %d: add free buffer, size %zd, "
 		     "at %p\n", proc->pid, new_buffer_size, new_buffer);
 
+	if (new_buffer_size < BINDER_FREE_CLASS_MAX) {
+		list_add(&new_buffer->class_entry, &proc->free_classes[
+			 new_buffer_size >> BINDER_FREE_CLASS_SHIFT]);
+		return;
+	}
+
 	while (*p) {
 		parent = *p;
 		buffer = rb_entry(parent, struct binder_buffer, rb_node);
@@ -560,6 +718,36 @@ static void binder_insert_free_buffer(struct binder_proc *proc,
 	rb_insert_color(&new_buffer->rb_node, &proc->free_buffers);
 }
 
+static void binder_erase_free_buffer(struct binder_proc *proc,
+				     struct binder_buffer *buffer)
+{
+	BUG_ON(!buffer->free);
+
+	if (binder_buffer_size(proc, buffer) < BINDER_FREE_CLASS_MAX)
+		list_del(&buffer->class_entry);
+	else
+		rb_erase(&buffer->rb_node, &proc->free_buffers);
+}
+
+/*
+ * Returns the most recently freed buffer of the smallest size class that
+ * is guaranteed to hold size bytes, or NULL if the tree has to be used.
+ */
+static struct binder_buffer *binder_find_free_class(struct binder_proc *proc,
+						    size_t size)
+{
+	int i;
+
+	for (i = DIV_ROUND_UP(size, 1 << BINDER_FREE_CLASS_SHIFT);
+	     i < BINDER_FREE_CLASSES; i++) {
+		if (!list_empty(&proc->free_classes[i]))
+			return list_first_entry(&proc->free_classes[i],
+						struct binder_buffer,
+						class_entry);
+	}
+	return NULL;
+}
+
 static void binder_insert_allocated_buffer(struct binder_proc *proc,
 					   struct binder_buffer *new_buffer)
 {
@@ -609,6 +797,32 @@ static struct binder_buffer *binder_buffer_lookup(struct binder_proc *proc,
 	return NULL;
 }
 
+static void binder_lru_add(struct binder_lru_page *page)
+{
+	spin_lock(&binder_lru_lock);
+	if (list_empty(&page->lru)) {
+		list_add_tail(&page->lru, &binder_lru);
+		binder_lru_count++;
+	}
+	spin_unlock(&binder_lru_lock);
+}
+
+static void binder_lru_del(struct binder_lru_page *page)
+{
+	spin_lock(&binder_lru_lock);
+	if (!list_empty(&page->lru)) {
+		list_del_init(&page->lru);
+		binder_lru_count--;
+	}
+	spin_unlock(&binder_lru_lock);
+}
+
+/*
+ * Pages of freed buffers stay mapped in the kernel and in the user vma and
+ * are parked on binder_lru, so the next buffer using them needs neither a
+ * page allocation nor mmap_sem. binder_shrink() returns them to the system
+ * under memory pressure.
+ */
 static int binder_update_page_range(struct binder_proc *proc, int allocate,
 				    void *start, void *end,
 				    struct vm_area_struct *vma)
@@ -616,8 +830,9 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 	void *page_addr;
 	unsigned long user_page_addr;
 	struct vm_struct tmp_area;
-	struct page **page;
-	struct mm_struct *mm;
+	struct binder_lru_page *page;
+	struct mm_struct *mm = NULL;
+	int need_map = 0;
 
 	binder_debug(BINDER_DEBUG_BUFFER_ALLOC,
 		     "binder: %d: %s pages %p-%p\n", proc->pid,
@@ -626,9 +841,18 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 	if (end <= start)
 		return 0;
 
-	if (vma)
-		mm = NULL;
-	else
+	if (allocate == 0)
+		goto free_range;
+
+	for (page_addr = start; page_addr < end; page_addr += PAGE_SIZE) {
+		page = &proc->pages[(page_addr - proc->buffer) / PAGE_SIZE];
+		if (page->page_ptr == NULL) {
+			need_map = 1;
+			break;
+		}
+	}
+
+	if (need_map && vma == NULL)
 		mm = get_task_mm(proc->tsk);
 
 	if (mm) {
@@ -641,10 +865,7 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 		}
 	}
 
-	if (allocate == 0)
-		goto free_range;
-
-	if (vma == NULL) {
+	if (need_map && vma == NULL) {
 		printk(KERN_ERR "binder: %d: binder_alloc_buf failed to "
 		       "map pages in userspace, no vma\n", proc->pid);
 		goto err_no_vma;
@@ -655,16 +876,21 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 		struct page **page_array_ptr;
 		page = &proc->pages[(page_addr - proc->buffer) / PAGE_SIZE];
 
-		BUG_ON(*page);
-		*page = alloc_page(GFP_KERNEL | __GFP_HIGHMEM | __GFP_ZERO);
-		if (*page == NULL) {
+		if (page->page_ptr) {
+			binder_lru_del(page);
+			continue;
+		}
+		page->page_ptr = alloc_page(GFP_KERNEL | __GFP_HIGHMEM |
+					    __GFP_ZERO);
+		if (page->page_ptr == NULL) {
 			printk(KERN_ERR "binder: %d: binder_alloc_buf failed "
 			       "for page at %p\n", proc->pid, page_addr);
 			goto err_alloc_page_failed;
 		}
+		page->proc = proc;
 		tmp_area.addr = page_addr;
 		tmp_area.size = PAGE_SIZE + PAGE_SIZE /* guard page? */;
-		page_array_ptr = page;
+		page_array_ptr = &page->page_ptr;
 		ret = map_vm_area(&tmp_area, PAGE_KERNEL, &page_array_ptr);
 		if (ret) {
 			printk(KERN_ERR "binder: %d: binder_alloc_buf failed "
@@ -674,7 +900,7 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 		}
 		user_page_addr =
 			(uintptr_t)page_addr + proc->user_buffer_offset;
-		ret = vm_insert_page(vma, user_page_addr, page[0]);
+		ret = vm_insert_page(vma, user_page_addr, page->page_ptr);
 		if (ret) {
 			printk(KERN_ERR "binder: %d: binder_alloc_buf failed "
 			       "to map page at %lx in userspace\n",
@@ -693,25 +919,22 @@ free_range:
 	for (page_addr = end - PAGE_SIZE; page_addr >= start;
 	     page_addr -= PAGE_SIZE) {
 		page = &proc->pages[(page_addr - proc->buffer) / PAGE_SIZE];
-		if (vma)
-			zap_page_range(vma, (uintptr_t)page_addr +
-				proc->user_buffer_offset, PAGE_SIZE, NULL);
+		if (page->page_ptr)
+			binder_lru_add(page);
+	}
+	return 0;
+
 err_vm_insert_page_failed:
-		unmap_kernel_range((unsigned long)page_addr, PAGE_SIZE);
+	unmap_kernel_range((unsigned long)page_addr, PAGE_SIZE);
 err_map_kernel_failed:
-		/* LGE_CHANGE_S [jugwan.eom@lge.com] 2011-10-22, workaround for *page has been already NULL */
-#if 1
-		if (*page) {
-			__free_page(*page);
-		}
-#else /* Original */
-		__free_page(*page);
-#endif
-		/* LGE_CHANGE_E [jugwan.eom@lge.com] 2011-10-22, workaround for *page has been already NULL */
-		*page = NULL;
+	__free_page(page->page_ptr);
+	page->page_ptr = NULL;
 err_alloc_page_failed:
-		;
-	}
+	/* the pages set up so far are fine, keep them in the pool */
+	for (page_addr -= PAGE_SIZE; page_addr >= start;
+	     page_addr -= PAGE_SIZE)
+		binder_lru_add(&proc->pages[(page_addr - proc->buffer) /
+					    PAGE_SIZE]);
 err_no_vma:
 	if (mm) {
 		up_write(&mm->mmap_sem);
@@ -720,9 +943,77 @@ err_no_vma:
 	return -ENOMEM;
 }
 
-static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
-					      size_t data_size,
-					      size_t offsets_size, int is_async)
+/*
+ * Pages of freed buffers stay mapped on binder_lru so the next transaction
+ * of the same size does not pay for alloc_page, map_vm_area and
+ * vm_insert_page again. Under memory pressure they are unmapped here,
+ * oldest first. Procs busy in their allocator are skipped.
+ */
+static int binder_shrink(struct shrinker *s, struct shrink_control *sc)
+{
+	unsigned long nr = sc->nr_to_scan;
+	int scanned = 0;
+
+	spin_lock(&binder_lru_lock);
+	while (nr-- && !list_empty(&binder_lru) &&
+	       scanned++ < binder_lru_count) {
+		struct binder_lru_page *page;
+		struct binder_proc *proc;
+		struct mm_struct *mm;
+		void *page_addr;
+
+		page = list_first_entry(&binder_lru, struct binder_lru_page,
+					lru);
+		list_move_tail(&page->lru, &binder_lru);
+		proc = page->proc;
+
+		if (!mutex_trylock(&proc->buffer_lock))
+			continue;
+		mm = proc->vma_vm_mm;
+		if (!atomic_inc_not_zero(&mm->mm_users))
+			mm = NULL;
+		if (mm && !down_read_trylock(&mm->mmap_sem)) {
+			mutex_unlock(&proc->buffer_lock);
+			spin_unlock(&binder_lru_lock);
+			mmput(mm);
+			spin_lock(&binder_lru_lock);
+			continue;
+		}
+		list_del_init(&page->lru);
+		binder_lru_count--;
+		spin_unlock(&binder_lru_lock);
+
+		page_addr = proc->buffer +
+			(page - proc->pages) * PAGE_SIZE;
+		if (mm && proc->vma)
+			zap_page_range(proc->vma, (uintptr_t)page_addr +
+				       proc->user_buffer_offset,
+				       PAGE_SIZE, NULL);
+		if (mm)
+			up_read(&mm->mmap_sem);
+		unmap_kernel_range((unsigned long)page_addr, PAGE_SIZE);
+		__free_page(page->page_ptr);
+		page->page_ptr = NULL;
+		mutex_unlock(&proc->buffer_lock);
+		if (mm)
+			mmput(mm);
+
+		spin_lock(&binder_lru_lock);
+	}
+	nr = binder_lru_count;
+	spin_unlock(&binder_lru_lock);
+	return nr;
+}
+
+static struct shrinker binder_shrinker = {
+	.shrink = binder_shrink,
+	.seeks = DEFAULT_SEEKS,
+};
+
+static struct binder_buffer *binder_alloc_buf_locked(struct binder_proc *proc,
+						     size_t data_size,
+						     size_t offsets_size,
+						     int is_async)
 {
 	struct rb_node *n = proc->free_buffers.rb_node;
 	struct binder_buffer *buffer;
@@ -755,30 +1046,33 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 		return NULL;
 	}
 
-	while (n) {
-		buffer = rb_entry(n, struct binder_buffer, rb_node);
-		BUG_ON(!buffer->free);
-		buffer_size = binder_buffer_size(proc, buffer);
-
-		if (size < buffer_size) {
-			best_fit = n;
-			n = n->rb_left;
-		} else if (size > buffer_size)
-			n = n->rb_right;
-		else {
-			best_fit = n;
-			break;
+	buffer = NULL;
+	if (size < BINDER_FREE_CLASS_MAX)
+		buffer = binder_find_free_class(proc, size);
+	if (buffer == NULL) {
+		while (n) {
+			buffer = rb_entry(n, struct binder_buffer, rb_node);
+			BUG_ON(!buffer->free);
+			buffer_size = binder_buffer_size(proc, buffer);
+
+			if (size < buffer_size) {
+				best_fit = n;
+				n = n->rb_left;
+			} else if (size > buffer_size)
+				n = n->rb_right;
+			else {
+				best_fit = n;
+				break;
+			}
+		}
+		if (best_fit == NULL) {
+			printk(KERN_ERR "binder: %d: binder_alloc_buf size %zd "
+			       "failed, no address space\n", proc->pid, size);
+			return NULL;
 		}
-	}
-	if (best_fit == NULL) {
-		printk(KERN_ERR "binder: %d: binder_alloc_buf size %zd failed, "
-		       "no address space\n", proc->pid, size);
-		return NULL;
-	}
-	if (n == NULL) {
 		buffer = rb_entry(best_fit, struct binder_buffer, rb_node);
-		buffer_size = binder_buffer_size(proc, buffer);
 	}
+	buffer_size = binder_buffer_size(proc, buffer);
 
 	binder_debug(BINDER_DEBUG_BUFFER_ALLOC,
 		     "binder: %d: binder_alloc_buf size %zd got buff"
@@ -786,7 +1080,7 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 
 	has_page_addr =
 		(void *)(((uintptr_t)buffer->data + buffer_size) & PAGE_MASK);
-	if (n == NULL) {
+	if (buffer_size > size) {
 		if (size + sizeof(struct binder_buffer) + 4 >= buffer_size)
 			buffer_size = size; /* no room for other buffers */
 		else
@@ -800,7 +1094,7 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 	    (void *)PAGE_ALIGN((uintptr_t)buffer->data), end_page_addr, NULL))
 		return NULL;
 
-	rb_erase(best_fit, &proc->free_buffers);
+	binder_erase_free_buffer(proc, buffer);
 	buffer->free = 0;
 	binder_insert_allocated_buffer(proc, buffer);
 	if (buffer_size != size) {
@@ -815,6 +1109,9 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 	buffer->data_size = data_size;
 	buffer->offsets_size = offsets_size;
 	buffer->async_transaction = is_async;
+	buffer->allow_user_free = 0;
+	buffer->transaction = NULL;
+	buffer->target_node = NULL;
 	if (is_async) {
 		proc->free_async_space -= size + sizeof(struct binder_buffer);
 		binder_debug(BINDER_DEBUG_BUFFER_ALLOC_ASYNC,
@@ -826,6 +1123,19 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 	return buffer;
 }
 
+static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
+					      size_t data_size,
+					      size_t offsets_size, int is_async)
+{
+	struct binder_buffer *buffer;
+
+	mutex_lock(&proc->buffer_lock);
+	buffer = binder_alloc_buf_locked(proc, data_size, offsets_size,
+					 is_async);
+	mutex_unlock(&proc->buffer_lock);
+	return buffer;
+}
+
 static void *buffer_start_page(struct binder_buffer *buffer)
 {
 	return (void *)((uintptr_t)buffer & PAGE_MASK);
@@ -883,8 +1193,8 @@ static void binder_delete_free_buffer(struct binder_proc *proc,
 	}
 }
 
-static void binder_free_buf(struct binder_proc *proc,
-			    struct binder_buffer *buffer)
+static void binder_free_buf_locked(struct binder_proc *proc,
+				   struct binder_buffer *buffer)
 {
 	size_t size, buffer_size;
 
@@ -922,7 +1232,7 @@ static void binder_free_buf(struct binder_proc *proc,
 		struct binder_buffer *next = list_entry(buffer->entry.next,
 						struct binder_buffer, entry);
 		if (next->free) {
-			rb_erase(&next->rb_node, &proc->free_buffers);
+			binder_erase_free_buffer(proc, next);
 			binder_delete_free_buffer(proc, next);
 		}
 	}
@@ -930,16 +1240,102 @@ static void binder_free_buf(struct binder_proc *proc,
 		struct binder_buffer *prev = list_entry(buffer->entry.prev,
 						struct binder_buffer, entry);
 		if (prev->free) {
+			/* erase first, its size grows once buffer is gone */
+			binder_erase_free_buffer(proc, prev);
 			binder_delete_free_buffer(proc, buffer);
-			rb_erase(&prev->rb_node, &proc->free_buffers);
 			buffer = prev;
 		}
 	}
 	binder_insert_free_buffer(proc, buffer);
 }
 
-static struct binder_node *binder_get_node(struct binder_proc *proc,
-					   void __user *ptr)
+static void binder_free_buf(struct binder_proc *proc,
+			    struct binder_buffer *buffer)
+{
+	mutex_lock(&proc->buffer_lock);
+	binder_free_buf_locked(proc, buffer);
+	mutex_unlock(&proc->buffer_lock);
+}
+
+static void binder_proc_dec_tmpref(struct binder_proc *proc)
+{
+	spin_lock(&proc->inner_lock);
+	BUG_ON(proc->tmp_ref <= 0);
+	proc->tmp_ref--;
+	if (proc->is_dead && !proc->tmp_ref) {
+		spin_unlock(&proc->inner_lock);
+		binder_free_proc(proc);
+		return;
+	}
+	spin_unlock(&proc->inner_lock);
+}
+
+static void binder_free_thread(struct binder_thread *thread)
+{
+	struct binder_proc *proc = thread->proc;
+
+	kfree(thread);
+	binder_stats_deleted(BINDER_STAT_THREAD);
+	binder_proc_dec_tmpref(proc);
+}
+
+static void binder_thread_dec_tmpref(struct binder_thread *thread)
+{
+	struct binder_proc *proc = thread->proc;
+
+	/* is_dead is set under the inner lock, test it under the same lock */
+	spin_lock(&proc->inner_lock);
+	if (atomic_dec_and_test(&thread->tmp_ref) && thread->is_dead) {
+		spin_unlock(&proc->inner_lock);
+		binder_free_thread(thread);
+		return;
+	}
+	spin_unlock(&proc->inner_lock);
+}
+
+/*
+ * Returns the sender of t with a temporary reference, or NULL if it has
+ * exited.
+ */
+static struct binder_thread *binder_get_txn_from(struct binder_transaction *t)
+{
+	struct binder_thread *from;
+
+	spin_lock(&t->lock);
+	from = t->from;
+	if (from)
+		atomic_inc(&from->tmp_ref);
+	spin_unlock(&t->lock);
+	return from;
+}
+
+/* Takes the lock protecting node->tmp_refs and node->work, see "Locking" */
+static void binder_node_inner_lock(struct binder_node *node)
+{
+	if (node->proc)
+		spin_lock(&node->proc->inner_lock);
+	else
+		spin_lock(&binder_dead_nodes_lock);
+}
+
+static void binder_node_inner_unlock(struct binder_node *node)
+{
+	if (node->proc)
+		spin_unlock(&node->proc->inner_lock);
+	else
+		spin_unlock(&binder_dead_nodes_lock);
+}
+
+static void binder_free_node(struct binder_node *node)
+{
+	kfree(node->lat);
+	kfree(node);
+	binder_stats_deleted(BINDER_STAT_NODE);
+}
+
+/* Returns the node with a temporary reference, proc->inner_lock held */
+static struct binder_node *binder_get_node_ilocked(struct binder_proc *proc,
+						   void __user *ptr)
 {
 	struct rb_node *n = proc->nodes.rb_node;
 	struct binder_node *node;
@@ -951,20 +1347,44 @@ static struct binder_node *binder_get_node(struct binder_proc *proc,
 			n = n->rb_left;
 		else if (ptr > node->ptr)
 			n = n->rb_right;
-		else
+		else {
+			node->tmp_refs++;
 			return node;
+		}
 	}
 	return NULL;
 }
 
+static struct binder_node *binder_get_node(struct binder_proc *proc,
+					   void __user *ptr)
+{
+	struct binder_node *node;
+
+	spin_lock(&proc->inner_lock);
+	node = binder_get_node_ilocked(proc, ptr);
+	spin_unlock(&proc->inner_lock);
+	return node;
+}
+
+/*
+ * Returns the node of proc for ptr with a temporary reference, creating it
+ * if needed. Another thread of proc may have created it first, in that
+ * case its node is returned and flags are ignored.
+ */
 static struct binder_node *binder_new_node(struct binder_proc *proc,
 					   void __user *ptr,
-					   void __user *cookie)
+					   void __user *cookie,
+					   unsigned long flags)
 {
 	struct rb_node **p = &proc->nodes.rb_node;
 	struct rb_node *parent = NULL;
-	struct binder_node *node;
+	struct binder_node *node, *new_node;
+
+	new_node = kzalloc(sizeof(*new_node), GFP_KERNEL);
+	if (new_node == NULL)
+		return NULL;
 
+	spin_lock(&proc->inner_lock);
 	while (*p) {
 		parent = *p;
 		node = rb_entry(parent, struct binder_node, rb_node);
@@ -973,23 +1393,29 @@ static struct binder_node *binder_new_node(struct binder_proc *proc,
 			p = &(*p)->rb_left;
 		else if (ptr > node->ptr)
 			p = &(*p)->rb_right;
-		else
-			return NULL;
+		else {
+			node->tmp_refs++;
+			spin_unlock(&proc->inner_lock);
+			kfree(new_node);
+			return node;
+		}
 	}
-
-	node = kzalloc(sizeof(*node), GFP_KERNEL);
-	if (node == NULL)
-		return NULL;
+	node = new_node;
 	binder_stats_created(BINDER_STAT_NODE);
-	rb_link_node(&node->rb_node, parent, p);
-	rb_insert_color(&node->rb_node, &proc->nodes);
-	node->debug_id = ++binder_last_id;
+	spin_lock_init(&node->lock);
+	node->tmp_refs = 1;
+	node->debug_id = atomic_inc_return(&binder_last_id);
 	node->proc = proc;
 	node->ptr = ptr;
 	node->cookie = cookie;
+	node->min_priority = flags & FLAT_BINDER_FLAG_PRIORITY_MASK;
+	node->accept_fds = !!(flags & FLAT_BINDER_FLAG_ACCEPTS_FDS);
 	node->work.type = BINDER_WORK_NODE;
 	INIT_LIST_HEAD(&node->work.entry);
 	INIT_LIST_HEAD(&node->async_todo);
+	rb_link_node(&node->rb_node, parent, p);
+	rb_insert_color(&node->rb_node, &proc->nodes);
+	spin_unlock(&proc->inner_lock);
 	binder_debug(BINDER_DEBUG_INTERNAL_REFS,
 		     "binder: %d:%d node %d u%p c%p created\n",
 		     proc->pid, current->pid, node->debug_id,
@@ -997,9 +1423,13 @@ static struct binder_node *binder_new_node(struct binder_proc *proc,
 	return node;
 }
 
-static int binder_inc_node(struct binder_node *node, int strong, int internal,
-			   struct list_head *target_list)
+/* node->lock held, target_list must be a list of node->proc */
+static int binder_inc_node_nlocked(struct binder_node *node, int strong,
+				   int internal, struct list_head *target_list)
 {
+	int ret = 0;
+
+	binder_node_inner_lock(node);
 	if (strong) {
 		if (internal) {
 			if (target_list == NULL &&
@@ -1008,7 +1438,8 @@ static int binder_inc_node(struct binder_node *node, int strong, int internal,
 			    node->has_strong_ref)) {
 				printk(KERN_ERR "binder: invalid inc strong "
 					"node for %d\n", node->debug_id);
-				return -EINVAL;
+				ret = -EINVAL;
+				goto out;
 			}
 			node->internal_strong_refs++;
 		} else
@@ -1024,16 +1455,60 @@ static int binder_inc_node(struct binder_node *node, int strong, int internal,
 			if (target_list == NULL) {
 				printk(KERN_ERR "binder: invalid inc weak node "
 					"for %d\n", node->debug_id);
-				return -EINVAL;
+				ret = -EINVAL;
+				goto out;
 			}
 			list_add_tail(&node->work.entry, target_list);
 		}
 	}
-	return 0;
+out:
+	binder_node_inner_unlock(node);
+	return ret;
+}
+
+static int binder_inc_node(struct binder_node *node, int strong, int internal,
+			   struct list_head *target_list)
+{
+	int ret;
+
+	spin_lock(&node->lock);
+	ret = binder_inc_node_nlocked(node, strong, internal, target_list);
+	spin_unlock(&node->lock);
+	return ret;
+}
+
+/*
+ * node->lock and the lock from binder_node_inner_lock() held. Unlinks the
+ * node and returns 1 if nothing references it any more, the caller frees
+ * it with binder_free_node() once it has dropped node->lock.
+ */
+static int binder_unlink_node_ilocked(struct binder_node *node)
+{
+	if (!hlist_empty(&node->refs) || node->local_strong_refs ||
+	    node->local_weak_refs || node->tmp_refs)
+		return 0;
+
+	list_del_init(&node->work.entry);
+	if (node->proc) {
+		rb_erase(&node->rb_node, &node->proc->nodes);
+		binder_debug(BINDER_DEBUG_INTERNAL_REFS,
+			     "binder: refless node %d deleted\n",
+			     node->debug_id);
+	} else {
+		hlist_del(&node->dead_node);
+		binder_debug(BINDER_DEBUG_INTERNAL_REFS,
+			     "binder: dead node %d deleted\n",
+			     node->debug_id);
+	}
+	return 1;
 }
 
-static int binder_dec_node(struct binder_node *node, int strong, int internal)
+/* node->lock held, returns 1 if the caller must free the node */
+static int binder_dec_node_nlocked(struct binder_node *node, int strong,
+				   int internal)
 {
+	int free_node = 0;
+
 	if (strong) {
 		if (internal)
 			node->internal_strong_refs--;
@@ -1047,35 +1522,120 @@ static int binder_dec_node(struct binder_node *node, int strong, int internal)
 		if (node->local_weak_refs || !hlist_empty(&node->refs))
 			return 0;
 	}
+	binder_node_inner_lock(node);
 	if (node->proc && (node->has_strong_ref || node->has_weak_ref)) {
 		if (list_empty(&node->work.entry)) {
 			list_add_tail(&node->work.entry, &node->proc->todo);
 			wake_up_interruptible(&node->proc->wait);
 		}
-	} else {
-		if (hlist_empty(&node->refs) && !node->local_strong_refs &&
-		    !node->local_weak_refs) {
-			list_del_init(&node->work.entry);
-			if (node->proc) {
-				rb_erase(&node->rb_node, &node->proc->nodes);
-				binder_debug(BINDER_DEBUG_INTERNAL_REFS,
-					     "binder: refless node %d deleted\n",
-					     node->debug_id);
-			} else {
-				hlist_del(&node->dead_node);
-				binder_debug(BINDER_DEBUG_INTERNAL_REFS,
-					     "binder: dead node %d deleted\n",
-					     node->debug_id);
-			}
-			kfree(node);
-			binder_stats_deleted(BINDER_STAT_NODE);
-		}
+	} else
+		free_node = binder_unlink_node_ilocked(node);
+	binder_node_inner_unlock(node);
+
+	return free_node;
+}
+
+static void binder_dec_node(struct binder_node *node, int strong, int internal)
+{
+	int free_node;
+
+	spin_lock(&node->lock);
+	free_node = binder_dec_node_nlocked(node, strong, internal);
+	spin_unlock(&node->lock);
+	if (free_node)
+		binder_free_node(node);
+}
+
+static void binder_inc_node_tmpref(struct binder_node *node)
+{
+	spin_lock(&node->lock);
+	binder_node_inner_lock(node);
+	node->tmp_refs++;
+	binder_node_inner_unlock(node);
+	spin_unlock(&node->lock);
+}
+
+static void binder_put_node(struct binder_node *node)
+{
+	int free_node = 0;
+
+	spin_lock(&node->lock);
+	binder_node_inner_lock(node);
+	BUG_ON(node->tmp_refs <= 0);
+	node->tmp_refs--;
+	/* user space still has to be told to drop its references */
+	if (!(node->proc && (node->has_strong_ref || node->has_weak_ref)))
+		free_node = binder_unlink_node_ilocked(node);
+	binder_node_inner_unlock(node);
+	spin_unlock(&node->lock);
+	if (free_node)
+		binder_free_node(node);
+}
+
+static void binder_lat_add(struct binder_lat_hist *h, unsigned int us)
+{
+	int i = 0;
+
+	if (us >> BINDER_LAT_BUCKET_SHIFT)
+		i = min(fls(us >> BINDER_LAT_BUCKET_SHIFT),
+			BINDER_LAT_BUCKETS - 1);
+	h->count[i]++;
+	h->total_us += us;
+	if (us > h->max_us)
+		h->max_us = us;
+}
+
+/* The caller holds a reference on node, but none of the binder locks */
+static void binder_record_latency(struct binder_node *node,
+				  struct binder_transaction *t, int stage,
+				  ktime_t start, ktime_t end)
+{
+	s64 delta = ktime_us_delta(end, start);
+	unsigned int us = delta < 0 ? 0 : min_t(s64, delta, UINT_MAX);
+	struct binder_lat_stats *lat = NULL;
+
+	trace_binder_transaction_latency(t->debug_id, node->debug_id, stage,
+					 us);
+	if (node->lat == NULL)
+		lat = kzalloc(sizeof(*lat), GFP_KERNEL);
+	spin_lock(&node->lock);
+	if (node->lat == NULL) {
+		node->lat = lat;
+		lat = NULL;
+	}
+	if (node->lat)
+		binder_lat_add(&node->lat->stage[stage], us);
+	if (node->proc) {
+		spin_lock(&node->proc->inner_lock);
+		binder_lat_add(&node->proc->lat.stage[stage], us);
+		spin_unlock(&node->proc->inner_lock);
 	}
+	spin_unlock(&node->lock);
+	kfree(lat);
+}
 
-	return 0;
+/*
+ * Frees a transaction nobody else can reach any more: it is off all todo
+ * lists and transaction stacks.
+ */
+static void binder_free_transaction(struct binder_transaction *t)
+{
+	struct binder_proc *target_proc = t->to_proc;
+
+	if (target_proc) {
+		spin_lock(&target_proc->inner_lock);
+		if (t->buffer)
+			t->buffer->transaction = NULL;
+		spin_unlock(&target_proc->inner_lock);
+	}
+	if (t->stats_node)
+		binder_put_node(t->stats_node);
+	kfree(t);
+	binder_stats_deleted(BINDER_STAT_TRANSACTION);
 }
 
 
+/* proc->outer_lock held, the ref is only valid until it is dropped */
 static struct binder_ref *binder_get_ref(struct binder_proc *proc,
 					 uint32_t desc)
 {
@@ -1095,6 +1655,10 @@ static struct binder_ref *binder_get_ref(struct binder_proc *proc,
 	return NULL;
 }
 
+/*
+ * proc->outer_lock held. The caller holds a reference on node. Fails once
+ * proc is dead, its refs have been or are being deleted.
+ */
 static struct binder_ref *binder_get_ref_for_node(struct binder_proc *proc,
 						  struct binder_node *node)
 {
@@ -1102,6 +1666,7 @@ static struct binder_ref *binder_get_ref_for_node(struct binder_proc *proc,
 	struct rb_node **p = &proc->refs_by_node.rb_node;
 	struct rb_node *parent = NULL;
 	struct binder_ref *ref, *new_ref;
+	int is_dead;
 
 	while (*p) {
 		parent = *p;
@@ -1114,11 +1679,16 @@ static struct binder_ref *binder_get_ref_for_node(struct binder_proc *proc,
 		else
 			return ref;
 	}
+	spin_lock(&proc->inner_lock);
+	is_dead = proc->is_dead;
+	spin_unlock(&proc->inner_lock);
+	if (is_dead)
+		return NULL;
 	new_ref = kzalloc(sizeof(*ref), GFP_KERNEL);
 	if (new_ref == NULL)
 		return NULL;
 	binder_stats_created(BINDER_STAT_REF);
-	new_ref->debug_id = ++binder_last_id;
+	new_ref->debug_id = atomic_inc_return(&binder_last_id);
 	new_ref->proc = proc;
 	new_ref->node = node;
 	rb_link_node(&new_ref->rb_node_node, parent, p);
@@ -1146,48 +1716,57 @@ static struct binder_ref *binder_get_ref_for_node(struct binder_proc *proc,
 	}
 	rb_link_node(&new_ref->rb_node_desc, parent, p);
 	rb_insert_color(&new_ref->rb_node_desc, &proc->refs_by_desc);
-	if (node) {
-		hlist_add_head(&new_ref->node_entry, &node->refs);
+	spin_lock(&node->lock);
+	hlist_add_head(&new_ref->node_entry, &node->refs);
+	spin_unlock(&node->lock);
 
-		binder_debug(BINDER_DEBUG_INTERNAL_REFS,
-			     "binder: %d new ref %d desc %d for "
-			     "node %d\n", proc->pid, new_ref->debug_id,
-			     new_ref->desc, node->debug_id);
-	} else {
-		binder_debug(BINDER_DEBUG_INTERNAL_REFS,
-			     "binder: %d new ref %d desc %d for "
-			     "dead node\n", proc->pid, new_ref->debug_id,
-			      new_ref->desc);
-	}
+	binder_debug(BINDER_DEBUG_INTERNAL_REFS,
+		     "binder: %d new ref %d desc %d for "
+		     "node %d\n", proc->pid, new_ref->debug_id,
+		     new_ref->desc, node->debug_id);
 	return new_ref;
 }
 
+/* ref->proc->outer_lock held */
 static void binder_delete_ref(struct binder_ref *ref)
 {
+	struct binder_node *node = ref->node;
+	struct binder_ref_death *death;
+	int free_node;
+
 	binder_debug(BINDER_DEBUG_INTERNAL_REFS,
 		     "binder: %d delete ref %d desc %d for "
 		     "node %d\n", ref->proc->pid, ref->debug_id,
-		     ref->desc, ref->node->debug_id);
+		     ref->desc, node->debug_id);
 
 	rb_erase(&ref->rb_node_desc, &ref->proc->refs_by_desc);
 	rb_erase(&ref->rb_node_node, &ref->proc->refs_by_node);
+	spin_lock(&node->lock);
 	if (ref->strong)
-		binder_dec_node(ref->node, 1, 1);
+		binder_dec_node_nlocked(node, 1, 1);
 	hlist_del(&ref->node_entry);
-	binder_dec_node(ref->node, 0, 1);
-	if (ref->death) {
+	free_node = binder_dec_node_nlocked(node, 0, 1);
+	death = ref->death;
+	ref->death = NULL;
+	spin_unlock(&node->lock);
+	if (free_node)
+		binder_free_node(node);
+	if (death) {
 		binder_debug(BINDER_DEBUG_DEAD_BINDER,
 			     "binder: %d delete ref %d desc %d "
 			     "has death notification\n", ref->proc->pid,
 			     ref->debug_id, ref->desc);
-		list_del(&ref->death->work.entry);
-		kfree(ref->death);
+		spin_lock(&ref->proc->inner_lock);
+		list_del(&death->work.entry);
+		spin_unlock(&ref->proc->inner_lock);
+		kfree(death);
 		binder_stats_deleted(BINDER_STAT_DEATH);
 	}
 	kfree(ref);
 	binder_stats_deleted(BINDER_STAT_REF);
 }
 
+/* ref->proc->outer_lock held */
 static int binder_inc_ref(struct binder_ref *ref, int strong,
 			  struct list_head *target_list)
 {
@@ -1211,6 +1790,7 @@ static int binder_inc_ref(struct binder_ref *ref, int strong,
 }
 
 
+/* ref->proc->outer_lock held, ref may be freed on return */
 static int binder_dec_ref(struct binder_ref *ref, int strong)
 {
 	if (strong) {
@@ -1222,12 +1802,8 @@ static int binder_dec_ref(struct binder_ref *ref, int strong)
 			return -EINVAL;
 		}
 		ref->strong--;
-		if (ref->strong == 0) {
-			int ret;
-			ret = binder_dec_node(ref->node, strong, 1);
-			if (ret)
-				return ret;
-		}
+		if (ref->strong == 0)
+			binder_dec_node(ref->node, strong, 1);
 	} else {
 		if (ref->weak == 0) {
 			binder_user_error("binder: %d invalid dec weak, "
@@ -1243,31 +1819,40 @@ static int binder_dec_ref(struct binder_ref *ref, int strong)
 	return 0;
 }
 
-static void binder_pop_transaction(struct binder_thread *target_thread,
-				   struct binder_transaction *t)
+/* target_thread->proc->inner_lock held */
+static void binder_pop_transaction_ilocked(struct binder_thread *target_thread,
+					   struct binder_transaction *t)
 {
-	if (target_thread) {
-		BUG_ON(target_thread->transaction_stack != t);
-		BUG_ON(target_thread->transaction_stack->from != target_thread);
-		target_thread->transaction_stack =
-			target_thread->transaction_stack->from_parent;
-		t->from = NULL;
-	}
+	BUG_ON(target_thread->transaction_stack != t);
+	BUG_ON(target_thread->transaction_stack->from != target_thread);
+	target_thread->transaction_stack =
+		target_thread->transaction_stack->from_parent;
+	spin_lock(&t->lock);
+	t->from = NULL;
+	spin_unlock(&t->lock);
 	t->need_reply = 0;
-	if (t->buffer)
-		t->buffer->transaction = NULL;
-	kfree(t);
-	binder_stats_deleted(BINDER_STAT_TRANSACTION);
 }
 
+/* Called without locks, frees t */
 static void binder_send_failed_reply(struct binder_transaction *t,
 				     uint32_t error_code)
 {
 	struct binder_thread *target_thread;
+	struct binder_transaction *next;
+
 	BUG_ON(t->flags & TF_ONE_WAY);
 	while (1) {
-		target_thread = t->from;
+		target_thread = binder_get_txn_from(t);
 		if (target_thread) {
+			struct binder_proc *target_proc = target_thread->proc;
+
+			spin_lock(&target_proc->inner_lock);
+			if (target_thread->is_dead) {
+				/* t->from is NULL now, unwind as below */
+				spin_unlock(&target_proc->inner_lock);
+				binder_thread_dec_tmpref(target_thread);
+				continue;
+			}
 			if (target_thread->return_error != BR_OK &&
 			   target_thread->return_error2 == BR_OK) {
 				target_thread->return_error2 =
@@ -1278,43 +1863,49 @@ static void binder_send_failed_reply(struct binder_transaction *t,
 				binder_debug(BINDER_DEBUG_FAILED_TRANSACTION,
 					     "binder: send failed reply for "
 					     "transaction %d to %d:%d\n",
-					      t->debug_id, target_thread->proc->pid,
+					      t->debug_id, target_proc->pid,
 					      target_thread->pid);
 
-				binder_pop_transaction(target_thread, t);
+				binder_pop_transaction_ilocked(target_thread, t);
 				target_thread->return_error = error_code;
 				wake_up_interruptible(&target_thread->wait);
+				spin_unlock(&target_proc->inner_lock);
+				binder_free_transaction(t);
 			} else {
 				printk(KERN_ERR "binder: reply failed, target "
 					"thread, %d:%d, has error code %d "
-					"already\n", target_thread->proc->pid,
+					"already\n", target_proc->pid,
 					target_thread->pid,
 					target_thread->return_error);
+				spin_unlock(&target_proc->inner_lock);
 			}
+			binder_thread_dec_tmpref(target_thread);
 			return;
-		} else {
-			struct binder_transaction *next = t->from_parent;
-
-			binder_debug(BINDER_DEBUG_FAILED_TRANSACTION,
-				     "binder: send failed reply "
-				     "for transaction %d, target dead\n",
-				     t->debug_id);
-
-			binder_pop_transaction(target_thread, t);
-			if (next == NULL) {
-				binder_debug(BINDER_DEBUG_DEAD_BINDER,
-					     "binder: reply failed,"
-					     " no target thread at root\n");
-				return;
-			}
-			t = next;
+		}
+
+		/* the sender exited, nobody else walks its stack any more */
+		next = t->from_parent;
+
+		binder_debug(BINDER_DEBUG_FAILED_TRANSACTION,
+			     "binder: send failed reply "
+			     "for transaction %d, target dead\n",
+			     t->debug_id);
+
+		binder_free_transaction(t);
+		if (next == NULL) {
 			binder_debug(BINDER_DEBUG_DEAD_BINDER,
-				     "binder: reply failed, no target "
-				     "thread -- retry %d\n", t->debug_id);
+				     "binder: reply failed,"
+				     " no target thread at root\n");
+			return;
 		}
+		t = next;
+		binder_debug(BINDER_DEBUG_DEAD_BINDER,
+			     "binder: reply failed, no target "
+			     "thread -- retry %d\n", t->debug_id);
 	}
 }
 
+/* Called without locks */
 static void binder_transaction_buffer_release(struct binder_proc *proc,
 					      struct binder_buffer *buffer,
 					      size_t *failed_at)
@@ -1359,11 +1950,16 @@ static void binder_transaction_buffer_release(struct binder_proc *proc,
 				     "        node %d u%p\n",
 				     node->debug_id, node->ptr);
 			binder_dec_node(node, fp->type == BINDER_TYPE_BINDER, 0);
+			binder_put_node(node);
 		} break;
 		case BINDER_TYPE_HANDLE:
 		case BINDER_TYPE_WEAK_HANDLE: {
-			struct binder_ref *ref = binder_get_ref(proc, fp->handle);
+			struct binder_ref *ref;
+
+			mutex_lock(&proc->outer_lock);
+			ref = binder_get_ref(proc, fp->handle);
 			if (ref == NULL) {
+				mutex_unlock(&proc->outer_lock);
 				printk(KERN_ERR "binder: transaction release %d"
 				       " bad handle %ld\n", debug_id,
 				       fp->handle);
@@ -1373,13 +1969,17 @@ static void binder_transaction_buffer_release(struct binder_proc *proc,
 				     "        ref %d desc %d (node %d)\n",
 				     ref->debug_id, ref->desc, ref->node->debug_id);
 			binder_dec_ref(ref, fp->type == BINDER_TYPE_HANDLE);
+			mutex_unlock(&proc->outer_lock);
 		} break;
 
 		case BINDER_TYPE_FD:
 			binder_debug(BINDER_DEBUG_TRANSACTION,
 				     "        fd %ld\n", fp->handle);
-			if (failed_at)
+			if (failed_at) {
+				mutex_lock(&proc->files_lock);
 				task_close_fd(proc, fp->handle);
+				mutex_unlock(&proc->files_lock);
+			}
 			break;
 
 		default:
@@ -1397,7 +1997,7 @@ static void binder_transaction(struct binder_proc *proc,
 	struct binder_transaction *t;
 	struct binder_work *tcomplete;
 	size_t *offp, *off_end;
-	struct binder_proc *target_proc;
+	struct binder_proc *target_proc = NULL;
 	struct binder_thread *target_thread = NULL;
 	struct binder_node *target_node = NULL;
 	struct list_head *target_list;
@@ -1419,16 +2019,21 @@ static void binder_transaction(struct binder_proc *proc,
 	e->offsets_size = tr->offsets_size;
 
 	if (reply) {
+		long saved_priority;
+
+		spin_lock(&proc->inner_lock);
 		in_reply_to = thread->transaction_stack;
 		if (in_reply_to == NULL) {
+			spin_unlock(&proc->inner_lock);
 			binder_user_error("binder: %d:%d got reply transaction "
 					  "with no transaction stack\n",
 					  proc->pid, thread->pid);
 			return_error = BR_FAILED_REPLY;
 			goto err_empty_call_stack;
 		}
-		binder_set_nice(in_reply_to->saved_priority);
+		saved_priority = in_reply_to->saved_priority;
 		if (in_reply_to->to_thread != thread) {
+			spin_lock(&in_reply_to->lock);
 			binder_user_error("binder: %d:%d got reply transaction "
 				"with bad transaction stack,"
 				" transaction %d has target %d:%d\n",
@@ -1437,35 +2042,33 @@ static void binder_transaction(struct binder_proc *proc,
 				in_reply_to->to_proc->pid : 0,
 				in_reply_to->to_thread ?
 				in_reply_to->to_thread->pid : 0);
+			spin_unlock(&in_reply_to->lock);
+			spin_unlock(&proc->inner_lock);
+			binder_set_nice(saved_priority);
 			return_error = BR_FAILED_REPLY;
 			in_reply_to = NULL;
-			goto err_bad_call_stack;
+			goto err_bad_reply_stack;
 		}
 		thread->transaction_stack = in_reply_to->to_parent;
-		target_thread = in_reply_to->from;
+		spin_unlock(&proc->inner_lock);
+		binder_set_nice(saved_priority);
+		target_thread = binder_get_txn_from(in_reply_to);
 		if (target_thread == NULL) {
 			return_error = BR_DEAD_REPLY;
 			goto err_dead_binder;
 		}
-		if (target_thread->transaction_stack != in_reply_to) {
-			binder_user_error("binder: %d:%d got reply transaction "
-				"with bad target transaction stack %d, "
-				"expected %d\n",
-				proc->pid, thread->pid,
-				target_thread->transaction_stack ?
-				target_thread->transaction_stack->debug_id : 0,
-				in_reply_to->debug_id);
-			return_error = BR_FAILED_REPLY;
-			in_reply_to = NULL;
-			target_thread = NULL;
-			goto err_dead_binder;
-		}
 		target_proc = target_thread->proc;
+		spin_lock(&target_proc->inner_lock);
+		target_proc->tmp_ref++;
+		spin_unlock(&target_proc->inner_lock);
 	} else {
 		if (tr->target.handle) {
 			struct binder_ref *ref;
+
+			mutex_lock(&proc->outer_lock);
 			ref = binder_get_ref(proc, tr->target.handle);
 			if (ref == NULL) {
+				mutex_unlock(&proc->outer_lock);
 				binder_user_error("binder: %d:%d got "
 					"transaction to invalid handle\n",
 					proc->pid, thread->pid);
@@ -1473,23 +2076,43 @@ static void binder_transaction(struct binder_proc *proc,
 				goto err_invalid_target_handle;
 			}
 			target_node = ref->node;
+			binder_inc_node_tmpref(target_node);
+			mutex_unlock(&proc->outer_lock);
 		} else {
+			mutex_lock(&binder_context_mgr_node_lock);
 			target_node = binder_context_mgr_node;
+			if (target_node)
+				binder_inc_node_tmpref(target_node);
+			mutex_unlock(&binder_context_mgr_node_lock);
 			if (target_node == NULL) {
 				return_error = BR_DEAD_REPLY;
 				goto err_no_context_mgr_node;
 			}
 		}
 		e->to_node = target_node->debug_id;
+		spin_lock(&target_node->lock);
 		target_proc = target_node->proc;
+		if (target_proc) {
+			spin_lock(&target_proc->inner_lock);
+			target_proc->tmp_ref++;
+			spin_unlock(&target_proc->inner_lock);
+		}
+		spin_unlock(&target_node->lock);
 		if (target_proc == NULL) {
 			return_error = BR_DEAD_REPLY;
 			goto err_dead_binder;
 		}
-		if (!(tr->flags & TF_ONE_WAY) && thread->transaction_stack) {
-			struct binder_transaction *tmp;
+		if (!(tr->flags & TF_ONE_WAY)) {
+			struct binder_transaction *tmp, *match = NULL;
+
+			/*
+			 * Only this thread unwinds the chain below its stack
+			 * top, so it stays valid under our own inner lock.
+			 */
+			spin_lock(&proc->inner_lock);
 			tmp = thread->transaction_stack;
-			if (tmp->to_thread != thread) {
+			if (tmp && tmp->to_thread != thread) {
+				spin_lock(&tmp->lock);
 				binder_user_error("binder: %d:%d got new "
 					"transaction with bad transaction stack"
 					", transaction %d has target %d:%d\n",
@@ -1497,24 +2120,25 @@ static void binder_transaction(struct binder_proc *proc,
 					tmp->to_proc ? tmp->to_proc->pid : 0,
 					tmp->to_thread ?
 					tmp->to_thread->pid : 0);
+				spin_unlock(&tmp->lock);
+				spin_unlock(&proc->inner_lock);
 				return_error = BR_FAILED_REPLY;
 				goto err_bad_call_stack;
 			}
 			while (tmp) {
+				spin_lock(&tmp->lock);
 				if (tmp->from && tmp->from->proc == target_proc)
-					target_thread = tmp->from;
+					match = tmp;
+				spin_unlock(&tmp->lock);
 				tmp = tmp->from_parent;
 			}
+			if (match)
+				target_thread = binder_get_txn_from(match);
+			spin_unlock(&proc->inner_lock);
 		}
 	}
-	if (target_thread) {
+	if (target_thread)
 		e->to_thread = target_thread->pid;
-		target_list = &target_thread->todo;
-		target_wait = &target_thread->wait;
-	} else {
-		target_list = &target_proc->todo;
-		target_wait = &target_proc->wait;
-	}
 	e->to_proc = target_proc->pid;
 
 	/* TODO: reuse incoming transaction for reply */
@@ -1524,6 +2148,7 @@ static void binder_transaction(struct binder_proc *proc,
 		goto err_alloc_t_failed;
 	}
 	binder_stats_created(BINDER_STAT_TRANSACTION);
+	spin_lock_init(&t->lock);
 
 	tcomplete = kzalloc(sizeof(*tcomplete), GFP_KERNEL);
 	if (tcomplete == NULL) {
@@ -1532,7 +2157,7 @@ static void binder_transaction(struct binder_proc *proc,
 	}
 	binder_stats_created(BINDER_STAT_TRANSACTION_COMPLETE);
 
-	t->debug_id = ++binder_last_id;
+	t->debug_id = atomic_inc_return(&binder_last_id);
 	e->debug_id = t->debug_id;
 
 	if (reply)
@@ -1562,30 +2187,34 @@ static void binder_transaction(struct binder_proc *proc,
 	t->code = tr->code;
 	t->flags = tr->flags;
 	t->priority = task_nice(current);
+
+	/*
+	 * target_proc, target_thread and target_node are pinned, so the
+	 * buffer is allocated and filled without any of their locks.
+	 */
 	t->buffer = binder_alloc_buf(target_proc, tr->data_size,
 		tr->offsets_size, !reply && (t->flags & TF_ONE_WAY));
 	if (t->buffer == NULL) {
 		return_error = BR_FAILED_REPLY;
 		goto err_binder_alloc_buf_failed;
 	}
-	t->buffer->allow_user_free = 0;
 	t->buffer->debug_id = t->debug_id;
 	t->buffer->transaction = t;
 	t->buffer->target_node = target_node;
 	if (target_node)
 		binder_inc_node(target_node, 1, 0, NULL);
-
 	offp = (size_t *)(t->buffer->data + ALIGN(tr->data_size, sizeof(void *)));
 
-	if (copy_from_user(t->buffer->data, tr->data.ptr.buffer, tr->data_size)) {
-		binder_user_error("binder: %d:%d got transaction with invalid "
-			"data ptr\n", proc->pid, thread->pid);
+	if (copy_from_user(t->buffer->data, tr->data.ptr.buffer,
+			   tr->data_size)) {
+		binder_user_error("binder: %d:%d got transaction with "
+			"invalid data ptr\n", proc->pid, thread->pid);
 		return_error = BR_FAILED_REPLY;
 		goto err_copy_data_failed;
 	}
 	if (copy_from_user(offp, tr->data.ptr.offsets, tr->offsets_size)) {
-		binder_user_error("binder: %d:%d got transaction with invalid "
-			"offsets ptr\n", proc->pid, thread->pid);
+		binder_user_error("binder: %d:%d got transaction with "
+			"invalid offsets ptr\n", proc->pid, thread->pid);
 		return_error = BR_FAILED_REPLY;
 		goto err_copy_data_failed;
 	}
@@ -1615,13 +2244,12 @@ static void binder_transaction(struct binder_proc *proc,
 			struct binder_ref *ref;
 			struct binder_node *node = binder_get_node(proc, fp->binder);
 			if (node == NULL) {
-				node = binder_new_node(proc, fp->binder, fp->cookie);
+				node = binder_new_node(proc, fp->binder,
+						       fp->cookie, fp->flags);
 				if (node == NULL) {
 					return_error = BR_FAILED_REPLY;
 					goto err_binder_new_node_failed;
 				}
-				node->min_priority = fp->flags & FLAT_BINDER_FLAG_PRIORITY_MASK;
-				node->accept_fds = !!(fp->flags & FLAT_BINDER_FLAG_ACCEPTS_FDS);
 			}
 			if (fp->cookie != node->cookie) {
 				binder_user_error("binder: %d:%d sending u%p "
@@ -1629,10 +2257,14 @@ static void binder_transaction(struct binder_proc *proc,
 					proc->pid, thread->pid,
 					fp->binder, node->debug_id,
 					fp->cookie, node->cookie);
+				binder_put_node(node);
 				goto err_binder_get_ref_for_node_failed;
 			}
+			mutex_lock(&target_proc->outer_lock);
 			ref = binder_get_ref_for_node(target_proc, node);
 			if (ref == NULL) {
+				mutex_unlock(&target_proc->outer_lock);
+				binder_put_node(node);
 				return_error = BR_FAILED_REPLY;
 				goto err_binder_get_ref_for_node_failed;
 			}
@@ -1648,11 +2280,19 @@ static void binder_transaction(struct binder_proc *proc,
 				     "        node %d u%p -> ref %d desc %d\n",
 				     node->debug_id, node->ptr, ref->debug_id,
 				     ref->desc);
+			mutex_unlock(&target_proc->outer_lock);
+			binder_put_node(node);
 		} break;
 		case BINDER_TYPE_HANDLE:
 		case BINDER_TYPE_WEAK_HANDLE: {
-			struct binder_ref *ref = binder_get_ref(proc, fp->handle);
+			struct binder_ref *ref;
+			struct binder_node *node;
+			int ref_debug_id;
+
+			mutex_lock(&proc->outer_lock);
+			ref = binder_get_ref(proc, fp->handle);
 			if (ref == NULL) {
+				mutex_unlock(&proc->outer_lock);
 				binder_user_error("binder: %d:%d got "
 					"transaction with invalid "
 					"handle, %ld\n", proc->pid,
@@ -1660,32 +2300,46 @@ static void binder_transaction(struct binder_proc *proc,
 				return_error = BR_FAILED_REPLY;
 				goto err_binder_get_ref_failed;
 			}
-			if (ref->node->proc == target_proc) {
+			node = ref->node;
+			ref_debug_id = ref->debug_id;
+			binder_inc_node_tmpref(node);
+			mutex_unlock(&proc->outer_lock);
+
+			spin_lock(&node->lock);
+			if (node->proc == target_proc) {
 				if (fp->type == BINDER_TYPE_HANDLE)
 					fp->type = BINDER_TYPE_BINDER;
 				else
 					fp->type = BINDER_TYPE_WEAK_BINDER;
-				fp->binder = ref->node->ptr;
-				fp->cookie = ref->node->cookie;
-				binder_inc_node(ref->node, fp->type == BINDER_TYPE_BINDER, 0, NULL);
+				fp->binder = node->ptr;
+				fp->cookie = node->cookie;
+				binder_inc_node_nlocked(node, fp->type == BINDER_TYPE_BINDER, 0, NULL);
+				spin_unlock(&node->lock);
 				binder_debug(BINDER_DEBUG_TRANSACTION,
-					     "        ref %d desc %d -> node %d u%p\n",
-					     ref->debug_id, ref->desc, ref->node->debug_id,
-					     ref->node->ptr);
+					     "        ref %d desc %ld -> node %d u%p\n",
+					     ref_debug_id, fp->handle, node->debug_id,
+					     node->ptr);
 			} else {
 				struct binder_ref *new_ref;
-				new_ref = binder_get_ref_for_node(target_proc, ref->node);
+
+				spin_unlock(&node->lock);
+				mutex_lock(&target_proc->outer_lock);
+				new_ref = binder_get_ref_for_node(target_proc, node);
 				if (new_ref == NULL) {
+					mutex_unlock(&target_proc->outer_lock);
+					binder_put_node(node);
 					return_error = BR_FAILED_REPLY;
 					goto err_binder_get_ref_for_node_failed;
 				}
+				binder_debug(BINDER_DEBUG_TRANSACTION,
+					     "        ref %d desc %ld -> ref %d desc %d (node %d)\n",
+					     ref_debug_id, fp->handle, new_ref->debug_id,
+					     new_ref->desc, node->debug_id);
 				fp->handle = new_ref->desc;
 				binder_inc_ref(new_ref, fp->type == BINDER_TYPE_HANDLE, NULL);
-				binder_debug(BINDER_DEBUG_TRANSACTION,
-					     "        ref %d desc %d -> ref %d desc %d (node %d)\n",
-					     ref->debug_id, ref->desc, new_ref->debug_id,
-					     new_ref->desc, ref->node->debug_id);
+				mutex_unlock(&target_proc->outer_lock);
 			}
+			binder_put_node(node);
 		} break;
 
 		case BINDER_TYPE_FD: {
@@ -1713,13 +2367,16 @@ static void binder_transaction(struct binder_proc *proc,
 				return_error = BR_FAILED_REPLY;
 				goto err_fget_failed;
 			}
+			mutex_lock(&target_proc->files_lock);
 			target_fd = task_get_unused_fd_flags(target_proc, O_CLOEXEC);
 			if (target_fd < 0) {
+				mutex_unlock(&target_proc->files_lock);
 				fput(file);
 				return_error = BR_FAILED_REPLY;
 				goto err_get_unused_fd_failed;
 			}
 			task_fd_install(target_proc, target_fd, file);
+			mutex_unlock(&target_proc->files_lock);
 			binder_debug(BINDER_DEBUG_TRANSACTION,
 				     "        fd %ld -> %d\n", fp->handle, target_fd);
 			/* TODO: fput? */
@@ -1734,31 +2391,130 @@ static void binder_transaction(struct binder_proc *proc,
 			goto err_bad_object_type;
 		}
 	}
+	trace_binder_transaction(t->debug_id, reply,
+				 target_node ? target_node->debug_id : 0,
+				 target_proc->pid,
+				 target_thread ? target_thread->pid : 0,
+				 t->code, t->flags);
+	t->work.type = BINDER_WORK_TRANSACTION;
+	tcomplete->type = BINDER_WORK_TRANSACTION_COMPLETE;
+
+	/*
+	 * The completion is queued before the target can see t, so the
+	 * sender always reads BR_TRANSACTION_COMPLETE before the reply.
+	 * From here on t belongs to the target once it is queued.
+	 */
 	if (reply) {
 		BUG_ON(t->buffer->async_transaction != 0);
-		binder_pop_transaction(target_thread, in_reply_to);
+		t->start_time = in_reply_to->start_time;
+		t->stats_node = in_reply_to->stats_node;
+		in_reply_to->stats_node = NULL;
+		if (t->stats_node)
+			binder_record_latency(t->stats_node, in_reply_to,
+					      BINDER_LAT_SERVICE,
+					      in_reply_to->dequeue_time,
+					      ktime_get());
+		spin_lock(&proc->inner_lock);
+		list_add_tail(&tcomplete->entry, &thread->todo);
+		spin_unlock(&proc->inner_lock);
+
+		spin_lock(&target_proc->inner_lock);
+		if (target_thread->is_dead) {
+			spin_unlock(&target_proc->inner_lock);
+			return_error = BR_DEAD_REPLY;
+			goto err_dead_proc_or_thread;
+		}
+		if (target_thread->transaction_stack != in_reply_to) {
+			binder_user_error("binder: %d:%d got reply transaction "
+				"with bad target transaction stack %d, "
+				"expected %d\n",
+				proc->pid, thread->pid,
+				target_thread->transaction_stack ?
+				target_thread->transaction_stack->debug_id : 0,
+				in_reply_to->debug_id);
+			spin_unlock(&target_proc->inner_lock);
+			return_error = BR_FAILED_REPLY;
+			in_reply_to = NULL;
+			goto err_dead_proc_or_thread;
+		}
+		binder_pop_transaction_ilocked(target_thread, in_reply_to);
+		list_add_tail(&t->work.entry, &target_thread->todo);
+		wake_up_interruptible(&target_thread->wait);
+		spin_unlock(&target_proc->inner_lock);
+		binder_free_transaction(in_reply_to);
 	} else if (!(t->flags & TF_ONE_WAY)) {
 		BUG_ON(t->buffer->async_transaction != 0);
+		t->start_time = ktime_get();
+		t->stats_node = target_node;
+		binder_inc_node_tmpref(target_node);
 		t->need_reply = 1;
+		spin_lock(&proc->inner_lock);
+		list_add_tail(&tcomplete->entry, &thread->todo);
 		t->from_parent = thread->transaction_stack;
 		thread->transaction_stack = t;
+		spin_unlock(&proc->inner_lock);
+
+		if (target_thread) {
+			target_list = &target_thread->todo;
+			target_wait = &target_thread->wait;
+		} else {
+			target_list = &target_proc->todo;
+			target_wait = &target_proc->wait;
+		}
+		spin_lock(&target_proc->inner_lock);
+		if (target_proc->is_dead ||
+		    (target_thread && target_thread->is_dead)) {
+			spin_unlock(&target_proc->inner_lock);
+			spin_lock(&proc->inner_lock);
+			binder_pop_transaction_ilocked(thread, t);
+			spin_unlock(&proc->inner_lock);
+			return_error = BR_DEAD_REPLY;
+			goto err_dead_proc_or_thread;
+		}
+		list_add_tail(&t->work.entry, target_list);
+		wake_up_interruptible(target_wait);
+		spin_unlock(&target_proc->inner_lock);
 	} else {
 		BUG_ON(target_node == NULL);
 		BUG_ON(t->buffer->async_transaction != 1);
+		t->start_time = ktime_get();
+		spin_lock(&proc->inner_lock);
+		list_add_tail(&tcomplete->entry, &thread->todo);
+		spin_unlock(&proc->inner_lock);
+
+		spin_lock(&target_node->lock);
+		spin_lock(&target_proc->inner_lock);
+		if (target_proc->is_dead) {
+			spin_unlock(&target_proc->inner_lock);
+			spin_unlock(&target_node->lock);
+			return_error = BR_DEAD_REPLY;
+			goto err_dead_proc_or_thread;
+		}
 		if (target_node->has_async_transaction) {
-			target_list = &target_node->async_todo;
-			target_wait = NULL;
-		} else
+			list_add_tail(&t->work.entry, &target_node->async_todo);
+		} else {
 			target_node->has_async_transaction = 1;
+			list_add_tail(&t->work.entry, &target_proc->todo);
+			wake_up_interruptible(&target_proc->wait);
+		}
+		spin_unlock(&target_proc->inner_lock);
+		spin_unlock(&target_node->lock);
 	}
-	t->work.type = BINDER_WORK_TRANSACTION;
-	list_add_tail(&t->work.entry, target_list);
-	tcomplete->type = BINDER_WORK_TRANSACTION_COMPLETE;
-	list_add_tail(&tcomplete->entry, &thread->todo);
-	if (target_wait)
-		wake_up_interruptible(target_wait);
+	if (target_thread)
+		binder_thread_dec_tmpref(target_thread);
+	binder_proc_dec_tmpref(target_proc);
+	if (target_node)
+		binder_put_node(target_node);
 	return;
 
+err_dead_proc_or_thread:
+	spin_lock(&proc->inner_lock);
+	list_del(&tcomplete->entry);
+	spin_unlock(&proc->inner_lock);
+	if (t->stats_node) {
+		binder_put_node(t->stats_node);
+		t->stats_node = NULL;
+	}
 err_get_unused_fd_failed:
 err_fget_failed:
 err_fd_not_allowed:
@@ -1779,10 +2535,16 @@ err_alloc_tcomplete_failed:
 	binder_stats_deleted(BINDER_STAT_TRANSACTION);
 err_alloc_t_failed:
 err_bad_call_stack:
-err_empty_call_stack:
+	if (target_thread)
+		binder_thread_dec_tmpref(target_thread);
+	binder_proc_dec_tmpref(target_proc);
 err_dead_binder:
+	if (target_node)
+		binder_put_node(target_node);
 err_invalid_target_handle:
 err_no_context_mgr_node:
+err_bad_reply_stack:
+err_empty_call_stack:
 	binder_debug(BINDER_DEBUG_FAILED_TRANSACTION,
 		     "binder: %d:%d transaction failed %d, size %zd-%zd\n",
 		     proc->pid, thread->pid, return_error,
@@ -1794,12 +2556,16 @@ err_no_context_mgr_node:
 		*fe = *e;
 	}
 
+	spin_lock(&proc->inner_lock);
 	BUG_ON(thread->return_error != BR_OK);
 	if (in_reply_to) {
 		thread->return_error = BR_TRANSACTION_COMPLETE;
+		spin_unlock(&proc->inner_lock);
 		binder_send_failed_reply(in_reply_to, return_error);
-	} else
+	} else {
 		thread->return_error = return_error;
+		spin_unlock(&proc->inner_lock);
+	}
 }
 
 int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
@@ -1814,9 +2580,9 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 			return -EFAULT;
 		ptr += sizeof(uint32_t);
 		if (_IOC_NR(cmd) < ARRAY_SIZE(binder_stats.bc)) {
-			binder_stats.bc[_IOC_NR(cmd)]++;
-			proc->stats.bc[_IOC_NR(cmd)]++;
-			thread->stats.bc[_IOC_NR(cmd)]++;
+			atomic_inc(&binder_stats.bc[_IOC_NR(cmd)]);
+			atomic_inc(&proc->stats.bc[_IOC_NR(cmd)]);
+			atomic_inc(&thread->stats.bc[_IOC_NR(cmd)]);
 		}
 		switch (cmd) {
 		case BC_INCREFS:
@@ -1825,17 +2591,27 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 		case BC_DECREFS: {
 			uint32_t target;
 			struct binder_ref *ref;
+			struct binder_node *ctx_mgr_node = NULL;
 			const char *debug_string;
 
 			if (get_user(target, (uint32_t __user *)ptr))
 				return -EFAULT;
 			ptr += sizeof(uint32_t);
-			if (target == 0 && binder_context_mgr_node &&
+			if (target == 0 &&
 			    (cmd == BC_INCREFS || cmd == BC_ACQUIRE)) {
-				ref = binder_get_ref_for_node(proc,
-					       binder_context_mgr_node);
+				mutex_lock(&binder_context_mgr_node_lock);
+				ctx_mgr_node = binder_context_mgr_node;
+				if (ctx_mgr_node)
+					binder_inc_node_tmpref(ctx_mgr_node);
+				mutex_unlock(&binder_context_mgr_node_lock);
+			}
+			mutex_lock(&proc->outer_lock);
+			if (ctx_mgr_node) {
+				ref = binder_get_ref_for_node(proc, ctx_mgr_node);
 #if defined(CONFIG_MACH_LGE_OMAP3) //LGE_CHANGE [sunggyun.yu@lge.com] 2011-03-19, WBT
 				if (ref == NULL) {
+					mutex_unlock(&proc->outer_lock);
+					binder_put_node(ctx_mgr_node);
 					return -ENOMEM;
 				}
 #endif
@@ -1850,6 +2626,9 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 			} else
 				ref = binder_get_ref(proc, target);
 			if (ref == NULL) {
+				mutex_unlock(&proc->outer_lock);
+				if (ctx_mgr_node)
+					binder_put_node(ctx_mgr_node);
 				binder_user_error("binder: %d:%d refcou"
 					"nt change on invalid ref %d\n",
 					proc->pid, thread->pid, target);
@@ -1874,10 +2653,13 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 				binder_dec_ref(ref, 0);
 				break;
 			}
+			/* a release may have freed ref, only report the handle */
 			binder_debug(BINDER_DEBUG_USER_REFS,
-				     "binder: %d:%d %s ref %d desc %d s %d w %d for node %d\n",
-				     proc->pid, thread->pid, debug_string, ref->debug_id,
-				     ref->desc, ref->strong, ref->weak, ref->node->debug_id);
+				     "binder: %d:%d %s desc %d\n",
+				     proc->pid, thread->pid, debug_string, target);
+			mutex_unlock(&proc->outer_lock);
+			if (ctx_mgr_node)
+				binder_put_node(ctx_mgr_node);
 			break;
 		}
 		case BC_INCREFS_DONE:
@@ -1911,35 +2693,44 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 					"BC_INCREFS_DONE" : "BC_ACQUIRE_DONE",
 					node_ptr, node->debug_id,
 					cookie, node->cookie);
+				binder_put_node(node);
 				break;
 			}
+			spin_lock(&node->lock);
 			if (cmd == BC_ACQUIRE_DONE) {
 				if (node->pending_strong_ref == 0) {
+					spin_unlock(&node->lock);
 					binder_user_error("binder: %d:%d "
 						"BC_ACQUIRE_DONE node %d has "
 						"no pending acquire request\n",
 						proc->pid, thread->pid,
 						node->debug_id);
+					binder_put_node(node);
 					break;
 				}
 				node->pending_strong_ref = 0;
 			} else {
 				if (node->pending_weak_ref == 0) {
+					spin_unlock(&node->lock);
 					binder_user_error("binder: %d:%d "
 						"BC_INCREFS_DONE node %d has "
 						"no pending increfs request\n",
 						proc->pid, thread->pid,
 						node->debug_id);
+					binder_put_node(node);
 					break;
 				}
 				node->pending_weak_ref = 0;
 			}
-			binder_dec_node(node, cmd == BC_ACQUIRE_DONE, 0);
+			/* the temporary reference keeps the node alive */
+			binder_dec_node_nlocked(node, cmd == BC_ACQUIRE_DONE, 0);
 			binder_debug(BINDER_DEBUG_USER_REFS,
 				     "binder: %d:%d %s node %d ls %d lw %d\n",
 				     proc->pid, thread->pid,
 				     cmd == BC_INCREFS_DONE ? "BC_INCREFS_DONE" : "BC_ACQUIRE_DONE",
 				     node->debug_id, node->local_strong_refs, node->local_weak_refs);
+			spin_unlock(&node->lock);
+			binder_put_node(node);
 			break;
 		}
 		case BC_ATTEMPT_ACQUIRE:
@@ -1952,40 +2743,57 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 		case BC_FREE_BUFFER: {
 			void __user *data_ptr;
 			struct binder_buffer *buffer;
+			struct binder_node *buf_node;
 
 			if (get_user(data_ptr, (void * __user *)ptr))
 				return -EFAULT;
 			ptr += sizeof(void *);
 
+			mutex_lock(&proc->buffer_lock);
 			buffer = binder_buffer_lookup(proc, data_ptr);
 			if (buffer == NULL) {
+				mutex_unlock(&proc->buffer_lock);
 				binder_user_error("binder: %d:%d "
 					"BC_FREE_BUFFER u%p no match\n",
 					proc->pid, thread->pid, data_ptr);
 				break;
 			}
 			if (!buffer->allow_user_free) {
+				mutex_unlock(&proc->buffer_lock);
 				binder_user_error("binder: %d:%d "
 					"BC_FREE_BUFFER u%p matched "
 					"unreturned buffer\n",
 					proc->pid, thread->pid, data_ptr);
 				break;
 			}
+			/* claim it, the rest runs without buffer_lock */
+			buffer->allow_user_free = 0;
+			mutex_unlock(&proc->buffer_lock);
+
+			spin_lock(&proc->inner_lock);
 			binder_debug(BINDER_DEBUG_FREE_BUFFER,
 				     "binder: %d:%d BC_FREE_BUFFER u%p found buffer %d for %s transaction\n",
 				     proc->pid, thread->pid, data_ptr, buffer->debug_id,
 				     buffer->transaction ? "active" : "finished");
-
 			if (buffer->transaction) {
 				buffer->transaction->buffer = NULL;
 				buffer->transaction = NULL;
 			}
-			if (buffer->async_transaction && buffer->target_node) {
-				BUG_ON(!buffer->target_node->has_async_transaction);
-				if (list_empty(&buffer->target_node->async_todo))
-					buffer->target_node->has_async_transaction = 0;
-				else
-					list_move_tail(buffer->target_node->async_todo.next, &thread->todo);
+			spin_unlock(&proc->inner_lock);
+
+			buf_node = buffer->target_node;
+			if (buffer->async_transaction && buf_node) {
+				spin_lock(&buf_node->lock);
+				BUG_ON(!buf_node->has_async_transaction);
+				if (list_empty(&buf_node->async_todo)) {
+					buf_node->has_async_transaction = 0;
+				} else {
+					spin_lock(&proc->inner_lock);
+					list_move_tail(buf_node->async_todo.next,
+						       &thread->todo);
+					spin_unlock(&proc->inner_lock);
+				}
+				spin_unlock(&buf_node->lock);
 			}
 			binder_transaction_buffer_release(proc, buffer, NULL);
 			binder_free_buf(proc, buffer);
@@ -2007,6 +2815,7 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 			binder_debug(BINDER_DEBUG_THREADS,
 				     "binder: %d:%d BC_REGISTER_LOOPER\n",
 				     proc->pid, thread->pid);
+			spin_lock(&proc->inner_lock);
 			if (thread->looper & BINDER_LOOPER_STATE_ENTERED) {
 				thread->looper |= BINDER_LOOPER_STATE_INVALID;
 				binder_user_error("binder: %d:%d ERROR:"
@@ -2024,11 +2833,13 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 				proc->requested_threads_started++;
 			}
 			thread->looper |= BINDER_LOOPER_STATE_REGISTERED;
+			spin_unlock(&proc->inner_lock);
 			break;
 		case BC_ENTER_LOOPER:
 			binder_debug(BINDER_DEBUG_THREADS,
 				     "binder: %d:%d BC_ENTER_LOOPER\n",
 				     proc->pid, thread->pid);
+			spin_lock(&proc->inner_lock);
 			if (thread->looper & BINDER_LOOPER_STATE_REGISTERED) {
 				thread->looper |= BINDER_LOOPER_STATE_INVALID;
 				binder_user_error("binder: %d:%d ERROR:"
@@ -2037,12 +2848,15 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 					proc->pid, thread->pid);
 			}
 			thread->looper |= BINDER_LOOPER_STATE_ENTERED;
+			spin_unlock(&proc->inner_lock);
 			break;
 		case BC_EXIT_LOOPER:
 			binder_debug(BINDER_DEBUG_THREADS,
 				     "binder: %d:%d BC_EXIT_LOOPER\n",
 				     proc->pid, thread->pid);
+			spin_lock(&proc->inner_lock);
 			thread->looper |= BINDER_LOOPER_STATE_EXITED;
+			spin_unlock(&proc->inner_lock);
 			break;
 
 		case BC_REQUEST_DEATH_NOTIFICATION:
@@ -2050,7 +2864,8 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 			uint32_t target;
 			void __user *cookie;
 			struct binder_ref *ref;
-			struct binder_ref_death *death;
+			struct binder_ref_death *death = NULL;
+			struct binder_node *node;
 
 			if (get_user(target, (uint32_t __user *)ptr))
 				return -EFAULT;
@@ -2058,8 +2873,23 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 			if (get_user(cookie, (void __user * __user *)ptr))
 				return -EFAULT;
 			ptr += sizeof(void *);
+			if (cmd == BC_REQUEST_DEATH_NOTIFICATION) {
+				death = kzalloc(sizeof(*death), GFP_KERNEL);
+				if (death == NULL) {
+					spin_lock(&proc->inner_lock);
+					thread->return_error = BR_ERROR;
+					spin_unlock(&proc->inner_lock);
+					binder_debug(BINDER_DEBUG_FAILED_TRANSACTION,
+						     "binder: %d:%d "
+						     "BC_REQUEST_DEATH_NOTIFICATION failed\n",
+						     proc->pid, thread->pid);
+					break;
+				}
+			}
+			mutex_lock(&proc->outer_lock);
 			ref = binder_get_ref(proc, target);
 			if (ref == NULL) {
+				mutex_unlock(&proc->outer_lock);
 				binder_user_error("binder: %d:%d %s "
 					"invalid ref %d\n",
 					proc->pid, thread->pid,
@@ -2067,6 +2897,7 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 					"BC_REQUEST_DEATH_NOTIFICATION" :
 					"BC_CLEAR_DEATH_NOTIFICATION",
 					target);
+				kfree(death);
 				break;
 			}
 
@@ -2079,39 +2910,39 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 				     cookie, ref->debug_id, ref->desc,
 				     ref->strong, ref->weak, ref->node->debug_id);
 
+			node = ref->node;
+			spin_lock(&node->lock);
 			if (cmd == BC_REQUEST_DEATH_NOTIFICATION) {
 				if (ref->death) {
+					spin_unlock(&node->lock);
+					mutex_unlock(&proc->outer_lock);
 					binder_user_error("binder: %d:%"
 						"d BC_REQUEST_DEATH_NOTI"
 						"FICATION death notific"
 						"ation already set\n",
 						proc->pid, thread->pid);
-					break;
-				}
-				death = kzalloc(sizeof(*death), GFP_KERNEL);
-				if (death == NULL) {
-					thread->return_error = BR_ERROR;
-					binder_debug(BINDER_DEBUG_FAILED_TRANSACTION,
-						     "binder: %d:%d "
-						     "BC_REQUEST_DEATH_NOTIFICATION failed\n",
-						     proc->pid, thread->pid);
+					kfree(death);
 					break;
 				}
 				binder_stats_created(BINDER_STAT_DEATH);
 				INIT_LIST_HEAD(&death->work.entry);
 				death->cookie = cookie;
 				ref->death = death;
-				if (ref->node->proc == NULL) {
+				if (node->proc == NULL) {
 					ref->death->work.type = BINDER_WORK_DEAD_BINDER;
+					spin_lock(&proc->inner_lock);
 					if (thread->looper & (BINDER_LOOPER_STATE_REGISTERED | BINDER_LOOPER_STATE_ENTERED)) {
 						list_add_tail(&ref->death->work.entry, &thread->todo);
 					} else {
 						list_add_tail(&ref->death->work.entry, &proc->todo);
 						wake_up_interruptible(&proc->wait);
 					}
+					spin_unlock(&proc->inner_lock);
 				}
 			} else {
 				if (ref->death == NULL) {
+					spin_unlock(&node->lock);
+					mutex_unlock(&proc->outer_lock);
 					binder_user_error("binder: %d:%"
 						"d BC_CLEAR_DEATH_NOTIFI"
 						"CATION death notificat"
@@ -2121,6 +2952,8 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 				}
 				death = ref->death;
 				if (death->cookie != cookie) {
+					spin_unlock(&node->lock);
+					mutex_unlock(&proc->outer_lock);
 					binder_user_error("binder: %d:%"
 						"d BC_CLEAR_DEATH_NOTIFI"
 						"CATION death notificat"
@@ -2131,6 +2964,7 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 					break;
 				}
 				ref->death = NULL;
+				spin_lock(&proc->inner_lock);
 				if (list_empty(&death->work.entry)) {
 					death->work.type = BINDER_WORK_CLEAR_DEATH_NOTIFICATION;
 					if (thread->looper & (BINDER_LOOPER_STATE_REGISTERED | BINDER_LOOPER_STATE_ENTERED)) {
@@ -2143,7 +2977,10 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 					BUG_ON(death->work.type != BINDER_WORK_DEAD_BINDER);
 					death->work.type = BINDER_WORK_DEAD_BINDER_AND_CLEAR;
 				}
+				spin_unlock(&proc->inner_lock);
 			}
+			spin_unlock(&node->lock);
+			mutex_unlock(&proc->outer_lock);
 		} break;
 		case BC_DEAD_BINDER_DONE: {
 			struct binder_work *w;
@@ -2153,6 +2990,7 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 				return -EFAULT;
 
 			ptr += sizeof(void *);
+			spin_lock(&proc->inner_lock);
 			list_for_each_entry(w, &proc->delivered_death, entry) {
 				struct binder_ref_death *tmp_death = container_of(w, struct binder_ref_death, work);
 				if (tmp_death->cookie == cookie) {
@@ -2164,6 +3002,7 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 				     "binder: %d:%d BC_DEAD_BINDER_DONE %p found %p\n",
 				     proc->pid, thread->pid, cookie, death);
 			if (death == NULL) {
+				spin_unlock(&proc->inner_lock);
 				binder_user_error("binder: %d:%d BC_DEAD"
 					"_BINDER_DONE %p not found\n",
 					proc->pid, thread->pid, cookie);
@@ -2180,6 +3019,7 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 					wake_up_interruptible(&proc->wait);
 				}
 			}
+			spin_unlock(&proc->inner_lock);
 		} break;
 
 		default:
@@ -2196,23 +3036,35 @@ void binder_stat_br(struct binder_proc *proc, struct binder_thread *thread,
 		    uint32_t cmd)
 {
 	if (_IOC_NR(cmd) < ARRAY_SIZE(binder_stats.br)) {
-		binder_stats.br[_IOC_NR(cmd)]++;
-		proc->stats.br[_IOC_NR(cmd)]++;
-		thread->stats.br[_IOC_NR(cmd)]++;
+		atomic_inc(&binder_stats.br[_IOC_NR(cmd)]);
+		atomic_inc(&proc->stats.br[_IOC_NR(cmd)]);
+		atomic_inc(&thread->stats.br[_IOC_NR(cmd)]);
 	}
 }
 
 static int binder_has_proc_work(struct binder_proc *proc,
 				struct binder_thread *thread)
 {
-	return !list_empty(&proc->todo) ||
+	int has_work;
+
+	spin_lock(&proc->inner_lock);
+	has_work = !list_empty(&proc->todo) ||
 		(thread->looper & BINDER_LOOPER_STATE_NEED_RETURN);
+	spin_unlock(&proc->inner_lock);
+	return has_work;
 }
 
 static int binder_has_thread_work(struct binder_thread *thread)
 {
-	return !list_empty(&thread->todo) || thread->return_error != BR_OK ||
+	struct binder_proc *proc = thread->proc;
+	int has_work;
+
+	spin_lock(&proc->inner_lock);
+	has_work = !list_empty(&thread->todo) ||
+		thread->return_error != BR_OK ||
 		(thread->looper & BINDER_LOOPER_STATE_NEED_RETURN);
+	spin_unlock(&proc->inner_lock);
+	return has_work;
 }
 
 static int binder_thread_read(struct binder_proc *proc,
@@ -2233,22 +3085,31 @@ static int binder_thread_read(struct binder_proc *proc,
 	}
 
 retry:
+	spin_lock(&proc->inner_lock);
 	wait_for_proc_work = thread->transaction_stack == NULL &&
 				list_empty(&thread->todo);
 
 	if (thread->return_error != BR_OK && ptr < end) {
-		if (thread->return_error2 != BR_OK) {
-			if (put_user(thread->return_error2, (uint32_t __user *)ptr))
+		uint32_t return_error = thread->return_error;
+		uint32_t return_error2 = thread->return_error2;
+
+		/* if only return_error2 fits, both are returned next time */
+		if (return_error2 == BR_OK ||
+		    end - ptr >= 2 * sizeof(uint32_t)) {
+			thread->return_error2 = BR_OK;
+			thread->return_error = BR_OK;
+		}
+		spin_unlock(&proc->inner_lock);
+		if (return_error2 != BR_OK) {
+			if (put_user(return_error2, (uint32_t __user *)ptr))
 				return -EFAULT;
 			ptr += sizeof(uint32_t);
 			if (ptr == end)
 				goto done;
-			thread->return_error2 = BR_OK;
 		}
-		if (put_user(thread->return_error, (uint32_t __user *)ptr))
+		if (put_user(return_error, (uint32_t __user *)ptr))
 			return -EFAULT;
 		ptr += sizeof(uint32_t);
-		thread->return_error = BR_OK;
 		goto done;
 	}
 
@@ -2256,7 +3117,7 @@ retry:
 	thread->looper |= BINDER_LOOPER_STATE_WAITING;
 	if (wait_for_proc_work)
 		proc->ready_threads++;
-	mutex_unlock(&binder_lock);
+	spin_unlock(&proc->inner_lock);
 	if (wait_for_proc_work) {
 		if (!(thread->looper & (BINDER_LOOPER_STATE_REGISTERED |
 					BINDER_LOOPER_STATE_ENTERED))) {
@@ -2280,10 +3141,11 @@ retry:
 		} else
 			ret = wait_event_interruptible(thread->wait, binder_has_thread_work(thread));
 	}
-	mutex_lock(&binder_lock);
+	spin_lock(&proc->inner_lock);
 	if (wait_for_proc_work)
 		proc->ready_threads--;
 	thread->looper &= ~BINDER_LOOPER_STATE_WAITING;
+	spin_unlock(&proc->inner_lock);
 
 	if (ret)
 		return ret;
@@ -2292,26 +3154,47 @@ retry:
 		uint32_t cmd;
 		struct binder_transaction_data tr;
 		struct binder_work *w;
+		struct list_head *list;
 		struct binder_transaction *t = NULL;
+		struct binder_thread *t_from;
 
+		spin_lock(&proc->inner_lock);
 		if (!list_empty(&thread->todo))
-			w = list_first_entry(&thread->todo, struct binder_work, entry);
+			list = &thread->todo;
 		else if (!list_empty(&proc->todo) && wait_for_proc_work)
-			w = list_first_entry(&proc->todo, struct binder_work, entry);
+			list = &proc->todo;
 		else {
-			if (ptr - buffer == 4 && !(thread->looper & BINDER_LOOPER_STATE_NEED_RETURN)) /* no data added */
+			int need_return = thread->looper &
+					  BINDER_LOOPER_STATE_NEED_RETURN;
+
+			spin_unlock(&proc->inner_lock);
+			if (ptr - buffer == 4 && !need_return) /* no data added */
 				goto retry;
 			break;
 		}
 
-		if (end - ptr < sizeof(tr) + 4)
+		if (end - ptr < sizeof(tr) + 4) {
+			spin_unlock(&proc->inner_lock);
 			break;
+		}
+		w = list_first_entry(list, struct binder_work, entry);
 
+		/*
+		 * Everything is taken off the list under the inner lock and
+		 * copied to user space after it is dropped.
+		 */
 		switch (w->type) {
 		case BINDER_WORK_TRANSACTION: {
+			list_del_init(&w->entry);
+			spin_unlock(&proc->inner_lock);
 			t = container_of(w, struct binder_transaction, work);
 		} break;
 		case BINDER_WORK_TRANSACTION_COMPLETE: {
+			list_del(&w->entry);
+			spin_unlock(&proc->inner_lock);
+			kfree(w);
+			binder_stats_deleted(BINDER_STAT_TRANSACTION_COMPLETE);
+
 			cmd = BR_TRANSACTION_COMPLETE;
 			if (put_user(cmd, (uint32_t __user *)ptr))
 				return -EFAULT;
@@ -2321,17 +3204,30 @@ retry:
 			binder_debug(BINDER_DEBUG_TRANSACTION_COMPLETE,
 				     "binder: %d:%d BR_TRANSACTION_COMPLETE\n",
 				     proc->pid, thread->pid);
-
-			list_del(&w->entry);
-			kfree(w);
-			binder_stats_deleted(BINDER_STAT_TRANSACTION_COMPLETE);
 		} break;
 		case BINDER_WORK_NODE: {
 			struct binder_node *node = container_of(w, struct binder_node, work);
 			uint32_t cmd = BR_NOOP;
 			const char *cmd_name;
-			int strong = node->internal_strong_refs || node->local_strong_refs;
-			int weak = !hlist_empty(&node->refs) || node->local_weak_refs || strong;
+			void __user *node_ptr;
+			void __user *node_cookie;
+			int node_debug_id;
+			int strong, weak;
+
+			/*
+			 * The work stays queued until the state is unchanged,
+			 * it is only removed holding node->lock so a reference
+			 * taken meanwhile cannot be missed.
+			 */
+			node->tmp_refs++;
+			spin_unlock(&proc->inner_lock);
+
+			spin_lock(&node->lock);
+			node_ptr = node->ptr;
+			node_cookie = node->cookie;
+			node_debug_id = node->debug_id;
+			strong = node->internal_strong_refs || node->local_strong_refs;
+			weak = !hlist_empty(&node->refs) || node->local_weak_refs || strong;
 			if (weak && !node->has_weak_ref) {
 				cmd = BR_INCREFS;
 				cmd_name = "BR_INCREFS";
@@ -2353,37 +3249,36 @@ retry:
 				cmd_name = "BR_DECREFS";
 				node->has_weak_ref = 0;
 			}
+			if (cmd == BR_NOOP) {
+				spin_lock(&proc->inner_lock);
+				list_del_init(&w->entry);
+				spin_unlock(&proc->inner_lock);
+			}
+			spin_unlock(&node->lock);
+			/* frees the node if this was the last reference */
+			binder_put_node(node);
+
 			if (cmd != BR_NOOP) {
 				if (put_user(cmd, (uint32_t __user *)ptr))
 					return -EFAULT;
 				ptr += sizeof(uint32_t);
-				if (put_user(node->ptr, (void * __user *)ptr))
+				if (put_user(node_ptr, (void * __user *)ptr))
 					return -EFAULT;
 				ptr += sizeof(void *);
-				if (put_user(node->cookie, (void * __user *)ptr))
+				if (put_user(node_cookie, (void * __user *)ptr))
 					return -EFAULT;
 				ptr += sizeof(void *);
 
 				binder_stat_br(proc, thread, cmd);
 				binder_debug(BINDER_DEBUG_USER_REFS,
 					     "binder: %d:%d %s %d u%p c%p\n",
-					     proc->pid, thread->pid, cmd_name, node->debug_id, node->ptr, node->cookie);
+					     proc->pid, thread->pid, cmd_name, node_debug_id, node_ptr, node_cookie);
 			} else {
-				list_del_init(&w->entry);
-				if (!weak && !strong) {
-					binder_debug(BINDER_DEBUG_INTERNAL_REFS,
-						     "binder: %d:%d node %d u%p c%p deleted\n",
-						     proc->pid, thread->pid, node->debug_id,
-						     node->ptr, node->cookie);
-					rb_erase(&node->rb_node, &proc->nodes);
-					kfree(node);
-					binder_stats_deleted(BINDER_STAT_NODE);
-				} else {
-					binder_debug(BINDER_DEBUG_INTERNAL_REFS,
-						     "binder: %d:%d node %d u%p c%p state unchanged\n",
-						     proc->pid, thread->pid, node->debug_id, node->ptr,
-						     node->cookie);
-				}
+				binder_debug(BINDER_DEBUG_INTERNAL_REFS,
+					     "binder: %d:%d node %d u%p c%p %s\n",
+					     proc->pid, thread->pid, node_debug_id,
+					     node_ptr, node_cookie,
+					     weak ? "state unchanged" : "released");
 			}
 		} break;
 		case BINDER_WORK_DEAD_BINDER:
@@ -2391,16 +3286,25 @@ retry:
 		case BINDER_WORK_CLEAR_DEATH_NOTIFICATION: {
 			struct binder_ref_death *death;
 			uint32_t cmd;
+			void __user *cookie;
 
 			death = container_of(w, struct binder_ref_death, work);
-			if (w->type == BINDER_WORK_CLEAR_DEATH_NOTIFICATION)
+			cookie = death->cookie;
+			if (w->type == BINDER_WORK_CLEAR_DEATH_NOTIFICATION) {
 				cmd = BR_CLEAR_DEATH_NOTIFICATION_DONE;
-			else
+				list_del(&w->entry);
+				spin_unlock(&proc->inner_lock);
+				kfree(death);
+				binder_stats_deleted(BINDER_STAT_DEATH);
+			} else {
 				cmd = BR_DEAD_BINDER;
+				list_move(&w->entry, &proc->delivered_death);
+				spin_unlock(&proc->inner_lock);
+			}
 			if (put_user(cmd, (uint32_t __user *)ptr))
 				return -EFAULT;
 			ptr += sizeof(uint32_t);
-			if (put_user(death->cookie, (void * __user *)ptr))
+			if (put_user(cookie, (void * __user *)ptr))
 				return -EFAULT;
 			ptr += sizeof(void *);
 			binder_debug(BINDER_DEBUG_DEATH_NOTIFICATION,
@@ -2409,22 +3313,23 @@ retry:
 				      cmd == BR_DEAD_BINDER ?
 				      "BR_DEAD_BINDER" :
 				      "BR_CLEAR_DEATH_NOTIFICATION_DONE",
-				      death->cookie);
+				      cookie);
 
-			if (w->type == BINDER_WORK_CLEAR_DEATH_NOTIFICATION) {
-				list_del(&w->entry);
-				kfree(death);
-				binder_stats_deleted(BINDER_STAT_DEATH);
-			} else
-				list_move(&w->entry, &proc->delivered_death);
 			if (cmd == BR_DEAD_BINDER)
 				goto done; /* DEAD_BINDER notifications can cause transactions */
 		} break;
+		default:
+			spin_unlock(&proc->inner_lock);
+			break;
 		}
 
 		if (!t)
 			continue;
 
+		/*
+		 * t is off the list and nobody frees its buffer before
+		 * allow_user_free is set below.
+		 */
 		BUG_ON(t->buffer == NULL);
 		if (t->buffer->target_node) {
 			struct binder_node *target_node = t->buffer->target_node;
@@ -2447,8 +3352,9 @@ retry:
 		tr.flags = t->flags;
 		tr.sender_euid = t->sender_euid;
 
-		if (t->from) {
-			struct task_struct *sender = t->from->proc->tsk;
+		t_from = binder_get_txn_from(t);
+		if (t_from) {
+			struct task_struct *sender = t_from->proc->tsk;
 			tr.sender_pid = task_tgid_nr_ns(sender,
 							current->nsproxy->pid_ns);
 		} else {
@@ -2465,13 +3371,22 @@ retry:
 
 		/* LGE_CHANGE_S [jugwan.eom@lge.com] 2011-11-04, verify user ptr */
 		if (!access_ok(VERIFY_WRITE, (uint32_t __user *)ptr, 4))
-			return -EFAULT;
+			ret = -EFAULT;
 		/* LGE_CHANGE_E [jugwan.eom@lge.com] 2011-11-04, verify user ptr */
-		if (put_user(cmd, (uint32_t __user *)ptr))
-			return -EFAULT;
+		if (!ret && (put_user(cmd, (uint32_t __user *)ptr) ||
+			     copy_to_user(ptr + sizeof(uint32_t), &tr,
+					  sizeof(tr))))
+			ret = -EFAULT;
+		if (ret) {
+			/* put it back, it is delivered on the next read */
+			if (t_from)
+				binder_thread_dec_tmpref(t_from);
+			spin_lock(&proc->inner_lock);
+			list_add(&t->work.entry, list);
+			spin_unlock(&proc->inner_lock);
+			return ret;
+		}
 		ptr += sizeof(uint32_t);
-		if (copy_to_user(ptr, &tr, sizeof(tr)))
-			return -EFAULT;
 		ptr += sizeof(tr);
 
 		binder_stat_br(proc, thread, cmd);
@@ -2481,21 +3396,38 @@ retry:
 			     proc->pid, thread->pid,
 			     (cmd == BR_TRANSACTION) ? "BR_TRANSACTION" :
 			     "BR_REPLY",
-			     t->debug_id, t->from ? t->from->proc->pid : 0,
-			     t->from ? t->from->pid : 0, cmd,
+			     t->debug_id, t_from ? t_from->proc->pid : 0,
+			     t_from ? t_from->pid : 0, cmd,
 			     t->buffer->data_size, t->buffer->offsets_size,
 			     tr.data.ptr.buffer, tr.data.ptr.offsets);
-
-		list_del(&t->work.entry);
+		if (t_from)
+			binder_thread_dec_tmpref(t_from);
+
+		trace_binder_transaction_received(t->debug_id, proc->pid,
+						  thread->pid);
+		if (cmd == BR_TRANSACTION) {
+			t->dequeue_time = ktime_get();
+			binder_record_latency(t->buffer->target_node, t,
+					      BINDER_LAT_QUEUE, t->start_time,
+					      t->dequeue_time);
+		} else if (t->stats_node) {
+			binder_record_latency(t->stats_node, t,
+					      BINDER_LAT_ROUND_TRIP,
+					      t->start_time, ktime_get());
+		}
+		mutex_lock(&proc->buffer_lock);
 		t->buffer->allow_user_free = 1;
+		mutex_unlock(&proc->buffer_lock);
 		if (cmd == BR_TRANSACTION && !(t->flags & TF_ONE_WAY)) {
+			spin_lock(&proc->inner_lock);
 			t->to_parent = thread->transaction_stack;
+			spin_lock(&t->lock);
 			t->to_thread = thread;
+			spin_unlock(&t->lock);
 			thread->transaction_stack = t;
+			spin_unlock(&proc->inner_lock);
 		} else {
-			t->buffer->transaction = NULL;
-			kfree(t);
-			binder_stats_deleted(BINDER_STAT_TRANSACTION);
+			binder_free_transaction(t);
 		}
 		break;
 	}
@@ -2503,27 +3435,39 @@ retry:
 done:
 
 	*consumed = ptr - buffer;
+	spin_lock(&proc->inner_lock);
 	if (proc->requested_threads + proc->ready_threads == 0 &&
 	    proc->requested_threads_started < proc->max_threads &&
 	    (thread->looper & (BINDER_LOOPER_STATE_REGISTERED |
 	     BINDER_LOOPER_STATE_ENTERED)) /* the user-space code fails to */
 	     /*spawn a new thread if we leave this out */) {
 		proc->requested_threads++;
+		spin_unlock(&proc->inner_lock);
 		binder_debug(BINDER_DEBUG_THREADS,
 			     "binder: %d:%d BR_SPAWN_LOOPER\n",
 			     proc->pid, thread->pid);
 		if (put_user(BR_SPAWN_LOOPER, (uint32_t __user *)buffer))
 			return -EFAULT;
-	}
+	} else
+		spin_unlock(&proc->inner_lock);
 	return 0;
 }
 
-static void binder_release_work(struct list_head *list)
+static void binder_release_work(struct binder_proc *proc,
+				struct list_head *list)
 {
 	struct binder_work *w;
-	while (!list_empty(list)) {
+
+	while (1) {
+		spin_lock(&proc->inner_lock);
+		if (list_empty(list)) {
+			spin_unlock(&proc->inner_lock);
+			break;
+		}
 		w = list_first_entry(list, struct binder_work, entry);
 		list_del_init(&w->entry);
+		spin_unlock(&proc->inner_lock);
+
 		switch (w->type) {
 		case BINDER_WORK_TRANSACTION: {
 			struct binder_transaction *t;
@@ -2536,9 +3480,7 @@ static void binder_release_work(struct list_head *list)
 				binder_debug(BINDER_DEBUG_DEAD_TRANSACTION,
 					"binder: undelivered transaction %d\n",
 					t->debug_id);
-				t->buffer->transaction = NULL;
-				kfree(t);
-				binder_stats_deleted(BINDER_STAT_TRANSACTION);
+				binder_free_transaction(t);
 			}
 		} break;
 		case BINDER_WORK_TRANSACTION_COMPLETE: {
@@ -2571,8 +3513,10 @@ static struct binder_thread *binder_get_thread(struct binder_proc *proc)
 {
 	struct binder_thread *thread = NULL;
 	struct rb_node *parent = NULL;
-	struct rb_node **p = &proc->threads.rb_node;
+	struct rb_node **p;
 
+	mutex_lock(&proc->outer_lock);
+	p = &proc->threads.rb_node;
 	while (*p) {
 		parent = *p;
 		thread = rb_entry(parent, struct binder_thread, rb_node);
@@ -2586,11 +3530,14 @@ static struct binder_thread *binder_get_thread(struct binder_proc *proc)
 	}
 	if (*p == NULL) {
 		thread = kzalloc(sizeof(*thread), GFP_KERNEL);
-		if (thread == NULL)
+		if (thread == NULL) {
+			mutex_unlock(&proc->outer_lock);
 			return NULL;
+		}
 		binder_stats_created(BINDER_STAT_THREAD);
 		thread->proc = proc;
 		thread->pid = current->pid;
+		atomic_set(&thread->tmp_ref, 0);
 		init_waitqueue_head(&thread->wait);
 		INIT_LIST_HEAD(&thread->todo);
 		rb_link_node(&thread->rb_node, parent, p);
@@ -2599,22 +3546,36 @@ static struct binder_thread *binder_get_thread(struct binder_proc *proc)
 		thread->return_error = BR_OK;
 		thread->return_error2 = BR_OK;
 	}
+	mutex_unlock(&proc->outer_lock);
 	return thread;
 }
 
-static int binder_free_thread(struct binder_proc *proc,
-			      struct binder_thread *thread)
+/*
+ * Unlinks the thread and fails the transactions it still takes part in.
+ * The thread is freed once the last sender holding a tmp_ref drops it.
+ */
+static int binder_thread_release(struct binder_proc *proc,
+				 struct binder_thread *thread)
 {
-	struct binder_transaction *t;
+	struct binder_transaction *t, *next;
 	struct binder_transaction *send_reply = NULL;
 	int active_transactions = 0;
 
+	mutex_lock(&proc->outer_lock);
 	rb_erase(&thread->rb_node, &proc->threads);
+	mutex_unlock(&proc->outer_lock);
+
+	spin_lock(&proc->inner_lock);
+	/* dropped by binder_free_thread() */
+	proc->tmp_ref++;
+	atomic_inc(&thread->tmp_ref);
+	thread->is_dead = 1;
 	t = thread->transaction_stack;
 	if (t && t->to_thread == thread)
 		send_reply = t;
 	while (t) {
 		active_transactions++;
+		spin_lock(&t->lock);
 		binder_debug(BINDER_DEBUG_DEAD_TRANSACTION,
 			     "binder: release %d:%d transaction %d "
 			     "%s, still active\n", proc->pid, thread->pid,
@@ -2628,18 +3589,21 @@ static int binder_free_thread(struct binder_proc *proc,
 				t->buffer->transaction = NULL;
 				t->buffer = NULL;
 			}
-			t = t->to_parent;
+			next = t->to_parent;
 		} else if (t->from == thread) {
 			t->from = NULL;
-			t = t->from_parent;
+			next = t->from_parent;
 		} else
 			BUG();
+		spin_unlock(&t->lock);
+		t = next;
 	}
+	spin_unlock(&proc->inner_lock);
+
 	if (send_reply)
 		binder_send_failed_reply(send_reply, BR_DEAD_REPLY);
-	binder_release_work(&thread->todo);
-	kfree(thread);
-	binder_stats_deleted(BINDER_STAT_THREAD);
+	binder_release_work(proc, &thread->todo);
+	binder_thread_dec_tmpref(thread);
 	return active_transactions;
 }
 
@@ -2650,19 +3614,18 @@ static unsigned int binder_poll(struct file *filp,
 	struct binder_thread *thread = NULL;
 	int wait_for_proc_work;
 
-	mutex_lock(&binder_lock);
 	thread = binder_get_thread(proc);
 #if defined(CONFIG_MACH_LGE_OMAP3) //LGE_CHANGE [sunggyun.yu@lge.com] 2011-03-19, WBT
 	if (thread == NULL) {
 		printk(KERN_ERR "binder_get_thread failed.\n");
-		mutex_unlock(&binder_lock);
 		return 0;
 	}
 #endif
 
+	spin_lock(&proc->inner_lock);
 	wait_for_proc_work = thread->transaction_stack == NULL &&
 		list_empty(&thread->todo) && thread->return_error == BR_OK;
-	mutex_unlock(&binder_lock);
+	spin_unlock(&proc->inner_lock);
 
 	if (wait_for_proc_work) {
 		if (binder_has_proc_work(proc, thread))
@@ -2680,6 +3643,46 @@ static unsigned int binder_poll(struct file *filp,
 	return 0;
 }
 
+static int binder_ioctl_set_ctx_mgr(struct binder_proc *proc)
+{
+	struct binder_node *node;
+	int ret = 0;
+
+	mutex_lock(&binder_context_mgr_node_lock);
+	if (binder_context_mgr_node != NULL) {
+		printk(KERN_ERR "binder: BINDER_SET_CONTEXT_MGR already set\n");
+		ret = -EBUSY;
+		goto out;
+	}
+	if (binder_context_mgr_uid != -1) {
+		if (binder_context_mgr_uid != current->cred->euid) {
+			printk(KERN_ERR "binder: BINDER_SET_"
+			       "CONTEXT_MGR bad uid %d != %d\n",
+			       current->cred->euid,
+			       binder_context_mgr_uid);
+			ret = -EPERM;
+			goto out;
+		}
+	} else
+		binder_context_mgr_uid = current->cred->euid;
+	node = binder_new_node(proc, NULL, NULL, 0);
+	if (node == NULL) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	spin_lock(&node->lock);
+	node->local_weak_refs++;
+	node->local_strong_refs++;
+	node->has_strong_ref = 1;
+	node->has_weak_ref = 1;
+	spin_unlock(&node->lock);
+	binder_context_mgr_node = node;
+	binder_put_node(node);
+out:
+	mutex_unlock(&binder_context_mgr_node_lock);
+	return ret;
+}
+
 static long binder_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 {
 	int ret;
@@ -2694,7 +3697,6 @@ static long binder_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 	if (ret)
 		return ret;
 
-	mutex_lock(&binder_lock);
 	thread = binder_get_thread(proc);
 	if (thread == NULL) {
 		ret = -ENOMEM;
@@ -2728,8 +3730,10 @@ static long binder_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 		}
 		if (bwr.read_size > 0) {
 			ret = binder_thread_read(proc, thread, (void __user *)bwr.read_buffer, bwr.read_size, &bwr.read_consumed, filp->f_flags & O_NONBLOCK);
+			spin_lock(&proc->inner_lock);
 			if (!list_empty(&proc->todo))
 				wake_up_interruptible(&proc->wait);
+			spin_unlock(&proc->inner_lock);
 			if (ret < 0) {
 				if (copy_to_user(ubuf, &bwr, sizeof(bwr)))
 					ret = -EFAULT;
@@ -2746,43 +3750,27 @@ static long binder_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 		}
 		break;
 	}
-	case BINDER_SET_MAX_THREADS:
-		if (copy_from_user(&proc->max_threads, ubuf, sizeof(proc->max_threads))) {
+	case BINDER_SET_MAX_THREADS: {
+		int max_threads;
+
+		if (copy_from_user(&max_threads, ubuf, sizeof(max_threads))) {
 			ret = -EINVAL;
 			goto err;
 		}
+		spin_lock(&proc->inner_lock);
+		proc->max_threads = max_threads;
+		spin_unlock(&proc->inner_lock);
 		break;
+	}
 	case BINDER_SET_CONTEXT_MGR:
-		if (binder_context_mgr_node != NULL) {
-			printk(KERN_ERR "binder: BINDER_SET_CONTEXT_MGR already set\n");
-			ret = -EBUSY;
-			goto err;
-		}
-		if (binder_context_mgr_uid != -1) {
-			if (binder_context_mgr_uid != current->cred->euid) {
-				printk(KERN_ERR "binder: BINDER_SET_"
-				       "CONTEXT_MGR bad uid %d != %d\n",
-				       current->cred->euid,
-				       binder_context_mgr_uid);
-				ret = -EPERM;
-				goto err;
-			}
-		} else
-			binder_context_mgr_uid = current->cred->euid;
-		binder_context_mgr_node = binder_new_node(proc, NULL, NULL);
-		if (binder_context_mgr_node == NULL) {
-			ret = -ENOMEM;
+		ret = binder_ioctl_set_ctx_mgr(proc);
+		if (ret)
 			goto err;
-		}
-		binder_context_mgr_node->local_weak_refs++;
-		binder_context_mgr_node->local_strong_refs++;
-		binder_context_mgr_node->has_strong_ref = 1;
-		binder_context_mgr_node->has_weak_ref = 1;
 		break;
 	case BINDER_THREAD_EXIT:
 		binder_debug(BINDER_DEBUG_THREADS, "binder: %d:%d exit\n",
 			     proc->pid, thread->pid);
-		binder_free_thread(proc, thread);
+		binder_thread_release(proc, thread);
 		thread = NULL;
 		break;
 	case BINDER_VERSION:
@@ -2801,9 +3789,11 @@ static long binder_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 	}
 	ret = 0;
 err:
-	if (thread)
+	if (thread) {
+		spin_lock(&proc->inner_lock);
 		thread->looper &= ~BINDER_LOOPER_STATE_NEED_RETURN;
-	mutex_unlock(&binder_lock);
+		spin_unlock(&proc->inner_lock);
+	}
 	wait_event_interruptible(binder_user_error_wait, binder_stop_on_user_error < 2);
 	if (ret && ret != -ERESTARTSYS)
 		printk(KERN_INFO "binder: %d:%d ioctl %x %lx returned %d\n", proc->pid, current->pid, cmd, arg, ret);
@@ -2830,7 +3820,6 @@ static void binder_vma_close(struct vm_area_struct *vma)
 		     (vma->vm_end - vma->vm_start) / SZ_1K, vma->vm_flags,
 		     (unsigned long)pgprot_val(vma->vm_page_prot));
 	proc->vma = NULL;
-	proc->vma_vm_mm = NULL;
 	binder_defer_work(proc, BINDER_DEFERRED_PUT_FILES);
 }
 
@@ -2846,6 +3835,7 @@ static int binder_mmap(struct file *filp, struct vm_area_struct *vma)
 	struct binder_proc *proc = filp->private_data;
 	const char *failure_string;
 	struct binder_buffer *buffer;
+	int i;
 
 	if ((vma->vm_end - vma->vm_start) > SZ_4M)
 		vma->vm_end = vma->vm_start + SZ_4M;
@@ -2895,10 +3885,16 @@ static int binder_mmap(struct file *filp, struct vm_area_struct *vma)
 		goto err_alloc_pages_failed;
 	}
 	proc->buffer_size = vma->vm_end - vma->vm_start;
+	for (i = 0; i < proc->buffer_size / PAGE_SIZE; i++)
+		INIT_LIST_HEAD(&proc->pages[i].lru);
 
 	vma->vm_ops = &binder_vm_ops;
 	vma->vm_private_data = proc;
 
+	/*
+	 * No buffer_lock here: binder_alloc_buf() fails until proc->vma is
+	 * set below, and taking it under mmap_sem would invert the order.
+	 */
 	if (binder_update_page_range(proc, 1, proc->buffer, proc->buffer + PAGE_SIZE, vma)) {
 		ret = -ENOMEM;
 		failure_string = "alloc small buf";
@@ -2906,13 +3902,19 @@ static int binder_mmap(struct file *filp, struct vm_area_struct *vma)
 	}
 	buffer = proc->buffer;
 	INIT_LIST_HEAD(&proc->buffers);
+	for (i = 0; i < BINDER_FREE_CLASSES; i++)
+		INIT_LIST_HEAD(&proc->free_classes[i]);
 	list_add(&buffer->entry, &proc->buffers);
 	buffer->free = 1;
 	binder_insert_free_buffer(proc, buffer);
 	proc->free_async_space = proc->buffer_size / 2;
 	barrier();
+	mutex_lock(&proc->files_lock);
 	proc->files = get_files_struct(proc->tsk);
+	mutex_unlock(&proc->files_lock);
 	proc->vma = vma;
+	/* kept until the proc is freed, for the page pool shrinker */
+	atomic_inc(&vma->vm_mm->mm_count);
 	proc->vma_vm_mm = vma->vm_mm;
 
 	/*printk(KERN_INFO "binder_mmap: %d %lx-%lx maps %p\n",
@@ -2949,14 +3951,18 @@ static int binder_open(struct inode *nodp, struct file *filp)
 	proc->tsk = current;
 	INIT_LIST_HEAD(&proc->todo);
 	init_waitqueue_head(&proc->wait);
+	mutex_init(&proc->buffer_lock);
+	mutex_init(&proc->outer_lock);
+	spin_lock_init(&proc->inner_lock);
+	mutex_init(&proc->files_lock);
 	proc->default_priority = task_nice(current);
-	mutex_lock(&binder_lock);
-	binder_stats_created(BINDER_STAT_PROC);
-	hlist_add_head(&proc->proc_node, &binder_procs);
 	proc->pid = current->group_leader->pid;
 	INIT_LIST_HEAD(&proc->delivered_death);
 	filp->private_data = proc;
-	mutex_unlock(&binder_lock);
+	binder_stats_created(BINDER_STAT_PROC);
+	mutex_lock(&binder_procs_lock);
+	hlist_add_head(&proc->proc_node, &binder_procs);
+	mutex_unlock(&binder_procs_lock);
 
 	if (binder_debugfs_dir_entry_proc) {
 		char strbuf[11];
@@ -2981,6 +3987,9 @@ static void binder_deferred_flush(struct binder_proc *proc)
 {
 	struct rb_node *n;
 	int wake_count = 0;
+
+	mutex_lock(&proc->outer_lock);
+	spin_lock(&proc->inner_lock);
 	for (n = rb_first(&proc->threads); n != NULL; n = rb_next(n)) {
 		struct binder_thread *thread = rb_entry(n, struct binder_thread, rb_node);
 		thread->looper |= BINDER_LOOPER_STATE_NEED_RETURN;
@@ -2989,6 +3998,8 @@ static void binder_deferred_flush(struct binder_proc *proc)
 			wake_count++;
 		}
 	}
+	spin_unlock(&proc->inner_lock);
+	mutex_unlock(&proc->outer_lock);
 	wake_up_interruptible_all(&proc->wait);
 
 	binder_debug(BINDER_DEBUG_OPEN_CLOSE,
@@ -3005,81 +4016,167 @@ static int binder_release(struct inode *nodp, struct file *filp)
 	return 0;
 }
 
-static void binder_deferred_release(struct binder_proc *proc)
+/*
+ * Called with a temporary reference on node, which it drops. Returns the
+ * number of refs the node still had, the node stays on binder_dead_nodes
+ * until they are gone.
+ */
+static int binder_node_release(struct binder_node *node, int refs)
 {
+	struct binder_proc *proc = node->proc;
+	struct binder_ref *ref;
 	struct hlist_node *pos;
-	struct binder_transaction *t;
+	LIST_HEAD(async_todo);
+	int death = 0;
+	int free_node = 0;
+
+	spin_lock(&node->lock);
+	spin_lock(&proc->inner_lock);
+	list_del_init(&node->work.entry);
+	list_splice_init(&node->async_todo, &async_todo);
+	node->tmp_refs--;
+	if (hlist_empty(&node->refs) && !node->tmp_refs) {
+		free_node = 1;
+		spin_unlock(&proc->inner_lock);
+	} else {
+		node->proc = NULL;
+		node->local_strong_refs = 0;
+		node->local_weak_refs = 0;
+		spin_unlock(&proc->inner_lock);
+
+		spin_lock(&binder_dead_nodes_lock);
+		hlist_add_head(&node->dead_node, &binder_dead_nodes);
+		spin_unlock(&binder_dead_nodes_lock);
+
+		hlist_for_each_entry(ref, pos, &node->refs, node_entry) {
+			refs++;
+			if (!ref->death)
+				continue;
+			death++;
+			spin_lock(&ref->proc->inner_lock);
+			if (list_empty(&ref->death->work.entry)) {
+				ref->death->work.type = BINDER_WORK_DEAD_BINDER;
+				list_add_tail(&ref->death->work.entry,
+					      &ref->proc->todo);
+				wake_up_interruptible(&ref->proc->wait);
+			} else
+				BUG();
+			spin_unlock(&ref->proc->inner_lock);
+		}
+		binder_debug(BINDER_DEBUG_DEAD_BINDER,
+			     "binder: node %d now dead, "
+			     "refs %d, death %d\n", node->debug_id,
+			     refs, death);
+	}
+	spin_unlock(&node->lock);
+
+	/* async transactions queued behind the node go with the proc */
+	spin_lock(&proc->inner_lock);
+	list_splice(&async_todo, &proc->todo);
+	spin_unlock(&proc->inner_lock);
+
+	if (free_node)
+		binder_free_node(node);
+	return refs;
+}
+
+static void binder_deferred_release(struct binder_proc *proc)
+{
 	struct rb_node *n;
-	int threads, nodes, incoming_refs, outgoing_refs, buffers, active_transactions, page_count;
+	int threads, nodes, incoming_refs, outgoing_refs, active_transactions;
 
 	BUG_ON(proc->vma);
 	BUG_ON(proc->files);
 
+	mutex_lock(&binder_procs_lock);
 	hlist_del(&proc->proc_node);
+	mutex_unlock(&binder_procs_lock);
+
+	mutex_lock(&binder_context_mgr_node_lock);
 	if (binder_context_mgr_node && binder_context_mgr_node->proc == proc) {
 		binder_debug(BINDER_DEBUG_DEAD_BINDER,
 			     "binder_release: %d context_mgr_node gone\n",
 			     proc->pid);
 		binder_context_mgr_node = NULL;
 	}
+	mutex_unlock(&binder_context_mgr_node_lock);
+
+	/*
+	 * From here on no new refs, nodes or work reach the proc, senders
+	 * that already pinned it see is_dead before they queue anything.
+	 */
+	spin_lock(&proc->inner_lock);
+	proc->is_dead = 1;
+	proc->tmp_ref++;
+	spin_unlock(&proc->inner_lock);
 
 	threads = 0;
 	active_transactions = 0;
-	while ((n = rb_first(&proc->threads))) {
-		struct binder_thread *thread = rb_entry(n, struct binder_thread, rb_node);
+	while (1) {
+		struct binder_thread *thread;
+
+		mutex_lock(&proc->outer_lock);
+		n = rb_first(&proc->threads);
+		mutex_unlock(&proc->outer_lock);
+		if (n == NULL)
+			break;
+		thread = rb_entry(n, struct binder_thread, rb_node);
 		threads++;
-		active_transactions += binder_free_thread(proc, thread);
+		active_transactions += binder_thread_release(proc, thread);
 	}
+
 	nodes = 0;
 	incoming_refs = 0;
-	while ((n = rb_first(&proc->nodes))) {
-		struct binder_node *node = rb_entry(n, struct binder_node, rb_node);
+	while (1) {
+		struct binder_node *node;
 
+		spin_lock(&proc->inner_lock);
+		n = rb_first(&proc->nodes);
+		if (n == NULL) {
+			spin_unlock(&proc->inner_lock);
+			break;
+		}
+		node = rb_entry(n, struct binder_node, rb_node);
 		nodes++;
+		node->tmp_refs++;
 		rb_erase(&node->rb_node, &proc->nodes);
-		list_del_init(&node->work.entry);
-		binder_release_work(&node->async_todo);
-		if (hlist_empty(&node->refs)) {
-			kfree(node);
-			binder_stats_deleted(BINDER_STAT_NODE);
-		} else {
-			struct binder_ref *ref;
-			int death = 0;
-
-			node->proc = NULL;
-			node->local_strong_refs = 0;
-			node->local_weak_refs = 0;
-			hlist_add_head(&node->dead_node, &binder_dead_nodes);
-
-			hlist_for_each_entry(ref, pos, &node->refs, node_entry) {
-				incoming_refs++;
-				if (ref->death) {
-					death++;
-					if (list_empty(&ref->death->work.entry)) {
-						ref->death->work.type = BINDER_WORK_DEAD_BINDER;
-						list_add_tail(&ref->death->work.entry, &ref->proc->todo);
-						wake_up_interruptible(&ref->proc->wait);
-					} else
-						BUG();
-				}
-			}
-			binder_debug(BINDER_DEBUG_DEAD_BINDER,
-				     "binder: node %d now dead, "
-				     "refs %d, death %d\n", node->debug_id,
-				     incoming_refs, death);
-		}
+		spin_unlock(&proc->inner_lock);
+		incoming_refs = binder_node_release(node, incoming_refs);
 	}
+
 	outgoing_refs = 0;
+	mutex_lock(&proc->outer_lock);
 	while ((n = rb_first(&proc->refs_by_desc))) {
 		struct binder_ref *ref = rb_entry(n, struct binder_ref,
 						  rb_node_desc);
 		outgoing_refs++;
 		binder_delete_ref(ref);
 	}
-	binder_release_work(&proc->todo);
-	binder_release_work(&proc->delivered_death);
-	buffers = 0;
+	mutex_unlock(&proc->outer_lock);
+
+	binder_release_work(proc, &proc->todo);
+	binder_release_work(proc, &proc->delivered_death);
+
+	binder_debug(BINDER_DEBUG_OPEN_CLOSE,
+		     "binder_release: %d threads %d, nodes %d (ref %d), "
+		     "refs %d, active transactions %d\n",
+		     proc->pid, threads, nodes, incoming_refs, outgoing_refs,
+		     active_transactions);
 
+	/* senders still copying into our buffers hold a tmp_ref */
+	binder_proc_dec_tmpref(proc);
+}
+
+static void binder_free_proc(struct binder_proc *proc)
+{
+	struct binder_transaction *t;
+	struct rb_node *n;
+	int buffers, page_count;
+
+	BUG_ON(!proc->is_dead || proc->tmp_ref);
+
+	buffers = 0;
+	mutex_lock(&proc->buffer_lock);
 	while ((n = rb_first(&proc->allocated_buffers))) {
 		struct binder_buffer *buffer = rb_entry(n, struct binder_buffer,
 							rb_node);
@@ -3092,41 +4189,52 @@ static void binder_deferred_release(struct binder_proc *proc)
 			       proc->pid, t->debug_id);
 			/*BUG();*/
 		}
-		binder_free_buf(proc, buffer);
+		binder_free_buf_locked(proc, buffer);
 		buffers++;
 	}
 
 	binder_stats_deleted(BINDER_STAT_PROC);
 
+	/* buffer_lock also keeps the shrinker off the pages freed here */
 	page_count = 0;
 	if (proc->pages) {
 		int i;
 		for (i = 0; i < proc->buffer_size / PAGE_SIZE; i++) {
-			if (proc->pages[i]) {
-				void *page_addr = proc->buffer + i * PAGE_SIZE;
+			struct binder_lru_page *page = &proc->pages[i];
+			void *page_addr = proc->buffer + i * PAGE_SIZE;
+
+			if (!page->page_ptr)
+				continue;
+			spin_lock(&binder_lru_lock);
+			if (list_empty(&page->lru)) {
 				binder_debug(BINDER_DEBUG_BUFFER_ALLOC,
 					     "binder_release: %d: "
 					     "page %d at %p not freed\n",
 					     proc->pid, i,
 					     page_addr);
-				unmap_kernel_range((unsigned long)page_addr,
-					PAGE_SIZE);
-				__free_page(proc->pages[i]);
-				page_count++;
+			} else {
+				list_del_init(&page->lru);
+				binder_lru_count--;
 			}
+			spin_unlock(&binder_lru_lock);
+			unmap_kernel_range((unsigned long)page_addr,
+				PAGE_SIZE);
+			__free_page(page->page_ptr);
+			page->page_ptr = NULL;
+			page_count++;
 		}
 		kfree(proc->pages);
 		vfree(proc->buffer);
 	}
+	mutex_unlock(&proc->buffer_lock);
+	if (proc->vma_vm_mm)
+		mmdrop(proc->vma_vm_mm);
 
 	put_task_struct(proc->tsk);
 
 	binder_debug(BINDER_DEBUG_OPEN_CLOSE,
-		     "binder_release: %d threads %d, nodes %d (ref %d), "
-		     "refs %d, active transactions %d, buffers %d, "
-		     "pages %d\n",
-		     proc->pid, threads, nodes, incoming_refs, outgoing_refs,
-		     active_transactions, buffers, page_count);
+		     "binder_release: %d buffers %d, pages %d\n",
+		     proc->pid, buffers, page_count);
 
 	kfree(proc);
 }
@@ -3138,7 +4246,6 @@ static void binder_deferred_func(struct work_struct *work)
 
 	int defer;
 	do {
-		mutex_lock(&binder_lock);
 		mutex_lock(&binder_deferred_lock);
 		if (!hlist_empty(&binder_deferred_list)) {
 			proc = hlist_entry(binder_deferred_list.first,
@@ -3154,9 +4261,11 @@ static void binder_deferred_func(struct work_struct *work)
 
 		files = NULL;
 		if (defer & BINDER_DEFERRED_PUT_FILES) {
+			mutex_lock(&proc->files_lock);
 			files = proc->files;
 			if (files)
 				proc->files = NULL;
+			mutex_unlock(&proc->files_lock);
 		}
 
 		if (defer & BINDER_DEFERRED_FLUSH)
@@ -3165,7 +4274,6 @@ static void binder_deferred_func(struct work_struct *work)
 		if (defer & BINDER_DEFERRED_RELEASE)
 			binder_deferred_release(proc); /* frees proc */
 
-		mutex_unlock(&binder_lock);
 		if (files)
 			put_files_struct(files);
 	} while (proc);
@@ -3185,9 +4293,11 @@ binder_defer_work(struct binder_proc *proc, enum binder_deferred_state defer)
 	mutex_unlock(&binder_deferred_lock);
 }
 
+/* Called with the inner lock of t->to_proc held, if it has one */
 static void print_binder_transaction(struct seq_file *m, const char *prefix,
 				     struct binder_transaction *t)
 {
+	spin_lock(&t->lock);
 	seq_printf(m,
 		   "%s %d: %p from %d:%d to %d:%d code %x flags %x pri %ld r%d",
 		   prefix, t->debug_id, t,
@@ -3196,6 +4306,7 @@ static void print_binder_transaction(struct seq_file *m, const char *prefix,
 		   t->to_proc ? t->to_proc->pid : 0,
 		   t->to_thread ? t->to_thread->pid : 0,
 		   t->code, t->flags, t->priority, t->need_reply);
+	spin_unlock(&t->lock);
 	if (t->buffer == NULL) {
 		seq_puts(m, " buffer free\n");
 		return;
@@ -3252,6 +4363,7 @@ static void print_binder_work(struct seq_file *m, const char *prefix,
 	}
 }
 
+/* thread->proc->inner_lock held */
 static void print_binder_thread(struct seq_file *m,
 				struct binder_thread *thread,
 				int print_always)
@@ -3285,6 +4397,7 @@ static void print_binder_thread(struct seq_file *m,
 		m->count = start_pos;
 }
 
+/* node->lock held */
 static void print_binder_node(struct seq_file *m, struct binder_node *node)
 {
 	struct binder_ref *ref;
@@ -3312,11 +4425,14 @@ static void print_binder_node(struct seq_file *m, struct binder_node *node)
 				  "    pending async transaction", w);
 }
 
+/* ref->proc->outer_lock held */
 static void print_binder_ref(struct seq_file *m, struct binder_ref *ref)
 {
+	spin_lock(&ref->node->lock);
 	seq_printf(m, "  ref %d: desc %d %snode %d s %d w %d d %p\n",
 		   ref->debug_id, ref->desc, ref->node->proc ? "" : "dead ",
 		   ref->node->debug_id, ref->strong, ref->weak, ref->death);
+	spin_unlock(&ref->node->lock);
 }
 
 static void print_binder_proc(struct seq_file *m,
@@ -3324,21 +4440,39 @@ static void print_binder_proc(struct seq_file *m,
 {
 	struct binder_work *w;
 	struct rb_node *n;
+	struct binder_node *last_node = NULL;
 	size_t start_pos = m->count;
 	size_t header_pos;
 
 	seq_printf(m, "proc %d\n", proc->pid);
 	header_pos = m->count;
 
+	mutex_lock(&proc->outer_lock);
+	spin_lock(&proc->inner_lock);
 	for (n = rb_first(&proc->threads); n != NULL; n = rb_next(n))
 		print_binder_thread(m, rb_entry(n, struct binder_thread,
 						rb_node), print_all);
+	/*
+	 * node->lock nests outside the inner lock, so pin each node and drop
+	 * the inner lock to print it. A pinned node stays in the tree.
+	 */
 	for (n = rb_first(&proc->nodes); n != NULL; n = rb_next(n)) {
 		struct binder_node *node = rb_entry(n, struct binder_node,
 						    rb_node);
+		node->tmp_refs++;
+		spin_unlock(&proc->inner_lock);
+		if (last_node)
+			binder_put_node(last_node);
+		spin_lock(&node->lock);
 		if (print_all || node->has_async_transaction)
 			print_binder_node(m, node);
+		spin_unlock(&node->lock);
+		last_node = node;
+		spin_lock(&proc->inner_lock);
 	}
+	spin_unlock(&proc->inner_lock);
+	if (last_node)
+		binder_put_node(last_node);
 	if (print_all) {
 		for (n = rb_first(&proc->refs_by_desc);
 		     n != NULL;
@@ -3346,15 +4480,20 @@ static void print_binder_proc(struct seq_file *m,
 			print_binder_ref(m, rb_entry(n, struct binder_ref,
 						     rb_node_desc));
 	}
+	mutex_unlock(&proc->outer_lock);
+	mutex_lock(&proc->buffer_lock);
 	for (n = rb_first(&proc->allocated_buffers); n != NULL; n = rb_next(n))
 		print_binder_buffer(m, "  buffer",
 				    rb_entry(n, struct binder_buffer, rb_node));
+	mutex_unlock(&proc->buffer_lock);
+	spin_lock(&proc->inner_lock);
 	list_for_each_entry(w, &proc->todo, entry)
 		print_binder_work(m, "  ", "  pending transaction", w);
 	list_for_each_entry(w, &proc->delivered_death, entry) {
 		seq_puts(m, "  has delivered dead binder\n");
 		break;
 	}
+	spin_unlock(&proc->inner_lock);
 	if (!print_all && m->count == header_pos)
 		m->count = start_pos;
 }
@@ -3418,17 +4557,21 @@ static void print_binder_stats(struct seq_file *m, const char *prefix,
 	BUILD_BUG_ON(ARRAY_SIZE(stats->bc) !=
 		     ARRAY_SIZE(binder_command_strings));
 	for (i = 0; i < ARRAY_SIZE(stats->bc); i++) {
-		if (stats->bc[i])
+		int count = atomic_read(&stats->bc[i]);
+
+		if (count)
 			seq_printf(m, "%s%s: %d\n", prefix,
-				   binder_command_strings[i], stats->bc[i]);
+				   binder_command_strings[i], count);
 	}
 
 	BUILD_BUG_ON(ARRAY_SIZE(stats->br) !=
 		     ARRAY_SIZE(binder_return_strings));
 	for (i = 0; i < ARRAY_SIZE(stats->br); i++) {
-		if (stats->br[i])
+		int count = atomic_read(&stats->br[i]);
+
+		if (count)
 			seq_printf(m, "%s%s: %d\n", prefix,
-				   binder_return_strings[i], stats->br[i]);
+				   binder_return_strings[i], count);
 	}
 
 	BUILD_BUG_ON(ARRAY_SIZE(stats->obj_created) !=
@@ -3436,11 +4579,13 @@ static void print_binder_stats(struct seq_file *m, const char *prefix,
 	BUILD_BUG_ON(ARRAY_SIZE(stats->obj_created) !=
 		     ARRAY_SIZE(stats->obj_deleted));
 	for (i = 0; i < ARRAY_SIZE(stats->obj_created); i++) {
-		if (stats->obj_created[i] || stats->obj_deleted[i])
+		int created = atomic_read(&stats->obj_created[i]);
+		int deleted = atomic_read(&stats->obj_deleted[i]);
+
+		if (created || deleted)
 			seq_printf(m, "%s%s: active %d total %d\n", prefix,
 				binder_objstat_strings[i],
-				stats->obj_created[i] - stats->obj_deleted[i],
-				stats->obj_created[i]);
+				created - deleted, created);
 	}
 }
 
@@ -3450,24 +4595,33 @@ static void print_binder_proc_stats(struct seq_file *m,
 	struct binder_work *w;
 	struct rb_node *n;
 	int count, strong, weak;
+	size_t free_async_space;
 
 	seq_printf(m, "proc %d\n", proc->pid);
 	count = 0;
+	mutex_lock(&proc->outer_lock);
 	for (n = rb_first(&proc->threads); n != NULL; n = rb_next(n))
 		count++;
+	mutex_unlock(&proc->outer_lock);
 	seq_printf(m, "  threads: %d\n", count);
+	mutex_lock(&proc->buffer_lock);
+	free_async_space = proc->free_async_space;
+	mutex_unlock(&proc->buffer_lock);
+	spin_lock(&proc->inner_lock);
 	seq_printf(m, "  requested threads: %d+%d/%d\n"
 			"  ready threads %d\n"
 			"  free async space %zd\n", proc->requested_threads,
 			proc->requested_threads_started, proc->max_threads,
-			proc->ready_threads, proc->free_async_space);
+			proc->ready_threads, free_async_space);
 	count = 0;
 	for (n = rb_first(&proc->nodes); n != NULL; n = rb_next(n))
 		count++;
+	spin_unlock(&proc->inner_lock);
 	seq_printf(m, "  nodes: %d\n", count);
 	count = 0;
 	strong = 0;
 	weak = 0;
+	mutex_lock(&proc->outer_lock);
 	for (n = rb_first(&proc->refs_by_desc); n != NULL; n = rb_next(n)) {
 		struct binder_ref *ref = rb_entry(n, struct binder_ref,
 						  rb_node_desc);
@@ -3475,14 +4629,18 @@ static void print_binder_proc_stats(struct seq_file *m,
 		strong += ref->strong;
 		weak += ref->weak;
 	}
+	mutex_unlock(&proc->outer_lock);
 	seq_printf(m, "  refs: %d s %d w %d\n", count, strong, weak);
 
 	count = 0;
+	mutex_lock(&proc->buffer_lock);
 	for (n = rb_first(&proc->allocated_buffers); n != NULL; n = rb_next(n))
 		count++;
+	mutex_unlock(&proc->buffer_lock);
 	seq_printf(m, "  buffers: %d\n", count);
 
 	count = 0;
+	spin_lock(&proc->inner_lock);
 	list_for_each_entry(w, &proc->todo, entry) {
 		switch (w->type) {
 		case BINDER_WORK_TRANSACTION:
@@ -3492,6 +4650,7 @@ static void print_binder_proc_stats(struct seq_file *m,
 			break;
 		}
 	}
+	spin_unlock(&proc->inner_lock);
 	seq_printf(m, "  pending transactions: %d\n", count);
 
 	print_binder_stats(m, "  ", &proc->stats);
@@ -3503,22 +4662,33 @@ static int binder_state_show(struct seq_file *m, void *unused)
 	struct binder_proc *proc;
 	struct hlist_node *pos;
 	struct binder_node *node;
-	int do_lock = !binder_debug_no_lock;
-
-	if (do_lock)
-		mutex_lock(&binder_lock);
+	struct binder_node *last_node = NULL;
 
 	seq_puts(m, "binder state:\n");
 
+	spin_lock(&binder_dead_nodes_lock);
 	if (!hlist_empty(&binder_dead_nodes))
 		seq_puts(m, "dead nodes:\n");
-	hlist_for_each_entry(node, pos, &binder_dead_nodes, dead_node)
+	hlist_for_each_entry(node, pos, &binder_dead_nodes, dead_node) {
+		/* pinned like the nodes in print_binder_proc() */
+		node->tmp_refs++;
+		spin_unlock(&binder_dead_nodes_lock);
+		if (last_node)
+			binder_put_node(last_node);
+		spin_lock(&node->lock);
 		print_binder_node(m, node);
+		spin_unlock(&node->lock);
+		last_node = node;
+		spin_lock(&binder_dead_nodes_lock);
+	}
+	spin_unlock(&binder_dead_nodes_lock);
+	if (last_node)
+		binder_put_node(last_node);
 
+	mutex_lock(&binder_procs_lock);
 	hlist_for_each_entry(proc, pos, &binder_procs, proc_node)
 		print_binder_proc(m, proc, 1);
-	if (do_lock)
-		mutex_unlock(&binder_lock);
+	mutex_unlock(&binder_procs_lock);
 	return 0;
 }
 
@@ -3526,19 +4696,15 @@ static int binder_stats_show(struct seq_file *m, void *unused)
 {
 	struct binder_proc *proc;
 	struct hlist_node *pos;
-	int do_lock = !binder_debug_no_lock;
-
-	if (do_lock)
-		mutex_lock(&binder_lock);
 
 	seq_puts(m, "binder stats:\n");
 
 	print_binder_stats(m, "", &binder_stats);
 
+	mutex_lock(&binder_procs_lock);
 	hlist_for_each_entry(proc, pos, &binder_procs, proc_node)
 		print_binder_proc_stats(m, proc);
-	if (do_lock)
-		mutex_unlock(&binder_lock);
+	mutex_unlock(&binder_procs_lock);
 	return 0;
 }
 
@@ -3546,30 +4712,97 @@ static int binder_transactions_show(struct seq_file *m, void *unused)
 {
 	struct binder_proc *proc;
 	struct hlist_node *pos;
-	int do_lock = !binder_debug_no_lock;
-
-	if (do_lock)
-		mutex_lock(&binder_lock);
 
 	seq_puts(m, "binder transactions:\n");
+	mutex_lock(&binder_procs_lock);
 	hlist_for_each_entry(proc, pos, &binder_procs, proc_node)
 		print_binder_proc(m, proc, 0);
-	if (do_lock)
-		mutex_unlock(&binder_lock);
+	mutex_unlock(&binder_procs_lock);
+	return 0;
+}
+
+static void print_binder_lat_stats(struct seq_file *m, const char *prefix,
+				   struct binder_lat_stats *lat)
+{
+	int i, j;
+
+	for (i = 0; i < BINDER_LAT_STAGES; i++) {
+		struct binder_lat_hist *h = &lat->stage[i];
+		unsigned int count = 0;
+
+		for (j = 0; j < BINDER_LAT_BUCKETS; j++)
+			count += h->count[j];
+		if (!count)
+			continue;
+		seq_printf(m, "%s%s: count %u avg %llu max %u\n%s ", prefix,
+			   binder_lat_stage_strings[i], count,
+			   div_u64(h->total_us, count), h->max_us, prefix);
+		for (j = 0; j < BINDER_LAT_BUCKETS - 1; j++)
+			seq_printf(m, " <%u: %u",
+				   (1U << BINDER_LAT_BUCKET_SHIFT) << j,
+				   h->count[j]);
+		seq_printf(m, " >=%u: %u\n",
+			   (1U << BINDER_LAT_BUCKET_SHIFT) << j, h->count[j]);
+	}
+}
+
+static int binder_latency_show(struct seq_file *m, void *unused)
+{
+	struct binder_proc *proc;
+	struct hlist_node *pos;
+	struct rb_node *n;
+
+	seq_puts(m, "binder latency (us):\n");
+	mutex_lock(&binder_procs_lock);
+	hlist_for_each_entry(proc, pos, &binder_procs, proc_node) {
+		struct binder_node *last_node = NULL;
+
+		seq_printf(m, "proc %d\n", proc->pid);
+		spin_lock(&proc->inner_lock);
+		print_binder_lat_stats(m, "  ", &proc->lat);
+		for (n = rb_first(&proc->nodes); n != NULL; n = rb_next(n)) {
+			struct binder_node *node = rb_entry(n,
+						struct binder_node, rb_node);
+
+			node->tmp_refs++;
+			spin_unlock(&proc->inner_lock);
+			if (last_node)
+				binder_put_node(last_node);
+			spin_lock(&node->lock);
+			if (node->lat) {
+				seq_printf(m, "  node %d: u%p c%p\n",
+					   node->debug_id, node->ptr,
+					   node->cookie);
+				print_binder_lat_stats(m, "    ", node->lat);
+			}
+			spin_unlock(&node->lock);
+			last_node = node;
+			spin_lock(&proc->inner_lock);
+		}
+		spin_unlock(&proc->inner_lock);
+		if (last_node)
+			binder_put_node(last_node);
+	}
+	mutex_unlock(&binder_procs_lock);
 	return 0;
 }
 
 static int binder_proc_show(struct seq_file *m, void *unused)
 {
+	struct binder_proc *itr;
 	struct binder_proc *proc = m->private;
-	int do_lock = !binder_debug_no_lock;
+	struct hlist_node *pos;
 
-	if (do_lock)
-		mutex_lock(&binder_lock);
 	seq_puts(m, "binder proc state:\n");
-	print_binder_proc(m, proc, 1);
-	if (do_lock)
-		mutex_unlock(&binder_lock);
+	/* the file can outlive the proc, only print it while it is listed */
+	mutex_lock(&binder_procs_lock);
+	hlist_for_each_entry(itr, pos, &binder_procs, proc_node) {
+		if (itr == proc) {
+			print_binder_proc(m, proc, 1);
+			break;
+		}
+	}
+	mutex_unlock(&binder_procs_lock);
 	return 0;
 }
 
@@ -3618,6 +4851,7 @@ BINDER_DEBUG_ENTRY(state);
 BINDER_DEBUG_ENTRY(stats);
 BINDER_DEBUG_ENTRY(transactions);
 BINDER_DEBUG_ENTRY(transaction_log);
+BINDER_DEBUG_ENTRY(latency);
 
 static int __init binder_init(void)
 {
@@ -3627,6 +4861,8 @@ static int __init binder_init(void)
 	if (!binder_deferred_workqueue)
 		return -ENOMEM;
 
+	register_shrinker(&binder_shrinker);
+
 	binder_debugfs_dir_entry_root = debugfs_create_dir("binder", NULL);
 	if (binder_debugfs_dir_entry_root)
 		binder_debugfs_dir_entry_proc = debugfs_create_dir("proc",
@@ -3658,6 +4894,11 @@ static int __init binder_init(void)
 				    binder_debugfs_dir_entry_root,
 				    &binder_transaction_log_failed,
 				    &binder_transaction_log_fops);
+		debugfs_create_file("latency",
+				    S_IRUGO,
+				    binder_debugfs_dir_entry_root,
+				    NULL,
+				    &binder_latency_fops);
 	}
 	return ret;
 }
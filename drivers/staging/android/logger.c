@@ -21,30 +21,103 @@
 #include <linux/module.h>
 #include <linux/fs.h>
 #include <linux/miscdevice.h>
+#include <linux/mm.h>
+#include <linux/pagemap.h>
 #include <linux/uaccess.h>
 #include <linux/poll.h>
 #include <linux/slab.h>
+#include <linux/spinlock.h>
 #include <linux/time.h>
+#include <linux/vmalloc.h>
+#include <linux/workqueue.h>
+#include <linux/lzo.h>
 #include "logger.h"
 
 #include <asm/ioctls.h>
 
+#ifdef CONFIG_ANDROID_LOGGER_ARCHIVE
+/*
+ * struct logger_archive - compressed history of a log
+ *
+ * Once LOGGER_SEGMENT_SIZE bytes of committed entries have gathered after
+ * 'next', a worker copies them out of the ring, compresses them into a
+ * logger_segment and appends it here, before the writers get to overwrite
+ * them. Readers lapped by the writers continue in the archive instead of
+ * jumping to log->head, and the oldest segments are dropped once the
+ * archive holds more than CONFIG_ANDROID_LOGGER_ARCHIVE_SIZE kilobytes.
+ *
+ * 'start', 'end', 'next' and 'flushes' are protected by log->lock, the
+ * segment list by 'mutex'. The archive is empty when 'start' equals 'end'.
+ */
+struct logger_archive {
+	struct mutex		mutex;	/* protects the segment list */
+	struct list_head	segments; /* oldest first */
+	size_t			bytes;	/* compressed bytes held */
+	size_t			start;	/* first archived entry */
+	size_t			end;	/* past the last archived entry */
+	size_t			next;	/* first entry not archived yet */
+	unsigned int		flushes; /* LOGGER_FLUSH_LOG count */
+	struct work_struct	work;	/* runs logger_archive_work() */
+};
+
+/*
+ * struct logger_segment - LOGGER_SEGMENT_SIZE bytes or less of entries,
+ * [start, end) in the free running offsets of the log, compressed with LZO
+ */
+struct logger_segment {
+	struct list_head	list;
+	size_t			start;
+	size_t			end;
+	size_t			clen;	/* compressed length of 'data' */
+	unsigned char		data[0];
+};
+
+#define LOGGER_SEGMENT_SIZE	(16*1024)
+
+static void logger_archive_work(struct work_struct *work);
+
+#define LOGGER_ARCHIVE_INIT(VAR) \
+	.archive = { \
+		.mutex = __MUTEX_INITIALIZER(VAR .archive.mutex), \
+		.segments = LIST_HEAD_INIT(VAR .archive.segments), \
+		.work = __WORK_INITIALIZER(VAR .archive.work, \
+					   logger_archive_work), \
+	},
+#else
+#define LOGGER_ARCHIVE_INIT(VAR)
+#endif
+
 /*
  * struct logger_log - represents a specific log, such as 'main' or 'radio'
  *
  * This structure lives from module insertion until module removal, so it does
- * not need additional reference counting. The structure is protected by the
- * mutex 'mutex'.
+ * not need additional reference counting.
+ *
+ * Writers do not serialize on each other. A writer takes 'lock' only to
+ * reserve room for its entry and to write the entry header, then copies the
+ * payload from user space without any lock held and finally commits the
+ * entry. Readers only see entries below 'committed', which advances in
+ * order once every earlier entry is committed too.
+ *
+ * The offsets are free running byte counts, logger_offset() maps them into
+ * the buffer. An entry at offset 'off' is overwritten once 'head' moves
+ * past 'off', so a reader validates what it copied against 'head' instead
+ * of being pulled forward by every writer.
  */
 struct logger_log {
 	unsigned char 		*buffer;/* the ring buffer itself */
 	struct miscdevice	misc;	/* misc device representing the log */
-	wait_queue_head_t	wq;	/* wait queue for readers */
-	struct list_head	readers; /* this log's readers */
-	struct mutex		mutex;	/* mutex protecting buffer */
-	size_t			w_off;	/* current write head offset */
+	wait_queue_head_t	wq;	/* wait queue for readers and writers */
+	struct mutex		mutex;	/* serializes readers */
+	spinlock_t		lock;	/* protects the offsets below */
+	size_t			w_off;	/* reserved up to here */
+	size_t			committed; /* readable up to here */
 	size_t			head;	/* new readers start here */
 	size_t			size;	/* size of the log */
+	struct logger_mmap_header *mmap_hdr; /* offsets shown to mmap */
+#ifdef CONFIG_ANDROID_LOGGER_ARCHIVE
+	struct logger_archive	archive; /* compressed older entries */
+#endif
 };
 
 /*
@@ -55,13 +128,24 @@ struct logger_log {
  */
 struct logger_reader {
 	struct logger_log	*log;	/* associated log */
-	struct list_head	list;	/* entry in logger_log's list */
 	size_t			r_off;	/* current read head offset */
+	int			ring_only; /* uses LOGGER_SET_READ_POS */
+#ifdef CONFIG_ANDROID_LOGGER_ARCHIVE
+	unsigned char		*cache;	/* last segment decompressed */
+	size_t			cache_start; /* its offset, if cache_len */
+	size_t			cache_len;
+#endif
 };
 
 /* logger_offset - returns index 'n' into the log via (optimized) modulus */
 #define logger_offset(n)	((n) & (log->size - 1))
 
+/* logger_before - is free running offset 'a' before 'b'? */
+#define logger_before(a, b)	((long)((a) - (b)) < 0)
+
+/* entry was committed out of order, 'committed' has not passed it yet */
+#define LOGGER_ENTRY_DONE	1
+
 /*
  * file_get_log - Given a file structure, return the associated log
  *
@@ -85,39 +169,429 @@ static inline struct logger_log *file_get_log(struct file *file)
 		return file->private_data;
 }
 
+/*
+ * do_read_log - reads 'count' bytes at offset 'off' of 'log' into 'buf'
+ */
+static void do_read_log(struct logger_log *log, size_t off, void *buf,
+			size_t count)
+{
+	size_t len;
+
+	off = logger_offset(off);
+	len = min(count, log->size - off);
+	memcpy(buf, log->buffer + off, len);
+
+	if (count != len)
+		memcpy(buf + len, log->buffer, count - len);
+}
+
+/*
+ * do_write_log - writes 'count' bytes from 'buf' at offset 'off' of 'log'
+ */
+static void do_write_log(struct logger_log *log, size_t off, const void *buf,
+			 size_t count)
+{
+	size_t len;
+
+	off = logger_offset(off);
+	len = min(count, log->size - off);
+	memcpy(log->buffer + off, buf, len);
+
+	if (count != len)
+		memcpy(log->buffer, buf + len, count - len);
+}
+
 /*
  * get_entry_len - Grabs the length of the payload of the next entry starting
  * from 'off'.
  *
- * Caller needs to hold log->mutex.
+ * Caller needs to hold log->lock, or to validate 'off' against log->head
+ * afterwards.
  */
 static __u32 get_entry_len(struct logger_log *log, size_t off)
 {
 	__u16 val;
 
-	switch (log->size - off) {
-	case 1:
-		memcpy(&val, log->buffer + off, 1);
-		memcpy(((char *) &val) + 1, log->buffer, 1);
-		break;
-	default:
-		memcpy(&val, log->buffer + off, 2);
+	do_read_log(log, off, &val, sizeof(val));
+
+	return sizeof(struct logger_entry) + val;
+}
+
+static __u16 get_entry_pad(struct logger_log *log, size_t off)
+{
+	__u16 val;
+
+	do_read_log(log, off + offsetof(struct logger_entry, __pad), &val,
+		    sizeof(val));
+	return val;
+}
+
+static void set_entry_pad(struct logger_log *log, size_t off, __u16 val)
+{
+	do_write_log(log, off + offsetof(struct logger_entry, __pad), &val,
+		     sizeof(val));
+}
+
+#ifdef CONFIG_ANDROID_LOGGER_ARCHIVE
+/* scratch space of logger_archive_work(), shared by all logs */
+static DEFINE_MUTEX(logger_archive_mutex);
+static void *logger_archive_wrkmem;
+static unsigned char *logger_archive_src;
+static unsigned char *logger_archive_dst;
+
+/*
+ * logger_archive_oldest - the oldest archived entry that is no longer in
+ * the ring, or log->head if there is none
+ *
+ * Caller needs to hold log->lock, otherwise the result is only a hint.
+ */
+static size_t logger_archive_oldest(struct logger_log *log, size_t off)
+{
+	struct logger_archive *a = &log->archive;
+	size_t start = ACCESS_ONCE(a->start);
+	size_t end = ACCESS_ONCE(a->end);
+	size_t head = ACCESS_ONCE(log->head);
+
+	if (start == end || !logger_before(off, end))
+		return head;
+	if (logger_before(off, start))
+		off = start;
+	return logger_before(off, head) ? off : head;
+}
+
+/*
+ * logger_first_off - where a new reader starts: at the oldest archived
+ * entry, or at log->head. Caller needs to hold log->lock.
+ */
+static size_t logger_first_off(struct logger_log *log)
+{
+	return logger_archive_oldest(log, log->archive.start);
+}
+
+/*
+ * logger_archive_work - compresses every full segment of committed entries
+ * after archive->next into the archive
+ */
+static void logger_archive_work(struct work_struct *work)
+{
+	struct logger_archive *a = container_of(work, struct logger_archive,
+						work);
+	struct logger_log *log = container_of(a, struct logger_log, archive);
+	struct logger_segment *seg, *old;
+	size_t start, end, clen;
+	unsigned int flushes;
+	int full;
+
+	mutex_lock(&logger_archive_mutex);
+	while (1) {
+		cond_resched();
+
+		spin_lock(&log->lock);
+		start = a->next;
+		if (logger_before(start, log->head))
+			start = log->head;
+		full = 0;
+		for (end = start; logger_before(end, log->committed); ) {
+			size_t len = get_entry_len(log, end);
+
+			if (end - start + len > LOGGER_SEGMENT_SIZE) {
+				full = 1;
+				break;
+			}
+			end += len;
+		}
+		flushes = a->flushes;
+		spin_unlock(&log->lock);
+		/* no entry is larger than a segment, so empty means garbage */
+		if (!full || end == start)
+			break;
+
+		do_read_log(log, start, logger_archive_src, end - start);
+
+		/* pairs with the smp_wmb() in logger_reserve() */
+		smp_rmb();
+
+		/* lapped while copying, those entries are lost */
+		if (unlikely(logger_before(start, ACCESS_ONCE(log->head))))
+			continue;
+
+		lzo1x_1_compress(logger_archive_src, end - start,
+				 logger_archive_dst, &clen,
+				 logger_archive_wrkmem);
+
+		/* out of memory, try again on a later commit */
+		seg = kmalloc(sizeof(*seg) + clen, GFP_KERNEL);
+		if (!seg)
+			break;
+		seg->start = start;
+		seg->end = end;
+		seg->clen = clen;
+		memcpy(seg->data, logger_archive_dst, clen);
+
+		mutex_lock(&a->mutex);
+		spin_lock(&log->lock);
+		if (unlikely(flushes != a->flushes)) {
+			spin_unlock(&log->lock);
+			mutex_unlock(&a->mutex);
+			kfree(seg);
+			continue;
+		}
+		list_add_tail(&seg->list, &a->segments);
+		a->bytes += clen;
+		if (a->start == a->end)
+			a->start = start;
+		a->end = end;
+		a->next = end;
+
+		while (a->bytes > CONFIG_ANDROID_LOGGER_ARCHIVE_SIZE * 1024) {
+			old = list_first_entry(&a->segments,
+					       struct logger_segment, list);
+			list_del(&old->list);
+			a->bytes -= old->clen;
+			if (list_empty(&a->segments))
+				a->start = a->end;
+			else
+				a->start = list_first_entry(&a->segments,
+					struct logger_segment, list)->start;
+			kfree(old);
+		}
+		spin_unlock(&log->lock);
+		mutex_unlock(&a->mutex);
 	}
+	mutex_unlock(&logger_archive_mutex);
+}
+
+/*
+ * logger_archive_kick - queues the archive worker once a full segment of
+ * committed entries is waiting. Caller needs to hold log->lock.
+ */
+static void logger_archive_kick(struct logger_log *log)
+{
+	if (!logger_before(log->committed,
+			   log->archive.next + LOGGER_SEGMENT_SIZE))
+		schedule_work(&log->archive.work);
+}
+
+/*
+ * logger_archive_flush - drops the whole archive, for LOGGER_FLUSH_LOG
+ *
+ * Caller needs to hold log->mutex.
+ */
+static void logger_archive_flush(struct logger_log *log)
+{
+	struct logger_archive *a = &log->archive;
+	struct logger_segment *seg, *tmp;
+	LIST_HEAD(segments);
+
+	mutex_lock(&a->mutex);
+	spin_lock(&log->lock);
+	list_splice_init(&a->segments, &segments);
+	a->bytes = 0;
+	a->start = a->end;
+	a->next = log->committed;
+	a->flushes++;
+	spin_unlock(&log->lock);
+	mutex_unlock(&a->mutex);
+
+	list_for_each_entry_safe(seg, tmp, &segments, list)
+		kfree(seg);
+}
 
+/*
+ * logger_archive_fill - decompresses the segment holding the reader's next
+ * entry into reader->cache, moving the reader over any hole in the archive.
+ * Returns the length of that entry, zero if the archive has nothing at or
+ * after the reader's offset, or a negative error code.
+ *
+ * Caller needs to hold log->mutex.
+ */
+static ssize_t logger_archive_fill(struct logger_log *log,
+				   struct logger_reader *reader)
+{
+	struct logger_archive *a = &log->archive;
+	struct logger_segment *seg;
+	size_t len;
+	__u16 val;
+	int ret;
+
+	if (!reader->cache) {
+		reader->cache = vmalloc(LOGGER_SEGMENT_SIZE);
+		if (!reader->cache)
+			return -ENOMEM;
+	}
+
+	mutex_lock(&a->mutex);
+	list_for_each_entry(seg, &a->segments, list)
+		if (logger_before(reader->r_off, seg->end))
+			goto found;
+	mutex_unlock(&a->mutex);
+	return 0;
+
+found:
+	if (logger_before(reader->r_off, seg->start))
+		reader->r_off = seg->start;
+
+	if (!reader->cache_len || reader->cache_start != seg->start) {
+		reader->cache_len = 0;
+		len = LOGGER_SEGMENT_SIZE;
+		ret = lzo1x_decompress_safe(seg->data, seg->clen,
+					    reader->cache, &len);
+		if (unlikely(ret != LZO_E_OK || len != seg->end - seg->start)) {
+			mutex_unlock(&a->mutex);
+			printk(KERN_ERR "logger: corrupt archive segment in "
+			       "log '%s'\n", log->misc.name);
+			return -EIO;
+		}
+		reader->cache_start = seg->start;
+		reader->cache_len = len;
+	}
+	mutex_unlock(&a->mutex);
+
+	memcpy(&val, reader->cache + (reader->r_off - reader->cache_start),
+	       sizeof(val));
 	return sizeof(struct logger_entry) + val;
 }
 
+/*
+ * logger_archive_read - reads the reader's next entry from the archive into
+ * the user-space buffer 'buf'. Returns the length of the entry, zero if the
+ * archive has nothing at or after the reader's offset, or a negative error
+ * code.
+ *
+ * Caller needs to hold log->mutex.
+ */
+static ssize_t logger_archive_read(struct logger_log *log,
+				   struct logger_reader *reader,
+				   char __user *buf, size_t count)
+{
+	ssize_t ret;
+
+	ret = logger_archive_fill(log, reader);
+	if (ret <= 0)
+		return ret;
+	if (count < ret)
+		return -EINVAL;
+
+	if (copy_to_user(buf, reader->cache +
+			 (reader->r_off - reader->cache_start), ret))
+		return -EFAULT;
+
+	reader->r_off += ret;
+	return ret;
+}
+
+static void logger_archive_release(struct logger_reader *reader)
+{
+	vfree(reader->cache);
+}
+
+static int __init logger_archive_init(void)
+{
+	logger_archive_wrkmem = vmalloc(LZO1X_MEM_COMPRESS);
+	logger_archive_src = vmalloc(LOGGER_SEGMENT_SIZE);
+	logger_archive_dst =
+		vmalloc(lzo1x_worst_compress(LOGGER_SEGMENT_SIZE));
+	if (!logger_archive_wrkmem || !logger_archive_src ||
+	    !logger_archive_dst) {
+		vfree(logger_archive_wrkmem);
+		vfree(logger_archive_src);
+		vfree(logger_archive_dst);
+		return -ENOMEM;
+	}
+	return 0;
+}
+#else
+static inline size_t logger_archive_oldest(struct logger_log *log, size_t off)
+{
+	return ACCESS_ONCE(log->head);
+}
+
+static inline size_t logger_first_off(struct logger_log *log)
+{
+	return log->head;
+}
+
+static inline void logger_archive_kick(struct logger_log *log) { }
+static inline void logger_archive_flush(struct logger_log *log) { }
+
+static inline ssize_t logger_archive_fill(struct logger_log *log,
+					  struct logger_reader *reader)
+{
+	return 0;
+}
+
+static inline ssize_t logger_archive_read(struct logger_log *log,
+					  struct logger_reader *reader,
+					  char __user *buf, size_t count)
+{
+	return 0;
+}
+
+static inline void logger_archive_release(struct logger_reader *reader) { }
+
+static inline int logger_archive_init(void)
+{
+	return 0;
+}
+#endif
+
+/*
+ * logger_resume_off - where a reader at 'off' continues once the writers
+ * lapped it: in the archive if it still has entries at or after 'off',
+ * otherwise at the oldest entry in the ring
+ */
+static size_t logger_resume_off(struct logger_log *log,
+				struct logger_reader *reader, size_t off)
+{
+	if (reader->ring_only)
+		return ACCESS_ONCE(log->head);
+	return logger_archive_oldest(log, off);
+}
+
+/*
+ * fix_up_reader - moves a reader that was lapped by the writers forward to
+ * the oldest entry still in the log.
+ *
+ * Caller needs to hold log->lock.
+ */
+static void fix_up_reader(struct logger_log *log, struct logger_reader *reader)
+{
+	if (logger_before(reader->r_off, log->head))
+		reader->r_off = logger_resume_off(log, reader, reader->r_off);
+}
+
+/*
+ * logger_readable - is there a committed or archived entry at the reader's
+ * offset?
+ *
+ * Only a hint without log->lock held.
+ */
+static int logger_readable(struct logger_log *log,
+			   struct logger_reader *reader)
+{
+	size_t r_off = reader->r_off;
+
+	if (logger_before(r_off, ACCESS_ONCE(log->head))) {
+		r_off = logger_resume_off(log, reader, r_off);
+		if (logger_before(r_off, ACCESS_ONCE(log->head)))
+			return 1;
+	}
+	return logger_before(r_off, ACCESS_ONCE(log->committed));
+}
+
 /*
  * do_read_log_to_user - reads exactly 'count' bytes from 'log' into the
  * user-space buffer 'buf'. Returns 'count' on success.
  *
- * Caller must hold log->mutex.
+ * Caller must hold log->mutex. The copy may race with a writer reusing the
+ * space, the caller checks log->head once it is done.
  */
 static ssize_t do_read_log_to_user(struct logger_log *log,
 				   struct logger_reader *reader,
 				   char __user *buf,
 				   size_t count)
 {
+	size_t off = logger_offset(reader->r_off);
 	size_t len;
 
 	/*
@@ -125,8 +599,8 @@ static ssize_t do_read_log_to_user(struct logger_log *log,
 	 * the current read head offset up to 'count' bytes or to the end of
 	 * the log, whichever comes first.
 	 */
-	len = min(count, log->size - reader->r_off);
-	if (copy_to_user(buf, log->buffer + reader->r_off, len))
+	len = min(count, log->size - off);
+	if (copy_to_user(buf, log->buffer + off, len))
 		return -EFAULT;
 
 	/*
@@ -137,8 +611,6 @@ static ssize_t do_read_log_to_user(struct logger_log *log,
 		if (copy_to_user(buf + len, log->buffer, count - len))
 			return -EFAULT;
 
-	reader->r_off = logger_offset(reader->r_off + count);
-
 	return count;
 }
 
@@ -166,9 +638,7 @@ start:
 	while (1) {
 		prepare_to_wait(&log->wq, &wait, TASK_INTERRUPTIBLE);
 
-		mutex_lock(&log->mutex);
-		ret = (log->w_off == reader->r_off);
-		mutex_unlock(&log->mutex);
+		ret = !logger_readable(log, reader);
 		if (!ret)
 			break;
 
@@ -191,21 +661,52 @@ start:
 
 	mutex_lock(&log->mutex);
 
+retry:
+	spin_lock(&log->lock);
+	fix_up_reader(log, reader);
+
+	/* lapped readers continue in the archive, if there is one */
+	if (logger_before(reader->r_off, log->head)) {
+		spin_unlock(&log->lock);
+		ret = logger_archive_read(log, reader, buf, count);
+		if (ret)
+			goto out;
+		spin_lock(&log->lock);
+		if (logger_before(reader->r_off, log->head))
+			reader->r_off = log->head;
+	}
+
 	/* is there still something to read or did we race? */
-	if (unlikely(log->w_off == reader->r_off)) {
+	if (unlikely(!logger_before(reader->r_off, log->committed))) {
+		spin_unlock(&log->lock);
 		mutex_unlock(&log->mutex);
 		goto start;
 	}
 
 	/* get the size of the next entry */
 	ret = get_entry_len(log, reader->r_off);
+	spin_unlock(&log->lock);
 	if (count < ret) {
 		ret = -EINVAL;
 		goto out;
 	}
 
+	/* pairs with the smp_wmb() in logger_commit() */
+	smp_rmb();
+
 	/* get exactly one entry from the log */
 	ret = do_read_log_to_user(log, reader, buf, ret);
+	if (ret < 0)
+		goto out;
+
+	/* pairs with the smp_wmb() in logger_reserve() */
+	smp_rmb();
+
+	/* a writer reused the entry while we copied it, start over */
+	if (unlikely(logger_before(reader->r_off, ACCESS_ONCE(log->head))))
+		goto retry;
+
+	reader->r_off += ret;
 
 out:
 	mutex_unlock(&log->mutex);
@@ -214,105 +715,109 @@ out:
 }
 
 /*
- * get_next_entry - return the offset of the first valid entry at least 'len'
- * bytes after 'off'.
- *
- * Caller must hold log->mutex.
+ * logger_reserve - reserves 'len' bytes for a new entry and writes its
+ * header. Entries overwritten by the new one are dropped from the head of
+ * the log. Waits if that would overwrite an entry that is not committed
+ * yet; liblog does not retry, so the new entry is never dropped here.
+ * Returns zero and the entry offset in 'off', or -ERESTARTSYS.
  */
-static size_t get_next_entry(struct logger_log *log, size_t off, size_t len)
+static int logger_reserve(struct logger_log *log, struct logger_entry *header,
+			  size_t len, size_t *off)
 {
-	size_t count = 0;
+	int ret;
 
-	do {
-		size_t nr = get_entry_len(log, off);
-		off = logger_offset(off + nr);
-		count += nr;
-	} while (count < len);
+	spin_lock(&log->lock);
+	while (log->w_off + len - log->committed > log->size) {
+		spin_unlock(&log->lock);
+		ret = wait_event_interruptible(log->wq,
+			ACCESS_ONCE(log->w_off) + len -
+			ACCESS_ONCE(log->committed) <= log->size);
+		if (ret)
+			return ret;
+		spin_lock(&log->lock);
+	}
 
-	return off;
-}
+	*off = log->w_off;
+	log->w_off += len;
+	while (logger_before(log->head, log->w_off - log->size))
+		log->head += get_entry_len(log, log->head);
+	log->mmap_hdr->head = log->head;
 
-/*
- * clock_interval - is a < c < b in mod-space? Put another way, does the line
- * from a to b cross c?
- */
-static inline int clock_interval(size_t a, size_t b, size_t c)
-{
-	if (b < a) {
-		if (a < c || b >= c)
-			return 1;
-	} else {
-		if (a < c && b >= c)
-			return 1;
-	}
+	/* readers must see the new head before the entries get clobbered */
+	smp_wmb();
+
+	header->__pad = 0;
+	do_write_log(log, *off, header, sizeof(struct logger_entry));
+	spin_unlock(&log->lock);
 
 	return 0;
 }
 
 /*
- * fix_up_readers - walk the list of all readers and "fix up" any who were
- * lapped by the writer; also do the same for the default "start head".
- * We do this by "pulling forward" the readers and start head to the first
- * entry after the new write head.
- *
- * The caller needs to hold log->mutex.
+ * logger_commit - makes the entry at 'off' readable, along with any
+ * following entries that were committed before it.
  */
-static void fix_up_readers(struct logger_log *log, size_t len)
+static void logger_commit(struct logger_log *log, size_t off)
 {
-	size_t old = log->w_off;
-	size_t new = logger_offset(old + len);
-	struct logger_reader *reader;
-
-	if (clock_interval(old, new, log->head))
-		log->head = get_next_entry(log, log->head, len);
-
-	list_for_each_entry(reader, &log->readers, list)
-		if (clock_interval(old, new, reader->r_off))
-			reader->r_off = get_next_entry(log, reader->r_off, len);
+	/* the payload must be visible before 'committed' moves past it */
+	smp_wmb();
+
+	spin_lock(&log->lock);
+	set_entry_pad(log, off, LOGGER_ENTRY_DONE);
+	while (log->committed != log->w_off &&
+	       get_entry_pad(log, log->committed) == LOGGER_ENTRY_DONE) {
+		set_entry_pad(log, log->committed, 0);
+		log->committed += get_entry_len(log, log->committed);
+	}
+	/* mmap readers do not take the lock, see the cleared __pad first */
+	smp_wmb();
+	log->mmap_hdr->committed = log->committed;
+	logger_archive_kick(log);
+	spin_unlock(&log->lock);
 }
 
 /*
- * do_write_log - writes 'len' bytes from 'buf' to 'log'
- *
- * The caller needs to hold log->mutex.
+ * logger_copy_from_user - copy_from_user() for the payload of a reserved
+ * entry. logger_aio_write() faults the payload in before reserving, so
+ * this does not normally sleep on a page fault while other writers may be
+ * waiting for the entry to be committed. Only if the pages went away in
+ * the meantime does it fall back to a copy that can fault.
  */
-static void do_write_log(struct logger_log *log, const void *buf, size_t count)
+static unsigned long logger_copy_from_user(void *to, const void __user *from,
+					   unsigned long n)
 {
-	size_t len;
-
-	len = min(count, log->size - log->w_off);
-	memcpy(log->buffer + log->w_off, buf, len);
-
-	if (count != len)
-		memcpy(log->buffer, buf + len, count - len);
-
-	log->w_off = logger_offset(log->w_off + count);
-
+	unsigned long left;
+
+	pagefault_disable();
+	left = __copy_from_user_inatomic(to, from, n);
+	pagefault_enable();
+	if (left)
+		left = copy_from_user(to + n - left, from + n - left, left);
+	return left;
 }
 
 /*
  * do_write_log_user - writes 'len' bytes from the user-space buffer 'buf' to
- * the log 'log'
+ * the log 'log' at offset 'off'
  *
- * The caller needs to hold log->mutex.
+ * The caller needs to have reserved the space with logger_reserve().
  *
  * Returns 'count' on success, negative error code on failure.
  */
-static ssize_t do_write_log_from_user(struct logger_log *log,
+static ssize_t do_write_log_from_user(struct logger_log *log, size_t off,
 				      const void __user *buf, size_t count)
 {
 	size_t len;
 
-	len = min(count, log->size - log->w_off);
-	if (len && copy_from_user(log->buffer + log->w_off, buf, len))
+	off = logger_offset(off);
+	len = min(count, log->size - off);
+	if (len && logger_copy_from_user(log->buffer + off, buf, len))
 		return -EFAULT;
 
 	if (count != len)
-		if (copy_from_user(log->buffer, buf + len, count - len))
+		if (logger_copy_from_user(log->buffer, buf + len, count - len))
 			return -EFAULT;
 
-	log->w_off = logger_offset(log->w_off + count);
-
 	return count;
 }
 
@@ -325,10 +830,12 @@ ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 			 unsigned long nr_segs, loff_t ppos)
 {
 	struct logger_log *log = file_get_log(iocb->ki_filp);
-	size_t orig = log->w_off;
 	struct logger_entry header;
 	struct timespec now;
 	ssize_t ret = 0;
+	size_t off;
+	unsigned long i;
+	int err;
 
 	now = current_kernel_time();
 
@@ -342,19 +849,22 @@ ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 	if (unlikely(!header.len))
 		return 0;
 
-	mutex_lock(&log->mutex);
+	/* take any page faults now, before holding up other writers */
+	for (i = 0; i < nr_segs && ret < header.len; i++) {
+		size_t len = min_t(size_t, iov[i].iov_len, header.len - ret);
 
-	/*
-	 * Fix up any readers, pulling them forward to the first readable
-	 * entry after (what will be) the new write offset. We do this now
-	 * because if we partially fail, we can end up with clobbered log
-	 * entries that encroach on readable buffer.
-	 */
-	fix_up_readers(log, sizeof(struct logger_entry) + header.len);
+		fault_in_pages_readable(iov[i].iov_base, len);
+		ret += len;
+	}
+	ret = 0;
 
-	do_write_log(log, &header, sizeof(struct logger_entry));
+	err = logger_reserve(log, &header,
+			     sizeof(struct logger_entry) + header.len, &off);
+	if (unlikely(err))
+		return err;
+	off += sizeof(struct logger_entry);
 
-	while (nr_segs-- > 0) {
+	while (nr_segs-- > 0 && ret < header.len) {
 		size_t len;
 		ssize_t nr;
 
@@ -362,23 +872,41 @@ ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 		len = min_t(size_t, iov->iov_len, header.len - ret);
 
 		/* write out this segment's payload */
-		nr = do_write_log_from_user(log, iov->iov_base, len);
+		nr = do_write_log_from_user(log, off + ret, iov->iov_base,
+					    len);
 		if (unlikely(nr < 0)) {
-			log->w_off = orig;
-			mutex_unlock(&log->mutex);
-			return nr;
+			err = nr;
+			break;
 		}
 
 		iov++;
 		ret += nr;
 	}
 
-	mutex_unlock(&log->mutex);
+	/*
+	 * The space is taken and later entries may already depend on it, so
+	 * a failed entry is still committed, with its payload cleared.
+	 */
+	if (unlikely(ret < header.len)) {
+		static const char zero[64];
+
+		while (ret < header.len) {
+			size_t len = min_t(size_t, header.len - ret,
+					   sizeof(zero));
 
-	/* wake up any blocked readers */
+			do_write_log(log, off + ret, zero, len);
+			ret += len;
+		}
+		if (!err)
+			err = -EFAULT;
+	}
+
+	logger_commit(log, off - sizeof(struct logger_entry));
+
+	/* wake up any blocked readers and writers */
 	wake_up_interruptible(&log->wq);
 
-	return ret;
+	return err ? err : ret;
 }
 
 static struct logger_log *get_log_from_minor(int);
@@ -404,17 +932,15 @@ static int logger_open(struct inode *inode, struct file *file)
 	if (file->f_mode & FMODE_READ) {
 		struct logger_reader *reader;
 
-		reader = kmalloc(sizeof(struct logger_reader), GFP_KERNEL);
+		reader = kzalloc(sizeof(struct logger_reader), GFP_KERNEL);
 		if (!reader)
 			return -ENOMEM;
 
 		reader->log = log;
-		INIT_LIST_HEAD(&reader->list);
 
-		mutex_lock(&log->mutex);
-		reader->r_off = log->head;
-		list_add_tail(&reader->list, &log->readers);
-		mutex_unlock(&log->mutex);
+		spin_lock(&log->lock);
+		reader->r_off = logger_first_off(log);
+		spin_unlock(&log->lock);
 
 		file->private_data = reader;
 	} else
@@ -433,9 +959,7 @@ static int logger_release(struct inode *ignored, struct file *file)
 	if (file->f_mode & FMODE_READ) {
 		struct logger_reader *reader = file->private_data;
 
-		mutex_lock(&reader->log->mutex);
-		list_del(&reader->list);
-		mutex_unlock(&reader->log->mutex);
+		logger_archive_release(reader);
 		kfree(reader);
 	}
 
@@ -465,10 +989,8 @@ static unsigned int logger_poll(struct file *file, poll_table *wait)
 
 	poll_wait(file, &log->wq, wait);
 
-	mutex_lock(&log->mutex);
-	if (log->w_off != reader->r_off)
+	if (logger_readable(log, reader))
 		ret |= POLLIN | POLLRDNORM;
-	mutex_unlock(&log->mutex);
 
 	return ret;
 }
@@ -480,6 +1002,7 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 	long ret = -ENOTTY;
 
 	mutex_lock(&log->mutex);
+	spin_lock(&log->lock);
 
 	switch (cmd) {
 	case LOGGER_GET_LOG_BUF_SIZE:
@@ -491,10 +1014,11 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			break;
 		}
 		reader = file->private_data;
-		if (log->w_off >= reader->r_off)
-			ret = log->w_off - reader->r_off;
+		fix_up_reader(log, reader);
+		if (logger_before(reader->r_off, log->committed))
+			ret = log->committed - reader->r_off;
 		else
-			ret = (log->size - reader->r_off) + log->w_off;
+			ret = 0;
 		break;
 	case LOGGER_GET_NEXT_ENTRY_LEN:
 		if (!(file->f_mode & FMODE_READ)) {
@@ -502,7 +1026,18 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			break;
 		}
 		reader = file->private_data;
-		if (log->w_off != reader->r_off)
+		fix_up_reader(log, reader);
+		if (logger_before(reader->r_off, log->head)) {
+			spin_unlock(&log->lock);
+			ret = logger_archive_fill(log, reader);
+			spin_lock(&log->lock);
+			if (ret)
+				break;
+			fix_up_reader(log, reader);
+			if (logger_before(reader->r_off, log->head))
+				reader->r_off = log->head;
+		}
+		if (logger_before(reader->r_off, log->committed))
 			ret = get_entry_len(log, reader->r_off);
 		else
 			ret = 0;
@@ -512,23 +1047,80 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			ret = -EBADF;
 			break;
 		}
-		list_for_each_entry(reader, &log->readers, list)
-			reader->r_off = log->w_off;
+		/* readers are moved forward lazily by fix_up_reader() */
 		log->head = log->w_off;
+		log->mmap_hdr->head = log->head;
+		ret = 0;
+		break;
+	case LOGGER_SET_READ_POS: {
+		u32 back;
+
+		if (!(file->f_mode & FMODE_READ)) {
+			ret = -EBADF;
+			break;
+		}
+		/* 'arg' is the low 32 bits of an offset before committed */
+		back = (u32)log->committed - (u32)arg;
+		if ((s32)back < 0) {
+			ret = -EINVAL;
+			break;
+		}
+		reader = file->private_data;
+		reader->ring_only = 1;
+		reader->r_off = log->committed - min_t(size_t, back,
+						       log->size + 1);
+		fix_up_reader(log, reader);
 		ret = 0;
 		break;
 	}
+	}
+
+	spin_unlock(&log->lock);
+
+	if (cmd == LOGGER_FLUSH_LOG && !ret)
+		logger_archive_flush(log);
 
 	mutex_unlock(&log->mutex);
 
 	return ret;
 }
 
+/*
+ * logger_mmap - the log's mmap file operation
+ *
+ * Maps the header page and the ring, read-only, as laid out in logger.h.
+ */
+static int logger_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct logger_log *log = file_get_log(file);
+	unsigned long len = vma->vm_end - vma->vm_start;
+	int ret;
+
+	if (!(file->f_mode & FMODE_READ))
+		return -EACCES;
+	if (vma->vm_pgoff || len != PAGE_SIZE + log->size)
+		return -EINVAL;
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+	vma->vm_flags &= ~VM_MAYWRITE;
+
+	ret = remap_pfn_range(vma, vma->vm_start,
+			      virt_to_phys(log->mmap_hdr) >> PAGE_SHIFT,
+			      PAGE_SIZE, vma->vm_page_prot);
+	if (ret)
+		return ret;
+
+	return remap_pfn_range(vma, vma->vm_start + PAGE_SIZE,
+			       virt_to_phys(log->buffer) >> PAGE_SHIFT,
+			       log->size, vma->vm_page_prot);
+}
+
 static const struct file_operations logger_fops = {
 	.owner = THIS_MODULE,
 	.read = logger_read,
 	.aio_write = logger_aio_write,
 	.poll = logger_poll,
+	.mmap = logger_mmap,
 	.unlocked_ioctl = logger_ioctl,
 	.compat_ioctl = logger_ioctl,
 	.open = logger_open,
@@ -537,11 +1129,11 @@ static const struct file_operations logger_fops = {
 
 /*
  * Defines a log structure with name 'NAME' and a size of 'SIZE' bytes, which
- * must be a power of two, greater than LOGGER_ENTRY_MAX_LEN, and less than
- * LONG_MAX minus LOGGER_ENTRY_MAX_LEN.
+ * must be a power of two, greater than LOGGER_ENTRY_MAX_LEN, at least
+ * PAGE_SIZE, and less than LONG_MAX minus LOGGER_ENTRY_MAX_LEN.
  */
 #define DEFINE_LOGGER_DEVICE(VAR, NAME, SIZE) \
-static unsigned char _buf_ ## VAR[SIZE]; \
+static unsigned char _buf_ ## VAR[SIZE] __aligned(PAGE_SIZE); \
 static struct logger_log VAR = { \
 	.buffer = _buf_ ## VAR, \
 	.misc = { \
@@ -551,11 +1143,13 @@ static struct logger_log VAR = { \
 		.parent = NULL, \
 	}, \
 	.wq = __WAIT_QUEUE_HEAD_INITIALIZER(VAR .wq), \
-	.readers = LIST_HEAD_INIT(VAR .readers), \
 	.mutex = __MUTEX_INITIALIZER(VAR .mutex), \
+	.lock = __SPIN_LOCK_UNLOCKED(VAR .lock), \
 	.w_off = 0, \
+	.committed = 0, \
 	.head = 0, \
 	.size = SIZE, \
+	LOGGER_ARCHIVE_INIT(VAR) \
 };
 
 DEFINE_LOGGER_DEVICE(log_main, LOGGER_LOG_MAIN, 256*1024)
@@ -580,10 +1174,17 @@ static int __init init_log(struct logger_log *log)
 {
 	int ret;
 
+	log->mmap_hdr = (void *)get_zeroed_page(GFP_KERNEL);
+	if (unlikely(!log->mmap_hdr))
+		return -ENOMEM;
+	log->mmap_hdr->version = LOGGER_MMAP_VERSION;
+	log->mmap_hdr->size = log->size;
+
 	ret = misc_register(&log->misc);
 	if (unlikely(ret)) {
 		printk(KERN_ERR "logger: failed to register misc "
 		       "device for log '%s'!\n", log->misc.name);
+		free_page((unsigned long)log->mmap_hdr);
 		return ret;
 	}
 
@@ -597,6 +1198,10 @@ static int __init logger_init(void)
 {
 	int ret;
 
+	ret = logger_archive_init();
+	if (unlikely(ret))
+		goto out;
+
 	ret = init_log(&log_main);
 	if (unlikely(ret))
 		goto out;
@@ -39,11 +39,35 @@ struct logger_entry {
 #define LOGGER_ENTRY_MAX_PAYLOAD	\
 	(LOGGER_ENTRY_MAX_LEN - sizeof(struct logger_entry))
 
+/*
+ * A log opened for reading can be mapped read-only: one page holding
+ * struct logger_mmap_header, followed by the LOGGER_GET_LOG_BUF_SIZE bytes
+ * of the ring. Offsets are free running, (off & (size - 1)) indexes the
+ * ring and entries may wrap around its end.
+ *
+ * Entries below 'committed' are complete. An entry at 'off' has been
+ * overwritten once 'head' is past 'off'. A reader loads 'committed', issues
+ * a read barrier, copies the entries below it, issues another read barrier
+ * and then checks 'head'; if it moved past the copied entries, they are
+ * lost and reading resumes at 'head'. Consumed entries are reported with
+ * LOGGER_SET_READ_POS so that poll() only wakes up for new ones. Such a
+ * reader only sees the ring, not the compressed history read() may return.
+ */
+struct logger_mmap_header {
+	__u32		version;	/* LOGGER_MMAP_VERSION */
+	__u32		size;		/* size of the ring */
+	__u32		head;		/* oldest entry still in the ring */
+	__u32		committed;	/* end of the readable entries */
+};
+
+#define LOGGER_MMAP_VERSION		1
+
 #define __LOGGERIO	0xAE
 
 #define LOGGER_GET_LOG_BUF_SIZE		_IO(__LOGGERIO, 1) /* size of log */
 #define LOGGER_GET_LOG_LEN		_IO(__LOGGERIO, 2) /* used log len */
 #define LOGGER_GET_NEXT_ENTRY_LEN	_IO(__LOGGERIO, 3) /* next entry len */
 #define LOGGER_FLUSH_LOG		_IO(__LOGGERIO, 4) /* flush log */
+#define LOGGER_SET_READ_POS		_IO(__LOGGERIO, 5) /* mmap read pos */
 
 #endif /* _LINUX_LOGGER_H */
@@ -16,6 +16,12 @@
  * percentage of the cached memory is locked this can be very inaccurate
  * and processes may not get killed until the normal oom killer is triggered.
  *
+ * With pressure_mode set, the thresholds above are only acted upon while
+ * reclaim is struggling: the share of scanned pages that reclaim failed
+ * to free reaches pressure_medium percent, or less than swap_min_free
+ * percent of swap is left.  The current level (low, medium or critical)
+ * can be read and polled in /sys/kernel/mm/lowmemorykiller/pressure_level.
+ *
  * Copyright (C) 2007-2008 Google, Inc.
  *
  * This software is licensed under the terms of the GNU General Public
@@ -36,6 +42,10 @@
 #include <linux/sched.h>
 #include <linux/notifier.h>
 #include <linux/compaction.h>
+#include <linux/kobject.h>
+#include <linux/swap.h>
+#include <linux/sysfs.h>
+#include <linux/vmstat.h>
 
 //<!-- BEGIN: hyeongseok.kim@lge.com 2012-08-16 -->
 //<!-- MOD : make LMK see swap condition 
@@ -85,6 +95,200 @@ extern int compact_nodes(bool sync);
 			printk(x);			\
 	} while (0)
 
+/*
+ * Thread group leaders with their oom_adj, one list per value, so that
+ * the shrinker only has to look at the tasks it may kill rather than
+ * walk the whole task list.  Maintained by the hooks below, which are
+ * called with tasklist_lock held for writing, and after oom_adj writes.
+ */
+#define LOWMEM_NR_BUCKETS	(OOM_ADJUST_MAX - OOM_DISABLE + 1)
+
+/* hlists so that the index is usable before lowmem_init() runs */
+static struct hlist_head lowmem_buckets[LOWMEM_NR_BUCKETS];
+static DEFINE_SPINLOCK(lowmem_index_lock);
+
+static struct hlist_head *lowmem_bucket(int oom_adj)
+{
+	oom_adj = clamp(oom_adj, OOM_DISABLE, OOM_ADJUST_MAX);
+	return &lowmem_buckets[oom_adj - OOM_DISABLE];
+}
+
+void lowmem_index_add(struct task_struct *p)
+{
+	spin_lock(&lowmem_index_lock);
+	hlist_add_head(&p->lowmem_node, lowmem_bucket(p->signal->oom_adj));
+	spin_unlock(&lowmem_index_lock);
+}
+
+void lowmem_index_del(struct task_struct *p)
+{
+	spin_lock(&lowmem_index_lock);
+	hlist_del_init(&p->lowmem_node);
+	spin_unlock(&lowmem_index_lock);
+}
+
+/* a non-leader thread took over the thread group in exec */
+void lowmem_index_replace(struct task_struct *old, struct task_struct *new)
+{
+	spin_lock(&lowmem_index_lock);
+	if (!hlist_unhashed(&old->lowmem_node)) {
+		hlist_del_init(&old->lowmem_node);
+		hlist_add_head(&new->lowmem_node,
+			       lowmem_bucket(new->signal->oom_adj));
+	}
+	spin_unlock(&lowmem_index_lock);
+}
+
+void lowmem_index_update(struct task_struct *p)
+{
+	read_lock(&tasklist_lock);
+	p = p->group_leader;
+	spin_lock_irq(&lowmem_index_lock);
+	if (!hlist_unhashed(&p->lowmem_node)) {
+		hlist_del(&p->lowmem_node);
+		hlist_add_head(&p->lowmem_node,
+			       lowmem_bucket(p->signal->oom_adj));
+	}
+	spin_unlock_irq(&lowmem_index_lock);
+	read_unlock(&tasklist_lock);
+}
+
+/* Tasks the shrinker takes references on per trip into the index */
+#define LOWMEM_SCAN_BATCH	16
+
+/*
+ * Take a reference on up to LOWMEM_SCAN_BATCH tasks with @adj, skipping
+ * the first @skip.  Returns the number of tasks stored in @tasks.
+ */
+static int lowmem_grab_bucket(int adj, int skip, struct task_struct **tasks)
+{
+	struct task_struct *p;
+	struct hlist_node *node;
+	int nr = 0;
+
+	spin_lock_irq(&lowmem_index_lock);
+	hlist_for_each_entry(p, node, lowmem_bucket(adj), lowmem_node) {
+		if (skip) {
+			skip--;
+			continue;
+		}
+		get_task_struct(p);
+		tasks[nr++] = p;
+		if (nr == LOWMEM_SCAN_BATCH)
+			break;
+	}
+	spin_unlock_irq(&lowmem_index_lock);
+	return nr;
+}
+
+/*
+ * Reclaim pressure, computed like vmpressure: the percentage of pages
+ * scanned by reclaim that it failed to free, over windows of at least
+ * LOWMEM_PRESSURE_WINDOW scanned pages.
+ */
+enum {
+	LOWMEM_PRESSURE_LOW,
+	LOWMEM_PRESSURE_MEDIUM,
+	LOWMEM_PRESSURE_CRITICAL,
+};
+
+static const char * const lowmem_pressure_names[] = {
+	"low", "medium", "critical",
+};
+
+#define LOWMEM_PRESSURE_WINDOW	(SWAP_CLUSTER_MAX * 16)
+
+static int lowmem_pressure_mode;
+static int lowmem_pressure_medium = 60;
+static int lowmem_pressure_critical = 95;
+static int lowmem_swap_min_free = 10;	/* percent */
+
+static DEFINE_SPINLOCK(lowmem_pressure_lock);
+static unsigned long lowmem_win_scanned;
+static unsigned long lowmem_win_reclaimed;
+static int lowmem_pressure;
+static int lowmem_pressure_level;
+static struct kobject *lowmem_kobj;
+static struct sysfs_dirent *lowmem_level_sd;
+
+#ifdef CONFIG_VM_EVENT_COUNTERS
+/* sum a per-zone vm event over all zones and cpus */
+static unsigned long lowmem_zone_events(enum vm_event_item normal)
+{
+	enum vm_event_item item = normal - ZONE_NORMAL;
+	unsigned long sum = 0;
+	int cpu, i;
+
+	for_each_online_cpu(cpu)
+		for (i = 0; i < MAX_NR_ZONES; i++)
+			sum += per_cpu(vm_event_states, cpu).event[item + i];
+	return sum;
+}
+
+static void lowmem_sample_reclaim(void)
+{
+	unsigned long scanned, reclaimed;
+
+	scanned = lowmem_zone_events(PGSCAN_KSWAPD_NORMAL) +
+		  lowmem_zone_events(PGSCAN_DIRECT_NORMAL);
+	reclaimed = lowmem_zone_events(PGSTEAL_NORMAL);
+
+	spin_lock(&lowmem_pressure_lock);
+	if (scanned - lowmem_win_scanned >= LOWMEM_PRESSURE_WINDOW) {
+		scanned -= lowmem_win_scanned;
+		reclaimed -= lowmem_win_reclaimed;
+		lowmem_win_scanned += scanned;
+		lowmem_win_reclaimed += reclaimed;
+		reclaimed = min(reclaimed, scanned);
+		lowmem_pressure = 100 - reclaimed * 100 / scanned;
+	}
+	spin_unlock(&lowmem_pressure_lock);
+}
+#else
+static void lowmem_sample_reclaim(void) { }
+#endif
+
+static int lowmem_update_pressure(void)
+{
+	struct sysinfo si;
+	int level, changed;
+
+	lowmem_sample_reclaim();
+	si_swapinfo(&si);
+
+	spin_lock(&lowmem_pressure_lock);
+	if (si.totalswap &&
+	    si.freeswap * 100 < si.totalswap * lowmem_swap_min_free)
+		level = LOWMEM_PRESSURE_CRITICAL;
+	else if (lowmem_pressure >= lowmem_pressure_critical)
+		level = LOWMEM_PRESSURE_CRITICAL;
+	else if (lowmem_pressure >= lowmem_pressure_medium)
+		level = LOWMEM_PRESSURE_MEDIUM;
+	else
+		level = LOWMEM_PRESSURE_LOW;
+	changed = level != lowmem_pressure_level;
+	lowmem_pressure_level = level;
+	spin_unlock(&lowmem_pressure_lock);
+
+	if (changed) {
+		lowmem_print(3, "lowmem pressure %d%%, swap free %lu/%lu, %s\n",
+			     lowmem_pressure, si.freeswap, si.totalswap,
+			     lowmem_pressure_names[level]);
+		if (lowmem_level_sd)
+			sysfs_notify_dirent(lowmem_level_sd);
+	}
+	return level;
+}
+
+static ssize_t pressure_level_show(struct kobject *kobj,
+				   struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%s\n",
+		       lowmem_pressure_names[lowmem_pressure_level]);
+}
+
+static struct kobj_attribute pressure_level_attr = __ATTR_RO(pressure_level);
+
 static int
 task_notify_func(struct notifier_block *self, unsigned long val, void *data);
 
@@ -105,8 +309,11 @@ task_notify_func(struct notifier_block *self, unsigned long val, void *data)
 
 static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 {
+	struct task_struct *tasks[LOWMEM_SCAN_BATCH];
 	struct task_struct *p;
 	struct task_struct *selected = NULL;
+	int adj;
+	int nr;
 	int rem = 0;
 	int tasksize;
 	int i;
@@ -180,6 +387,10 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 		global_page_state(NR_ACTIVE_FILE) +
 		global_page_state(NR_INACTIVE_ANON) +
 		global_page_state(NR_INACTIVE_FILE);
+	if (sc->nr_to_scan > 0 &&
+	    lowmem_update_pressure() == LOWMEM_PRESSURE_LOW &&
+	    lowmem_pressure_mode)
+		min_adj = OOM_ADJUST_MAX + 1;
 	if (sc->nr_to_scan <= 0 || min_adj == OOM_ADJUST_MAX + 1) {
 		lowmem_print(5, "lowmem_shrink %lu, %x, return %d\n",
 			     sc->nr_to_scan, sc->gfp_mask, rem);
@@ -194,56 +405,66 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 		min_free_swap -= LMK_SWAP_DEC_KBYTES;*/
 //<!-- END: hyeongseok.kim@lge.com 2012-08-16 -->
 
-	read_lock(&tasklist_lock);
-	for_each_process(p) {
-		struct mm_struct *mm;
-		struct signal_struct *sig;
-		int oom_adj;
-		int target_offset;
-
-		task_lock(p);
-		mm = p->mm;
-		sig = p->signal;
-		if (!mm || !sig) {
-			task_unlock(p);
-			continue;
-		}
-		oom_adj = sig->oom_adj;
-		if (oom_adj < min_adj) {
-			task_unlock(p);
-			continue;
-		}
-		tasksize = get_mm_rss(mm);
-		task_unlock(p);
-		if (tasksize <= 0)
-			continue;
-		target_offset = abs(target_free - tasksize);
-		if (selected) {
-			if (oom_adj < selected_oom_adj)
-				continue;
-			if (oom_adj == selected_oom_adj &&
-			    target_offset >= selected_target_offset)
-				continue;
-		}
-		selected = p;
-		selected_tasksize = tasksize;
-		selected_target_offset = target_offset;
-		selected_oom_adj = oom_adj;
-	//kiyong.choi@lge.com (+)
-		if(lowmem_deathpending && selected != lowmem_deathpending)
-		{
-		   if(selected_oom_adj > 5){
-				force_sig(SIGKILL, selected);
-				lowmem_print(1, "time out send sigkill to %d (%s), adj %d, size %d ****\n",
-					 selected->pid, selected->comm,
-					 selected_oom_adj, selected_tasksize);
-				selected=NULL;
-				continue;
-		   }
-		}
-    	//kiyong.choi@lge.com (-)
-		lowmem_print(2, "select %d (%s), adj %d, size %d, to kill\n",
-			     p->pid, p->comm, oom_adj, tasksize);
+	/*
+	 * Walk the buckets from the highest oom_adj down; the first one
+	 * holding a task with pages to free has our victim.  The tasks
+	 * are looked at with references held rather than under
+	 * lowmem_index_lock: the exit path takes that lock inside siglock,
+	 * so it must not be held across force_sig().
+	 */
+	for (adj = OOM_ADJUST_MAX; !selected && adj >= min_adj; adj--) {
+		int skip = 0;
+
+		do {
+			nr = lowmem_grab_bucket(adj, skip, tasks);
+			skip += nr;
+			for (i = 0; i < nr; i++) {
+				struct mm_struct *mm;
+				int oom_adj;
+				int target_offset;
+
+				p = tasks[i];
+				task_lock(p);
+				mm = p->mm;
+				oom_adj = p->signal->oom_adj;
+				tasksize = mm ? get_mm_rss(mm) : 0;
+				task_unlock(p);
+				if (oom_adj < min_adj || tasksize <= 0) {
+					put_task_struct(p);
+					continue;
+				}
+				target_offset = abs(target_free - tasksize);
+				if (selected) {
+					if (oom_adj < selected_oom_adj ||
+					    (oom_adj == selected_oom_adj &&
+					     target_offset >= selected_target_offset)) {
+						put_task_struct(p);
+						continue;
+					}
+					put_task_struct(selected);
+				}
+				selected = p;
+				selected_tasksize = tasksize;
+				selected_target_offset = target_offset;
+				selected_oom_adj = oom_adj;
+			//kiyong.choi@lge.com (+)
+				if(lowmem_deathpending && selected != lowmem_deathpending)
+				{
+				   if(selected_oom_adj > 5){
+						force_sig(SIGKILL, selected);
+						lowmem_print(1, "time out send sigkill to %d (%s), adj %d, size %d ****\n",
+							 selected->pid, selected->comm,
+							 selected_oom_adj, selected_tasksize);
+						put_task_struct(selected);
+						selected=NULL;
+						continue;
+				   }
+				}
+			//kiyong.choi@lge.com (-)
+				lowmem_print(2, "select %d (%s), adj %d, size %d, to kill\n",
+					     p->pid, p->comm, oom_adj, tasksize);
+			}
+		} while (nr == LOWMEM_SCAN_BATCH);
 	}
 	if (selected) {
 		lowmem_print(1, "send sigkill to %d (%s), adj %d, size %d\n",
@@ -267,11 +488,11 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
     
 		//lowmem_deathpending_timeout = jiffies + HZ;		
 		force_sig(SIGKILL, selected);
+		put_task_struct(selected);
 		rem -= selected_tasksize;
 	}
 	lowmem_print(4, "lowmem_shrink %lu, %x, return %d\n",
 		     sc->nr_to_scan, sc->gfp_mask, rem);
-	read_unlock(&tasklist_lock);
     if (selected)
         compact_nodes(false);
 	return rem;
@@ -290,6 +511,11 @@ static int __init lowmem_init(void)
 /*	lmk_kill_info = kmalloc(1024, GFP_KERNEL);*/
 //<!-- END: hyeongseok.kim@lge.com 2012-08-16 -->
 
+	lowmem_kobj = kobject_create_and_add("lowmemorykiller", mm_kobj);
+	if (lowmem_kobj &&
+	    !sysfs_create_file(lowmem_kobj, &pressure_level_attr.attr))
+		lowmem_level_sd = sysfs_get_dirent(lowmem_kobj->sd, NULL,
+						   "pressure_level");
 	task_free_register(&task_nb);
 	register_shrinker(&lowmem_shrinker);
 	return 0;
@@ -299,6 +525,9 @@ static void __exit lowmem_exit(void)
 {
 	unregister_shrinker(&lowmem_shrinker);
 	task_free_unregister(&task_nb);
+	if (lowmem_level_sd)
+		sysfs_put(lowmem_level_sd);
+	kobject_put(lowmem_kobj);
 //<!-- BEGIN: hyeongseok.kim@lge.com 2012-08-16 -->
 //<!-- MOD : make LMK see swap condition 
 //DEL : bs.lim@lge.com
@@ -314,6 +543,14 @@ module_param_array_named(adj, lowmem_adj, int, &lowmem_adj_size,
 module_param_array_named(minfree, lowmem_minfree, uint, &lowmem_minfree_size,
 			 S_IRUGO | S_IWUSR);
 module_param_named(debug_level, lowmem_debug_level, uint, S_IRUGO | S_IWUSR);
+module_param_named(pressure_mode, lowmem_pressure_mode, int,
+		   S_IRUGO | S_IWUSR);
+module_param_named(pressure_medium, lowmem_pressure_medium, int,
+		   S_IRUGO | S_IWUSR);
+module_param_named(pressure_critical, lowmem_pressure_critical, int,
+		   S_IRUGO | S_IWUSR);
+module_param_named(swap_min_free, lowmem_swap_min_free, int,
+		   S_IRUGO | S_IWUSR);
 //<!-- BEGIN: hyeongseok.kim@lge.com 2012-08-16 -->
 //<!-- MOD : make LMK see swap condition 
 //DEL : bs.lim@lge.com
@@ -1,5 +1,5 @@
 /*
- * zcache.c
+ * zcache-main.c
  *
  * Copyright (c) 2010,2011, Dan Magenheimer, Oracle Corp.
  * Copyright (c) 2010,2011, Nitin Gupta
@@ -10,19 +10,21 @@
  * 1) "compression buddies" ("zbud") is used for ephemeral pages
  * 2) xvmalloc is used for persistent pages.
  * Xvmalloc (based on the TLSF allocator) has very low fragmentation
- * so maximizes space efficiency, while zbud allows pairs (and potentially,
- * in the future, more than a pair of) compressed pages to be closely linked
- * so that reclaiming can be done via the kernel's physical-page-oriented
- * "shrinker" interface.
+ * so maximizes space efficiency, while zbud allows up to three compressed
+ * pages to be closely linked so that reclaiming can be done via the
+ * kernel's physical-page-oriented "shrinker" interface.
  *
  * [1] For a definition of page-accessible memory (aka PAM), see:
  *   http://marc.info/?l=linux-mm&m=127811271605009
  */
 
 #include <linux/cpu.h>
+#include <linux/debugfs.h>
 #include <linux/highmem.h>
+#include <linux/hrtimer.h>
 #include <linux/list.h>
 #include <linux/lzo.h>
+#include <linux/seq_file.h>
 #include <linux/slab.h>
 #include <linux/spinlock.h>
 #include <linux/types.h>
@@ -49,39 +51,54 @@
 	(__GFP_FS | __GFP_NORETRY | __GFP_NOWARN | __GFP_NOMEMALLOC)
 #endif
 
+#define MAX_POOLS_PER_CLIENT 16
+
 /**********
- * Compression buddies ("zbud") provides for packing two (or, possibly
- * in the future, more) compressed ephemeral pages into a single "raw"
- * (physical) page and tracking them with data structures so that
- * the raw pages can be easily reclaimed.
+ * Compression buddies ("zbud") provides for packing up to three
+ * compressed ephemeral pages into a single "raw" (physical) page and
+ * tracking them with data structures so that the raw pages can be
+ * easily reclaimed.
  *
- * A zbud page ("zbpg") is an aligned page containing a list_head,
- * a lock, and two "zbud headers".  The remainder of the physical
- * page is divided up into aligned 64-byte "chunks" which contain
- * the compressed data for zero, one, or two zbuds.  Each zbpg
- * resides on: (1) an "unused list" if it has no zbuds; (2) a
- * "buddied" list if it is fully populated  with two zbuds; or
- * (3) one of PAGE_SIZE/64 "unbuddied" lists indexed by how many chunks
- * the one unbuddied zbud uses.  The data inside a zbpg cannot be
- * read or written unless the zbpg's lock is held.
+ * A zbud page ("zbpg") is an aligned page containing list heads, a
+ * lock, and three "zbud headers".  The remainder of the physical page
+ * is divided up into aligned 64-byte "chunks".  The data of the zbuds
+ * in use is kept packed at the start of the chunk area (each header
+ * records its first chunk), so the free space of a zbpg is always one
+ * contiguous run at its end.  The data inside a zbpg cannot be read,
+ * written or moved unless the zbpg's lock is held.
+ *
+ * Each zbpg belongs to one ephemeral tmem pool and sits on that pool's
+ * LRU list, most recently put first; the shrinker evicts from the
+ * tail.  A zbpg with a vacant zbud and some free chunks also sits on
+ * one of the pool's per-cpu "unbuddied" lists, indexed by how many
+ * chunks are free, so that puts normally only take a lock local to
+ * their cpu.  A zbpg that is neither full nor empty is "unbuddied";
+ * a full one is "buddied".  Empty zbpgs are freed right away.
  */
 
 #define ZBH_SENTINEL  0x43214321
 #define ZBPG_SENTINEL  0xdeadbeef
 
-#define ZBUD_MAX_BUDS 2
+#define ZBUD_MAX_BUDS 3
 
 struct zbud_hdr {
 	uint32_t pool_id;
 	struct tmem_oid oid;
 	uint32_t index;
 	uint16_t size; /* compressed size in bytes, zero means unused */
+	uint8_t start; /* first chunk of the data */
 	DECL_SENTINEL
 };
 
+struct zbud_pool;
+
 struct zbud_page {
-	struct list_head bud_list;
+	struct list_head bud_list;	/* unbuddied list, empty if full */
+	struct list_head lru;		/* pool LRU */
+	struct zbud_pool *pool;
 	spinlock_t lock;
+	uint16_t cpu;			/* owner of the unbuddied list */
+	uint8_t zombie;			/* being evicted */
 	struct zbud_hdr buddy[ZBUD_MAX_BUDS];
 	DECL_SENTINEL
 	/* followed by NUM_CHUNK aligned CHUNK_SIZE-byte chunks */
@@ -90,30 +107,28 @@ struct zbud_page {
 #define CHUNK_SHIFT	6
 #define CHUNK_SIZE	(1 << CHUNK_SHIFT)
 #define CHUNK_MASK	(~(CHUNK_SIZE-1))
-#define NCHUNKS		(((PAGE_SIZE - sizeof(struct zbud_page)) & \
-				CHUNK_MASK) >> CHUNK_SHIFT)
+#define ZBUD_DATA_START	((sizeof(struct zbud_page) + CHUNK_SIZE - 1) & \
+				CHUNK_MASK)
+#define NCHUNKS		((PAGE_SIZE - ZBUD_DATA_START) >> CHUNK_SHIFT)
 #define MAX_CHUNK	(NCHUNKS-1)
 
-static struct {
-	struct list_head list;
-	unsigned count;
-} zbud_unbuddied[NCHUNKS];
-/* list N contains pages with N chunks USED and NCHUNKS-N unused */
+/* list N contains pages with N chunks free */
 /* element 0 is never used but optimizing that isn't worth it */
-static unsigned long zbud_cumul_chunk_counts[NCHUNKS];
-
-struct list_head zbud_buddied_list;
-static unsigned long zcache_zbud_buddied_count;
-
-/* protects the buddied list and all unbuddied lists */
-static DEFINE_SPINLOCK(zbud_budlists_spinlock);
+struct zbud_unbuddied {
+	spinlock_t lock;
+	struct list_head list[NCHUNKS];
+	unsigned count[NCHUNKS];
+};
 
-static LIST_HEAD(zbpg_unused_list);
-static unsigned long zcache_zbpg_unused_list_count;
+struct zbud_pool {
+	struct zbud_unbuddied __percpu *unbuddied;
+	spinlock_t lru_lock;
+	struct list_head lru;
+};
 
-/* protects the unused page list */
-static DEFINE_SPINLOCK(zbpg_unused_list_spinlock);
+static unsigned long zbud_cumul_chunk_counts[NCHUNKS];
 
+static atomic_t zcache_zbud_buddied_count;
 static atomic_t zcache_zbud_curr_raw_pages;
 static atomic_t zcache_zbud_curr_zpages;
 static unsigned long zcache_zbud_curr_zbytes;
@@ -156,85 +171,194 @@ static inline int zbud_budnum(struct zbud_hdr *zh)
 	return budnum;
 }
 
+static inline struct zbud_page *zbud_hdr_to_page(struct zbud_hdr *zh)
+{
+	unsigned budnum = zbud_budnum(zh);
+
+	return container_of(zh, struct zbud_page, buddy[budnum]);
+}
+
 static char *zbud_data(struct zbud_hdr *zh, unsigned size)
 {
 	struct zbud_page *zbpg;
-	char *p;
-	unsigned budnum;
 
 	ASSERT_SENTINEL(zh, ZBH);
-	budnum = zbud_budnum(zh);
 	BUG_ON(size == 0 || size > zbud_max_buddy_size());
-	zbpg = container_of(zh, struct zbud_page, buddy[budnum]);
+	zbpg = zbud_hdr_to_page(zh);
 	ASSERT_SPINLOCK(&zbpg->lock);
-	p = (char *)zbpg;
-	if (budnum == 0)
-		p += ((sizeof(struct zbud_page) + CHUNK_SIZE - 1) &
-							CHUNK_MASK);
-	else if (budnum == 1)
-		p += PAGE_SIZE - ((size + CHUNK_SIZE - 1) & CHUNK_MASK);
-	return p;
+	return (char *)zbpg + ZBUD_DATA_START + (zh->start << CHUNK_SHIFT);
+}
+
+static unsigned zbud_used_chunks(struct zbud_page *zbpg)
+{
+	unsigned i, chunks = 0;
+
+	for (i = 0; i < ZBUD_MAX_BUDS; i++)
+		if (zbpg->buddy[i].size)
+			chunks += zbud_size_to_chunks(zbpg->buddy[i].size);
+	return chunks;
+}
+
+static struct zbud_hdr *zbud_vacant(struct zbud_page *zbpg)
+{
+	int i;
+
+	for (i = 0; i < ZBUD_MAX_BUDS; i++)
+		if (zbpg->buddy[i].size == 0)
+			return &zbpg->buddy[i];
+	return NULL;
+}
+
+static bool zbud_empty(struct zbud_page *zbpg)
+{
+	int i;
+
+	for (i = 0; i < ZBUD_MAX_BUDS; i++)
+		if (zbpg->buddy[i].size)
+			return 0;
+	return 1;
 }
 
 /*
- * zbud raw page management
+ * zbud list management: the zbpg lock must be held.  Lock order is
+ * zbpg lock, then unbuddied or LRU lock; going the other way requires
+ * a trylock.
  */
 
-static struct zbud_page *zbud_alloc_raw_page(void)
+/* put zbpg on the unbuddied list for its free space, if it has any */
+static void zbud_list_add(struct zbud_page *zbpg)
 {
-	struct zbud_page *zbpg = NULL;
-	struct zbud_hdr *zh0, *zh1;
-	bool recycled = 0;
-
-	/* if any pages on the zbpg list, use one */
-	spin_lock(&zbpg_unused_list_spinlock);
-	if (!list_empty(&zbpg_unused_list)) {
-		zbpg = list_first_entry(&zbpg_unused_list,
-				struct zbud_page, bud_list);
-		list_del_init(&zbpg->bud_list);
-		zcache_zbpg_unused_list_count--;
-		recycled = 1;
+	unsigned free = NCHUNKS - zbud_used_chunks(zbpg);
+	struct zbud_unbuddied *ub;
+
+	ASSERT_SPINLOCK(&zbpg->lock);
+	if (free == 0 || zbud_vacant(zbpg) == NULL) {
+		atomic_inc(&zcache_zbud_buddied_count);
+		return;
 	}
-	spin_unlock(&zbpg_unused_list_spinlock);
-	if (zbpg == NULL)
-		/* none on zbpg list, try to get a kernel page */
-		zbpg = zcache_get_free_page();
-	if (likely(zbpg != NULL)) {
-		INIT_LIST_HEAD(&zbpg->bud_list);
-		zh0 = &zbpg->buddy[0]; zh1 = &zbpg->buddy[1];
-		spin_lock_init(&zbpg->lock);
-		if (recycled) {
-			ASSERT_INVERTED_SENTINEL(zbpg, ZBPG);
-			SET_SENTINEL(zbpg, ZBPG);
-			BUG_ON(zh0->size != 0 || tmem_oid_valid(&zh0->oid));
-			BUG_ON(zh1->size != 0 || tmem_oid_valid(&zh1->oid));
-		} else {
-			atomic_inc(&zcache_zbud_curr_raw_pages);
-			INIT_LIST_HEAD(&zbpg->bud_list);
-			SET_SENTINEL(zbpg, ZBPG);
-			zh0->size = 0; zh1->size = 0;
-			tmem_oid_set_invalid(&zh0->oid);
-			tmem_oid_set_invalid(&zh1->oid);
-		}
+	ub = per_cpu_ptr(zbpg->pool->unbuddied, zbpg->cpu);
+	spin_lock(&ub->lock);
+	list_add_tail(&zbpg->bud_list, &ub->list[free]);
+	ub->count[free]++;
+	spin_unlock(&ub->lock);
+}
+
+/* take zbpg off its unbuddied list; returns true if it was buddied */
+static bool zbud_list_del(struct zbud_page *zbpg)
+{
+	unsigned free;
+	struct zbud_unbuddied *ub;
+
+	ASSERT_SPINLOCK(&zbpg->lock);
+	if (list_empty(&zbpg->bud_list)) {
+		atomic_dec(&zcache_zbud_buddied_count);
+		return 1;
 	}
+	free = NCHUNKS - zbud_used_chunks(zbpg);
+	ub = per_cpu_ptr(zbpg->pool->unbuddied, zbpg->cpu);
+	spin_lock(&ub->lock);
+	list_del_init(&zbpg->bud_list);
+	ub->count[free]--;
+	spin_unlock(&ub->lock);
+	return 0;
+}
+
+/* mark zbpg most recently used */
+static void zbud_lru_touch(struct zbud_page *zbpg)
+{
+	struct zbud_pool *zpool = zbpg->pool;
+
+	spin_lock(&zpool->lru_lock);
+	list_move(&zbpg->lru, &zpool->lru);
+	spin_unlock(&zpool->lru_lock);
+}
+
+static void zbud_lru_del(struct zbud_page *zbpg)
+{
+	struct zbud_pool *zpool = zbpg->pool;
+
+	spin_lock(&zpool->lru_lock);
+	list_del_init(&zbpg->lru);
+	spin_unlock(&zpool->lru_lock);
+}
+
+/*
+ * zbud raw page management
+ */
+
+static struct zbud_page *zbud_alloc_raw_page(struct zbud_pool *zpool)
+{
+	struct zbud_page *zbpg;
+	int i;
+
+	zbpg = zcache_get_free_page();
+	if (unlikely(zbpg == NULL))
+		return NULL;
+	atomic_inc(&zcache_zbud_curr_raw_pages);
+	INIT_LIST_HEAD(&zbpg->bud_list);
+	INIT_LIST_HEAD(&zbpg->lru);
+	zbpg->pool = zpool;
+	spin_lock_init(&zbpg->lock);
+	zbpg->cpu = smp_processor_id();
+	zbpg->zombie = 0;
+	for (i = 0; i < ZBUD_MAX_BUDS; i++) {
+		zbpg->buddy[i].size = 0;
+		tmem_oid_set_invalid(&zbpg->buddy[i].oid);
+	}
+	SET_SENTINEL(zbpg, ZBPG);
 	return zbpg;
 }
 
 static void zbud_free_raw_page(struct zbud_page *zbpg)
 {
-	struct zbud_hdr *zh0 = &zbpg->buddy[0], *zh1 = &zbpg->buddy[1];
+	int i;
 
 	ASSERT_SENTINEL(zbpg, ZBPG);
 	BUG_ON(!list_empty(&zbpg->bud_list));
-	ASSERT_SPINLOCK(&zbpg->lock);
-	BUG_ON(zh0->size != 0 || tmem_oid_valid(&zh0->oid));
-	BUG_ON(zh1->size != 0 || tmem_oid_valid(&zh1->oid));
+	BUG_ON(!list_empty(&zbpg->lru));
+	for (i = 0; i < ZBUD_MAX_BUDS; i++)
+		BUG_ON(zbpg->buddy[i].size != 0 ||
+			tmem_oid_valid(&zbpg->buddy[i].oid));
 	INVERT_SENTINEL(zbpg, ZBPG);
-	spin_unlock(&zbpg->lock);
-	spin_lock(&zbpg_unused_list_spinlock);
-	list_add(&zbpg->bud_list, &zbpg_unused_list);
-	zcache_zbpg_unused_list_count++;
-	spin_unlock(&zbpg_unused_list_spinlock);
+	atomic_dec(&zcache_zbud_curr_raw_pages);
+	zcache_free_page(zbpg);
+}
+
+static struct zbud_pool *zbud_create_pool(void)
+{
+	struct zbud_pool *zpool;
+	struct zbud_unbuddied *ub;
+	int cpu, i;
+
+	zpool = kzalloc(sizeof(*zpool), GFP_KERNEL);
+	if (zpool == NULL)
+		return NULL;
+	zpool->unbuddied = alloc_percpu(struct zbud_unbuddied);
+	if (zpool->unbuddied == NULL) {
+		kfree(zpool);
+		return NULL;
+	}
+	for_each_possible_cpu(cpu) {
+		ub = per_cpu_ptr(zpool->unbuddied, cpu);
+		spin_lock_init(&ub->lock);
+		for (i = 0; i < NCHUNKS; i++) {
+			INIT_LIST_HEAD(&ub->list[i]);
+			ub->count[i] = 0;
+		}
+	}
+	spin_lock_init(&zpool->lru_lock);
+	INIT_LIST_HEAD(&zpool->lru);
+	return zpool;
+}
+
+/* all zbpgs must have been freed by tmem_destroy_pool() */
+static void zbud_destroy_pool(struct zbud_pool *zpool)
+{
+	if (zpool == NULL)
+		return;
+	WARN_ON(!list_empty(&zpool->lru));
+	free_percpu(zpool->unbuddied);
+	kfree(zpool);
 }
 
 /*
@@ -257,107 +381,129 @@ static unsigned zbud_free(struct zbud_hdr *zh)
 	return size;
 }
 
+/*
+ * Slide the data behind a freed zbud down to keep free space contiguous.
+ * Buds must move lowest first, or one would overwrite the next: a reused
+ * header slot may hold the bud furthest into the page.
+ */
+static void zbud_pack(struct zbud_page *zbpg, unsigned start, unsigned chunks)
+{
+	struct zbud_hdr *zh, *next;
+	char *data = (char *)zbpg + ZBUD_DATA_START;
+	int i;
+
+	ASSERT_SPINLOCK(&zbpg->lock);
+	for (;;) {
+		next = NULL;
+		for (i = 0; i < ZBUD_MAX_BUDS; i++) {
+			zh = &zbpg->buddy[i];
+			if (zh->size == 0 || zh->start < start)
+				continue;
+			if (next == NULL || zh->start < next->start)
+				next = zh;
+		}
+		if (next == NULL)
+			break;
+		/* everything left to move lies beyond this bud */
+		start = next->start + 1;
+		memmove(data + ((next->start - chunks) << CHUNK_SHIFT),
+			data + (next->start << CHUNK_SHIFT),
+			zbud_size_to_chunks(next->size) << CHUNK_SHIFT);
+		next->start -= chunks;
+	}
+}
+
 static void zbud_free_and_delist(struct zbud_hdr *zh)
 {
-	unsigned chunks;
-	struct zbud_hdr *zh_other;
-	unsigned budnum = zbud_budnum(zh), size;
-	struct zbud_page *zbpg =
-		container_of(zh, struct zbud_page, buddy[budnum]);
+	struct zbud_page *zbpg = zbud_hdr_to_page(zh);
+	unsigned start, size;
 
 	spin_lock(&zbpg->lock);
-	if (list_empty(&zbpg->bud_list)) {
+	if (zbpg->zombie) {
 		/* ignore zombie page... see zbud_evict_pages() */
 		spin_unlock(&zbpg->lock);
 		return;
 	}
+	zbud_list_del(zbpg);
+	start = zh->start;
 	size = zbud_free(zh);
-	ASSERT_SPINLOCK(&zbpg->lock);
-	zh_other = &zbpg->buddy[(budnum == 0) ? 1 : 0];
-	if (zh_other->size == 0) { /* was unbuddied: unlist and free */
-		chunks = zbud_size_to_chunks(size) ;
-		spin_lock(&zbud_budlists_spinlock);
-		BUG_ON(list_empty(&zbud_unbuddied[chunks].list));
-		list_del_init(&zbpg->bud_list);
-		zbud_unbuddied[chunks].count--;
-		spin_unlock(&zbud_budlists_spinlock);
-		zbud_free_raw_page(zbpg);
-	} else { /* was buddied: move remaining buddy to unbuddied list */
-		chunks = zbud_size_to_chunks(zh_other->size) ;
-		spin_lock(&zbud_budlists_spinlock);
-		list_del_init(&zbpg->bud_list);
-		zcache_zbud_buddied_count--;
-		list_add_tail(&zbpg->bud_list, &zbud_unbuddied[chunks].list);
-		zbud_unbuddied[chunks].count++;
-		spin_unlock(&zbud_budlists_spinlock);
+	if (zbud_empty(zbpg)) {
+		zbud_lru_del(zbpg);
 		spin_unlock(&zbpg->lock);
+		zbud_free_raw_page(zbpg);
+		return;
 	}
+	zbud_pack(zbpg, start, zbud_size_to_chunks(size));
+	zbud_list_add(zbpg);
+	spin_unlock(&zbpg->lock);
 }
 
-static struct zbud_hdr *zbud_create(uint32_t pool_id, struct tmem_oid *oid,
+/*
+ * Find a zbpg with room for nchunks, best fit first, preferring this
+ * cpu's unbuddied lists.  Returns it locked and off its list.
+ */
+static struct zbud_page *zbud_find_unbuddied(struct zbud_pool *zpool,
+						unsigned nchunks)
+{
+	struct zbud_unbuddied *ub;
+	struct zbud_page *zbpg;
+	int this_cpu = smp_processor_id(), cpu = this_cpu, i;
+
+	do {
+		ub = per_cpu_ptr(zpool->unbuddied, cpu);
+		spin_lock(&ub->lock);
+		for (i = nchunks; i < NCHUNKS; i++) {
+			list_for_each_entry(zbpg, &ub->list[i], bud_list) {
+				if (!spin_trylock(&zbpg->lock))
+					continue;
+				list_del_init(&zbpg->bud_list);
+				ub->count[i]--;
+				spin_unlock(&ub->lock);
+				zbpg->cpu = this_cpu;
+				return zbpg;
+			}
+		}
+		spin_unlock(&ub->lock);
+		cpu = cpumask_next(cpu, cpu_online_mask);
+		if (cpu >= nr_cpu_ids)
+			cpu = cpumask_first(cpu_online_mask);
+	} while (cpu != this_cpu);
+	return NULL;
+}
+
+static struct zbud_hdr *zbud_create(struct zbud_pool *zpool,
+					uint32_t pool_id, struct tmem_oid *oid,
 					uint32_t index, struct page *page,
 					void *cdata, unsigned size)
 {
-	struct zbud_hdr *zh0, *zh1, *zh = NULL;
-	struct zbud_page *zbpg = NULL, *ztmp;
+	struct zbud_hdr *zh = NULL;
+	struct zbud_page *zbpg;
 	unsigned nchunks;
 	char *to;
-	int i, found_good_buddy = 0;
-
-	nchunks = zbud_size_to_chunks(size) ;
-	for (i = MAX_CHUNK - nchunks + 1; i > 0; i--) {
-		spin_lock(&zbud_budlists_spinlock);
-		if (!list_empty(&zbud_unbuddied[i].list)) {
-			list_for_each_entry_safe(zbpg, ztmp,
-				    &zbud_unbuddied[i].list, bud_list) {
-				if (spin_trylock(&zbpg->lock)) {
-					found_good_buddy = i;
-					goto found_unbuddied;
-				}
-			}
-		}
-		spin_unlock(&zbud_budlists_spinlock);
-	}
-	/* didn't find a good buddy, try allocating a new page */
-	zbpg = zbud_alloc_raw_page();
-	if (unlikely(zbpg == NULL))
-		goto out;
-	/* ok, have a page, now compress the data before taking locks */
-	spin_lock(&zbpg->lock);
-	spin_lock(&zbud_budlists_spinlock);
-	list_add_tail(&zbpg->bud_list, &zbud_unbuddied[nchunks].list);
-	zbud_unbuddied[nchunks].count++;
-	zh = &zbpg->buddy[0];
-	goto init_zh;
-
-found_unbuddied:
-	ASSERT_SPINLOCK(&zbpg->lock);
-	zh0 = &zbpg->buddy[0]; zh1 = &zbpg->buddy[1];
-	BUG_ON(!((zh0->size == 0) ^ (zh1->size == 0)));
-	if (zh0->size != 0) { /* buddy0 in use, buddy1 is vacant */
-		ASSERT_SENTINEL(zh0, ZBH);
-		zh = zh1;
-	} else if (zh1->size != 0) { /* buddy1 in use, buddy0 is vacant */
-		ASSERT_SENTINEL(zh1, ZBH);
-		zh = zh0;
-	} else
-		BUG();
-	list_del_init(&zbpg->bud_list);
-	zbud_unbuddied[found_good_buddy].count--;
-	list_add_tail(&zbpg->bud_list, &zbud_buddied_list);
-	zcache_zbud_buddied_count++;
 
-init_zh:
+	nchunks = zbud_size_to_chunks(size);
+	zbpg = zbud_find_unbuddied(zpool, nchunks);
+	if (zbpg == NULL) {
+		/* didn't find a good buddy, try allocating a new page */
+		zbpg = zbud_alloc_raw_page(zpool);
+		if (unlikely(zbpg == NULL))
+			goto out;
+		spin_lock(&zbpg->lock);
+	}
+	ASSERT_SENTINEL(zbpg, ZBPG);
+	zh = zbud_vacant(zbpg);
+	BUG_ON(zh == NULL);
+	zh->start = zbud_used_chunks(zbpg);
+	BUG_ON(zh->start + nchunks > NCHUNKS);
 	SET_SENTINEL(zh, ZBH);
 	zh->size = size;
 	zh->index = index;
 	zh->oid = *oid;
 	zh->pool_id = pool_id;
-	/* can wait to copy the data until the list locks are dropped */
-	spin_unlock(&zbud_budlists_spinlock);
-
 	to = zbud_data(zh, size);
 	memcpy(to, cdata, size);
+	zbud_list_add(zbpg);
+	zbud_lru_touch(zbpg);
 	spin_unlock(&zbpg->lock);
 	zbud_cumul_chunk_counts[nchunks]++;
 	atomic_inc(&zcache_zbud_curr_zpages);
@@ -370,16 +516,14 @@ out:
 
 static int zbud_decompress(struct page *page, struct zbud_hdr *zh)
 {
-	struct zbud_page *zbpg;
-	unsigned budnum = zbud_budnum(zh);
+	struct zbud_page *zbpg = zbud_hdr_to_page(zh);
 	size_t out_len = PAGE_SIZE;
 	char *to_va, *from_va;
 	unsigned size;
 	int ret = 0;
 
-	zbpg = container_of(zh, struct zbud_page, buddy[budnum]);
 	spin_lock(&zbpg->lock);
-	if (list_empty(&zbpg->bud_list)) {
+	if (zbpg->zombie) {
 		/* ignore zombie page... see zbud_evict_pages() */
 		ret = -EINVAL;
 		goto out;
@@ -403,15 +547,21 @@ out:
  * pages "least valuable" first.
  */
 
-static unsigned long zcache_evicted_raw_pages;
 static unsigned long zcache_evicted_buddied_pages;
 static unsigned long zcache_evicted_unbuddied_pages;
 
+/*
+ * Empty zbpgs are freed right away rather than parked on an unused list
+ * for the shrinker, so these stay 0.  Kept for existing sysfs readers.
+ */
+static unsigned long zcache_zbpg_unused_list_count;
+static unsigned long zcache_evicted_raw_pages;
+
 static struct tmem_pool *zcache_get_pool_by_id(uint32_t poolid);
 static void zcache_put_pool(struct tmem_pool *pool);
 
 /*
- * Flush and free all zbuds in a zbpg, then free the pageframe
+ * Flush and free all zbuds in a zombie zbpg, then free the pageframe
  */
 static void zbud_evict_zbpg(struct zbud_page *zbpg)
 {
@@ -422,7 +572,7 @@ static void zbud_evict_zbpg(struct zbud_page *zbpg)
 	struct tmem_pool *pool;
 
 	ASSERT_SPINLOCK(&zbpg->lock);
-	BUG_ON(!list_empty(&zbpg->bud_list));
+	BUG_ON(!zbpg->zombie);
 	for (i = 0, j = 0; i < ZBUD_MAX_BUDS; i++) {
 		zh = &zbpg->buddy[i];
 		if (zh->size) {
@@ -441,103 +591,65 @@ static void zbud_evict_zbpg(struct zbud_page *zbpg)
 			zcache_put_pool(pool);
 		}
 	}
-	ASSERT_SENTINEL(zbpg, ZBPG);
+	/* let any zbud_free_and_delist() that saw the zombie finish */
 	spin_lock(&zbpg->lock);
+	spin_unlock(&zbpg->lock);
 	zbud_free_raw_page(zbpg);
 }
 
 /*
- * Free nr pages.  This code is funky because we want to hold the locks
- * protecting various lists for as short a time as possible, and in some
- * circumstances the list may change asynchronously when the list lock is
- * not held.  In some cases we also trylock not only to avoid waiting on a
- * page in use by another cpu, but also to avoid potential deadlock due to
- * lock inversion.
+ * Evict the least recently used zbpg of a pool.  We trylock the zbpg
+ * since the LRU lock is taken out of order, and also to avoid waiting
+ * on a page in use by another cpu.
  */
-static void zbud_evict_pages(int nr)
+static int zbud_evict_lru(struct zbud_pool *zpool)
 {
 	struct zbud_page *zbpg;
-	int i;
-
-	/* first try freeing any pages on unused list */
-retry_unused_list:
-	spin_lock_bh(&zbpg_unused_list_spinlock);
-	if (!list_empty(&zbpg_unused_list)) {
-		/* can't walk list here, since it may change when unlocked */
-		zbpg = list_first_entry(&zbpg_unused_list,
-				struct zbud_page, bud_list);
-		list_del_init(&zbpg->bud_list);
-		zcache_zbpg_unused_list_count--;
-		atomic_dec(&zcache_zbud_curr_raw_pages);
-		spin_unlock_bh(&zbpg_unused_list_spinlock);
-		zcache_free_page(zbpg);
-		zcache_evicted_raw_pages++;
-		if (--nr <= 0)
-			goto out;
-		goto retry_unused_list;
-	}
-	spin_unlock_bh(&zbpg_unused_list_spinlock);
-
-	/* now try freeing unbuddied pages, starting with least space avail */
-	for (i = 0; i < MAX_CHUNK; i++) {
-retry_unbud_list_i:
-		spin_lock_bh(&zbud_budlists_spinlock);
-		if (list_empty(&zbud_unbuddied[i].list)) {
-			spin_unlock_bh(&zbud_budlists_spinlock);
-			continue;
-		}
-		list_for_each_entry(zbpg, &zbud_unbuddied[i].list, bud_list) {
-			if (unlikely(!spin_trylock(&zbpg->lock)))
-				continue;
-			list_del_init(&zbpg->bud_list);
-			zbud_unbuddied[i].count--;
-			spin_unlock(&zbud_budlists_spinlock);
-			zcache_evicted_unbuddied_pages++;
-			/* want budlists unlocked when doing zbpg eviction */
-			zbud_evict_zbpg(zbpg);
-			local_bh_enable();
-			if (--nr <= 0)
-				goto out;
-			goto retry_unbud_list_i;
-		}
-		spin_unlock_bh(&zbud_budlists_spinlock);
-	}
 
-	/* as a last resort, free buddied pages */
-retry_bud_list:
-	spin_lock_bh(&zbud_budlists_spinlock);
-	if (list_empty(&zbud_buddied_list)) {
-		spin_unlock_bh(&zbud_budlists_spinlock);
-		goto out;
-	}
-	list_for_each_entry(zbpg, &zbud_buddied_list, bud_list) {
+	spin_lock_bh(&zpool->lru_lock);
+	list_for_each_entry_reverse(zbpg, &zpool->lru, lru) {
 		if (unlikely(!spin_trylock(&zbpg->lock)))
 			continue;
-		list_del_init(&zbpg->bud_list);
-		zcache_zbud_buddied_count--;
-		spin_unlock(&zbud_budlists_spinlock);
-		zcache_evicted_buddied_pages++;
-		/* want budlists unlocked when doing zbpg eviction */
+		list_del_init(&zbpg->lru);
+		spin_unlock(&zpool->lru_lock);
+		if (zbud_list_del(zbpg))
+			zcache_evicted_buddied_pages++;
+		else
+			zcache_evicted_unbuddied_pages++;
+		zbpg->zombie = 1;
+		/* want list locks dropped when doing zbpg eviction */
 		zbud_evict_zbpg(zbpg);
 		local_bh_enable();
-		if (--nr <= 0)
-			goto out;
-		goto retry_bud_list;
+		return 1;
 	}
-	spin_unlock_bh(&zbud_budlists_spinlock);
-out:
-	return;
+	spin_unlock_bh(&zpool->lru_lock);
+	return 0;
 }
 
-static void zbud_init(void)
-{
-	int i;
+static struct zbud_pool *zcache_zbud_pool_by_id(uint32_t poolid);
 
-	INIT_LIST_HEAD(&zbud_buddied_list);
-	zcache_zbud_buddied_count = 0;
-	for (i = 0; i < NCHUNKS; i++) {
-		INIT_LIST_HEAD(&zbud_unbuddied[i].list);
-		zbud_unbuddied[i].count = 0;
+/*
+ * Free nr pages, taking the least recently used page of each ephemeral
+ * pool in turn so that no single pool absorbs all the pressure.
+ */
+static void zbud_evict_pages(int nr)
+{
+	static atomic_t next_pool_id = ATOMIC_INIT(0);
+	struct tmem_pool *pool;
+	struct zbud_pool *zpool;
+	int i, idle = 0;
+
+	while (nr > 0 && idle < MAX_POOLS_PER_CLIENT) {
+		i = (unsigned)atomic_inc_return(&next_pool_id) %
+						MAX_POOLS_PER_CLIENT;
+		pool = zcache_get_pool_by_id(i);
+		zpool = pool ? zcache_zbud_pool_by_id(i) : NULL;
+		if (zpool != NULL && zbud_evict_lru(zpool)) {
+			nr--;
+			idle = 0;
+		} else
+			idle++;
+		zcache_put_pool(pool);
 	}
 }
 
@@ -549,12 +661,27 @@ static void zbud_init(void)
  */
 static int zbud_show_unbuddied_list_counts(char *buf)
 {
-	int i;
+	unsigned counts[NCHUNKS] = { 0 };
+	struct zbud_unbuddied *ub;
+	struct zbud_pool *zpool;
+	struct tmem_pool *pool;
+	int i, poolid, cpu;
 	char *p = buf;
 
+	for (poolid = 0; poolid < MAX_POOLS_PER_CLIENT; poolid++) {
+		pool = zcache_get_pool_by_id(poolid);
+		zpool = pool ? zcache_zbud_pool_by_id(poolid) : NULL;
+		if (zpool != NULL)
+			for_each_possible_cpu(cpu) {
+				ub = per_cpu_ptr(zpool->unbuddied, cpu);
+				for (i = 0; i < NCHUNKS; i++)
+					counts[i] += ub->count[i];
+			}
+		zcache_put_pool(pool);
+	}
 	for (i = 0; i < NCHUNKS - 1; i++)
-		p += sprintf(p, "%u ", zbud_unbuddied[i].count);
-	p += sprintf(p, "%d\n", zbud_unbuddied[i].count);
+		p += sprintf(p, "%u ", counts[i]);
+	p += sprintf(p, "%u\n", counts[i]);
 	return p - buf;
 }
 
@@ -677,10 +804,13 @@ static unsigned long zcache_flobj_found;
 static unsigned long zcache_failed_eph_puts;
 static unsigned long zcache_failed_pers_puts;
 
-#define MAX_POOLS_PER_CLIENT 16
+struct zcache_pool_stats;
 
 static struct {
 	struct tmem_pool *tmem_pools[MAX_POOLS_PER_CLIENT];
+	struct zbud_pool *zbud_pools[MAX_POOLS_PER_CLIENT];
+	struct zcache_pool_stats __percpu *stats[MAX_POOLS_PER_CLIENT];
+	struct dentry *stats_dentry[MAX_POOLS_PER_CLIENT];
 	struct xv_pool *xvpool;
 } zcache_client;
 
@@ -709,6 +839,184 @@ static void zcache_put_pool(struct tmem_pool *pool)
 		atomic_dec(&pool->refcount);
 }
 
+/* caller must hold a reference on the tmem pool */
+static struct zbud_pool *zcache_zbud_pool_by_id(uint32_t poolid)
+{
+	return zcache_client.zbud_pools[poolid];
+}
+
+/*
+ * Per-pool histograms of put and get latency and of compressed size,
+ * exported in debugfs as zcache/pool<id>.  Cleancache creates one pool
+ * per mounted filesystem, so these show whether zcache pays off for a
+ * given mount.  Latency bucket 0 counts operations under 1us, bucket N
+ * those taking [2^(N-1), 2^N) us, and the last one everything slower.
+ * Compressed size is counted in tenths of a page, the last bucket
+ * holding pages that did not shrink at all.
+ */
+#define ZCACHE_LAT_BUCKETS	16
+#define ZCACHE_RATIO_BUCKETS	11
+
+struct zcache_pool_stats {
+	unsigned long put[ZCACHE_LAT_BUCKETS];
+	unsigned long get_hit[ZCACHE_LAT_BUCKETS];
+	unsigned long get_miss[ZCACHE_LAT_BUCKETS];
+	unsigned long ratio[ZCACHE_RATIO_BUCKETS];
+};
+
+#ifdef CONFIG_DEBUG_FS
+static struct dentry *zcache_debugfs_root;
+
+static inline ktime_t zcache_stats_start(void)
+{
+	return zcache_debugfs_root ? ktime_get() : ktime_set(0, 0);
+}
+
+static unsigned zcache_lat_bucket(ktime_t start)
+{
+	s64 us = ktime_us_delta(ktime_get(), start);
+
+	if (us <= 0)
+		return 0;
+	if (us >= 1 << (ZCACHE_LAT_BUCKETS - 2))
+		return ZCACHE_LAT_BUCKETS - 1;
+	return fls(us);
+}
+
+/* irqs are disabled in all callers */
+static void zcache_stats_put(uint32_t poolid, ktime_t start)
+{
+	struct zcache_pool_stats __percpu *stats;
+
+	stats = zcache_client.stats[poolid];
+	if (stats != NULL)
+		__this_cpu_inc(stats->put[zcache_lat_bucket(start)]);
+}
+
+static void zcache_stats_get(uint32_t poolid, ktime_t start, bool hit)
+{
+	struct zcache_pool_stats __percpu *stats;
+	unsigned b;
+
+	stats = zcache_client.stats[poolid];
+	if (stats == NULL)
+		return;
+	b = zcache_lat_bucket(start);
+	if (hit)
+		__this_cpu_inc(stats->get_hit[b]);
+	else
+		__this_cpu_inc(stats->get_miss[b]);
+}
+
+static void zcache_stats_ratio(uint32_t poolid, size_t clen)
+{
+	struct zcache_pool_stats __percpu *stats;
+
+	stats = zcache_client.stats[poolid];
+	if (stats != NULL)
+		__this_cpu_inc(stats->ratio[min_t(size_t,
+				clen * 10 / PAGE_SIZE,
+				ZCACHE_RATIO_BUCKETS - 1)]);
+}
+
+static int zcache_stats_show(struct seq_file *s, void *v)
+{
+	uint32_t poolid = (unsigned long)s->private;
+	struct zcache_pool_stats sum, *stats;
+	struct tmem_pool *pool;
+	int cpu, i;
+
+	pool = zcache_get_pool_by_id(poolid);
+	if (pool == NULL)
+		return -ENOENT;
+	memset(&sum, 0, sizeof(sum));
+	for_each_possible_cpu(cpu) {
+		stats = per_cpu_ptr(zcache_client.stats[poolid], cpu);
+		for (i = 0; i < ZCACHE_LAT_BUCKETS; i++) {
+			sum.put[i] += stats->put[i];
+			sum.get_hit[i] += stats->get_hit[i];
+			sum.get_miss[i] += stats->get_miss[i];
+		}
+		for (i = 0; i < ZCACHE_RATIO_BUCKETS; i++)
+			sum.ratio[i] += stats->ratio[i];
+	}
+	seq_printf(s, "pool %u (%s)\n", poolid,
+		is_ephemeral(pool) ? "ephemeral" : "persistent");
+	zcache_put_pool(pool);
+
+	seq_printf(s, "%8s %10s %10s %10s\n",
+		"usec", "put", "get_hit", "get_miss");
+	seq_printf(s, "%8s %10lu %10lu %10lu\n", "<1",
+		sum.put[0], sum.get_hit[0], sum.get_miss[0]);
+	for (i = 1; i < ZCACHE_LAT_BUCKETS; i++)
+		seq_printf(s, "%8lu %10lu %10lu %10lu\n", 1UL << (i - 1),
+			sum.put[i], sum.get_hit[i], sum.get_miss[i]);
+
+	seq_printf(s, "\n%8s %10s\n", "csize%", "pages");
+	for (i = 0; i < ZCACHE_RATIO_BUCKETS - 1; i++)
+		seq_printf(s, "%5d-%-2d %10lu\n", i * 10, i * 10 + 9,
+			sum.ratio[i]);
+	seq_printf(s, "%8s %10lu\n", ">=100", sum.ratio[i]);
+	return 0;
+}
+
+static int zcache_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, zcache_stats_show, inode->i_private);
+}
+
+static const struct file_operations zcache_stats_fops = {
+	.open = zcache_stats_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static void zcache_stats_create(uint32_t poolid)
+{
+	char name[16];
+
+	if (zcache_debugfs_root == NULL)
+		return;
+	zcache_client.stats[poolid] = alloc_percpu(struct zcache_pool_stats);
+	if (zcache_client.stats[poolid] == NULL)
+		return;
+	sprintf(name, "pool%u", poolid);
+	zcache_client.stats_dentry[poolid] = debugfs_create_file(name,
+			S_IRUGO, zcache_debugfs_root,
+			(void *)(unsigned long)poolid, &zcache_stats_fops);
+}
+
+/* the pool must already be unreachable and idle */
+static void zcache_stats_destroy(uint32_t poolid)
+{
+	debugfs_remove(zcache_client.stats_dentry[poolid]);
+	zcache_client.stats_dentry[poolid] = NULL;
+	free_percpu(zcache_client.stats[poolid]);
+	zcache_client.stats[poolid] = NULL;
+}
+
+static void __init zcache_debugfs_init(void)
+{
+	zcache_debugfs_root = debugfs_create_dir("zcache", NULL);
+	if (IS_ERR(zcache_debugfs_root))
+		zcache_debugfs_root = NULL;
+}
+#else
+static inline ktime_t zcache_stats_start(void)
+{
+	return ktime_set(0, 0);
+}
+
+static inline void zcache_stats_put(uint32_t poolid, ktime_t start) { }
+static inline void zcache_stats_get(uint32_t poolid, ktime_t start,
+					bool hit) { }
+static inline void zcache_stats_ratio(uint32_t poolid, size_t clen) { }
+static inline void zcache_stats_create(uint32_t poolid) { }
+static inline void zcache_stats_destroy(uint32_t poolid) { }
+static inline void zcache_debugfs_init(void) { }
+#endif
+
 /* counters for debugging */
 static unsigned long zcache_failed_get_free_pages;
 static unsigned long zcache_failed_alloc;
@@ -915,12 +1223,14 @@ static void *zcache_pampd_create(struct tmem_pool *pool, struct tmem_oid *oid,
 		if (ret == 0)
 
 			goto out;
+		zcache_stats_ratio(pool->pool_id, clen);
 		if (clen == 0 || clen > zbud_max_buddy_size()) {
 			zcache_compress_poor++;
 			goto out;
 		}
-		pampd = (void *)zbud_create(pool->pool_id, oid, index,
-						page, cdata, clen);
+		pampd = (void *)zbud_create(
+				zcache_zbud_pool_by_id(pool->pool_id),
+				pool->pool_id, oid, index, page, cdata, clen);
 		if (pampd != NULL) {
 			count = atomic_inc_return(&zcache_curr_eph_pampd_count);
 			if (count > zcache_curr_eph_pampd_count_max)
@@ -938,6 +1248,7 @@ static void *zcache_pampd_create(struct tmem_pool *pool, struct tmem_oid *oid,
 		ret = zcache_compress(page, &cdata, &clen);
 		if (ret == 0)
 			goto out;
+		zcache_stats_ratio(pool->pool_id, clen);
 		if (clen > zv_max_page_size) {
 			zcache_compress_poor++;
 			goto out;
@@ -1111,7 +1422,6 @@ ZCACHE_SYSFS_RO(failed_pers_puts);
 ZCACHE_SYSFS_RO(zbud_curr_zbytes);
 ZCACHE_SYSFS_RO(zbud_cumul_zpages);
 ZCACHE_SYSFS_RO(zbud_cumul_zbytes);
-ZCACHE_SYSFS_RO(zbud_buddied_count);
 ZCACHE_SYSFS_RO(zbpg_unused_list_count);
 ZCACHE_SYSFS_RO(evicted_raw_pages);
 ZCACHE_SYSFS_RO(evicted_unbuddied_pages);
@@ -1124,6 +1434,7 @@ ZCACHE_SYSFS_RO(aborted_shrink);
 ZCACHE_SYSFS_RO(compress_poor);
 ZCACHE_SYSFS_RO_ATOMIC(zbud_curr_raw_pages);
 ZCACHE_SYSFS_RO_ATOMIC(zbud_curr_zpages);
+ZCACHE_SYSFS_RO_ATOMIC(zbud_buddied_count);
 ZCACHE_SYSFS_RO_ATOMIC(curr_obj_count);
 ZCACHE_SYSFS_RO_ATOMIC(curr_objnode_count);
 ZCACHE_SYSFS_RO_CUSTOM(zbud_unbuddied_list_counts,
@@ -1216,6 +1527,7 @@ static int zcache_put_page(int pool_id, struct tmem_oid *oidp,
 				uint32_t index, struct page *page)
 {
 	struct tmem_pool *pool;
+	ktime_t start = zcache_stats_start();
 	int ret = -1;
 
 	BUG_ON(!irqs_disabled());
@@ -1231,6 +1543,7 @@ static int zcache_put_page(int pool_id, struct tmem_oid *oidp,
 			else
 				zcache_failed_pers_puts++;
 		}
+		zcache_stats_put(pool_id, start);
 		zcache_put_pool(pool);
 		preempt_enable_no_resched();
 	} else {
@@ -1248,14 +1561,17 @@ static int zcache_get_page(int pool_id, struct tmem_oid *oidp,
 				uint32_t index, struct page *page)
 {
 	struct tmem_pool *pool;
+	ktime_t start;
 	int ret = -1;
 	unsigned long flags;
 
 	local_irq_save(flags);
+	start = zcache_stats_start();
 	pool = zcache_get_pool_by_id(pool_id);
 	if (likely(pool != NULL)) {
 		if (atomic_read(&pool->obj_count) > 0)
 			ret = tmem_get(pool, oidp, index, page);
+		zcache_stats_get(pool_id, start, ret == 0);
 		zcache_put_pool(pool);
 	}
 	local_irq_restore(flags);
@@ -1319,6 +1635,9 @@ static int zcache_destroy_pool(int pool_id)
 	local_bh_disable();
 	ret = tmem_destroy_pool(pool);
 	local_bh_enable();
+	zbud_destroy_pool(zcache_client.zbud_pools[pool_id]);
+	zcache_client.zbud_pools[pool_id] = NULL;
+	zcache_stats_destroy(pool_id);
 	kfree(pool);
 	pr_info("zcache: destroyed pool id=%d\n", pool_id);
 out:
@@ -1345,10 +1664,20 @@ static int zcache_new_pool(uint32_t flags)
 		poolid = -1;
 		goto out;
 	}
+	if (!(flags & TMEM_POOL_PERSIST)) {
+		zcache_client.zbud_pools[poolid] = zbud_create_pool();
+		if (zcache_client.zbud_pools[poolid] == NULL) {
+			pr_info("zcache: pool creation failed: out of memory\n");
+			kfree(pool);
+			poolid = -1;
+			goto out;
+		}
+	}
 	atomic_set(&pool->refcount, 0);
 	pool->client = &zcache_client;
 	pool->pool_id = poolid;
 	tmem_new_pool(pool, flags);
+	zcache_stats_create(poolid);
 	zcache_client.tmem_pools[poolid] = pool;
 	pr_info("zcache: created %s tmem pool, id=%d\n",
 		flags & TMEM_POOL_PERSIST ? "persistent" : "ephemeral",
@@ -1603,6 +1932,7 @@ static int __init zcache_init(void)
 		goto out;
 	}
 #endif /* CONFIG_SYSFS */
+	zcache_debugfs_init();
 #if defined(CONFIG_CLEANCACHE) || defined(CONFIG_FRONTSWAP)
 	if (zcache_enabled) {
 		unsigned int cpu;
@@ -1629,7 +1959,6 @@ static int __init zcache_init(void)
 	if (zcache_enabled && use_cleancache) {
 		struct cleancache_ops old_ops;
 
-		zbud_init();
 		register_shrinker(&zcache_shrinker);
 		old_ops = zcache_cleancache_register_ops();
 		pr_info("zcache: cleancache enabled using kernel "
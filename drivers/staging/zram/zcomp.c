@@ -0,0 +1,288 @@
+/*
+ * zram compression streams
+ *
+ * Copyright (C) 2026 LG Electronics, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#define KMSG_COMPONENT "zram"
+#define pr_fmt(fmt) KMSG_COMPONENT ": " fmt
+
+#ifdef CONFIG_ZRAM_DEBUG
+#define DEBUG
+#endif
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/err.h>
+#include <linux/errno.h>
+#include <linux/gfp.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+
+#include "zcomp.h"
+#include "zcomp_lzo.h"
+#ifdef CONFIG_ZRAM_LZ4_COMPRESS
+#include "zcomp_lz4.h"
+#endif
+#ifdef CONFIG_ZRAM_ZLIB_COMPRESS
+#include "zcomp_zlib.h"
+#endif
+
+static struct zcomp_backend *backends[] = {
+	&zcomp_lzo,
+#ifdef CONFIG_ZRAM_LZ4_COMPRESS
+	&zcomp_lz4,
+#endif
+#ifdef CONFIG_ZRAM_ZLIB_COMPRESS
+	&zcomp_zlib,
+#endif
+	NULL
+};
+
+static struct zcomp_backend *find_backend(const char *compress)
+{
+	int i;
+
+	for (i = 0; backends[i]; i++) {
+		if (sysfs_streq(compress, backends[i]->name))
+			return backends[i];
+	}
+
+	return NULL;
+}
+
+static void zcomp_strm_free(struct zcomp *comp, struct zcomp_strm *zstrm)
+{
+	if (zstrm->private)
+		comp->backend->destroy(zstrm->private);
+	free_pages((unsigned long)zstrm->buffer, 1);
+	kfree(zstrm);
+}
+
+/*
+ * Allocate a new stream. Called without strm_lock held; the
+ * buffer is two pages since backends may expand an incompressible
+ * page slightly beyond PAGE_SIZE.
+ */
+static struct zcomp_strm *zcomp_strm_alloc(struct zcomp *comp)
+{
+	struct zcomp_strm *zstrm;
+
+	zstrm = kmalloc(sizeof(*zstrm), GFP_NOIO);
+	if (!zstrm)
+		return NULL;
+
+	zstrm->private = comp->backend->create();
+	zstrm->buffer = (void *)__get_free_pages(GFP_NOIO | __GFP_ZERO, 1);
+	if (!zstrm->private || !zstrm->buffer) {
+		zcomp_strm_free(comp, zstrm);
+		return NULL;
+	}
+
+	return zstrm;
+}
+
+/* Show available compressors, marking the selected one */
+ssize_t zcomp_available_show(const char *comp, char *buf)
+{
+	ssize_t sz = 0;
+	int i;
+
+	for (i = 0; backends[i]; i++) {
+		if (!strcmp(comp, backends[i]->name))
+			sz += sprintf(buf + sz, "[%s] ", backends[i]->name);
+		else
+			sz += sprintf(buf + sz, "%s ", backends[i]->name);
+	}
+	sz += sprintf(buf + sz, "\n");
+
+	return sz;
+}
+
+bool zcomp_available_algorithm(const char *comp)
+{
+	return find_backend(comp) != NULL;
+}
+
+/*
+ * Get an idle stream, allocating a new one if we are below the
+ * limit. Otherwise sleep until one is released. May sleep, so it
+ * must not be called from atomic context.
+ */
+struct zcomp_strm *zcomp_strm_find(struct zcomp *comp)
+{
+	struct zcomp_strm *zstrm;
+
+	while (1) {
+		spin_lock(&comp->strm_lock);
+		if (!list_empty(&comp->idle_strm)) {
+			zstrm = list_entry(comp->idle_strm.next,
+					struct zcomp_strm, list);
+			list_del(&zstrm->list);
+			spin_unlock(&comp->strm_lock);
+			return zstrm;
+		}
+
+		/* All streams are busy: wait for one to be released */
+		if (comp->avail_strm >= comp->max_strm) {
+			comp->strm_waits++;
+			spin_unlock(&comp->strm_lock);
+			wait_event(comp->strm_wait,
+				!list_empty(&comp->idle_strm));
+			continue;
+		}
+
+		/* Allocate a new stream outside the lock */
+		comp->avail_strm++;
+		spin_unlock(&comp->strm_lock);
+
+		zstrm = zcomp_strm_alloc(comp);
+		if (likely(zstrm))
+			return zstrm;
+
+		/*
+		 * Allocation failed under memory pressure. Fall back
+		 * to waiting for one of the existing streams.
+		 */
+		spin_lock(&comp->strm_lock);
+		comp->avail_strm--;
+		if (!comp->avail_strm) {
+			spin_unlock(&comp->strm_lock);
+			return NULL;
+		}
+		spin_unlock(&comp->strm_lock);
+		wait_event(comp->strm_wait, !list_empty(&comp->idle_strm));
+	}
+}
+EXPORT_SYMBOL_GPL(zcomp_strm_find);
+
+/*
+ * Put a stream back on the idle list, or free it if the stream
+ * limit was lowered while it was in use.
+ */
+void zcomp_strm_release(struct zcomp *comp, struct zcomp_strm *zstrm)
+{
+	spin_lock(&comp->strm_lock);
+	if (comp->avail_strm <= comp->max_strm) {
+		list_add(&zstrm->list, &comp->idle_strm);
+		spin_unlock(&comp->strm_lock);
+		wake_up(&comp->strm_wait);
+		return;
+	}
+
+	comp->avail_strm--;
+	spin_unlock(&comp->strm_lock);
+	zcomp_strm_free(comp, zstrm);
+}
+EXPORT_SYMBOL_GPL(zcomp_strm_release);
+
+int zcomp_compress(struct zcomp *comp, struct zcomp_strm *zstrm,
+			const unsigned char *src, size_t *dst_len)
+{
+	return comp->backend->compress(src, zstrm->buffer, dst_len,
+				zstrm->private);
+}
+EXPORT_SYMBOL_GPL(zcomp_compress);
+
+int zcomp_decompress(struct zcomp *comp, struct zcomp_strm *zstrm,
+			const unsigned char *src, size_t src_len,
+			unsigned char *dst)
+{
+	return comp->backend->decompress(src, src_len, dst, zstrm->private);
+}
+EXPORT_SYMBOL_GPL(zcomp_decompress);
+
+/*
+ * Change the stream limit. Idle streams above the new limit are
+ * freed right away; busy ones are freed as they are released.
+ */
+int zcomp_set_max_streams(struct zcomp *comp, int num_strm)
+{
+	struct zcomp_strm *zstrm;
+
+	if (num_strm < 1)
+		return -EINVAL;
+
+	spin_lock(&comp->strm_lock);
+	comp->max_strm = num_strm;
+	while (comp->avail_strm > num_strm &&
+			!list_empty(&comp->idle_strm)) {
+		zstrm = list_entry(comp->idle_strm.next,
+				struct zcomp_strm, list);
+		list_del(&zstrm->list);
+		comp->avail_strm--;
+		spin_unlock(&comp->strm_lock);
+		zcomp_strm_free(comp, zstrm);
+		spin_lock(&comp->strm_lock);
+	}
+	spin_unlock(&comp->strm_lock);
+
+	return 0;
+}
+
+u64 zcomp_strm_waits(struct zcomp *comp)
+{
+	u64 val;
+
+	spin_lock(&comp->strm_lock);
+	val = comp->strm_waits;
+	spin_unlock(&comp->strm_lock);
+
+	return val;
+}
+
+void zcomp_destroy(struct zcomp *comp)
+{
+	struct zcomp_strm *zstrm;
+
+	while (!list_empty(&comp->idle_strm)) {
+		zstrm = list_entry(comp->idle_strm.next,
+				struct zcomp_strm, list);
+		list_del(&zstrm->list);
+		zcomp_strm_free(comp, zstrm);
+	}
+	kfree(comp);
+}
+EXPORT_SYMBOL_GPL(zcomp_destroy);
+
+/*
+ * Create a stream pool for the named backend. One stream is
+ * allocated up front so that a writer can always make progress
+ * even under memory pressure.
+ */
+struct zcomp *zcomp_create(const char *compress, int max_strm)
+{
+	struct zcomp *comp;
+	struct zcomp_strm *zstrm;
+	struct zcomp_backend *backend;
+
+	backend = find_backend(compress);
+	if (!backend)
+		return ERR_PTR(-EINVAL);
+
+	comp = kzalloc(sizeof(*comp), GFP_KERNEL);
+	if (!comp)
+		return ERR_PTR(-ENOMEM);
+
+	comp->backend = backend;
+	spin_lock_init(&comp->strm_lock);
+	INIT_LIST_HEAD(&comp->idle_strm);
+	init_waitqueue_head(&comp->strm_wait);
+	comp->max_strm = max_strm > 0 ? max_strm : 1;
+
+	zstrm = zcomp_strm_alloc(comp);
+	if (!zstrm) {
+		kfree(comp);
+		return ERR_PTR(-ENOMEM);
+	}
+	list_add(&zstrm->list, &comp->idle_strm);
+	comp->avail_strm = 1;
+
+	return comp;
+}
+EXPORT_SYMBOL_GPL(zcomp_create);
@@ -0,0 +1,83 @@
+/*
+ * zram compression streams
+ *
+ * Copyright (C) 2026 LG Electronics, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#ifndef _ZCOMP_H_
+#define _ZCOMP_H_
+
+#include <linux/list.h>
+#include <linux/spinlock.h>
+#include <linux/types.h>
+#include <linux/wait.h>
+
+/*
+ * Compression stream: a compression buffer large enough to hold the
+ * worst-case output for one page plus the backend's working memory.
+ * Each reader or writer owns one stream for the duration of a page
+ * (de)compression.
+ */
+struct zcomp_strm {
+	void *buffer;
+	void *private;
+	struct list_head list;
+};
+
+/*
+ * Compression backend. compress() and decompress() always operate on
+ * a single page and return 0 on success. create() allocates the
+ * per-stream working memory passed to them as 'private'.
+ */
+struct zcomp_backend {
+	int (*compress)(const unsigned char *src, unsigned char *dst,
+			size_t *dst_len, void *private);
+
+	int (*decompress)(const unsigned char *src, size_t src_len,
+			unsigned char *dst, void *private);
+
+	void *(*create)(void);
+	void (*destroy)(void *private);
+
+	const char *name;
+};
+
+/*
+ * Pool of compression streams. Callers take an idle stream, or
+ * allocate a new one while fewer than max_strm exist, or sleep on
+ * strm_wait until somebody releases one.
+ */
+struct zcomp {
+	spinlock_t strm_lock;	/* protects idle_strm and counters below */
+	struct list_head idle_strm;
+	wait_queue_head_t strm_wait;
+	int avail_strm;		/* streams currently allocated */
+	int max_strm;		/* upper bound on avail_strm */
+	u64 strm_waits;		/* no. of times a caller had to sleep */
+
+	struct zcomp_backend *backend;
+};
+
+ssize_t zcomp_available_show(const char *comp, char *buf);
+bool zcomp_available_algorithm(const char *comp);
+
+struct zcomp *zcomp_create(const char *compress, int max_strm);
+void zcomp_destroy(struct zcomp *comp);
+
+struct zcomp_strm *zcomp_strm_find(struct zcomp *comp);
+void zcomp_strm_release(struct zcomp *comp, struct zcomp_strm *zstrm);
+
+int zcomp_compress(struct zcomp *comp, struct zcomp_strm *zstrm,
+			const unsigned char *src, size_t *dst_len);
+int zcomp_decompress(struct zcomp *comp, struct zcomp_strm *zstrm,
+			const unsigned char *src, size_t src_len,
+			unsigned char *dst);
+
+int zcomp_set_max_streams(struct zcomp *comp, int num_strm);
+u64 zcomp_strm_waits(struct zcomp *comp);
+
+#endif
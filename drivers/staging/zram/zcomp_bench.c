@@ -0,0 +1,239 @@
+/*
+ * zram compression backend benchmark
+ *
+ * Copyright (C) 2026 LG Electronics, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * Takes a snapshot of pages currently in use, spread evenly over all
+ * populated zones, and compresses them with each requested backend.
+ * Results are reported in the kernel log, e.g.:
+ *
+ *   modprobe zcomp_bench nr_pages=512 algos=lzo,lz4,zlib
+ */
+
+#define KMSG_COMPONENT "zcomp_bench"
+#define pr_fmt(fmt) KMSG_COMPONENT ": " fmt
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/err.h>
+#include <linux/highmem.h>
+#include <linux/hrtimer.h>
+#include <linux/math64.h>
+#include <linux/mm.h>
+#include <linux/mmzone.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/vmalloc.h>
+
+#include "zcomp.h"
+
+static unsigned int nr_pages = 256;
+static unsigned int iterations = 4;
+static char *algos = "lzo,lz4,zlib";
+
+static int page_zero_filled(const void *ptr)
+{
+	const unsigned long *page = ptr;
+	unsigned int pos;
+
+	for (pos = 0; pos != PAGE_SIZE / sizeof(*page); pos++) {
+		if (page[pos])
+			return 0;
+	}
+
+	return 1;
+}
+
+/*
+ * Copy up to 'count' in-use, non-zero pages into 'samples'. zram
+ * never compresses zero filled pages, so they are skipped.
+ */
+static unsigned int collect_samples(void *samples, unsigned int count)
+{
+	struct zone *zone;
+	unsigned long pfn, stride, spanned = 0;
+	unsigned int n = 0;
+
+	for_each_populated_zone(zone)
+		spanned += zone->spanned_pages;
+
+	/* Oversample to make up for free, reserved and zero pages */
+	stride = max(1UL, spanned / (4UL * count));
+
+	for_each_populated_zone(zone) {
+		unsigned long end = zone->zone_start_pfn + zone->spanned_pages;
+
+		for (pfn = zone->zone_start_pfn; pfn < end && n < count;
+				pfn += stride) {
+			struct page *page;
+			void *src, *dst;
+
+			if (!pfn_valid(pfn))
+				continue;
+
+			page = pfn_to_page(pfn);
+			if (!page_count(page) || PageReserved(page))
+				continue;
+
+			dst = samples + (size_t)n * PAGE_SIZE;
+			src = kmap_atomic(page, KM_USER0);
+			memcpy(dst, src, PAGE_SIZE);
+			kunmap_atomic(src, KM_USER0);
+
+			if (!page_zero_filled(dst))
+				n++;
+		}
+	}
+
+	return n;
+}
+
+static u64 mb_per_sec(u64 bytes, s64 ns)
+{
+	if (ns <= 0)
+		return 0;
+	return div64_u64(bytes * NSEC_PER_SEC, (u64)ns) >> 20;
+}
+
+static void bench_one(const char *name, void *samples, unsigned int count,
+			void *cbuf, size_t *clen, void *out)
+{
+	struct zcomp *comp;
+	struct zcomp_strm *zstrm;
+	ktime_t start;
+	s64 comp_ns, decomp_ns;
+	u64 total = 0;
+	unsigned int i, iter, stored = 0, failed = 0;
+
+	comp = zcomp_create(name, 1);
+	if (IS_ERR(comp)) {
+		pr_info("%s: not available (err=%ld)\n", name, PTR_ERR(comp));
+		return;
+	}
+	zstrm = zcomp_strm_find(comp);
+
+	start = ktime_get();
+	for (iter = 0; iter < iterations; iter++) {
+		for (i = 0; i < count; i++) {
+			if (zcomp_compress(comp, zstrm,
+					samples + (size_t)i * PAGE_SIZE,
+					&clen[i])) {
+				clen[i] = 0;
+				continue;
+			}
+			/* Keep the output for the decompression pass */
+			if (!iter)
+				memcpy(cbuf + (size_t)i * 2 * PAGE_SIZE,
+					zstrm->buffer, clen[i]);
+		}
+	}
+	comp_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	start = ktime_get();
+	for (iter = 0; iter < iterations; iter++) {
+		for (i = 0; i < count; i++) {
+			if (!clen[i])
+				continue;
+			if (zcomp_decompress(comp, zstrm,
+					cbuf + (size_t)i * 2 * PAGE_SIZE,
+					clen[i], out))
+				failed++;
+		}
+	}
+	decomp_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	for (i = 0; i < count; i++) {
+		if (!clen[i]) {
+			failed++;
+			continue;
+		}
+		/* zram stores poorly compressible pages as-is */
+		if (clen[i] <= PAGE_SIZE / 4 * 3) {
+			total += clen[i];
+			stored++;
+		} else {
+			total += PAGE_SIZE;
+		}
+		if (zcomp_decompress(comp, zstrm,
+				cbuf + (size_t)i * 2 * PAGE_SIZE,
+				clen[i], out) ||
+				memcmp(out, samples + (size_t)i * PAGE_SIZE,
+					PAGE_SIZE))
+			failed++;
+	}
+
+	zcomp_strm_release(comp, zstrm);
+	zcomp_destroy(comp);
+
+	pr_info("%s: compress %llu MB/s, decompress %llu MB/s, "
+		"ratio %llu%%, compressed %u/%u pages, errors %u\n",
+		name,
+		mb_per_sec((u64)count * iterations * PAGE_SIZE, comp_ns),
+		mb_per_sec((u64)count * iterations * PAGE_SIZE, decomp_ns),
+		div64_u64(total * 100, (u64)count * PAGE_SIZE),
+		stored, count, failed);
+}
+
+static int __init zcomp_bench_init(void)
+{
+	void *samples, *cbuf, *out;
+	size_t *clen;
+	char *list, *p, *name;
+	unsigned int count;
+	int ret = -ENOMEM;
+
+	if (!nr_pages || !iterations)
+		return -EINVAL;
+
+	samples = vmalloc((size_t)nr_pages * PAGE_SIZE);
+	cbuf = vmalloc((size_t)nr_pages * 2 * PAGE_SIZE);
+	clen = kcalloc(nr_pages, sizeof(*clen), GFP_KERNEL);
+	out = kmalloc(PAGE_SIZE, GFP_KERNEL);
+	list = kstrdup(algos, GFP_KERNEL);
+	if (!samples || !cbuf || !clen || !out || !list)
+		goto out;
+
+	count = collect_samples(samples, nr_pages);
+	if (!count) {
+		pr_info("no pages sampled\n");
+		ret = -ENODATA;
+		goto out;
+	}
+	pr_info("sampled %u pages, %u iterations\n", count, iterations);
+
+	p = list;
+	while ((name = strsep(&p, ",")) != NULL) {
+		if (*name)
+			bench_one(name, samples, count, cbuf, clen, out);
+	}
+	ret = 0;
+
+out:
+	kfree(list);
+	kfree(out);
+	kfree(clen);
+	vfree(cbuf);
+	vfree(samples);
+	return ret;
+}
+
+static void __exit zcomp_bench_exit(void)
+{
+}
+
+module_param(nr_pages, uint, 0);
+MODULE_PARM_DESC(nr_pages, "Number of in-use pages to sample");
+module_param(iterations, uint, 0);
+MODULE_PARM_DESC(iterations, "Passes over the sample per measurement");
+module_param(algos, charp, 0);
+MODULE_PARM_DESC(algos, "Comma separated list of backends to measure");
+
+module_init(zcomp_bench_init);
+module_exit(zcomp_bench_exit);
+
+MODULE_LICENSE("Dual BSD/GPL");
+MODULE_DESCRIPTION("zram compression backend benchmark");
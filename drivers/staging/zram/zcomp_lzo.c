@@ -0,0 +1,50 @@
+/*
+ * Copyright (C) 2026 LG Electronics, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/lzo.h>
+
+#include "zcomp_lzo.h"
+
+static void *zcomp_lzo_create(void)
+{
+	return kzalloc(LZO1X_MEM_COMPRESS, GFP_NOIO);
+}
+
+static void zcomp_lzo_destroy(void *private)
+{
+	kfree(private);
+}
+
+static int zcomp_lzo_compress(const unsigned char *src, unsigned char *dst,
+		size_t *dst_len, void *private)
+{
+	int ret;
+
+	ret = lzo1x_1_compress(src, PAGE_SIZE, dst, dst_len, private);
+	return ret == LZO_E_OK ? 0 : ret;
+}
+
+static int zcomp_lzo_decompress(const unsigned char *src, size_t src_len,
+		unsigned char *dst, void *private)
+{
+	size_t dst_len = PAGE_SIZE;
+	int ret;
+
+	ret = lzo1x_decompress_safe(src, src_len, dst, &dst_len);
+	return ret == LZO_E_OK ? 0 : ret;
+}
+
+struct zcomp_backend zcomp_lzo = {
+	.compress = zcomp_lzo_compress,
+	.decompress = zcomp_lzo_decompress,
+	.create = zcomp_lzo_create,
+	.destroy = zcomp_lzo_destroy,
+	.name = "lzo",
+};
@@ -0,0 +1,147 @@
+/*
+ * Copyright (C) 2026 LG Electronics, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/zlib.h>
+
+#include "zcomp_zlib.h"
+
+/*
+ * Raw deflate (no zlib header) with a window just large enough
+ * for a single page: zram never compresses across pages.
+ */
+#define ZLIB_LEVEL	Z_DEFAULT_COMPRESSION
+#define ZLIB_WINBITS	(PAGE_SHIFT > 15 ? 15 : PAGE_SHIFT)
+#define ZLIB_MEMLEVEL	7
+
+struct zcomp_zlib_ctx {
+	struct z_stream_s comp;
+	struct z_stream_s decomp;
+};
+
+static void zcomp_zlib_destroy(void *private)
+{
+	struct zcomp_zlib_ctx *ctx = private;
+
+	if (ctx->comp.workspace) {
+		zlib_deflateEnd(&ctx->comp);
+		vfree(ctx->comp.workspace);
+	}
+	if (ctx->decomp.workspace) {
+		zlib_inflateEnd(&ctx->decomp);
+		vfree(ctx->decomp.workspace);
+	}
+	kfree(ctx);
+}
+
+static void *zcomp_zlib_create(void)
+{
+	struct zcomp_zlib_ctx *ctx;
+
+	ctx = kzalloc(sizeof(*ctx), GFP_NOIO);
+	if (!ctx)
+		return NULL;
+
+	ctx->comp.workspace = __vmalloc(zlib_deflate_workspacesize(
+				-ZLIB_WINBITS, ZLIB_MEMLEVEL),
+				GFP_NOIO | __GFP_HIGHMEM, PAGE_KERNEL);
+	if (!ctx->comp.workspace)
+		goto fail;
+	if (zlib_deflateInit2(&ctx->comp, ZLIB_LEVEL, Z_DEFLATED,
+			-ZLIB_WINBITS, ZLIB_MEMLEVEL,
+			Z_DEFAULT_STRATEGY) != Z_OK) {
+		vfree(ctx->comp.workspace);
+		ctx->comp.workspace = NULL;
+		goto fail;
+	}
+
+	ctx->decomp.workspace = __vmalloc(zlib_inflate_workspacesize(),
+				GFP_NOIO | __GFP_HIGHMEM, PAGE_KERNEL);
+	if (!ctx->decomp.workspace)
+		goto fail;
+	if (zlib_inflateInit2(&ctx->decomp, -ZLIB_WINBITS) != Z_OK) {
+		vfree(ctx->decomp.workspace);
+		ctx->decomp.workspace = NULL;
+		goto fail;
+	}
+
+	return ctx;
+
+fail:
+	zcomp_zlib_destroy(ctx);
+	return NULL;
+}
+
+static int zcomp_zlib_compress(const unsigned char *src, unsigned char *dst,
+		size_t *dst_len, void *private)
+{
+	struct zcomp_zlib_ctx *ctx = private;
+	struct z_stream_s *stream = &ctx->comp;
+	int ret;
+
+	ret = zlib_deflateReset(stream);
+	if (ret != Z_OK)
+		return ret;
+
+	stream->next_in = (u8 *)src;
+	stream->avail_in = PAGE_SIZE;
+	stream->next_out = dst;
+	/* Stream buffers are two pages long */
+	stream->avail_out = 2 * PAGE_SIZE;
+
+	ret = zlib_deflate(stream, Z_FINISH);
+	if (ret != Z_STREAM_END)
+		return ret == Z_OK ? Z_BUF_ERROR : ret;
+
+	*dst_len = stream->total_out;
+	return 0;
+}
+
+static int zcomp_zlib_decompress(const unsigned char *src, size_t src_len,
+		unsigned char *dst, void *private)
+{
+	struct zcomp_zlib_ctx *ctx = private;
+	struct z_stream_s *stream = &ctx->decomp;
+	int ret;
+
+	ret = zlib_inflateReset(stream);
+	if (ret != Z_OK)
+		return ret;
+
+	stream->next_in = (u8 *)src;
+	stream->avail_in = src_len;
+	stream->next_out = dst;
+	stream->avail_out = PAGE_SIZE;
+
+	ret = zlib_inflate(stream, Z_SYNC_FLUSH);
+	/*
+	 * Raw deflate sometimes wants to taste an extra byte before
+	 * it reports the end of stream; see crypto/deflate.c.
+	 */
+	if (ret == Z_OK && !stream->avail_in && stream->avail_out) {
+		u8 zerostuff = 0;
+
+		stream->next_in = &zerostuff;
+		stream->avail_in = 1;
+		ret = zlib_inflate(stream, Z_FINISH);
+	}
+	if (ret != Z_STREAM_END)
+		return ret == Z_OK ? Z_DATA_ERROR : ret;
+
+	return stream->total_out == PAGE_SIZE ? 0 : Z_DATA_ERROR;
+}
+
+struct zcomp_backend zcomp_zlib = {
+	.compress = zcomp_zlib_compress,
+	.decompress = zcomp_zlib_decompress,
+	.create = zcomp_zlib_create,
+	.destroy = zcomp_zlib_destroy,
+	.name = "zlib",
+};
@@ -0,0 +1,217 @@
+/*
+ * Compressed RAM block device: same page deduplication
+ *
+ * Copyright (C) 2026 LG Electronics, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * Each stored object is hashed by the checksum of its uncompressed
+ * content into one of zram->hash_size buckets. A bucket is an rbtree
+ * sorted by checksum; several entries may share a checksum, so a
+ * candidate is only reused after its content compares equal.
+ */
+
+#include <linux/kernel.h>
+#include <linux/jhash.h>
+#include <linux/log2.h>
+#include <linux/string.h>
+#include <linux/vmalloc.h>
+
+#include "zram_drv.h"
+
+/* One hash bucket per this many disk pages */
+#define ZRAM_HASH_SHIFT		6
+#define ZRAM_HASH_SIZE_MAX	(1 << 16)
+
+static struct zram_hash *zram_dedup_hash(struct zram *zram, u32 checksum)
+{
+	return &zram->hash[checksum & (zram->hash_size - 1)];
+}
+
+u32 zram_dedup_checksum(unsigned char *mem)
+{
+	return jhash2((u32 *)mem, PAGE_SIZE / sizeof(u32), 0);
+}
+
+/*
+ * Compare 'mem' against the content of 'entry'. Compressed objects
+ * are decompressed into the stream buffer, which the caller owns and
+ * has not used yet.
+ */
+static int zram_dedup_match(struct zram *zram, struct zcomp_strm *zstrm,
+			struct zram_entry *entry, unsigned char *mem)
+{
+	int match = 0;
+	unsigned char *cmem;
+
+	cmem = zs_map_object(zram->mem_pool, entry->handle, ZS_MM_RO);
+	if (entry->len == PAGE_SIZE)
+		match = !memcmp(mem, cmem, PAGE_SIZE);
+	else if (!zcomp_decompress(zram->comp, zstrm, cmem, entry->len,
+				zstrm->buffer))
+		match = !memcmp(mem, zstrm->buffer, PAGE_SIZE);
+	zs_unmap_object(zram->mem_pool, entry->handle);
+
+	return match;
+}
+
+/* First entry with this checksum. Caller must hold hash->lock. */
+static struct zram_entry *zram_dedup_first(struct zram_hash *hash,
+			u32 checksum)
+{
+	struct zram_entry *entry;
+	struct rb_node *node, *prev;
+
+	node = hash->rb_root.rb_node;
+	while (node) {
+		entry = rb_entry(node, struct zram_entry, rb_node);
+		if (checksum == entry->checksum)
+			break;
+		node = checksum < entry->checksum ?
+				node->rb_left : node->rb_right;
+	}
+	if (!node)
+		return NULL;
+
+	/* Rewind to the first entry with this checksum */
+	while ((prev = rb_prev(node)) &&
+			rb_entry(prev, struct zram_entry,
+				rb_node)->checksum == checksum)
+		node = prev;
+
+	return rb_entry(node, struct zram_entry, rb_node);
+}
+
+/* Next entry with the same checksum. Caller must hold hash->lock. */
+static struct zram_entry *zram_dedup_next(struct zram_entry *entry)
+{
+	struct rb_node *node = rb_next(&entry->rb_node);
+	struct zram_entry *next;
+
+	if (!node)
+		return NULL;
+	next = rb_entry(node, struct zram_entry, rb_node);
+
+	return next->checksum == entry->checksum ? next : NULL;
+}
+
+/*
+ * Look for a stored object with the same content as 'mem'. On success
+ * a reference is taken on the returned entry.
+ *
+ * Candidates are compared without the bucket lock: a reference keeps
+ * each one hashed and its object allocated meanwhile.
+ */
+struct zram_entry *zram_dedup_find(struct zram *zram,
+			struct zcomp_strm *zstrm, unsigned char *mem,
+			u32 checksum)
+{
+	struct zram_hash *hash = zram_dedup_hash(zram, checksum);
+	struct zram_entry *entry, *next;
+
+	spin_lock(&hash->lock);
+	entry = zram_dedup_first(hash, checksum);
+	if (entry)
+		entry->refcount++;
+	spin_unlock(&hash->lock);
+
+	while (entry) {
+		if (zram_dedup_match(zram, zstrm, entry, mem))
+			return entry;
+
+		spin_lock(&hash->lock);
+		next = zram_dedup_next(entry);
+		if (next)
+			next->refcount++;
+		spin_unlock(&hash->lock);
+
+		zram_entry_unpin(zram, entry);
+		entry = next;
+	}
+
+	return NULL;
+}
+
+/*
+ * Make a newly stored entry visible to zram_dedup_find(). The object
+ * content must already be written.
+ */
+void zram_dedup_insert(struct zram *zram, struct zram_entry *entry,
+			u32 checksum)
+{
+	struct zram_hash *hash = zram_dedup_hash(zram, checksum);
+	struct rb_node **link, *parent = NULL;
+	struct zram_entry *cur;
+
+	entry->checksum = checksum;
+
+	spin_lock(&hash->lock);
+	link = &hash->rb_root.rb_node;
+	while (*link) {
+		parent = *link;
+		cur = rb_entry(parent, struct zram_entry, rb_node);
+		if (checksum < cur->checksum)
+			link = &parent->rb_left;
+		else
+			link = &parent->rb_right;
+	}
+	rb_link_node(&entry->rb_node, parent, link);
+	rb_insert_color(&entry->rb_node, &hash->rb_root);
+	spin_unlock(&hash->lock);
+}
+
+/*
+ * Drop a reference and return the number left. Once it reaches zero
+ * the entry is unhashed and the caller must free it.
+ */
+unsigned long zram_dedup_put(struct zram *zram, struct zram_entry *entry)
+{
+	struct zram_hash *hash;
+	unsigned long refcount;
+
+	/* Never hashed, so nobody else can find it */
+	if (RB_EMPTY_NODE(&entry->rb_node))
+		return --entry->refcount;
+
+	hash = zram_dedup_hash(zram, entry->checksum);
+	spin_lock(&hash->lock);
+	refcount = --entry->refcount;
+	if (!refcount)
+		rb_erase(&entry->rb_node, &hash->rb_root);
+	spin_unlock(&hash->lock);
+
+	return refcount;
+}
+
+int zram_dedup_init(struct zram *zram, size_t num_pages)
+{
+	size_t i;
+
+	zram->hash_size = num_pages >> ZRAM_HASH_SHIFT;
+	zram->hash_size = clamp_t(size_t, zram->hash_size, 1,
+				ZRAM_HASH_SIZE_MAX);
+	zram->hash_size = roundup_pow_of_two(zram->hash_size);
+
+	zram->hash = vzalloc(zram->hash_size * sizeof(*zram->hash));
+	if (!zram->hash) {
+		zram->hash_size = 0;
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < zram->hash_size; i++) {
+		spin_lock_init(&zram->hash[i].lock);
+		zram->hash[i].rb_root = RB_ROOT;
+	}
+
+	return 0;
+}
+
+/* All entries must have been put by now */
+void zram_dedup_fini(struct zram *zram)
+{
+	vfree(zram->hash);
+	zram->hash = NULL;
+	zram->hash_size = 0;
+}
@@ -28,8 +28,10 @@
 #include <linux/device.h>
 #include <linux/genhd.h>
 #include <linux/highmem.h>
+#include <linux/jiffies.h>
 #include <linux/slab.h>
-#include <linux/lzo.h>
+#include <linux/cpumask.h>
+#include <linux/err.h>
 #include <linux/string.h>
 #include <linux/vmalloc.h>
 
@@ -38,18 +40,21 @@
 /* Globals */
 static int zram_major;
 struct zram *devices;
+static struct kmem_cache *zram_entry_cache;
+static struct workqueue_struct *zram_wb_wq;
+static struct workqueue_struct *zram_io_wq;
 
 /* Module params (documentation at end) */
 unsigned int num_devices;
 
-static void zram_stat_inc(u32 *v)
+static void zram_stat_inc(atomic_t *v)
 {
-	*v = *v + 1;
+	atomic_inc(v);
 }
 
-static void zram_stat_dec(u32 *v)
+static void zram_stat_dec(atomic_t *v)
 {
-	*v = *v - 1;
+	atomic_dec(v);
 }
 
 static void zram_stat64_add(struct zram *zram, u64 *v, u64 inc)
@@ -89,6 +94,18 @@ static void zram_clear_flag(struct zram *zram, u32 index,
 	zram->table[index].flags &= ~BIT(flag);
 }
 
+/* Coarse time stamp for idle page tracking */
+static u32 zram_now(void)
+{
+	return div_u64(get_jiffies_64(), HZ);
+}
+
+static void zram_update_access(struct zram *zram, u32 index)
+{
+	if (zram->bdev)
+		zram->table[index].ac_time = zram_now();
+}
+
 static int page_zero_filled(void *ptr)
 {
 	unsigned int pos;
@@ -133,15 +150,98 @@ static void zram_set_disksize(struct zram *zram, size_t totalram_bytes)
 	zram->disksize &= PAGE_MASK;
 }
 
+static struct zram_entry *zram_entry_alloc(struct zram *zram, size_t len)
+{
+	struct zram_entry *entry;
+
+	entry = kmem_cache_alloc(zram_entry_cache, GFP_NOIO);
+	if (!entry)
+		return NULL;
+
+	entry->handle = zs_malloc(zram->mem_pool, len);
+	if (!entry->handle) {
+		kmem_cache_free(zram_entry_cache, entry);
+		return NULL;
+	}
+
+	RB_CLEAR_NODE(&entry->rb_node);
+	entry->refcount = 1;
+	entry->checksum = 0;
+	entry->len = len;
+
+	return entry;
+}
+
+static void zram_entry_free(struct zram *zram, struct zram_entry *entry)
+{
+	zram_stat64_sub(zram, &zram->stats.compr_size, entry->len);
+	zs_free(zram->mem_pool, entry->handle);
+	kmem_cache_free(zram_entry_cache, entry);
+}
+
+/* Drop a table reference; the object goes with the last one */
+static void zram_entry_put(struct zram *zram, struct zram_entry *entry)
+{
+	if (zram_dedup_put(zram, entry)) {
+		zram_stat64_sub(zram, &zram->stats.dedup_saved, entry->len);
+		return;
+	}
+
+	zram_entry_free(zram, entry);
+}
+
+/*
+ * Drop the reference zram_dedup_find() holds while comparing a
+ * candidate. If all table references went meanwhile, the last one
+ * was accounted as a saved duplicate: undo that and free the object.
+ */
+void zram_entry_unpin(struct zram *zram, struct zram_entry *entry)
+{
+	if (zram_dedup_put(zram, entry))
+		return;
+
+	zram_stat64_add(zram, &zram->stats.dedup_saved, entry->len);
+	zram_entry_free(zram, entry);
+}
+
+/* Release the in-memory object of a stored page */
+static void zram_free_object(struct zram *zram, size_t index)
+{
+	struct zram_entry *entry = zram->table[index].entry;
+
+	if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
+		zram_clear_flag(zram, index, ZRAM_UNCOMPRESSED);
+		zram_stat_dec(&zram->stats.pages_expand);
+	} else if (entry->len <= PAGE_SIZE / 2) {
+		zram_stat_dec(&zram->stats.good_compress);
+	}
+
+	zram_entry_put(zram, entry);
+	zram->table[index].entry = NULL;
+}
+
+/*
+ * Free memory associated with the given table entry.
+ * Caller must hold zram->tb_lock for write.
+ */
 static void zram_free_page(struct zram *zram, size_t index)
 {
-	u32 clen;
-	void *obj;
+	struct zram_entry *entry;
 
-	struct page *page = zram->table[index].page;
-	u32 offset = zram->table[index].offset;
+	/* Make a writeback of this page in progress discard its copy */
+	zram_clear_flag(zram, index, ZRAM_UNDER_WB);
 
-	if (unlikely(!page)) {
+	if (unlikely(zram_test_flag(zram, index, ZRAM_WB))) {
+		zram_clear_flag(zram, index, ZRAM_WB);
+		clear_bit(zram->table[index].block, zram->bd_map);
+		zram_stat_dec(&zram->stats.bd_count);
+		zram_stat_dec(&zram->stats.pages_stored);
+		zram->table[index].entry = NULL;
+		return;
+	}
+
+	entry = zram->table[index].entry;
+	if (unlikely(!entry)) {
 		/*
 		 * No memory is allocated for zero filled pages.
 		 * Simply clear zero page flag.
@@ -153,28 +253,8 @@ static void zram_free_page(struct zram *zram, size_t index)
 		return;
 	}
 
-	if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
-		clen = PAGE_SIZE;
-		__free_page(page);
-		zram_clear_flag(zram, index, ZRAM_UNCOMPRESSED);
-		zram_stat_dec(&zram->stats.pages_expand);
-		goto out;
-	}
-
-	obj = kmap_atomic(page, KM_USER0) + offset;
-	clen = xv_get_object_size(obj) - sizeof(struct zobj_header);
-	kunmap_atomic(obj, KM_USER0);
-
-	xv_free(zram->mem_pool, page, offset);
-	if (clen <= PAGE_SIZE / 2)
-		zram_stat_dec(&zram->stats.good_compress);
-
-out:
-	zram_stat64_sub(zram, &zram->stats.compr_size, clen);
+	zram_free_object(zram, index);
 	zram_stat_dec(&zram->stats.pages_stored);
-
-	zram->table[index].page = NULL;
-	zram->table[index].offset = 0;
 }
 
 static void handle_zero_page(struct page *page)
@@ -191,209 +271,463 @@ static void handle_zero_page(struct page *page)
 static void handle_uncompressed_page(struct zram *zram,
 				struct page *page, u32 index)
 {
+	unsigned long handle = zram->table[index].entry->handle;
 	unsigned char *user_mem, *cmem;
 
 	user_mem = kmap_atomic(page, KM_USER0);
-	cmem = kmap_atomic(zram->table[index].page, KM_USER1) +
-			zram->table[index].offset;
+	cmem = zs_map_object(zram->mem_pool, handle, ZS_MM_RO);
 
 	memcpy(user_mem, cmem, PAGE_SIZE);
+	zs_unmap_object(zram->mem_pool, handle);
 	kunmap_atomic(user_mem, KM_USER0);
-	kunmap_atomic(cmem, KM_USER1);
 
 	flush_dcache_page(page);
 }
 
-static void zram_read(struct zram *zram, struct bio *bio)
+struct zram_bd_io {
+	atomic_t pending;
+	struct completion done;
+	int error;
+};
+
+static void zram_bd_end_io(struct bio *bio, int err)
 {
+	struct zram_bd_io *io = bio->bi_private;
+
+	if (err || !test_bit(BIO_UPTODATE, &bio->bi_flags))
+		io->error = err ? err : -EIO;
+	if (atomic_dec_and_test(&io->pending))
+		complete(&io->done);
+	bio_put(bio);
+}
 
+/*
+ * Transfer pages[i] from/to backing block blocks[i] and wait for
+ * completion. Runs of consecutive blocks go out as one bio.
+ */
+static int zram_bd_rw(struct zram *zram, int rw, struct page **pages,
+			unsigned long *blocks, int nr)
+{
 	int i;
-	u32 index;
-	struct bio_vec *bvec;
+	struct zram_bd_io io;
+	struct blk_plug plug;
+	struct bio *bio = NULL;
+
+	atomic_set(&io.pending, 1);
+	init_completion(&io.done);
+	io.error = 0;
+
+	blk_start_plug(&plug);
+	for (i = 0; i < nr; i++) {
+		if (bio && blocks[i] == blocks[i - 1] + 1 &&
+				bio_add_page(bio, pages[i], PAGE_SIZE, 0))
+			continue;
 
-	zram_stat64_inc(zram, &zram->stats.num_reads);
-	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
+		if (bio)
+			submit_bio(rw, bio);
 
-	bio_for_each_segment(bvec, bio, i) {
-		int ret;
-		size_t clen;
-		struct page *page;
-		struct zobj_header *zheader;
-		unsigned char *user_mem, *cmem;
+		bio = bio_alloc(GFP_NOIO, nr - i);
+		bio->bi_bdev = zram->bdev;
+		bio->bi_sector = (sector_t)blocks[i] << SECTORS_PER_PAGE_SHIFT;
+		bio->bi_end_io = zram_bd_end_io;
+		bio->bi_private = &io;
+		bio_add_page(bio, pages[i], PAGE_SIZE, 0);
+		atomic_inc(&io.pending);
+	}
+	if (bio)
+		submit_bio(rw, bio);
+	blk_finish_plug(&plug);
 
-		page = bvec->bv_page;
+	if (!atomic_dec_and_test(&io.pending))
+		wait_for_completion(&io.done);
 
-		if (zram_test_flag(zram, index, ZRAM_ZERO)) {
-			handle_zero_page(page);
-			index++;
-			continue;
-		}
+	return io.error;
+}
 
-		/* Requested page is not present in compressed area */
-		if (unlikely(!zram->table[index].page)) {
-			pr_debug("Read before write: sector=%lu, size=%u",
-				(ulong)(bio->bi_sector), bio->bi_size);
-			handle_zero_page(page);
-			index++;
-			continue;
-		}
+struct zram_bd_read_work {
+	struct work_struct work;
+	struct zram *zram;
+	struct page *page;
+	unsigned long block;
+	int ret;
+};
 
-		/* Page is stored uncompressed since it's incompressible */
-		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
-			handle_uncompressed_page(zram, page, index);
-			index++;
-			continue;
-		}
+static void zram_bd_read_fn(struct work_struct *work)
+{
+	struct zram_bd_read_work *rw;
 
-		user_mem = kmap_atomic(page, KM_USER0);
-		clen = PAGE_SIZE;
+	rw = container_of(work, struct zram_bd_read_work, work);
+	rw->ret = zram_bd_rw(rw->zram, READ, &rw->page, &rw->block, 1);
+}
 
-		cmem = kmap_atomic(zram->table[index].page, KM_USER1) +
-				zram->table[index].offset;
+/*
+ * Read a written back page. Returns -EAGAIN if the page was freed or
+ * rewritten while the read was in flight.
+ */
+static int zram_bd_read(struct zram *zram, struct page *page, u32 index,
+			unsigned long block)
+{
+	struct zram_bd_read_work rw;
+	int ret = 0;
 
-		ret = lzo1x_decompress_safe(
-			cmem + sizeof(*zheader),
-			xv_get_object_size(cmem) - sizeof(*zheader),
-			user_mem, &clen);
+	/*
+	 * Bios submitted from make_request are only dispatched once it
+	 * returns, so waiting for one here would deadlock. Let a worker
+	 * do the I/O instead.
+	 */
+	rw.zram = zram;
+	rw.page = page;
+	rw.block = block;
+	INIT_WORK_ONSTACK(&rw.work, zram_bd_read_fn);
+	queue_work(zram_wb_wq, &rw.work);
+	flush_work(&rw.work);
+	destroy_work_on_stack(&rw.work);
+	if (rw.ret)
+		return rw.ret;
+
+	zram_stat64_inc(zram, &zram->stats.bd_reads);
+
+	read_lock(&zram->tb_lock);
+	if (!zram_test_flag(zram, index, ZRAM_WB) ||
+			zram->table[index].block != block)
+		ret = -EAGAIN;
+	read_unlock(&zram->tb_lock);
 
-		kunmap_atomic(user_mem, KM_USER0);
-		kunmap_atomic(cmem, KM_USER1);
+	flush_dcache_page(page);
+	return ret;
+}
+
+static int zram_bvec_read(struct zram *zram, struct page *page, u32 index)
+{
+	int ret;
+	struct zcomp_strm *zstrm = NULL;
+	struct zram_entry *entry;
+	unsigned char *user_mem, *cmem;
 
-		/* Should NEVER happen. Return bio error if it does. */
-		if (unlikely(ret != LZO_E_OK)) {
-			pr_err("Decompression failed! err=%d, page=%u\n",
-				ret, index);
+retry:
+	read_lock(&zram->tb_lock);
+	zram_update_access(zram, index);
+
+	/* Page was written back: fetch it from the backing device */
+	if (unlikely(zram_test_flag(zram, index, ZRAM_WB))) {
+		unsigned long block = zram->table[index].block;
+
+		read_unlock(&zram->tb_lock);
+		if (zstrm) {
+			zcomp_strm_release(zram->comp, zstrm);
+			zstrm = NULL;
+		}
+
+		ret = zram_bd_read(zram, page, index, block);
+		if (ret == -EAGAIN)
+			goto retry;
+		if (unlikely(ret)) {
+			pr_err("Backing device read failed! err=%d, "
+				"page=%u\n", ret, index);
 			zram_stat64_inc(zram, &zram->stats.failed_reads);
-			goto out;
 		}
+		return ret;
+	}
 
-		flush_dcache_page(page);
-		index++;
+	entry = zram->table[index].entry;
+	if (zram_test_flag(zram, index, ZRAM_ZERO) || unlikely(!entry)) {
+		read_unlock(&zram->tb_lock);
+		if (zstrm)
+			zcomp_strm_release(zram->comp, zstrm);
+		if (!entry && !zram_test_flag(zram, index, ZRAM_ZERO))
+			pr_debug("Read before write: page=%u\n", index);
+		handle_zero_page(page);
+		return 0;
 	}
 
-	set_bit(BIO_UPTODATE, &bio->bi_flags);
-	bio_endio(bio, 0);
-	return;
+	/* Page is stored uncompressed since it's incompressible */
+	if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
+		handle_uncompressed_page(zram, page, index);
+		read_unlock(&zram->tb_lock);
+		if (zstrm)
+			zcomp_strm_release(zram->comp, zstrm);
+		return 0;
+	}
 
-out:
-	bio_io_error(bio);
+	/*
+	 * Only compressed pages need a stream. Waiting for one may
+	 * sleep, so drop the table lock and look at the page again.
+	 */
+	if (!zstrm) {
+		read_unlock(&zram->tb_lock);
+		zstrm = zcomp_strm_find(zram->comp);
+		if (unlikely(!zstrm)) {
+			pr_info("Error allocating compression stream\n");
+			zram_stat64_inc(zram, &zram->stats.failed_reads);
+			return -ENOMEM;
+		}
+		goto retry;
+	}
+
+	user_mem = kmap_atomic(page, KM_USER0);
+	cmem = zs_map_object(zram->mem_pool, entry->handle, ZS_MM_RO);
+
+	ret = zcomp_decompress(zram->comp, zstrm, cmem, entry->len, user_mem);
+
+	zs_unmap_object(zram->mem_pool, entry->handle);
+	kunmap_atomic(user_mem, KM_USER0);
+	read_unlock(&zram->tb_lock);
+	zcomp_strm_release(zram->comp, zstrm);
+
+	/* Should NEVER happen. Return bio error if it does. */
+	if (unlikely(ret)) {
+		pr_err("Decompression failed! err=%d, page=%u\n", ret, index);
+		zram_stat64_inc(zram, &zram->stats.failed_reads);
+		return ret;
+	}
+
+	flush_dcache_page(page);
+	return 0;
 }
 
-static void zram_write(struct zram *zram, struct bio *bio)
+static int zram_bvec_write(struct zram *zram, struct page *page, u32 index)
 {
-	int i;
-	u32 index;
-	struct bio_vec *bvec;
-
-	zram_stat64_inc(zram, &zram->stats.num_writes);
-	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
+	int ret;
+	u32 checksum = 0;
+	size_t clen;
+	struct zram_entry *entry;
+	struct zcomp_strm *zstrm;
+	unsigned char *user_mem, *cmem, *src;
 
-	bio_for_each_segment(bvec, bio, i) {
-		int ret;
-		u32 offset;
-		size_t clen;
-		struct zobj_header *zheader;
-		struct page *page, *page_store;
-		unsigned char *user_mem, *cmem, *src;
+	/*
+	 * Grab a compression stream before mapping the page:
+	 * we may have to sleep until another writer releases one.
+	 */
+	zstrm = zcomp_strm_find(zram->comp);
+	if (unlikely(!zstrm)) {
+		pr_info("Error allocating compression stream\n");
+		zram_stat64_inc(zram, &zram->stats.failed_writes);
+		return -ENOMEM;
+	}
+	src = zstrm->buffer;
 
-		page = bvec->bv_page;
-		src = zram->compress_buffer;
+	user_mem = kmap_atomic(page, KM_USER0);
+	if (page_zero_filled(user_mem)) {
+		kunmap_atomic(user_mem, KM_USER0);
+		zcomp_strm_release(zram->comp, zstrm);
 
 		/*
-		 * System overwrites unused sectors. Free memory associated
-		 * with this sector now.
+		 * System overwrites unused sectors. Free memory
+		 * associated with this sector now.
 		 */
-		if (zram->table[index].page ||
-				zram_test_flag(zram, index, ZRAM_ZERO))
-			zram_free_page(zram, index);
+		write_lock(&zram->tb_lock);
+		zram_free_page(zram, index);
+		zram_set_flag(zram, index, ZRAM_ZERO);
+		zram_update_access(zram, index);
+		write_unlock(&zram->tb_lock);
 
-		mutex_lock(&zram->lock);
+		zram_stat_inc(&zram->stats.pages_zero);
+		return 0;
+	}
 
-		user_mem = kmap_atomic(page, KM_USER0);
-		if (page_zero_filled(user_mem)) {
+	/* Share the object of an identical page, if one is stored */
+	if (zram->use_dedup) {
+		checksum = zram_dedup_checksum(user_mem);
+		entry = zram_dedup_find(zram, zstrm, user_mem, checksum);
+		if (entry) {
 			kunmap_atomic(user_mem, KM_USER0);
-			mutex_unlock(&zram->lock);
-			zram_stat_inc(&zram->stats.pages_zero);
-			zram_set_flag(zram, index, ZRAM_ZERO);
-			index++;
-			continue;
+			zcomp_strm_release(zram->comp, zstrm);
+			clen = entry->len;
+			zram_stat64_inc(zram, &zram->stats.dedup_hits);
+			zram_stat64_add(zram, &zram->stats.dedup_saved, clen);
+			goto found;
 		}
+	}
 
-		ret = lzo1x_1_compress(user_mem, PAGE_SIZE, src, &clen,
-					zram->compress_workmem);
+	ret = zcomp_compress(zram->comp, zstrm, user_mem, &clen);
 
-		kunmap_atomic(user_mem, KM_USER0);
+	kunmap_atomic(user_mem, KM_USER0);
 
-		if (unlikely(ret != LZO_E_OK)) {
-			mutex_unlock(&zram->lock);
-			pr_err("Compression failed! err=%d\n", ret);
-			zram_stat64_inc(zram, &zram->stats.failed_writes);
-			goto out;
-		}
+	if (unlikely(ret)) {
+		zcomp_strm_release(zram->comp, zstrm);
+		pr_err("Compression failed! err=%d\n", ret);
+		zram_stat64_inc(zram, &zram->stats.failed_writes);
+		return ret;
+	}
 
-		/*
-		 * Page is incompressible. Store it as-is (uncompressed)
-		 * since we do not want to return too many disk write
-		 * errors which has side effect of hanging the system.
-		 */
-		if (unlikely(clen > max_zpage_size)) {
-			clen = PAGE_SIZE;
-			page_store = alloc_page(GFP_NOIO | __GFP_HIGHMEM);
-			if (unlikely(!page_store)) {
-				mutex_unlock(&zram->lock);
-				pr_info("Error allocating memory for "
-					"incompressible page: %u\n", index);
-				zram_stat64_inc(zram,
-					&zram->stats.failed_writes);
-				goto out;
-			}
+	/*
+	 * Page is incompressible. Store it as-is (uncompressed)
+	 * since we do not want to return too many disk write
+	 * errors which has side effect of hanging the system.
+	 */
+	if (unlikely(clen > max_zpage_size))
+		clen = PAGE_SIZE;
 
-			offset = 0;
-			zram_set_flag(zram, index, ZRAM_UNCOMPRESSED);
-			zram_stat_inc(&zram->stats.pages_expand);
-			zram->table[index].page = page_store;
-			src = kmap_atomic(page, KM_USER0);
-			goto memstore;
-		}
+	entry = zram_entry_alloc(zram, clen);
+	if (!entry) {
+		zcomp_strm_release(zram->comp, zstrm);
+		pr_info("Error allocating memory for compressed "
+			"page: %u, size=%zu\n", index, clen);
+		zram_stat64_inc(zram, &zram->stats.failed_writes);
+		return -ENOMEM;
+	}
 
-		if (xv_malloc(zram->mem_pool, clen + sizeof(*zheader),
-				&zram->table[index].page, &offset,
-				GFP_NOIO | __GFP_HIGHMEM)) {
-			mutex_unlock(&zram->lock);
-			pr_info("Error allocating memory for compressed "
-				"page: %u, size=%zu\n", index, clen);
-			zram_stat64_inc(zram, &zram->stats.failed_writes);
-			goto out;
-		}
+	cmem = zs_map_object(zram->mem_pool, entry->handle, ZS_MM_WO);
+	if (unlikely(clen == PAGE_SIZE))
+		src = kmap_atomic(page, KM_USER0);
+	memcpy(cmem, src, clen);
+	if (unlikely(clen == PAGE_SIZE))
+		kunmap_atomic(src, KM_USER0);
+	zs_unmap_object(zram->mem_pool, entry->handle);
+	zcomp_strm_release(zram->comp, zstrm);
+
+	zram_stat64_add(zram, &zram->stats.compr_size, clen);
+	if (zram->use_dedup)
+		zram_dedup_insert(zram, entry, checksum);
+
+found:
+	/*
+	 * Free memory associated with this sector now and
+	 * install the new object.
+	 */
+	write_lock(&zram->tb_lock);
+	zram_free_page(zram, index);
+	zram->table[index].entry = entry;
+	zram_update_access(zram, index);
+	if (unlikely(clen == PAGE_SIZE)) {
+		zram_set_flag(zram, index, ZRAM_UNCOMPRESSED);
+		zram_stat_inc(&zram->stats.pages_expand);
+		if (zram->wb_huge_map)
+			set_bit(index, zram->wb_huge_map);
+	}
+	write_unlock(&zram->tb_lock);
 
-memstore:
-		zram->table[index].offset = offset;
+	/*
+	 * Incompressible pages are better off on the backing device.
+	 * Write them back once there are enough for a batch.
+	 */
+	if (unlikely(clen == PAGE_SIZE) && zram->wb_huge_map &&
+	    atomic_inc_return(&zram->wb_huge_count) == ZRAM_WB_BATCH)
+		queue_work(zram_wb_wq, &zram->wb_work);
 
-		cmem = kmap_atomic(zram->table[index].page, KM_USER1) +
-				zram->table[index].offset;
+	/* Update stats */
+	zram_stat_inc(&zram->stats.pages_stored);
+	if (clen <= PAGE_SIZE / 2)
+		zram_stat_inc(&zram->stats.good_compress);
 
-#if 0
-		/* Back-reference needed for memory defragmentation */
-		if (!zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)) {
-			zheader = (struct zobj_header *)cmem;
-			zheader->table_idx = index;
-			cmem += sizeof(*zheader);
-		}
-#endif
+	return 0;
+}
 
-		memcpy(cmem, src, clen);
+static int zram_bvec_rw(struct zram *zram, struct page *page, u32 index,
+			int rw)
+{
+	if (rw == READ)
+		return zram_bvec_read(zram, page, index);
 
-		kunmap_atomic(cmem, KM_USER1);
-		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)))
-			kunmap_atomic(src, KM_USER0);
+	return zram_bvec_write(zram, page, index);
+}
+
+/*
+ * A multi-page bio handled by async_io: each page is a work item on
+ * zram_io_wq, and the bio completes when the last one finishes.
+ */
+struct zram_page_work {
+	struct work_struct work;
+	struct zram_io_ctx *ctx;
+	struct page *page;
+	u32 index;
+};
+
+struct zram_io_ctx {
+	struct zram *zram;
+	struct bio *bio;
+	int rw;
+	int error;
+	atomic_t pending;	/* pages not yet done */
+	struct zram_page_work works[0];
+};
+
+static void zram_page_work_fn(struct work_struct *work)
+{
+	struct zram_page_work *pw;
+	struct zram_io_ctx *ctx;
+	struct bio *bio;
+	int error;
 
-		/* Update stats */
-		zram_stat64_add(zram, &zram->stats.compr_size, clen);
-		zram_stat_inc(&zram->stats.pages_stored);
-		if (clen <= PAGE_SIZE / 2)
-			zram_stat_inc(&zram->stats.good_compress);
+	pw = container_of(work, struct zram_page_work, work);
+	ctx = pw->ctx;
 
-		mutex_unlock(&zram->lock);
+	if (zram_bvec_rw(ctx->zram, pw->page, pw->index, ctx->rw))
+		ctx->error = -EIO;
+
+	if (!atomic_dec_and_test(&ctx->pending))
+		return;
+
+	bio = ctx->bio;
+	error = ctx->error;
+	kfree(ctx);
+
+	if (error) {
+		bio_io_error(bio);
+		return;
+	}
+	set_bit(BIO_UPTODATE, &bio->bi_flags);
+	bio_endio(bio, 0);
+}
+
+/*
+ * Hand the pages of 'bio' to the I/O workers. The submitter does the
+ * first page itself rather than sit idle. Returns 0 if the bio was
+ * taken over.
+ */
+static int zram_rw_async(struct zram *zram, struct bio *bio, int rw,
+			u32 index)
+{
+	int i, nr = bio_segments(bio);
+	struct bio_vec *bvec;
+	struct zram_io_ctx *ctx;
+
+	ctx = kmalloc(sizeof(*ctx) + nr * sizeof(ctx->works[0]),
+			GFP_NOIO | __GFP_NOWARN);
+	if (!ctx)
+		return -ENOMEM;
+
+	ctx->zram = zram;
+	ctx->bio = bio;
+	ctx->rw = rw;
+	ctx->error = 0;
+	atomic_set(&ctx->pending, nr);
+
+	bio_for_each_segment(bvec, bio, i) {
+		struct zram_page_work *pw = &ctx->works[i - bio->bi_idx];
+
+		pw->ctx = ctx;
+		pw->page = bvec->bv_page;
+		pw->index = index++;
+		INIT_WORK(&pw->work, zram_page_work_fn);
+		if (pw != ctx->works)
+			queue_work(zram_io_wq, &pw->work);
+	}
+	zram_page_work_fn(&ctx->works[0].work);
+
+	return 0;
+}
+
+static void __zram_make_request(struct zram *zram, struct bio *bio, int rw)
+{
+	int i;
+	u32 index;
+	struct bio_vec *bvec;
+
+	if (rw == READ)
+		zram_stat64_inc(zram, &zram->stats.num_reads);
+	else
+		zram_stat64_inc(zram, &zram->stats.num_writes);
+
+	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
+
+	if (zram->async_io && bio_segments(bio) > 1 &&
+			!zram_rw_async(zram, bio, rw, index))
+		return;
+
+	bio_for_each_segment(bvec, bio, i) {
+		if (zram_bvec_rw(zram, bvec->bv_page, index, rw))
+			goto out;
 		index++;
 	}
 
@@ -440,60 +774,394 @@ static int zram_make_request(struct request_queue *queue, struct bio *bio)
 		return 0;
 	}
 
-	switch (bio_data_dir(bio)) {
-	case READ:
-		zram_read(zram, bio);
-		break;
+	__zram_make_request(zram, bio, bio_data_dir(bio));
+
+	return 0;
+}
+
+/*
+ * Migrate objects out of sparsely used zspages and give the freed
+ * pages back. Returns the number of pages freed.
+ */
+unsigned long zram_compact(struct zram *zram)
+{
+	unsigned long freed;
+
+	freed = zs_compact(zram->mem_pool);
+	zram_stat64_add(zram, &zram->stats.pages_compacted, freed);
+
+	return freed;
+}
 
-	case WRITE:
-		zram_write(zram, bio);
-		break;
+/*
+ * Shrinker callback: report how many pages compaction could free
+ * and compact up to nr_to_scan of them when asked to scan. Reclaim
+ * never waits for a compaction already running.
+ */
+static int zram_shrink(struct shrinker *shrinker, struct shrink_control *sc)
+{
+	struct zram *zram = container_of(shrinker, struct zram, shrinker);
+	long freed;
+
+	if (sc->nr_to_scan) {
+		if (!(sc->gfp_mask & __GFP_WAIT))
+			return -1;
+		freed = zs_shrink(zram->mem_pool, sc->nr_to_scan);
+		if (freed <= 0)
+			return -1;
+		zram_stat64_add(zram, &zram->stats.pages_compacted, freed);
 	}
 
+	return min_t(unsigned long, zs_compactable_pages(zram->mem_pool),
+			INT_MAX);
+}
+
+static unsigned long zram_bd_alloc_block(struct zram *zram)
+{
+	unsigned long block;
+
+	block = find_next_zero_bit(zram->bd_map, zram->bd_nr_blocks,
+				zram->bd_next);
+	if (block >= zram->bd_nr_blocks)
+		block = find_next_zero_bit(zram->bd_map, zram->bd_nr_blocks,
+					0);
+	if (block >= zram->bd_nr_blocks)
+		return block;
+
+	set_bit(block, zram->bd_map);
+	zram->bd_next = block + 1;
+
+	return block;
+}
+
+static int zram_wb_candidate(struct zram *zram, u32 index, int mode,
+			u32 now)
+{
+	struct table *t = &zram->table[index];
+
+	if (t->flags & (BIT(ZRAM_WB) | BIT(ZRAM_UNDER_WB)) || !t->entry)
+		return 0;
+
+	/* Writing back a shared object would not free it */
+	if (t->entry->refcount > 1)
+		return 0;
+
+	if ((mode & ZRAM_WB_HUGE) &&
+			zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))
+		return 1;
+
+	if ((mode & ZRAM_WB_IDLE) && zram->wb_idle_age &&
+			now - t->ac_time >= zram->wb_idle_age)
+		return 1;
+
 	return 0;
 }
 
-void zram_reset_device(struct zram *zram)
+/* Decompress a stored page into 'page'. Caller holds tb_lock. */
+static int zram_wb_copy(struct zram *zram, struct zcomp_strm *zstrm,
+			u32 index, struct page *page)
+{
+	int ret = 0;
+	struct zram_entry *entry = zram->table[index].entry;
+	unsigned char *mem, *cmem;
+
+	mem = kmap_atomic(page, KM_USER0);
+	cmem = zs_map_object(zram->mem_pool, entry->handle, ZS_MM_RO);
+	if (entry->len == PAGE_SIZE)
+		memcpy(mem, cmem, PAGE_SIZE);
+	else
+		ret = zcomp_decompress(zram->comp, zstrm, cmem, entry->len,
+					mem);
+	zs_unmap_object(zram->mem_pool, entry->handle);
+	kunmap_atomic(mem, KM_USER0);
+
+	return ret;
+}
+
+/*
+ * Replace the in-memory copy of a page by its backing block, unless
+ * the page was freed or rewritten while its write was in flight.
+ */
+static void zram_wb_commit(struct zram *zram, u32 index,
+			unsigned long block, int error)
+{
+	write_lock(&zram->tb_lock);
+	if (!error && zram_test_flag(zram, index, ZRAM_UNDER_WB)) {
+		zram_clear_flag(zram, index, ZRAM_UNDER_WB);
+		zram_free_object(zram, index);
+		zram->table[index].block = block;
+		zram_set_flag(zram, index, ZRAM_WB);
+		write_unlock(&zram->tb_lock);
+
+		zram_stat_inc(&zram->stats.bd_count);
+		zram_stat64_inc(zram, &zram->stats.bd_writes);
+		return;
+	}
+	zram_clear_flag(zram, index, ZRAM_UNDER_WB);
+	write_unlock(&zram->tb_lock);
+
+	clear_bit(block, zram->bd_map);
+}
+
+/*
+ * Next page to consider for writeback from 'index' on. Incompressible
+ * pages are marked in wb_huge_map when stored, so only idle writeback
+ * has to look at every page.
+ */
+static size_t zram_wb_next(struct zram *zram, size_t index,
+			size_t num_pages, int mode)
+{
+	if (mode & ZRAM_WB_IDLE)
+		return index;
+
+	return find_next_bit(zram->wb_huge_map, num_pages, index);
+}
+
+/*
+ * Write pages selected by 'mode' to the backing device, in batches
+ * of up to ZRAM_WB_BATCH pages. Only one batch is in flight at a
+ * time, so ZRAM_UNDER_WB reliably tells whether a page changed
+ * while it was being written.
+ */
+void zram_writeback(struct zram *zram, int mode)
+{
+	int i, nr_pages = 0, nr, error, full = 0;
+	struct page *pages[ZRAM_WB_BATCH];
+	unsigned long blocks[ZRAM_WB_BATCH];
+	u32 indices[ZRAM_WB_BATCH];
+	struct zcomp_strm *zstrm;
+	size_t index = 0, num_pages;
+	u32 now = zram_now();
+
+	mutex_lock(&zram->wb_lock);
+	if (!zram->bdev || !zram->wb_huge_map)
+		goto out;
+
+	for (; nr_pages < ZRAM_WB_BATCH; nr_pages++) {
+		pages[nr_pages] = alloc_page(GFP_NOIO | __GFP_NOWARN);
+		if (!pages[nr_pages])
+			break;
+	}
+
+	num_pages = zram->disksize >> PAGE_SHIFT;
+	while (nr_pages && index < num_pages && !full) {
+		zstrm = zcomp_strm_find(zram->comp);
+		if (!zstrm)
+			break;
+
+		for (nr = 0; nr < nr_pages; index++) {
+			index = zram_wb_next(zram, index, num_pages, mode);
+			if (index >= num_pages)
+				break;
+
+			write_lock(&zram->tb_lock);
+			clear_bit(index, zram->wb_huge_map);
+			if (!zram_wb_candidate(zram, index, mode, now)) {
+				write_unlock(&zram->tb_lock);
+				continue;
+			}
+
+			blocks[nr] = zram_bd_alloc_block(zram);
+			if (blocks[nr] >= zram->bd_nr_blocks) {
+				if (zram_test_flag(zram, index,
+						ZRAM_UNCOMPRESSED))
+					set_bit(index, zram->wb_huge_map);
+				write_unlock(&zram->tb_lock);
+				full = 1;
+				break;
+			}
+
+			if (zram_wb_copy(zram, zstrm, index, pages[nr])) {
+				write_unlock(&zram->tb_lock);
+				clear_bit(blocks[nr], zram->bd_map);
+				continue;
+			}
+
+			zram_set_flag(zram, index, ZRAM_UNDER_WB);
+			write_unlock(&zram->tb_lock);
+			indices[nr++] = index;
+		}
+		zcomp_strm_release(zram->comp, zstrm);
+
+		if (!nr)
+			break;
+
+		error = zram_bd_rw(zram, WRITE, pages, blocks, nr);
+		if (error)
+			pr_err("Backing device write failed! err=%d\n", error);
+
+		for (i = 0; i < nr; i++)
+			zram_wb_commit(zram, indices[i], blocks[i], error);
+
+		cond_resched();
+	}
+
+	while (nr_pages)
+		__free_page(pages[--nr_pages]);
+out:
+	mutex_unlock(&zram->wb_lock);
+}
+
+static void zram_wb_fn(struct work_struct *work)
+{
+	struct zram *zram = container_of(work, struct zram, wb_work);
+
+	atomic_set(&zram->wb_huge_count, 0);
+	zram_writeback(zram, ZRAM_WB_HUGE);
+}
+
+/* Periodic writeback of pages idle for longer than wb_idle_age */
+static void zram_wb_idle_fn(struct work_struct *work)
+{
+	struct zram *zram = container_of(to_delayed_work(work), struct zram,
+					wb_idle_work);
+	unsigned int age = zram->wb_idle_age;
+
+	if (!age)
+		return;
+
+	zram_writeback(zram, ZRAM_WB_HUGE | ZRAM_WB_IDLE);
+	queue_delayed_work(zram_wb_wq, &zram->wb_idle_work, age * HZ / 2 + 1);
+}
+
+/* Caller holds init_lock */
+void zram_wb_idle_start(struct zram *zram)
+{
+	if (zram->init_done && zram->bdev && zram->wb_idle_age)
+		queue_delayed_work(zram_wb_wq, &zram->wb_idle_work,
+				zram->wb_idle_age * HZ / 2 + 1);
+}
+
+static void zram_bd_reset(struct zram *zram)
+{
+	if (!zram->bdev)
+		return;
+
+	blkdev_put(zram->bdev, FMODE_READ | FMODE_WRITE | FMODE_EXCL);
+	zram->bdev = NULL;
+	kfree(zram->backing_dev);
+	zram->backing_dev = NULL;
+	vfree(zram->bd_map);
+	zram->bd_map = NULL;
+	zram->bd_nr_blocks = 0;
+	zram->bd_next = 0;
+}
+
+/*
+ * Open the backing device, or close it if 'path' is "none". Caller
+ * holds init_lock and the device is not initialized.
+ */
+int zram_bd_set(struct zram *zram, const char *path)
+{
+	int ret;
+	char *name;
+	unsigned long nr_blocks, *map;
+	struct block_device *bdev;
+
+	zram_bd_reset(zram);
+	if (sysfs_streq(path, "none"))
+		return 0;
+
+	name = kstrdup(path, GFP_KERNEL);
+	if (!name)
+		return -ENOMEM;
+	strim(name);
+
+	bdev = blkdev_get_by_path(name, FMODE_READ | FMODE_WRITE |
+				FMODE_EXCL, zram);
+	if (IS_ERR(bdev)) {
+		ret = PTR_ERR(bdev);
+		goto free_name;
+	}
+
+	nr_blocks = i_size_read(bdev->bd_inode) >> PAGE_SHIFT;
+	if (!nr_blocks) {
+		ret = -EINVAL;
+		goto put_bdev;
+	}
+
+	ret = set_blocksize(bdev, PAGE_SIZE);
+	if (ret)
+		goto put_bdev;
+
+	map = vzalloc(BITS_TO_LONGS(nr_blocks) * sizeof(long));
+	if (!map) {
+		ret = -ENOMEM;
+		goto put_bdev;
+	}
+
+	zram->bdev = bdev;
+	zram->backing_dev = name;
+	zram->bd_map = map;
+	zram->bd_nr_blocks = nr_blocks;
+	zram->bd_next = 0;
+
+	pr_info("%s: using backing device %s (%lu pages)\n",
+		zram->disk->disk_name, name, nr_blocks);
+	return 0;
+
+put_bdev:
+	blkdev_put(bdev, FMODE_READ | FMODE_WRITE | FMODE_EXCL);
+free_name:
+	kfree(name);
+	return ret;
+}
+
+/* Free what zram_init_device() set up. Caller holds init_lock. */
+static void __zram_reset_device(struct zram *zram)
 {
 	size_t index;
 
-	mutex_lock(&zram->init_lock);
+	if (zram->init_done)
+		unregister_shrinker(&zram->shrinker);
 	zram->init_done = 0;
 
-	/* Free various per-device buffers */
-	kfree(zram->compress_workmem);
-	free_pages((unsigned long)zram->compress_buffer, 1);
+	/* Writeback uses the streams and the pool freed below */
+	cancel_delayed_work_sync(&zram->wb_idle_work);
+	cancel_work_sync(&zram->wb_work);
+
+	/* So do pages of async_io bios still queued */
+	flush_workqueue(zram_io_wq);
 
-	zram->compress_workmem = NULL;
-	zram->compress_buffer = NULL;
+	/* Free compression streams */
+	if (zram->comp)
+		zcomp_destroy(zram->comp);
+	zram->comp = NULL;
 
 	/* Free all pages that are still in this zram device */
 	for (index = 0; index < zram->disksize >> PAGE_SHIFT; index++) {
-		struct page *page;
-		u16 offset;
+		struct zram_entry *entry = zram->table[index].entry;
 
-		page = zram->table[index].page;
-		offset = zram->table[index].offset;
-
-		if (!page)
+		if (!entry || zram_test_flag(zram, index, ZRAM_WB))
 			continue;
 
-		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)))
-			__free_page(page);
-		else
-			xv_free(zram->mem_pool, page, offset);
+		zram_entry_put(zram, entry);
 	}
 
 	vfree(zram->table);
 	zram->table = NULL;
+	vfree(zram->wb_huge_map);
+	zram->wb_huge_map = NULL;
+	atomic_set(&zram->wb_huge_count, 0);
+
+	zram_dedup_fini(zram);
 
-	xv_destroy_pool(zram->mem_pool);
+	if (zram->mem_pool)
+		zs_destroy_pool(zram->mem_pool);
 	zram->mem_pool = NULL;
 
 	/* Reset stats */
 	memset(&zram->stats, 0, sizeof(zram->stats));
 
 	zram->disksize = 0;
+}
+
+/* Also closes the backing device, which a failed init keeps */
+void zram_reset_device(struct zram *zram)
+{
+	mutex_lock(&zram->init_lock);
+	__zram_reset_device(zram);
+	zram_bd_reset(zram);
 	mutex_unlock(&zram->init_lock);
 }
 
@@ -511,17 +1179,11 @@ int zram_init_device(struct zram *zram)
 
 	zram_set_disksize(zram, totalram_pages << PAGE_SHIFT);
 
-	zram->compress_workmem = kzalloc(LZO1X_MEM_COMPRESS, GFP_KERNEL);
-	if (!zram->compress_workmem) {
-		pr_err("Error allocating compressor working memory!\n");
-		ret = -ENOMEM;
-		goto fail;
-	}
-
-	zram->compress_buffer = (void *)__get_free_pages(__GFP_ZERO, 1);
-	if (!zram->compress_buffer) {
-		pr_err("Error allocating compressor buffer space\n");
-		ret = -ENOMEM;
+	zram->comp = zcomp_create(zram->compressor, zram->max_comp_streams);
+	if (IS_ERR(zram->comp)) {
+		pr_err("Error initializing %s compressor\n", zram->compressor);
+		ret = PTR_ERR(zram->comp);
+		zram->comp = NULL;
 		goto fail;
 	}
 
@@ -535,27 +1197,49 @@ int zram_init_device(struct zram *zram)
 		goto fail;
 	}
 
+	if (zram->use_dedup && zram_dedup_init(zram, num_pages)) {
+		pr_err("Error allocating dedup hash table\n");
+		ret = -ENOMEM;
+		goto fail;
+	}
+
+	if (zram->bdev) {
+		zram->wb_huge_map = vzalloc(BITS_TO_LONGS(num_pages) *
+					sizeof(long));
+		if (!zram->wb_huge_map) {
+			pr_err("Error allocating writeback map\n");
+			ret = -ENOMEM;
+			goto fail;
+		}
+	}
+
 	set_capacity(zram->disk, zram->disksize >> SECTOR_SHIFT);
 
 	/* zram devices sort of resembles non-rotational disks */
 	queue_flag_set_unlocked(QUEUE_FLAG_NONROT, zram->disk->queue);
 
-	zram->mem_pool = xv_create_pool();
+	zram->mem_pool = zs_create_pool(zram->disk->disk_name,
+					GFP_NOIO | __GFP_HIGHMEM);
 	if (!zram->mem_pool) {
 		pr_err("Error creating memory pool\n");
 		ret = -ENOMEM;
 		goto fail;
 	}
 
+	zram->shrinker.shrink = zram_shrink;
+	zram->shrinker.seeks = DEFAULT_SEEKS;
+	register_shrinker(&zram->shrinker);
+
 	zram->init_done = 1;
+	zram_wb_idle_start(zram);
 	mutex_unlock(&zram->init_lock);
 
 	pr_debug("Initialization done!\n");
 	return 0;
 
 fail:
+	__zram_reset_device(zram);
 	mutex_unlock(&zram->init_lock);
-	zram_reset_device(zram);
 
 	pr_err("Initialization failed: err=%d\n", ret);
 	return ret;
@@ -566,7 +1250,9 @@ void zram_slot_free_notify(struct block_device *bdev, unsigned long index)
 	struct zram *zram;
 
 	zram = bdev->bd_disk->private_data;
+	write_lock(&zram->tb_lock);
 	zram_free_page(zram, index);
+	write_unlock(&zram->tb_lock);
 	zram_stat64_inc(zram, &zram->stats.notify_free);
 }
 
@@ -579,9 +1265,14 @@ static int create_device(struct zram *zram, int device_id)
 {
 	int ret = 0;
 
-	mutex_init(&zram->lock);
 	mutex_init(&zram->init_lock);
 	spin_lock_init(&zram->stat64_lock);
+	rwlock_init(&zram->tb_lock);
+	mutex_init(&zram->wb_lock);
+	INIT_WORK(&zram->wb_work, zram_wb_fn);
+	INIT_DELAYED_WORK(&zram->wb_idle_work, zram_wb_idle_fn);
+	zram->max_comp_streams = num_online_cpus();
+	strlcpy(zram->compressor, default_compressor, sizeof(zram->compressor));
 
 	zram->queue = blk_alloc_queue(GFP_KERNEL);
 	if (!zram->queue) {
@@ -664,11 +1355,30 @@ static int __init zram_init(void)
 		goto out;
 	}
 
+	zram_entry_cache = KMEM_CACHE(zram_entry, 0);
+	if (!zram_entry_cache) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	zram_wb_wq = alloc_workqueue("zram_wb", WQ_MEM_RECLAIM, 0);
+	if (!zram_wb_wq) {
+		ret = -ENOMEM;
+		goto free_cache;
+	}
+
+	/* Unbound, so that the pages of one bio run on all CPUs */
+	zram_io_wq = alloc_workqueue("zram_io", WQ_UNBOUND | WQ_MEM_RECLAIM, 0);
+	if (!zram_io_wq) {
+		ret = -ENOMEM;
+		goto destroy_wb_wq;
+	}
+
 	zram_major = register_blkdev(0, "zram");
 	if (zram_major <= 0) {
 		pr_warning("Unable to get major number\n");
 		ret = -EBUSY;
-		goto out;
+		goto destroy_io_wq;
 	}
 
 	if (!num_devices) {
@@ -698,6 +1408,12 @@ free_devices:
 	kfree(devices);
 unregister:
 	unregister_blkdev(zram_major, "zram");
+destroy_io_wq:
+	destroy_workqueue(zram_io_wq);
+destroy_wb_wq:
+	destroy_workqueue(zram_wb_wq);
+free_cache:
+	kmem_cache_destroy(zram_entry_cache);
 out:
 	return ret;
 }
@@ -713,11 +1429,15 @@ static void __exit zram_exit(void)
 		destroy_device(zram);
 		if (zram->init_done)
 			zram_reset_device(zram);
+		zram_bd_reset(zram);
 	}
 
 	unregister_blkdev(zram_major, "zram");
 
 	kfree(devices);
+	destroy_workqueue(zram_io_wq);
+	destroy_workqueue(zram_wb_wq);
+	kmem_cache_destroy(zram_entry_cache);
 	pr_debug("Cleanup done!\n");
 }
 
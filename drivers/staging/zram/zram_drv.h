@@ -17,8 +17,12 @@
 
 #include <linux/spinlock.h>
 #include <linux/mutex.h>
+#include <linux/mm.h>
+#include <linux/rbtree.h>
+#include <linux/workqueue.h>
 
-#include "xvmalloc.h"
+#include "zsmalloc.h"
+#include "zcomp.h"
 
 /*
  * Some arbitrary value. This is just to catch
@@ -26,20 +30,11 @@
  */
 static const unsigned max_num_devices = 32;
 
-/*
- * Stored at beginning of each compressed object.
- *
- * It stores back-reference to table entry which points to this
- * object. This is required to support memory defragmentation.
- */
-struct zobj_header {
-#if 0
-	u32 table_idx;
-#endif
-};
-
 /*-- Configurable parameters */
 
+/* Compression backend used unless overridden via sysfs */
+static const char default_compressor[] = "lzo";
+
 /* Default zram disk size: 25% of total RAM */
 static const unsigned default_disksize_perc_ram = 25;
 
@@ -50,9 +45,9 @@ static const unsigned default_disksize_perc_ram = 25;
 static const unsigned max_zpage_size = PAGE_SIZE / 4 * 3;
 
 /*
- * NOTE: max_zpage_size must be less than or equal to:
- *   XV_MAX_ALLOC_SIZE - sizeof(struct zobj_header)
- * otherwise, xv_malloc() would always return failure.
+ * NOTE: max_zpage_size must be less than PAGE_SIZE: incompressible
+ * pages are stored in the PAGE_SIZE zsmalloc class and recognized by
+ * their size.
  */
 
 /*-- End of configurable params */
@@ -71,19 +66,54 @@ enum zram_pageflags {
 	/* Page consists entirely of zeros */
 	ZRAM_ZERO,
 
+	/* Page is stored on the backing device */
+	ZRAM_WB,
+
+	/* Page is being written to the backing device */
+	ZRAM_UNDER_WB,
+
 	__NR_ZRAM_PAGEFLAGS,
 };
 
 /*-- Data structures */
 
+/*
+ * A stored compressed object. With deduplication enabled, disk pages
+ * with identical content share one entry; it is linked into the hash
+ * bucket for its checksum and freed when the last reference goes.
+ */
+struct zram_entry {
+	struct rb_node rb_node;	/* in zram->hash[], if deduplicated */
+	unsigned long handle;	/* zsmalloc handle */
+	unsigned long refcount;	/* table entries using this, and dedup
+				 * lookups comparing against it */
+	u32 checksum;
+	u16 len;		/* compressed object size */
+};
+
+/* Hash bucket of deduplicated entries, sorted by checksum */
+struct zram_hash {
+	spinlock_t lock;
+	struct rb_root rb_root;
+};
+
 /* Allocated for each disk page */
 struct table {
-	struct page *page;
-	u16 offset;
-	u8 count;	/* object ref count (not yet used) */
+	union {
+		struct zram_entry *entry;	/* NULL if not stored */
+		unsigned long block;	/* backing device block if ZRAM_WB */
+	};
+	u32 ac_time;	/* last access, in seconds since boot */
 	u8 flags;
 } __attribute__((aligned(4)));
 
+/* zram_writeback() modes */
+#define ZRAM_WB_HUGE	(1 << 0)	/* incompressible pages */
+#define ZRAM_WB_IDLE	(1 << 1)	/* pages idle for wb_idle_age */
+
+/* Max no. of pages written back to the backing device at once */
+#define ZRAM_WB_BATCH	32
+
 struct zram_stats {
 	u64 compr_size;		/* compressed size of pages stored */
 	u64 num_reads;		/* failed + successful */
@@ -92,20 +122,25 @@ struct zram_stats {
 	u64 failed_writes;	/* can happen when memory is too low */
 	u64 invalid_io;		/* non-page-aligned I/O requests */
 	u64 notify_free;	/* no. of swap slot free notifications */
-	u32 pages_zero;		/* no. of zero filled pages */
-	u32 pages_stored;	/* no. of pages currently stored */
-	u32 good_compress;	/* % of pages with compression ratio<=50% */
-	u32 pages_expand;	/* % of incompressible pages */
+	u64 pages_compacted;	/* no. of pages freed by compaction */
+	u64 dedup_hits;		/* no. of writes that found a duplicate */
+	u64 dedup_saved;	/* compressed bytes not stored due to dedup */
+	u64 bd_reads;		/* no. of pages read from backing device */
+	u64 bd_writes;		/* no. of pages written to backing device */
+	atomic_t pages_zero;	/* no. of zero filled pages */
+	atomic_t pages_stored;	/* no. of pages currently stored */
+	atomic_t good_compress;	/* % of pages with compression ratio<=50% */
+	atomic_t pages_expand;	/* % of incompressible pages */
+	atomic_t bd_count;	/* no. of pages on the backing device */
 };
 
 struct zram {
-	struct xv_pool *mem_pool;
-	void *compress_workmem;
-	void *compress_buffer;
+	struct zs_pool *mem_pool;
+	struct zcomp *comp;
 	struct table *table;
 	spinlock_t stat64_lock;	/* protect 64-bit stats */
-	struct mutex lock;	/* protect compression buffers against
-				 * concurrent writes */
+	rwlock_t tb_lock;	/* protect table entries against concurrent
+				 * read, write and slot free */
 	struct request_queue *queue;
 	struct gendisk *disk;
 	int init_done;
@@ -116,8 +151,39 @@ struct zram {
 	 * we can store in a disk.
 	 */
 	u64 disksize;	/* bytes */
+	/* Upper bound on concurrent compression streams */
+	int max_comp_streams;
+	/* Compression backend name, fixed once the device is initialized */
+	char compressor[10];
+
+	/* Spread the pages of multi-page bios over the I/O workers */
+	int async_io;
+	/* Share objects between pages with identical content */
+	int use_dedup;
+	struct zram_hash *hash;
+	size_t hash_size;	/* no. of buckets, a power of 2 */
+
+	/*
+	 * Optional backing device. Incompressible and idle pages are
+	 * written back to it to free memory. Fixed once the device is
+	 * initialized.
+	 */
+	struct block_device *bdev;
+	char *backing_dev;		/* path bdev was opened with */
+	unsigned long *bd_map;		/* allocated backing blocks */
+	unsigned long bd_nr_blocks;
+	unsigned long bd_next;		/* allocation hint */
+	unsigned int wb_idle_age;	/* seconds, 0 disables idle writeback */
+	unsigned long *wb_huge_map;	/* incompressible pages to write back */
+	atomic_t wb_huge_count;		/* pages added to it since last pass */
+	struct mutex wb_lock;		/* serializes writeback passes */
+	struct work_struct wb_work;
+	struct delayed_work wb_idle_work;
 
 	struct zram_stats stats;
+
+	/* Compacts mem_pool under memory pressure */
+	struct shrinker shrinker;
 };
 
 extern struct zram *devices;
@@ -128,5 +194,22 @@ extern struct attribute_group zram_disk_attr_group;
 
 extern int zram_init_device(struct zram *zram);
 extern void zram_reset_device(struct zram *zram);
+extern unsigned long zram_compact(struct zram *zram);
+extern int zram_bd_set(struct zram *zram, const char *path);
+extern void zram_writeback(struct zram *zram, int mode);
+extern void zram_wb_idle_start(struct zram *zram);
+extern void zram_entry_unpin(struct zram *zram, struct zram_entry *entry);
+
+/* zram_dedup.c */
+extern u32 zram_dedup_checksum(unsigned char *mem);
+extern struct zram_entry *zram_dedup_find(struct zram *zram,
+			struct zcomp_strm *zstrm, unsigned char *mem,
+			u32 checksum);
+extern void zram_dedup_insert(struct zram *zram, struct zram_entry *entry,
+			u32 checksum);
+extern unsigned long zram_dedup_put(struct zram *zram,
+			struct zram_entry *entry);
+extern int zram_dedup_init(struct zram *zram, size_t num_pages);
+extern void zram_dedup_fini(struct zram *zram);
 
 #endif
@@ -153,7 +153,7 @@ static ssize_t zero_pages_show(struct device *dev,
 {
 	struct zram *zram = dev_to_zram(dev);
 
-	return sprintf(buf, "%u\n", zram->stats.pages_zero);
+	return sprintf(buf, "%u\n", atomic_read(&zram->stats.pages_zero));
 }
 
 static ssize_t orig_data_size_show(struct device *dev,
@@ -162,7 +162,7 @@ static ssize_t orig_data_size_show(struct device *dev,
 	struct zram *zram = dev_to_zram(dev);
 
 	return sprintf(buf, "%llu\n",
-		(u64)(zram->stats.pages_stored) << PAGE_SHIFT);
+		(u64)atomic_read(&zram->stats.pages_stored) << PAGE_SHIFT);
 }
 
 static ssize_t compr_data_size_show(struct device *dev,
@@ -180,14 +180,328 @@ static ssize_t mem_used_total_show(struct device *dev,
 	u64 val = 0;
 	struct zram *zram = dev_to_zram(dev);
 
+	if (zram->init_done)
+		val = zs_get_total_size_bytes(zram->mem_pool);
+
+	return sprintf(buf, "%llu\n", val);
+}
+
+static ssize_t max_comp_streams_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return sprintf(buf, "%d\n", zram->max_comp_streams);
+}
+
+static ssize_t max_comp_streams_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	int ret;
+	unsigned long num;
+	struct zram *zram = dev_to_zram(dev);
+
+	ret = strict_strtoul(buf, 10, &num);
+	if (ret)
+		return ret;
+
+	if (!num || num > INT_MAX)
+		return -EINVAL;
+
+	mutex_lock(&zram->init_lock);
 	if (zram->init_done) {
-		val = xv_get_total_size_bytes(zram->mem_pool) +
-			((u64)(zram->stats.pages_expand) << PAGE_SHIFT);
+		ret = zcomp_set_max_streams(zram->comp, num);
+		if (ret) {
+			mutex_unlock(&zram->init_lock);
+			return ret;
+		}
+	}
+	zram->max_comp_streams = num;
+	mutex_unlock(&zram->init_lock);
+
+	return len;
+}
+
+static ssize_t comp_stream_waits_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	u64 val = 0;
+	struct zram *zram = dev_to_zram(dev);
+
+	mutex_lock(&zram->init_lock);
+	if (zram->init_done)
+		val = zcomp_strm_waits(zram->comp);
+	mutex_unlock(&zram->init_lock);
+
+	return sprintf(buf, "%llu\n", val);
+}
+
+static ssize_t comp_algorithm_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	size_t sz;
+	struct zram *zram = dev_to_zram(dev);
+
+	mutex_lock(&zram->init_lock);
+	sz = zcomp_available_show(zram->compressor, buf);
+	mutex_unlock(&zram->init_lock);
+
+	return sz;
+}
+
+static ssize_t comp_algorithm_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	if (!zcomp_available_algorithm(buf))
+		return -EINVAL;
+
+	mutex_lock(&zram->init_lock);
+	if (zram->init_done) {
+		mutex_unlock(&zram->init_lock);
+		pr_info("Cannot change compressor for initialized device\n");
+		return -EBUSY;
 	}
+	strlcpy(zram->compressor, buf, sizeof(zram->compressor));
+	strim(zram->compressor);
+	mutex_unlock(&zram->init_lock);
+
+	return len;
+}
+
+static ssize_t compact_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	mutex_lock(&zram->init_lock);
+	if (!zram->init_done) {
+		mutex_unlock(&zram->init_lock);
+		return -EINVAL;
+	}
+	zram_compact(zram);
+	mutex_unlock(&zram->init_lock);
+
+	return len;
+}
+
+static ssize_t pages_compacted_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return sprintf(buf, "%llu\n",
+		zram_stat64_read(zram, &zram->stats.pages_compacted));
+}
+
+static ssize_t num_migrated_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	u64 val = 0;
+	struct zram *zram = dev_to_zram(dev);
+
+	mutex_lock(&zram->init_lock);
+	if (zram->init_done)
+		val = zs_get_num_migrated(zram->mem_pool);
+	mutex_unlock(&zram->init_lock);
 
 	return sprintf(buf, "%llu\n", val);
 }
 
+static ssize_t async_io_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return sprintf(buf, "%d\n", zram->async_io);
+}
+
+static ssize_t async_io_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	int ret;
+	unsigned long val;
+	struct zram *zram = dev_to_zram(dev);
+
+	ret = strict_strtoul(buf, 10, &val);
+	if (ret)
+		return ret;
+
+	mutex_lock(&zram->init_lock);
+	zram->async_io = !!val;
+	mutex_unlock(&zram->init_lock);
+
+	return len;
+}
+
+static ssize_t use_dedup_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return sprintf(buf, "%d\n", zram->use_dedup);
+}
+
+static ssize_t use_dedup_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	int ret;
+	unsigned long val;
+	struct zram *zram = dev_to_zram(dev);
+
+	ret = strict_strtoul(buf, 10, &val);
+	if (ret)
+		return ret;
+
+	mutex_lock(&zram->init_lock);
+	if (zram->init_done) {
+		mutex_unlock(&zram->init_lock);
+		pr_info("Cannot change dedup for initialized device\n");
+		return -EBUSY;
+	}
+	zram->use_dedup = !!val;
+	mutex_unlock(&zram->init_lock);
+
+	return len;
+}
+
+static ssize_t dedup_hits_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return sprintf(buf, "%llu\n",
+		zram_stat64_read(zram, &zram->stats.dedup_hits));
+}
+
+static ssize_t dedup_saved_bytes_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return sprintf(buf, "%llu\n",
+		zram_stat64_read(zram, &zram->stats.dedup_saved));
+}
+
+static ssize_t backing_dev_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	ssize_t sz;
+	struct zram *zram = dev_to_zram(dev);
+
+	mutex_lock(&zram->init_lock);
+	sz = sprintf(buf, "%s\n",
+		zram->backing_dev ? zram->backing_dev : "none");
+	mutex_unlock(&zram->init_lock);
+
+	return sz;
+}
+
+static ssize_t backing_dev_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	int ret;
+	struct zram *zram = dev_to_zram(dev);
+
+	mutex_lock(&zram->init_lock);
+	if (zram->init_done) {
+		mutex_unlock(&zram->init_lock);
+		pr_info("Cannot change backing device for initialized "
+			"device\n");
+		return -EBUSY;
+	}
+	ret = zram_bd_set(zram, buf);
+	mutex_unlock(&zram->init_lock);
+
+	return ret ? ret : len;
+}
+
+static ssize_t writeback_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	int mode;
+	struct zram *zram = dev_to_zram(dev);
+
+	if (sysfs_streq(buf, "huge"))
+		mode = ZRAM_WB_HUGE;
+	else if (sysfs_streq(buf, "idle"))
+		mode = ZRAM_WB_IDLE;
+	else
+		return -EINVAL;
+
+	mutex_lock(&zram->init_lock);
+	if (!zram->init_done || !zram->bdev) {
+		mutex_unlock(&zram->init_lock);
+		return -EINVAL;
+	}
+	/* With no idle age every page would count as idle */
+	if ((mode & ZRAM_WB_IDLE) && !zram->wb_idle_age) {
+		mutex_unlock(&zram->init_lock);
+		return -EINVAL;
+	}
+	zram_writeback(zram, mode);
+	mutex_unlock(&zram->init_lock);
+
+	return len;
+}
+
+static ssize_t writeback_idle_age_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return sprintf(buf, "%u\n", zram->wb_idle_age);
+}
+
+static ssize_t writeback_idle_age_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	int ret;
+	unsigned long val;
+	struct zram *zram = dev_to_zram(dev);
+
+	ret = strict_strtoul(buf, 10, &val);
+	if (ret)
+		return ret;
+
+	if (val > UINT_MAX / HZ)
+		return -EINVAL;
+
+	mutex_lock(&zram->init_lock);
+	zram->wb_idle_age = val;
+	zram_wb_idle_start(zram);
+	mutex_unlock(&zram->init_lock);
+
+	return len;
+}
+
+static ssize_t bd_count_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return sprintf(buf, "%u\n", atomic_read(&zram->stats.bd_count));
+}
+
+static ssize_t bd_reads_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return sprintf(buf, "%llu\n",
+		zram_stat64_read(zram, &zram->stats.bd_reads));
+}
+
+static ssize_t bd_writes_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return sprintf(buf, "%llu\n",
+		zram_stat64_read(zram, &zram->stats.bd_writes));
+}
+
 static DEVICE_ATTR(disksize, S_IRUGO | S_IWUSR,
 		disksize_show, disksize_store);
 static DEVICE_ATTR(initstate, S_IRUGO, initstate_show, NULL);
@@ -200,6 +514,28 @@ static DEVICE_ATTR(zero_pages, S_IRUGO, zero_pages_show, NULL);
 static DEVICE_ATTR(orig_data_size, S_IRUGO, orig_data_size_show, NULL);
 static DEVICE_ATTR(compr_data_size, S_IRUGO, compr_data_size_show, NULL);
 static DEVICE_ATTR(mem_used_total, S_IRUGO, mem_used_total_show, NULL);
+static DEVICE_ATTR(max_comp_streams, S_IRUGO | S_IWUSR,
+		max_comp_streams_show, max_comp_streams_store);
+static DEVICE_ATTR(comp_stream_waits, S_IRUGO, comp_stream_waits_show, NULL);
+static DEVICE_ATTR(comp_algorithm, S_IRUGO | S_IWUSR,
+		comp_algorithm_show, comp_algorithm_store);
+static DEVICE_ATTR(compact, S_IWUSR, NULL, compact_store);
+static DEVICE_ATTR(pages_compacted, S_IRUGO, pages_compacted_show, NULL);
+static DEVICE_ATTR(num_migrated, S_IRUGO, num_migrated_show, NULL);
+static DEVICE_ATTR(async_io, S_IRUGO | S_IWUSR,
+		async_io_show, async_io_store);
+static DEVICE_ATTR(use_dedup, S_IRUGO | S_IWUSR,
+		use_dedup_show, use_dedup_store);
+static DEVICE_ATTR(dedup_hits, S_IRUGO, dedup_hits_show, NULL);
+static DEVICE_ATTR(dedup_saved_bytes, S_IRUGO, dedup_saved_bytes_show, NULL);
+static DEVICE_ATTR(backing_dev, S_IRUGO | S_IWUSR,
+		backing_dev_show, backing_dev_store);
+static DEVICE_ATTR(writeback, S_IWUSR, NULL, writeback_store);
+static DEVICE_ATTR(writeback_idle_age, S_IRUGO | S_IWUSR,
+		writeback_idle_age_show, writeback_idle_age_store);
+static DEVICE_ATTR(bd_count, S_IRUGO, bd_count_show, NULL);
+static DEVICE_ATTR(bd_reads, S_IRUGO, bd_reads_show, NULL);
+static DEVICE_ATTR(bd_writes, S_IRUGO, bd_writes_show, NULL);
 
 static struct attribute *zram_disk_attrs[] = {
 	&dev_attr_disksize.attr,
@@ -213,6 +549,22 @@ static struct attribute *zram_disk_attrs[] = {
 	&dev_attr_orig_data_size.attr,
 	&dev_attr_compr_data_size.attr,
 	&dev_attr_mem_used_total.attr,
+	&dev_attr_max_comp_streams.attr,
+	&dev_attr_comp_stream_waits.attr,
+	&dev_attr_comp_algorithm.attr,
+	&dev_attr_compact.attr,
+	&dev_attr_pages_compacted.attr,
+	&dev_attr_num_migrated.attr,
+	&dev_attr_async_io.attr,
+	&dev_attr_use_dedup.attr,
+	&dev_attr_dedup_hits.attr,
+	&dev_attr_dedup_saved_bytes.attr,
+	&dev_attr_backing_dev.attr,
+	&dev_attr_writeback.attr,
+	&dev_attr_writeback_idle_age.attr,
+	&dev_attr_bd_count.attr,
+	&dev_attr_bd_reads.attr,
+	&dev_attr_bd_writes.attr,
 	NULL,
 };
 
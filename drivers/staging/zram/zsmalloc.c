@@ -0,0 +1,904 @@
+/*
+ * zsmalloc memory allocator
+ *
+ * Copyright (C) 2026 LG Electronics, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+/*
+ * Size-class allocator for compressed pages.
+ *
+ * Each allocation size is rounded up to one of ZS_SIZE_CLASSES size
+ * classes. Objects of a class live in zspages: groups of order-0
+ * (possibly highmem) pages sized so that little space is wasted at
+ * the end. Objects may cross page boundaries within a zspage; such
+ * objects are copied through a per-cpu buffer when mapped.
+ *
+ * Users get an opaque handle instead of a <page, offset> pair. The
+ * handle points to a word holding the current object location, so
+ * objects can be migrated between zspages of the same class to
+ * compact sparsely used zspages and give their pages back.
+ */
+
+#ifdef CONFIG_ZRAM_DEBUG
+#define DEBUG
+#endif
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/bit_spinlock.h>
+#include <linux/debugfs.h>
+#include <linux/errno.h>
+#include <linux/highmem.h>
+#include <linux/init.h>
+#include <linux/percpu.h>
+#include <linux/sched.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/vmalloc.h>
+
+#include "zsmalloc.h"
+#include "zsmalloc_int.h"
+
+static DEFINE_PER_CPU(struct mapping_area, zs_map_area);
+
+/* Protects per-cpu mapping buffers and debugfs root */
+static DEFINE_MUTEX(zs_init_lock);
+static int zs_nr_pools;
+static struct dentry *zs_stat_root;
+
+static unsigned long location_to_obj(struct zspage *zspage, unsigned int idx)
+{
+	return (page_to_pfn(zspage->pages[0]) << OBJ_INDEX_BITS) | idx;
+}
+
+static void obj_to_location(unsigned long obj, struct zspage **zspage,
+				unsigned int *idx)
+{
+	struct page *page = pfn_to_page(obj >> OBJ_INDEX_BITS);
+
+	*zspage = (struct zspage *)page_private(page);
+	*idx = obj & OBJ_INDEX_MASK;
+}
+
+static unsigned long handle_to_obj(unsigned long handle)
+{
+	return *(unsigned long *)handle >> HANDLE_TAG_BITS;
+}
+
+/* Update object location, preserving the pin bit */
+static void record_obj(unsigned long handle, unsigned long obj)
+{
+	unsigned long *p = (unsigned long *)handle;
+
+	*p = (obj << HANDLE_TAG_BITS) | (*p & ((1UL << HANDLE_TAG_BITS) - 1));
+}
+
+static void pin_handle(unsigned long handle)
+{
+	bit_spin_lock(HANDLE_PIN_BIT, (unsigned long *)handle);
+}
+
+static int trypin_handle(unsigned long handle)
+{
+	return bit_spin_trylock(HANDLE_PIN_BIT, (unsigned long *)handle);
+}
+
+static void unpin_handle(unsigned long handle)
+{
+	bit_spin_unlock(HANDLE_PIN_BIT, (unsigned long *)handle);
+}
+
+static int get_size_class_index(int size)
+{
+	int idx = 0;
+
+	if (likely(size > ZS_MIN_ALLOC_SIZE))
+		idx = DIV_ROUND_UP(size - ZS_MIN_ALLOC_SIZE,
+				ZS_SIZE_CLASS_DELTA);
+
+	return idx;
+}
+
+/*
+ * Choose the zspage size (in pages) that wastes the smallest
+ * fraction of space for objects of the given class size.
+ */
+static int get_pages_per_zspage(int class_size)
+{
+	int i, max_usedpc = 0;
+	int max_usedpc_order = 1;
+
+	for (i = 1; i <= ZS_MAX_PAGES_PER_ZSPAGE; i++) {
+		int zspage_size = i * PAGE_SIZE;
+		int waste = zspage_size % class_size;
+		int usedpc = (zspage_size - waste) * 100 / zspage_size;
+
+		if (usedpc > max_usedpc) {
+			max_usedpc = usedpc;
+			max_usedpc_order = i;
+		}
+	}
+
+	return max_usedpc_order;
+}
+
+static enum fullness_group get_fullness_group(struct size_class *class,
+					struct zspage *zspage)
+{
+	if (!zspage->inuse)
+		return ZS_EMPTY;
+	if (zspage->inuse == class->objs_per_zspage)
+		return ZS_FULL;
+	if (zspage->inuse * ZS_ALMOST_EMPTY_DEN <=
+			class->objs_per_zspage * ZS_ALMOST_EMPTY_NUM)
+		return ZS_ALMOST_EMPTY;
+	return ZS_ALMOST_FULL;
+}
+
+/*
+ * Put zspage on the fullness list matching its usage. Empty zspages
+ * are not listed; the caller is expected to free them.
+ * Caller must hold class->lock.
+ */
+static enum fullness_group insert_zspage(struct size_class *class,
+					struct zspage *zspage)
+{
+	enum fullness_group fg = get_fullness_group(class, zspage);
+
+	zspage->fullness = fg;
+	if (fg == ZS_EMPTY)
+		return fg;
+
+	list_add(&zspage->list, &class->fullness_list[fg]);
+	class->nr_fullness[fg]++;
+
+	return fg;
+}
+
+static void remove_zspage(struct size_class *class, struct zspage *zspage)
+{
+	list_del_init(&zspage->list);
+	class->nr_fullness[zspage->fullness]--;
+}
+
+static enum fullness_group fix_fullness_group(struct size_class *class,
+					struct zspage *zspage)
+{
+	if (get_fullness_group(class, zspage) == zspage->fullness)
+		return zspage->fullness;
+
+	remove_zspage(class, zspage);
+	return insert_zspage(class, zspage);
+}
+
+/* Prefer the fullest zspages for new objects */
+static struct zspage *find_get_zspage(struct size_class *class)
+{
+	if (!list_empty(&class->fullness_list[ZS_ALMOST_FULL]))
+		return list_first_entry(&class->fullness_list[ZS_ALMOST_FULL],
+					struct zspage, list);
+	if (!list_empty(&class->fullness_list[ZS_ALMOST_EMPTY]))
+		return list_first_entry(&class->fullness_list[ZS_ALMOST_EMPTY],
+					struct zspage, list);
+	return NULL;
+}
+
+static struct zspage *alloc_zspage(struct zs_pool *pool,
+					struct size_class *class)
+{
+	int i;
+	struct zspage *zspage;
+
+	zspage = kzalloc(sizeof(*zspage) +
+			class->objs_per_zspage * sizeof(unsigned long),
+			pool->flags & ~__GFP_HIGHMEM);
+	if (!zspage)
+		return NULL;
+
+	for (i = 0; i < class->pages_per_zspage; i++) {
+		zspage->pages[i] = alloc_page(pool->flags);
+		if (!zspage->pages[i])
+			goto fail;
+	}
+	set_page_private(zspage->pages[0], (unsigned long)zspage);
+
+	INIT_LIST_HEAD(&zspage->list);
+	zspage->class = class;
+
+	/* Chain all objects on the free list: 0 -> 1 -> ... */
+	for (i = 0; i < class->objs_per_zspage; i++)
+		zspage->slots[i] = (unsigned long)(i + 1) << 1;
+	zspage->first_free = 0;
+
+	return zspage;
+
+fail:
+	while (i--)
+		__free_page(zspage->pages[i]);
+	kfree(zspage);
+	return NULL;
+}
+
+static void free_zspage(struct zs_pool *pool, struct zspage *zspage)
+{
+	int i;
+	int nr_pages = zspage->class->pages_per_zspage;
+
+	set_page_private(zspage->pages[0], 0);
+	for (i = 0; i < nr_pages; i++)
+		__free_page(zspage->pages[i]);
+	kfree(zspage);
+
+	atomic_long_sub(nr_pages, &pool->pages_allocated);
+}
+
+static unsigned int obj_alloc(struct size_class *class,
+				struct zspage *zspage, unsigned long handle)
+{
+	unsigned int idx = zspage->first_free;
+
+	zspage->first_free = zspage->slots[idx] >> 1;
+	zspage->slots[idx] = handle | OBJ_ALLOCATED_TAG;
+	zspage->inuse++;
+	class->objs_inuse++;
+
+	return idx;
+}
+
+static void obj_free(struct size_class *class, struct zspage *zspage,
+			unsigned int idx)
+{
+	zspage->slots[idx] = (unsigned long)zspage->first_free << 1;
+	zspage->first_free = idx;
+	zspage->inuse--;
+	class->objs_inuse--;
+}
+
+/* Copy between a linear buffer and an object that may span pages */
+static void zs_copy_object(struct zspage *zspage, unsigned long off,
+				char *buf, int size, int to_zspage)
+{
+	while (size) {
+		struct page *page = zspage->pages[off >> PAGE_SHIFT];
+		unsigned long poff = off & ~PAGE_MASK;
+		int n = min_t(int, size, PAGE_SIZE - poff);
+		char *addr;
+
+		addr = kmap_atomic(page, KM_USER0);
+		if (to_zspage)
+			memcpy(addr + poff, buf, n);
+		else
+			memcpy(buf, addr + poff, n);
+		kunmap_atomic(addr, KM_USER0);
+
+		off += n;
+		buf += n;
+		size -= n;
+	}
+}
+
+/* Copy an object between two zspages; used by compaction */
+static void zs_move_object(struct zspage *dst, unsigned long dst_off,
+			struct zspage *src, unsigned long src_off, int size)
+{
+	while (size) {
+		unsigned long s_poff = src_off & ~PAGE_MASK;
+		unsigned long d_poff = dst_off & ~PAGE_MASK;
+		int n = min_t(int, size, PAGE_SIZE - s_poff);
+		char *s_addr, *d_addr;
+
+		n = min_t(int, n, PAGE_SIZE - d_poff);
+
+		s_addr = kmap_atomic(src->pages[src_off >> PAGE_SHIFT],
+					KM_USER0);
+		d_addr = kmap_atomic(dst->pages[dst_off >> PAGE_SHIFT],
+					KM_USER1);
+		memcpy(d_addr + d_poff, s_addr + s_poff, n);
+		kunmap_atomic(d_addr, KM_USER1);
+		kunmap_atomic(s_addr, KM_USER0);
+
+		src_off += n;
+		dst_off += n;
+		size -= n;
+	}
+}
+
+/**
+ * zs_malloc - Allocate object of given size from pool.
+ * @pool: pool to allocate from
+ * @size: size of block to allocate
+ *
+ * Returns an opaque handle to the allocated object, or 0 on failure.
+ * Use zs_map_object() to access the object.
+ */
+unsigned long zs_malloc(struct zs_pool *pool, size_t size)
+{
+	unsigned int idx;
+	unsigned long handle;
+	struct zspage *zspage;
+	struct size_class *class;
+
+	if (unlikely(!size || size > ZS_MAX_ALLOC_SIZE))
+		return 0;
+
+	handle = (unsigned long)kmem_cache_alloc(pool->handle_cachep,
+					pool->flags & ~__GFP_HIGHMEM);
+	if (!handle)
+		return 0;
+
+	class = &pool->size_class[get_size_class_index(size)];
+
+	spin_lock(&class->lock);
+	zspage = find_get_zspage(class);
+	if (zspage) {
+		remove_zspage(class, zspage);
+	} else {
+		spin_unlock(&class->lock);
+		zspage = alloc_zspage(pool, class);
+		if (unlikely(!zspage)) {
+			kmem_cache_free(pool->handle_cachep, (void *)handle);
+			return 0;
+		}
+		atomic_long_add(class->pages_per_zspage,
+				&pool->pages_allocated);
+		spin_lock(&class->lock);
+		class->zspages++;
+	}
+
+	idx = obj_alloc(class, zspage, handle);
+	*(unsigned long *)handle = location_to_obj(zspage, idx) <<
+					HANDLE_TAG_BITS;
+	insert_zspage(class, zspage);
+	spin_unlock(&class->lock);
+
+	return handle;
+}
+EXPORT_SYMBOL_GPL(zs_malloc);
+
+void zs_free(struct zs_pool *pool, unsigned long handle)
+{
+	unsigned int idx;
+	struct zspage *zspage;
+	struct size_class *class;
+	enum fullness_group fg;
+
+	if (unlikely(!handle))
+		return;
+
+	/* Keep compaction from moving the object while we free it */
+	pin_handle(handle);
+	obj_to_location(handle_to_obj(handle), &zspage, &idx);
+	class = zspage->class;
+
+	spin_lock(&class->lock);
+	obj_free(class, zspage, idx);
+	fg = fix_fullness_group(class, zspage);
+	if (fg == ZS_EMPTY)
+		class->zspages--;
+	spin_unlock(&class->lock);
+	unpin_handle(handle);
+
+	kmem_cache_free(pool->handle_cachep, (void *)handle);
+	if (fg == ZS_EMPTY)
+		free_zspage(pool, zspage);
+}
+EXPORT_SYMBOL_GPL(zs_free);
+
+/**
+ * zs_map_object - get address of allocated object from handle.
+ * @pool: pool from which the object was allocated
+ * @handle: handle returned from zs_malloc
+ * @mm: mapping mode; only matters for objects spanning two pages
+ *
+ * Before using an object allocated from zs_malloc, it must be mapped
+ * using this function. When done, zs_unmap_object() must be called.
+ *
+ * The object is pinned against compaction and preemption is disabled
+ * between the two calls, so only one object can be mapped per cpu at
+ * a time and the caller must not sleep.
+ */
+void *zs_map_object(struct zs_pool *pool, unsigned long handle,
+			enum zs_mapmode mm)
+{
+	unsigned int idx;
+	unsigned long off;
+	struct zspage *zspage;
+	struct size_class *class;
+	struct mapping_area *area;
+
+	BUG_ON(!handle);
+
+	pin_handle(handle);
+	obj_to_location(handle_to_obj(handle), &zspage, &idx);
+	class = zspage->class;
+	off = (unsigned long)idx * class->size;
+
+	area = &__get_cpu_var(zs_map_area);
+	area->vm_mm = mm;
+
+	if ((off & ~PAGE_MASK) + class->size <= PAGE_SIZE) {
+		/* Object lies within a single page */
+		area->vm_addr = kmap_atomic(zspage->pages[off >> PAGE_SHIFT],
+					KM_USER1);
+		return area->vm_addr + (off & ~PAGE_MASK);
+	}
+
+	/* Object spans two pages: go through the per-cpu buffer */
+	area->vm_addr = NULL;
+	if (mm != ZS_MM_WO)
+		zs_copy_object(zspage, off, area->vm_buf, class->size, 0);
+
+	return area->vm_buf;
+}
+EXPORT_SYMBOL_GPL(zs_map_object);
+
+void zs_unmap_object(struct zs_pool *pool, unsigned long handle)
+{
+	unsigned int idx;
+	struct zspage *zspage;
+	struct size_class *class;
+	struct mapping_area *area;
+
+	BUG_ON(!handle);
+
+	area = &__get_cpu_var(zs_map_area);
+	if (area->vm_addr) {
+		kunmap_atomic(area->vm_addr, KM_USER1);
+		area->vm_addr = NULL;
+	} else if (area->vm_mm != ZS_MM_RO) {
+		obj_to_location(handle_to_obj(handle), &zspage, &idx);
+		class = zspage->class;
+		zs_copy_object(zspage, (unsigned long)idx * class->size,
+				area->vm_buf, class->size, 1);
+	}
+
+	unpin_handle(handle);
+}
+EXPORT_SYMBOL_GPL(zs_unmap_object);
+
+u64 zs_get_total_size_bytes(struct zs_pool *pool)
+{
+	return (u64)atomic_long_read(&pool->pages_allocated) << PAGE_SHIFT;
+}
+EXPORT_SYMBOL_GPL(zs_get_total_size_bytes);
+
+/*
+ * Number of zspages that could be freed if all objects of the class
+ * were packed together. Caller must hold class->lock.
+ */
+static unsigned long zs_can_compact(struct size_class *class)
+{
+	unsigned long obj_wasted;
+
+	obj_wasted = class->zspages * class->objs_per_zspage -
+			class->objs_inuse;
+
+	return obj_wasted / class->objs_per_zspage;
+}
+
+/* Pick the least used almost empty zspage as migration source */
+static struct zspage *isolate_source_zspage(struct size_class *class)
+{
+	struct zspage *zspage, *src = NULL;
+
+	list_for_each_entry(zspage,
+			&class->fullness_list[ZS_ALMOST_EMPTY], list) {
+		if (!src || zspage->inuse < src->inuse)
+			src = zspage;
+	}
+
+	if (src)
+		remove_zspage(class, src);
+
+	return src;
+}
+
+/*
+ * Move all objects of the isolated zspage src into other zspages of
+ * the class. Returns 0 if some object could not be moved because it
+ * is pinned or no destination is left. Caller must hold class->lock.
+ */
+static int migrate_zspage(struct size_class *class, struct zspage *src)
+{
+	unsigned int idx, new_idx;
+	unsigned long slot, handle;
+	struct zspage *dst;
+	int ret = 1;
+
+	for (idx = 0; idx < class->objs_per_zspage && src->inuse; idx++) {
+		slot = src->slots[idx];
+		if (!(slot & OBJ_ALLOCATED_TAG))
+			continue;
+
+		handle = slot & ~OBJ_ALLOCATED_TAG;
+		if (!trypin_handle(handle)) {
+			/* Object is mapped or being freed: leave it */
+			ret = 0;
+			continue;
+		}
+
+		dst = find_get_zspage(class);
+		if (!dst) {
+			unpin_handle(handle);
+			return 0;
+		}
+		remove_zspage(class, dst);
+
+		new_idx = obj_alloc(class, dst, handle);
+		zs_move_object(dst, (unsigned long)new_idx * class->size,
+				src, (unsigned long)idx * class->size,
+				class->size);
+		record_obj(handle, location_to_obj(dst, new_idx));
+		obj_free(class, src, idx);
+		insert_zspage(class, dst);
+
+		class->migrated++;
+		unpin_handle(handle);
+	}
+
+	return ret;
+}
+
+static unsigned long __zs_compact(struct zs_pool *pool,
+				struct size_class *class, unsigned long limit)
+{
+	unsigned long freed = 0;
+	struct zspage *src;
+	int done;
+
+	spin_lock(&class->lock);
+	while (freed < limit && zs_can_compact(class)) {
+		src = isolate_source_zspage(class);
+		if (!src)
+			break;
+
+		done = migrate_zspage(class, src);
+		if (insert_zspage(class, src) == ZS_EMPTY) {
+			class->zspages--;
+			free_zspage(pool, src);
+			freed += class->pages_per_zspage;
+		}
+		if (!done)
+			break;
+
+		spin_unlock(&class->lock);
+		cond_resched();
+		spin_lock(&class->lock);
+	}
+	spin_unlock(&class->lock);
+
+	return freed;
+}
+
+/* Compact the classes, largest first, until limit pages are freed */
+static unsigned long zs_compact_classes(struct zs_pool *pool,
+				unsigned long limit)
+{
+	int i;
+	unsigned long freed = 0;
+
+	for (i = ZS_SIZE_CLASSES - 1; i >= 0 && freed < limit; i--)
+		freed += __zs_compact(pool, &pool->size_class[i],
+					limit - freed);
+
+	return freed;
+}
+
+/**
+ * zs_compact - migrate objects out of sparsely used zspages
+ * @pool: pool to compact
+ *
+ * Returns the number of pages given back to the system. May sleep.
+ */
+unsigned long zs_compact(struct zs_pool *pool)
+{
+	unsigned long freed;
+
+	mutex_lock(&pool->compact_lock);
+	freed = zs_compact_classes(pool, ULONG_MAX);
+	mutex_unlock(&pool->compact_lock);
+
+	return freed;
+}
+EXPORT_SYMBOL_GPL(zs_compact);
+
+/**
+ * zs_shrink - compact on behalf of reclaim
+ * @pool: pool to compact
+ * @nr_pages: no. of pages to give back
+ *
+ * Like zs_compact() but stops once about @nr_pages pages are freed,
+ * and does not wait for a compaction already running. Returns the
+ * number of pages freed, or -EBUSY.
+ */
+long zs_shrink(struct zs_pool *pool, unsigned long nr_pages)
+{
+	unsigned long freed;
+
+	if (!mutex_trylock(&pool->compact_lock))
+		return -EBUSY;
+	freed = zs_compact_classes(pool, nr_pages);
+	mutex_unlock(&pool->compact_lock);
+
+	return freed;
+}
+EXPORT_SYMBOL_GPL(zs_shrink);
+
+/* Pages zs_compact() could give back right now */
+unsigned long zs_compactable_pages(struct zs_pool *pool)
+{
+	int i;
+	unsigned long pages = 0;
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		struct size_class *class = &pool->size_class[i];
+
+		spin_lock(&class->lock);
+		pages += zs_can_compact(class) * class->pages_per_zspage;
+		spin_unlock(&class->lock);
+	}
+
+	return pages;
+}
+EXPORT_SYMBOL_GPL(zs_compactable_pages);
+
+u64 zs_get_num_migrated(struct zs_pool *pool)
+{
+	int i;
+	u64 migrated = 0;
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		struct size_class *class = &pool->size_class[i];
+
+		spin_lock(&class->lock);
+		migrated += class->migrated;
+		spin_unlock(&class->lock);
+	}
+
+	return migrated;
+}
+EXPORT_SYMBOL_GPL(zs_get_num_migrated);
+
+#ifdef CONFIG_DEBUG_FS
+
+/*
+ * Per-class occupancy. "frag" is the percentage of allocated object
+ * slots that are unused; "compactable" is the number of pages that
+ * compaction could free in this class.
+ */
+static int zs_stats_classes_show(struct seq_file *s, void *v)
+{
+	int i;
+	struct zs_pool *pool = s->private;
+	unsigned long total_allocated = 0, total_used = 0, total_pages = 0;
+
+	seq_printf(s, " %5s %5s %9s %9s %6s %6s %6s %6s %5s %5s %11s %9s\n",
+		"class", "size", "obj_alloc", "obj_used", "pages",
+		"ppz", "full", "afull", "aempty", "frag", "compactable",
+		"migrated");
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		struct size_class *class = &pool->size_class[i];
+		unsigned long allocated, used, pages, compactable;
+		unsigned long full, afull, aempty;
+		u64 migrated;
+
+		spin_lock(&class->lock);
+		allocated = class->zspages * class->objs_per_zspage;
+		used = class->objs_inuse;
+		pages = class->zspages * class->pages_per_zspage;
+		compactable = zs_can_compact(class) * class->pages_per_zspage;
+		full = class->nr_fullness[ZS_FULL];
+		afull = class->nr_fullness[ZS_ALMOST_FULL];
+		aempty = class->nr_fullness[ZS_ALMOST_EMPTY];
+		migrated = class->migrated;
+		spin_unlock(&class->lock);
+
+		if (!allocated && !migrated)
+			continue;
+
+		seq_printf(s, " %5d %5d %9lu %9lu %6lu %6d %6lu %6lu %6lu "
+			"%4lu%% %11lu %9llu\n",
+			i, class->size, allocated, used, pages,
+			class->pages_per_zspage, full, afull, aempty,
+			allocated ? 100 - used * 100 / allocated : 0,
+			compactable, migrated);
+
+		total_allocated += allocated;
+		total_used += used;
+		total_pages += pages;
+	}
+
+	seq_printf(s, " %5s %5s %9lu %9lu %6lu %6s %6s %6s %6s %4lu%%\n",
+		"Total", "", total_allocated, total_used, total_pages,
+		"", "", "", "",
+		total_allocated ?
+			100 - total_used * 100 / total_allocated : 0);
+
+	return 0;
+}
+
+static int zs_stats_classes_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, zs_stats_classes_show, inode->i_private);
+}
+
+static const struct file_operations zs_stats_classes_fops = {
+	.open = zs_stats_classes_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static void zs_pool_stat_create(struct zs_pool *pool)
+{
+	if (!zs_stat_root)
+		return;
+
+	pool->stat_dentry = debugfs_create_dir(pool->name, zs_stat_root);
+	if (!pool->stat_dentry)
+		return;
+
+	debugfs_create_file("classes", S_IRUGO, pool->stat_dentry, pool,
+			&zs_stats_classes_fops);
+}
+
+static void zs_pool_stat_destroy(struct zs_pool *pool)
+{
+	debugfs_remove_recursive(pool->stat_dentry);
+}
+
+#else
+
+static void zs_pool_stat_create(struct zs_pool *pool)
+{
+}
+
+static void zs_pool_stat_destroy(struct zs_pool *pool)
+{
+}
+
+#endif
+
+static void zs_unregister_pool(struct zs_pool *pool)
+{
+	int cpu;
+
+	mutex_lock(&zs_init_lock);
+	zs_pool_stat_destroy(pool);
+	if (!--zs_nr_pools) {
+		for_each_possible_cpu(cpu) {
+			kfree(per_cpu(zs_map_area, cpu).vm_buf);
+			per_cpu(zs_map_area, cpu).vm_buf = NULL;
+		}
+#ifdef CONFIG_DEBUG_FS
+		debugfs_remove_recursive(zs_stat_root);
+		zs_stat_root = NULL;
+#endif
+	}
+	mutex_unlock(&zs_init_lock);
+}
+
+/* Set up per-cpu mapping buffers and stats on first pool creation */
+static int zs_register_pool(struct zs_pool *pool)
+{
+	int cpu;
+
+	mutex_lock(&zs_init_lock);
+	if (!zs_nr_pools++) {
+		for_each_possible_cpu(cpu) {
+			struct mapping_area *area = &per_cpu(zs_map_area, cpu);
+
+			area->vm_buf = kmalloc(ZS_MAX_ALLOC_SIZE, GFP_KERNEL);
+			if (!area->vm_buf) {
+				mutex_unlock(&zs_init_lock);
+				zs_unregister_pool(pool);
+				return -ENOMEM;
+			}
+		}
+#ifdef CONFIG_DEBUG_FS
+		zs_stat_root = debugfs_create_dir("zsmalloc", NULL);
+#endif
+	}
+	zs_pool_stat_create(pool);
+	mutex_unlock(&zs_init_lock);
+
+	return 0;
+}
+
+/**
+ * zs_create_pool - Creates an allocation pool to work from.
+ * @name: name of the pool, used for stats
+ * @flags: allocation flags used to allocate zspage pages
+ *
+ * Returns NULL on failure.
+ */
+struct zs_pool *zs_create_pool(const char *name, gfp_t flags)
+{
+	int i;
+	struct zs_pool *pool;
+
+	BUILD_BUG_ON(ZS_MAX_OBJS_PER_ZSPAGE > (1UL << OBJ_INDEX_BITS));
+
+	pool = vzalloc(sizeof(*pool));
+	if (!pool)
+		return NULL;
+
+	pool->name = kstrdup(name, GFP_KERNEL);
+	pool->handle_cache_name = kasprintf(GFP_KERNEL, "zs_handle-%s", name);
+	if (!pool->name || !pool->handle_cache_name)
+		goto fail;
+
+	pool->handle_cachep = kmem_cache_create(pool->handle_cache_name,
+				sizeof(unsigned long), 0, 0, NULL);
+	if (!pool->handle_cachep)
+		goto fail;
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		int fg;
+		struct size_class *class = &pool->size_class[i];
+
+		spin_lock_init(&class->lock);
+		class->index = i;
+		class->size = ZS_MIN_ALLOC_SIZE + i * ZS_SIZE_CLASS_DELTA;
+		if (class->size > ZS_MAX_ALLOC_SIZE)
+			class->size = ZS_MAX_ALLOC_SIZE;
+		class->pages_per_zspage = get_pages_per_zspage(class->size);
+		class->objs_per_zspage = class->pages_per_zspage *
+					PAGE_SIZE / class->size;
+		for (fg = 0; fg < _ZS_NR_FULLNESS_GROUPS; fg++)
+			INIT_LIST_HEAD(&class->fullness_list[fg]);
+	}
+
+	pool->flags = flags;
+	atomic_long_set(&pool->pages_allocated, 0);
+	mutex_init(&pool->compact_lock);
+
+	if (zs_register_pool(pool))
+		goto fail;
+
+	return pool;
+
+fail:
+	if (pool->handle_cachep)
+		kmem_cache_destroy(pool->handle_cachep);
+	kfree(pool->handle_cache_name);
+	kfree(pool->name);
+	vfree(pool);
+	return NULL;
+}
+EXPORT_SYMBOL_GPL(zs_create_pool);
+
+void zs_destroy_pool(struct zs_pool *pool)
+{
+	int i, fg;
+
+	zs_unregister_pool(pool);
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		struct size_class *class = &pool->size_class[i];
+
+		for (fg = 0; fg < _ZS_NR_FULLNESS_GROUPS; fg++) {
+			struct zspage *zspage, *tmp;
+
+			list_for_each_entry_safe(zspage, tmp,
+					&class->fullness_list[fg], list) {
+				pr_info("Freeing non-empty class %d (size %d)\n",
+					i, class->size);
+				list_del(&zspage->list);
+				free_zspage(pool, zspage);
+			}
+		}
+	}
+
+	kmem_cache_destroy(pool->handle_cachep);
+	kfree(pool->handle_cache_name);
+	kfree(pool->name);
+	vfree(pool);
+}
+EXPORT_SYMBOL_GPL(zs_destroy_pool);
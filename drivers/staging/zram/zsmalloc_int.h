@@ -0,0 +1,131 @@
+/*
+ * zsmalloc memory allocator
+ *
+ * Copyright (C) 2026 LG Electronics, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#ifndef _ZS_MALLOC_INT_H_
+#define _ZS_MALLOC_INT_H_
+
+#include <linux/kernel.h>
+#include <linux/list.h>
+#include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/types.h>
+
+#include "zsmalloc.h"
+
+/* User configurable params */
+
+/*
+ * A zspage is a group of up to ZS_MAX_PAGES_PER_ZSPAGE order-0 pages
+ * holding objects of a single size class. Objects are laid out back
+ * to back and may straddle a page boundary, so waste per zspage is
+ * less than one object.
+ */
+#define ZS_MAX_PAGES_PER_ZSPAGE	4
+
+#define ZS_MIN_ALLOC_SIZE	32
+#define ZS_MAX_ALLOC_SIZE	PAGE_SIZE
+
+/* Size classes are separated by ZS_SIZE_CLASS_DELTA bytes */
+#define ZS_SIZE_CLASS_DELTA	16
+#define ZS_SIZE_CLASSES		((ZS_MAX_ALLOC_SIZE - ZS_MIN_ALLOC_SIZE) \
+					/ ZS_SIZE_CLASS_DELTA + 1)
+
+/*
+ * A zspage is "almost empty" when at most this fraction of its
+ * objects is in use. Compaction moves objects out of almost empty
+ * zspages into fuller ones.
+ */
+#define ZS_ALMOST_EMPTY_NUM	3
+#define ZS_ALMOST_EMPTY_DEN	4
+
+/* End of user params */
+
+/*
+ * A handle is a pointer to a word holding the object location. The
+ * location is <pfn of first zspage page, object index>; bit 0 is a
+ * pin bit held while the object is mapped or being freed, which keeps
+ * compaction from moving the object underneath the user.
+ */
+#define HANDLE_PIN_BIT		0
+#define HANDLE_TAG_BITS		1
+
+#define ZS_MAX_OBJS_PER_ZSPAGE	\
+	(ZS_MAX_PAGES_PER_ZSPAGE * PAGE_SIZE / ZS_MIN_ALLOC_SIZE)
+
+/* Enough bits to index ZS_MAX_OBJS_PER_ZSPAGE objects */
+#define OBJ_INDEX_BITS		(PAGE_SHIFT - 3)
+#define OBJ_INDEX_MASK		((1UL << OBJ_INDEX_BITS) - 1)
+
+/*
+ * Per object slot kept in the zspage descriptor: either the owning
+ * handle tagged with OBJ_ALLOCATED_TAG, or the index of the next free
+ * object shifted left by one.
+ */
+#define OBJ_ALLOCATED_TAG	1UL
+
+enum fullness_group {
+	ZS_EMPTY,
+	ZS_ALMOST_EMPTY,
+	ZS_ALMOST_FULL,
+	ZS_FULL,
+	_ZS_NR_FULLNESS_GROUPS,
+};
+
+struct size_class;
+
+/* Descriptor for one zspage; the first page's ->private points here */
+struct zspage {
+	struct list_head list;
+	struct size_class *class;
+	enum fullness_group fullness;
+	unsigned int inuse;
+	unsigned int first_free;
+	struct page *pages[ZS_MAX_PAGES_PER_ZSPAGE];
+	unsigned long slots[0];
+};
+
+struct size_class {
+	spinlock_t lock;
+	int size;
+	int index;
+	int pages_per_zspage;
+	int objs_per_zspage;
+	struct list_head fullness_list[_ZS_NR_FULLNESS_GROUPS];
+
+	/* Stats, protected by lock */
+	unsigned long zspages;
+	unsigned long objs_inuse;
+	unsigned long nr_fullness[_ZS_NR_FULLNESS_GROUPS];
+	u64 migrated;
+};
+
+struct zs_pool {
+	const char *name;
+	gfp_t flags;
+	struct size_class size_class[ZS_SIZE_CLASSES];
+	struct kmem_cache *handle_cachep;
+	char *handle_cache_name;
+	atomic_long_t pages_allocated;
+	/* Serializes compaction runs from sysfs and the shrinker */
+	struct mutex compact_lock;
+	struct dentry *stat_dentry;
+};
+
+/*
+ * Per-cpu area used to map objects that straddle two pages: the
+ * object is copied into vm_buf on map and back on unmap.
+ */
+struct mapping_area {
+	char *vm_buf;
+	char *vm_addr;
+	enum zs_mapmode vm_mm;
+};
+
+#endif
@@ -543,6 +543,10 @@ static int dsscomp_probe(struct platform_device *pdev)
 #ifdef CONFIG_DSSCOMP_DEBUG_LOG
 		debugfs_create_file("log", S_IRUGO,
 			cdev->dbgfs, dsscomp_dbg_events, &dsscomp_debug_fops);
+#endif
+#ifdef CONFIG_DSSCOMP_DEBUG_TIMELINE
+		debugfs_create_file("timeline", S_IRUGO,
+			cdev->dbgfs, dsscomp_dbg_timeline, &dsscomp_debug_fops);
 #endif
 	}
 
@@ -25,6 +25,7 @@
 #include <linux/miscdevice.h>
 #include <linux/debugfs.h>
 #include <linux/seq_file.h>
+#include <linux/ktime.h>
 #ifdef CONFIG_DSSCOMP_DEBUG_LOG
 #include <linux/hrtimer.h>
 #endif
@@ -97,6 +98,17 @@ enum dsscomp_state {
 	DSSCOMP_STATE_DISPLAYED		= 0xD15504CA,
 };
 
+/* points of a composition's timeline */
+enum dsscomp_tl_point {
+	DSSCOMP_TL_POST,	/* posted by gralloc or the setup ioctl */
+	DSSCOMP_TL_APPLY,	/* apply started */
+	DSSCOMP_TL_GO,		/* GO bit set */
+	DSSCOMP_TL_PROGRAMMED,	/* configuration taken by DISPC */
+	DSSCOMP_TL_VSYNC,	/* first VSYNC after programming */
+	DSSCOMP_TL_RELEASE,	/* no longer displayed */
+	DSSCOMP_TL_NUM,
+};
+
 struct dsscomp_data {
 	enum dsscomp_state state;
 	/*
@@ -119,6 +131,7 @@ struct dsscomp_data {
 	void (*extra_cb)(void *data, int status);
 	void *extra_cb_data;
 	bool must_apply;	/* whether composition must be applied */
+	struct dsscomp_data *apply_next;	/* next on the apply list */
 
 #ifdef CONFIG_DEBUG_FS
 	struct list_head dbg_q;
@@ -127,6 +140,10 @@ struct dsscomp_data {
 		u32 t, state;
 	} dbg_log[8];
 #endif
+#ifdef CONFIG_DSSCOMP_DEBUG_TIMELINE
+	ktime_t tl[DSSCOMP_TL_NUM];
+	u32 tl_frame_us;	/* frame period of the display */
+#endif
 };
 
 struct dsscomp_sync_obj {
@@ -195,6 +212,26 @@ extern u32 dbg_event_ix;
 void dsscomp_dbg_events(struct seq_file *s);
 #endif
 
+#ifdef CONFIG_DSSCOMP_DEBUG_TIMELINE
+void dsscomp_dbg_timeline(struct seq_file *s);
+#endif
+
+static inline
+void dsscomp_tl_set(struct dsscomp_data *c, enum dsscomp_tl_point p, ktime_t t)
+{
+#ifdef CONFIG_DSSCOMP_DEBUG_TIMELINE
+	c->tl[p] = t;
+#endif
+}
+
+static inline
+void dsscomp_tl_mark(struct dsscomp_data *c, enum dsscomp_tl_point p)
+{
+#ifdef CONFIG_DSSCOMP_DEBUG_TIMELINE
+	c->tl[p] = ktime_get();
+#endif
+}
+
 static inline
 void __log_event(u32 ix, u32 ms, void *data, const char *fmt, u32 a1, u32 a2)
 {
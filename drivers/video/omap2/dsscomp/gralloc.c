@@ -179,6 +179,7 @@ int dsscomp_gralloc_queue(struct dsscomp_setup_dispc_data *d,
 	int skip;
 	struct dsscomp_gralloc_t *gsync;
 	struct dss2_rect_t win = { .w = 0 };
+	ktime_t post = ktime_get();
 
 	/* reserve tiler areas if not already done so */
 	dsscomp_gralloc_init(cdev);
@@ -269,6 +270,7 @@ int dsscomp_gralloc_queue(struct dsscomp_setup_dispc_data *d,
 								mgr->name);
 			continue;
 		}
+		dsscomp_tl_set(comp[ch], DSSCOMP_TL_POST, post);
 
 		/* set basic manager information for blanked managers */
 		if (!(mgr_set_mask & (1 << ch))) {
@@ -24,6 +24,7 @@
 #include <linux/sched.h>
 #include <linux/slab.h>
 #include <linux/ratelimit.h>
+#include <linux/math64.h>
 
 #include <video/omapdss.h>
 #include <video/dsscomp.h>
@@ -34,7 +35,15 @@
 #include "dsscomp.h"
 /* queue state */
 
-static DEFINE_MUTEX(mtx);
+/*
+ * A composition belongs to its creator until it is applied, so setting it
+ * up needs no locking.  qlock only guards the overlay bookkeeping, which
+ * is shared by all managers, and is never held across DSS calls.  Applied
+ * compositions are pushed onto their manager's apply list without locking
+ * and the manager's apply work takes the whole list at once, so posting
+ * never waits for the programming of the other display or for callbacks.
+ */
+static DEFINE_SPINLOCK(qlock);
 
 /* free overlay structs */
 struct maskref {
@@ -42,8 +51,11 @@ struct maskref {
 	u32 refs[MAX_OVERLAYS];
 };
 
-static struct {
+static struct dsscomp_mgrq {
 	struct workqueue_struct *apply_workq;
+	struct work_struct apply_work;
+	dsscomp_t apply_list;	/* compositions to apply, newest first */
+	struct mutex mtx;	/* serializes applying with blanking */
 
 	u32 ovl_mask;		/* overlays used on this display */
 	struct maskref ovl_qmask;		/* overlays queued to this display */
@@ -93,9 +105,11 @@ static void maskref_decmask(struct maskref *om, u32 mask)
 	}
 }
 
+static void dsscomp_do_apply(struct work_struct *work);
+
 /*
  * ===========================================================================
- *		EXIT
+ *		INIT
  * ===========================================================================
  */
 
@@ -114,6 +128,8 @@ int dsscomp_queue_init(struct dsscomp_dev *cdev_)
 		mgrq[i].apply_workq = create_singlethread_workqueue("dsscomp_apply");
 		if (!mgrq[i].apply_workq)
 			goto error;
+		INIT_WORK(&mgrq[i].apply_work, dsscomp_do_apply);
+		mutex_init(&mgrq[i].mtx);
 
 		/* record overlays on this display */
 		mgr = cdev->mgrs[i];
@@ -185,6 +201,7 @@ dsscomp_t dsscomp_new(struct omap_overlay_manager *mgr)
 		comp->frm.mgr.ix = display_ix;
 
 	comp->state = DSSCOMP_STATE_ACTIVE;
+	dsscomp_tl_mark(comp, DSSCOMP_TL_POST);
 
 	DO_IF_DEBUG_FS({
 		__log_state(comp, dsscomp_new, 0);
@@ -198,14 +215,9 @@ EXPORT_SYMBOL(dsscomp_new);
 /* returns overlays used in a composition */
 u32 dsscomp_get_ovls(dsscomp_t comp)
 {
-	u32 mask;
-
-	mutex_lock(&mtx);
 	BUG_ON(comp->state != DSSCOMP_STATE_ACTIVE);
-	mask = comp->ovl_mask;
-	mutex_unlock(&mtx);
 
-	return mask;
+	return comp->ovl_mask;
 }
 EXPORT_SYMBOL(dsscomp_get_ovls);
 
@@ -216,17 +228,15 @@ int dsscomp_set_ovl(dsscomp_t comp, struct dss2_ovl_info *ovl)
 	u32 i, mask, oix, ix;
 	struct omap_overlay *o;
 
-	mutex_lock(&mtx);
-
 	BUG_ON(!ovl);
 	BUG_ON(comp->state != DSSCOMP_STATE_ACTIVE);
 
 	ix = comp->ix;
 
-	if (ovl->cfg.ix >= cdev->num_ovls) {
-		r = -EINVAL;
-		goto done;
-	}
+	if (ovl->cfg.ix >= cdev->num_ovls)
+		return -EINVAL;
+
+	spin_lock(&qlock);
 
 	/* if overlay is already part of the composition */
 	mask = 1 << ovl->cfg.ix;
@@ -263,10 +273,12 @@ int dsscomp_set_ovl(dsscomp_t comp, struct dss2_ovl_info *ovl)
 		maskref_incbit(&mgrq[ix].ovl_qmask, ovl->cfg.ix);
 	}
 
+	spin_unlock(&qlock);
+
 	comp->ovls[oix] = *ovl;
-	r = 0;
+	return 0;
 done:
-	mutex_unlock(&mtx);
+	spin_unlock(&qlock);
 
 	return r;
 }
@@ -278,8 +290,6 @@ int dsscomp_get_ovl(dsscomp_t comp, u32 ix, struct dss2_ovl_info *ovl)
 	int r;
 	u32 oix;
 
-	mutex_lock(&mtx);
-
 	BUG_ON(!ovl);
 	BUG_ON(comp->state != DSSCOMP_STATE_ACTIVE);
 
@@ -297,8 +307,6 @@ int dsscomp_get_ovl(dsscomp_t comp, u32 ix, struct dss2_ovl_info *ovl)
 		r = -ENOENT;
 	}
 
-	mutex_unlock(&mtx);
-
 	return r;
 }
 EXPORT_SYMBOL(dsscomp_get_ovl);
@@ -306,15 +314,11 @@ EXPORT_SYMBOL(dsscomp_get_ovl);
 /* set manager info */
 int dsscomp_set_mgr(dsscomp_t comp, struct dss2_mgr_info *mgr)
 {
-	mutex_lock(&mtx);
-
 	BUG_ON(comp->state != DSSCOMP_STATE_ACTIVE);
 	BUG_ON(mgr->ix != comp->frm.mgr.ix);
 
 	comp->frm.mgr = *mgr;
 
-	mutex_unlock(&mtx);
-
 	return 0;
 }
 EXPORT_SYMBOL(dsscomp_set_mgr);
@@ -322,15 +326,11 @@ EXPORT_SYMBOL(dsscomp_set_mgr);
 /* get manager info */
 int dsscomp_get_mgr(dsscomp_t comp, struct dss2_mgr_info *mgr)
 {
-	mutex_lock(&mtx);
-
 	BUG_ON(!mgr);
 	BUG_ON(comp->state != DSSCOMP_STATE_ACTIVE);
 
 	*mgr = comp->frm.mgr;
 
-	mutex_unlock(&mtx);
-
 	return 0;
 }
 EXPORT_SYMBOL(dsscomp_get_mgr);
@@ -339,19 +339,114 @@ EXPORT_SYMBOL(dsscomp_get_mgr);
 int dsscomp_setup(dsscomp_t comp, enum dsscomp_setup_mode mode,
 			struct dss2_rect_t win)
 {
-	mutex_lock(&mtx);
-
 	BUG_ON(comp->state != DSSCOMP_STATE_ACTIVE);
 
 	comp->frm.mode = mode;
 	comp->frm.win = win;
 
-	mutex_unlock(&mtx);
-
 	return 0;
 }
 EXPORT_SYMBOL(dsscomp_setup);
 
+/*
+ * ===========================================================================
+ *		TIMELINE
+ * ===========================================================================
+ */
+
+#ifdef CONFIG_DSSCOMP_DEBUG_TIMELINE
+#define TL_SECS		16	/* seconds of histograms kept */
+
+/* upper bounds of the display latency buckets (ms), the last is open */
+static const u32 tl_lat_ms[] = { 8, 16, 33, 50, 67, 100 };
+
+/* timelines of the last released compositions */
+static struct dsscomp_tl_entry {
+	dsscomp_t comp;		/* only identifies the composition */
+	u32 ix, sync_id;
+	ktime_t t[DSSCOMP_TL_NUM];
+} tl_ring[128];
+static u32 tl_ring_ix;
+
+/* per-second statistics of each manager, by the second of the post */
+static struct dsscomp_tl_hist {
+	u32 sec;
+	u32 frames;				/* compositions displayed */
+	u32 lat[ARRAY_SIZE(tl_lat_ms) + 1];	/* post to 1st VSYNC */
+	u32 missed;				/* VSYNCs passed with GO set */
+	u32 dropped;				/* released without display */
+} tl_hist[MAX_MANAGERS][TL_SECS];
+
+static DEFINE_SPINLOCK(tl_lock);
+
+/* time between two points of a timeline in usecs */
+static u32 tl_us(ktime_t *t, enum dsscomp_tl_point from,
+		 enum dsscomp_tl_point to)
+{
+	s64 us = ktime_to_us(ktime_sub(t[to], t[from]));
+	return us > 0 ? us : 0;
+}
+
+/* frame period of a display in usecs, 0 if unknown */
+static u32 dsscomp_tl_frame_us(struct omap_dss_device *dssdev)
+{
+	struct omap_video_timings *t = &dssdev->panel.timings;
+	u64 pixels = (u64) (t->x_res + t->hsw + t->hfp + t->hbp) *
+				(t->y_res + t->vsw + t->vfp + t->vbp);
+
+	return t->pixel_clock ? div_u64(pixels * 1000, t->pixel_clock) : 0;
+}
+
+static void dsscomp_tl_record(dsscomp_t comp)
+{
+	struct dsscomp_tl_entry *e;
+	struct dsscomp_tl_hist *h;
+	ktime_t *t = comp->tl;
+	u32 sec = ktime_to_timeval(t[DSSCOMP_TL_POST]).tv_sec;
+	u32 i, ms;
+
+	spin_lock(&tl_lock);
+	e = tl_ring + tl_ring_ix;
+	e->comp = comp;
+	e->ix = comp->ix;
+	e->sync_id = comp->frm.sync_id;
+	memcpy(e->t, t, sizeof(e->t));
+	tl_ring_ix = (tl_ring_ix + 1) % ARRAY_SIZE(tl_ring);
+
+	h = &tl_hist[comp->ix][sec % TL_SECS];
+	if (h->sec > sec)
+		goto done;	/* second no longer kept */
+	if (h->sec != sec) {
+		memset(h, 0, sizeof(*h));
+		h->sec = sec;
+	}
+
+	if (!t[DSSCOMP_TL_VSYNC].tv64) {
+		h->dropped++;
+		goto done;
+	}
+
+	ms = tl_us(t, DSSCOMP_TL_POST, DSSCOMP_TL_VSYNC) / 1000;
+	for (i = 0; i < ARRAY_SIZE(tl_lat_ms); i++)
+		if (ms < tl_lat_ms[i])
+			break;
+	h->lat[i]++;
+	h->frames++;
+
+	/* GO is taken at the first VSYNC after it is set */
+	if (comp->tl_frame_us && t[DSSCOMP_TL_GO].tv64 &&
+	    t[DSSCOMP_TL_PROGRAMMED].tv64)
+		h->missed += tl_us(t, DSSCOMP_TL_GO, DSSCOMP_TL_PROGRAMMED) /
+							comp->tl_frame_us;
+done:
+	spin_unlock(&tl_lock);
+}
+#else
+static inline void dsscomp_tl_record(dsscomp_t comp)
+{
+}
+#endif
+
 /*
  * ===========================================================================
  *		QUEUING COMMITTING OPERATIONS
@@ -360,8 +455,11 @@ EXPORT_SYMBOL(dsscomp_setup);
 void dsscomp_drop(dsscomp_t comp)
 {
 	/* decrement unprogrammed references */
-	if (comp->state < DSSCOMP_STATE_PROGRAMMED)
+	if (comp->state < DSSCOMP_STATE_PROGRAMMED) {
+		spin_lock(&qlock);
 		maskref_decmask(&mgrq[comp->ix].ovl_qmask, comp->ovl_mask);
+		spin_unlock(&qlock);
+	}
 	comp->state = 0;
 
 	if (debug & DEBUG_COMPOSITIONS)
@@ -388,8 +486,6 @@ static void dsscomp_mgr_delayed_cb(struct work_struct *work)
 
 	kfree(work);
 
-	mutex_lock(&mtx);
-
 	BUG_ON(comp->state == DSSCOMP_STATE_ACTIVE);
 	ix = comp->ix;
 
@@ -403,8 +499,10 @@ static void dsscomp_mgr_delayed_cb(struct work_struct *work)
 		log_state(comp, dsscomp_mgr_delayed_cb, status);
 
 		/* update used overlay mask */
+		spin_lock(&qlock);
 		mgrq[ix].ovl_mask = comp->ovl_mask & ~comp->ovl_dmask;
 		maskref_decmask(&mgrq[ix].ovl_qmask, comp->ovl_mask);
+		spin_unlock(&qlock);
 
 		if (debug & DEBUG_PHASES)
 			dev_info(DEV(cdev), "[%p] programmed\n", comp);
@@ -420,15 +518,24 @@ static void dsscomp_mgr_delayed_cb(struct work_struct *work)
 		log_event(20 * comp->ix + 20, 0, comp, "%pf on %s",
 				(u32) dsscomp_mgr_delayed_cb,
 				(u32) log_status_str(status));
+		dsscomp_tl_record(comp);
 		dsscomp_drop(comp);
 	}
-	mutex_unlock(&mtx);
 }
 
 static u32 dsscomp_mgr_callback(void *data, int id, int status)
 {
 	struct dsscomp_data *comp = data;
 
+	/* take timestamps here, in the interrupt */
+	if (status == DSS_COMPLETION_PROGRAMMED)
+		dsscomp_tl_mark(comp, DSSCOMP_TL_PROGRAMMED);
+	else if (status == DSS_COMPLETION_DISPLAYED &&
+		 comp->state != DSSCOMP_STATE_DISPLAYED)
+		dsscomp_tl_mark(comp, DSSCOMP_TL_VSYNC);
+	else if (status & DSS_COMPLETION_RELEASED)
+		dsscomp_tl_mark(comp, DSSCOMP_TL_RELEASE);
+
 	if (status == DSS_COMPLETION_PROGRAMMED ||
 	    (status == DSS_COMPLETION_DISPLAYED &&
 	     comp->state != DSSCOMP_STATE_DISPLAYED) ||
@@ -472,6 +579,7 @@ static int dsscomp_apply(dsscomp_t comp)
 	};
 
 	BUG_ON(comp->state != DSSCOMP_STATE_APPLYING);
+	dsscomp_tl_mark(comp, DSSCOMP_TL_APPLY);
 
 	/* check if the display is valid and used */
 	r = -ENODEV;
@@ -498,6 +606,9 @@ for (i = 0; i < cdev->num_displays; i++) {
 		goto done;
 
 	dump_comp_info(cdev, d, "apply");
+#ifdef CONFIG_DSSCOMP_DEBUG_TIMELINE
+	comp->tl_frame_us = dsscomp_tl_frame_us(dssdev);
+#endif
 
 	r = 0;
 	dmask = 0;
@@ -580,10 +691,10 @@ skip_ovl_set:
 			if ((~comp->ovl_mask & mask) &&
 			    cdev->ovls[i]->info.enabled &&
 			    cdev->ovls[i]->manager == mgr) {
-				mutex_lock(&mtx);
+				spin_lock(&qlock);
 				comp->ovl_mask |= mask;
 				maskref_incbit(&mgrq[comp->ix].ovl_qmask, i);
-				mutex_unlock(&mtx);
+				spin_unlock(&qlock);
 			}
 		}
 	}
@@ -598,7 +709,7 @@ skip_ovl_set:
 	if (!d->win.h && !d->win.y)
 		d->win.h = dssdev->panel.timings.y_res - d->win.y;
 
-	mutex_lock(&mtx);
+	mutex_lock(&mgrq[comp->ix].mtx);
 	if (mgrq[comp->ix].blanking) {
 		pr_info_ratelimited("ignoring apply mgr(%s) while blanking\n",
 				    mgr->name);
@@ -607,11 +718,13 @@ skip_ovl_set:
 		r = mgr->apply(mgr);
 		if (r)
 			dev_err(DEV(cdev), "failed while applying %d", r);
+		else
+			dsscomp_tl_mark(comp, DSSCOMP_TL_GO);
 		/* keep error if set_mgr_info failed */
 		if (!r && !cb_programmed)
 			r = -EINVAL;
 	}
-	mutex_unlock(&mtx);
+	mutex_unlock(&mgrq[comp->ix].mtx);
 
 	/*
 	 * TRICKY: try to unregister callback to see if callbacks have
@@ -644,11 +757,6 @@ done:
 	return r;
 }
 
-struct dsscomp_apply_work {
-	struct work_struct work;
-	dsscomp_t comp;
-};
-
 int dsscomp_state_notifier(struct notifier_block *nb,
 						unsigned long arg, void *ptr)
 {
@@ -657,14 +765,14 @@ int dsscomp_state_notifier(struct notifier_block *nb,
 	struct omap_overlay_manager *mgr = dssdev->manager;
 	if (mgr) {
 		if (!cpu_is_omap3630()) {
-			mutex_lock(&mtx);
+			mutex_lock(&mgrq[mgr->id].mtx);
 			if (state == OMAP_DSS_DISPLAY_DISABLED) {
 				mgr->blank(mgr, true);
 				mgrq[mgr->id].blanking = true;
 			} else if (state == OMAP_DSS_DISPLAY_ACTIVE) {
 				mgrq[mgr->id].blanking = false;
 			}
-			mutex_unlock(&mtx);
+			mutex_unlock(&mgrq[mgr->id].mtx);
 		}
 	}
 	return 0;
@@ -673,21 +781,32 @@ int dsscomp_state_notifier(struct notifier_block *nb,
 
 static void dsscomp_do_apply(struct work_struct *work)
 {
-	struct dsscomp_apply_work *wk = container_of(work, typeof(*wk), work);
-	/* complete compositions that failed to apply */
-	if (dsscomp_apply(wk->comp))
-		dsscomp_mgr_callback(wk->comp, -1, DSS_COMPLETION_ECLIPSED_SET);
-	kfree(wk);
+	struct dsscomp_mgrq *q = container_of(work, typeof(*q), apply_work);
+	dsscomp_t comp, next, list = NULL;
+
+	/* take all queued compositions and apply them oldest first */
+	comp = xchg(&q->apply_list, NULL);
+	while (comp) {
+		next = comp->apply_next;
+		comp->apply_next = list;
+		list = comp;
+		comp = next;
+	}
+
+	while (list) {
+		comp = list;
+		list = comp->apply_next;
+		/* complete compositions that failed to apply */
+		if (dsscomp_apply(comp))
+			dsscomp_mgr_callback(comp, -1,
+					     DSS_COMPLETION_ECLIPSED_SET);
+	}
 }
 
 int dsscomp_delayed_apply(dsscomp_t comp)
 {
-	/* don't block in case we are called from interrupt context */
-	struct dsscomp_apply_work *wk = kzalloc(sizeof(*wk), GFP_NOWAIT);
-	if (!wk)
-		return -ENOMEM;
-
-	mutex_lock(&mtx);
+	struct dsscomp_mgrq *q = mgrq + comp->ix;
+	dsscomp_t head;
 
 	BUG_ON(comp->state != DSSCOMP_STATE_ACTIVE);
 	comp->state = DSSCOMP_STATE_APPLYING;
@@ -695,11 +814,20 @@ int dsscomp_delayed_apply(dsscomp_t comp)
 
 	if (debug & DEBUG_PHASES)
 		dev_info(DEV(cdev), "[%p] applying\n", comp);
-	mutex_unlock(&mtx);
 
-	wk->comp = comp;
-	INIT_WORK(&wk->work, dsscomp_do_apply);
-	return queue_work(mgrq[comp->ix].apply_workq, &wk->work) ? 0 : -EBUSY;
+	/*
+	 * don't block in case we are called from interrupt context.  Only the
+	 * apply work removes compositions, and it takes the whole list, so a
+	 * plain compare-and-swap push is safe.
+	 */
+	do {
+		head = ACCESS_ONCE(q->apply_list);
+		comp->apply_next = head;
+	} while (cmpxchg(&q->apply_list, head, comp) != head);
+
+	/* if the work is already queued, it will pick this one up as well */
+	queue_work(q->apply_workq, &q->apply_work);
+	return 0;
 }
 EXPORT_SYMBOL(dsscomp_delayed_apply);
 
@@ -804,6 +932,71 @@ void dsscomp_dbg_events(struct seq_file *s)
 #endif
 }
 
+#ifdef CONFIG_DSSCOMP_DEBUG_TIMELINE
+void dsscomp_dbg_timeline(struct seq_file *s)
+{
+	static const char * const names[DSSCOMP_TL_NUM] = {
+		"post", "apply", "go", "prog", "vsync", "release"
+	};
+	struct dsscomp_tl_entry *e;
+	struct dsscomp_tl_hist *h;
+	char label[8];
+	u32 i, j, ix, ms, sec, now = ktime_to_timeval(ktime_get()).tv_sec;
+
+	spin_lock(&tl_lock);
+
+	/* timelines, oldest first, in usecs after the post */
+	seq_printf(s, "%11s %3s %10s %8s", names[DSSCOMP_TL_POST], "mgr",
+		   "comp", "sync_id");
+	for (j = DSSCOMP_TL_APPLY; j < DSSCOMP_TL_NUM; j++)
+		seq_printf(s, " %8s", names[j]);
+	seq_printf(s, "\n");
+
+	for (i = tl_ring_ix; i < tl_ring_ix + ARRAY_SIZE(tl_ring); i++) {
+		e = tl_ring + (i % ARRAY_SIZE(tl_ring));
+		if (!e->comp)
+			continue;
+		ms = (u32) ktime_to_ms(e->t[DSSCOMP_TL_POST]);
+		seq_printf(s, "[%5u.%03u] %3u [%p] %8x", ms / 1000, ms % 1000,
+			   e->ix, e->comp, e->sync_id);
+		for (j = DSSCOMP_TL_APPLY; j < DSSCOMP_TL_NUM; j++) {
+			if (e->t[j].tv64)
+				seq_printf(s, " %8u",
+					   tl_us(e->t, DSSCOMP_TL_POST, j));
+			else
+				seq_printf(s, " %8s", "-");
+		}
+		seq_printf(s, "\n");
+	}
+
+	/* display latency histograms of the last seconds */
+	for (ix = 0; ix < cdev->num_mgrs; ix++) {
+		seq_printf(s, "\nLATENCY on %s (post to vsync, ms)\n%5s %6s",
+			   cdev->mgrs[ix]->name, "sec", "frames");
+		for (j = 0; j < ARRAY_SIZE(tl_lat_ms); j++) {
+			snprintf(label, sizeof(label), "<%u", tl_lat_ms[j]);
+			seq_printf(s, " %6s", label);
+		}
+		snprintf(label, sizeof(label), ">=%u", tl_lat_ms[j - 1]);
+		seq_printf(s, " %6s %6s %7s\n", label, "missed", "dropped");
+
+		for (i = TL_SECS; i; i--) {
+			sec = now - i + 1;
+			h = &tl_hist[ix][sec % TL_SECS];
+			if (sec > now || h->sec != sec ||
+			    !(h->frames || h->dropped))
+				continue;
+			seq_printf(s, "%5u %6u", sec, h->frames);
+			for (j = 0; j < ARRAY_SIZE(h->lat); j++)
+				seq_printf(s, " %6u", h->lat[j]);
+			seq_printf(s, " %6u %7u\n", h->missed, h->dropped);
+		}
+	}
+
+	spin_unlock(&tl_lock);
+}
+#endif
+
 /*
  * ===========================================================================
  *		EXIT
@@ -813,7 +1006,7 @@ void dsscomp_queue_exit(void)
 {
 	if (cdev) {
 		int i;
-		for (i = 0; i < cdev->num_displays; i++)
+		for (i = 0; i < cdev->num_mgrs; i++)
 			destroy_workqueue(mgrq[i].apply_workq);
 		destroy_workqueue(cb_wkq);
 		cdev = NULL;
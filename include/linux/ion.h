@@ -22,7 +22,7 @@
 struct ion_handle;
 /**
  * enum ion_heap_types - list of all possible types of heaps
- * @ION_HEAP_TYPE_SYSTEM:	 memory allocated via vmalloc
+ * @ION_HEAP_TYPE_SYSTEM:	 memory allocated from pooled pages
  * @ION_HEAP_TYPE_SYSTEM_CONTIG: memory allocated via kmalloc
  * @ION_HEAP_TYPE_CARVEOUT:	 memory allocated from a prereserved
  * 				 carveout heap, allocations are physically
@@ -222,6 +222,31 @@ struct ion_handle *ion_import(struct ion_client *client,
  * the handle to use to refer to it further.
  */
 struct ion_handle *ion_import_fd(struct ion_client *client, int fd);
+
+/**
+ * ion_share_fd() - returns a file descriptor for a buffer, like ION_IOC_SHARE
+ * @client:	this blocks client
+ * @handle:	the handle
+ *
+ * All descriptors for a buffer refer to the same file, which keeps the
+ * buffer alive until it is closed.  The descriptor can be mapped, or
+ * passed to ion_import_fd() in another client, without creating any new
+ * mapping of the buffer.
+ */
+int ion_share_fd(struct ion_client *client, struct ion_handle *handle);
+
+/**
+ * ion_sync() - make part of a buffer coherent for the cpu or for devices
+ * @client:	the client
+ * @handle:	the handle
+ * @offset:	first byte of the range
+ * @len:	length of the range, zero for the rest of the buffer
+ * @flags:	ION_SYNC_* flags, see struct ion_sync_data
+ *
+ * Returns -EINVAL if the handle or range is invalid.
+ */
+int ion_sync(struct ion_client *client, struct ion_handle *handle,
+	     size_t offset, size_t len, unsigned int flags);
 #endif /* __KERNEL__ */
 
 /**
@@ -314,6 +339,43 @@ struct ion_cached_user_buf_data {
 	size_t size;
 };
 
+/**
+ * struct ion_sync_data - a range of a buffer to hand over
+ * @handle:	a handle
+ * @offset:	first byte of the range
+ * @len:	length of the range, zero for the rest of the buffer
+ * @flags:	ION_SYNC_FOR_CPU or ION_SYNC_FOR_DEVICE, optionally with
+ *		ION_SYNC_WRITE, ION_SYNC_TRACKED and ION_SYNC_FORCE
+ *
+ * Clients that map a buffer cached announce every handover of a range with
+ * ION_IOC_SYNC.  ION_SYNC_FOR_DEVICE cleans the cache for the range before
+ * a device accesses it, ION_SYNC_FOR_CPU invalidates the cache for the range
+ * before the cpu reads it.  ION_SYNC_WRITE tells that the side getting the
+ * range will write to it.
+ *
+ * While the buffer is mapped to user space, the cache maintenance is done
+ * for the whole range, as writes through the mapping are not seen by ion.
+ * Clients that announce all of their writes with ION_SYNC_WRITE can pass
+ * ION_SYNC_TRACKED: the cache is then only cleaned for bytes the cpu was
+ * announced to write since they were last handed to a device, and only
+ * invalidated for bytes a device was announced to write since they were
+ * last handed to the cpu.  ION_SYNC_FORCE does the cache maintenance for
+ * the whole range in any case.  Buffers that are mapped in the kernel are
+ * always cleaned.
+ */
+struct ion_sync_data {
+	struct ion_handle *handle;
+	size_t offset;
+	size_t len;
+	unsigned int flags;
+};
+
+#define ION_SYNC_FOR_CPU	(1 << 0)
+#define ION_SYNC_FOR_DEVICE	(1 << 1)
+#define ION_SYNC_WRITE		(1 << 2)
+#define ION_SYNC_FORCE		(1 << 3)
+#define ION_SYNC_TRACKED	(1 << 4)
+
 #define ION_IOC_MAGIC		'I'
 
 /**
@@ -349,7 +411,9 @@ struct ion_cached_user_buf_data {
  * opaque handle.  Returns the struct with the fd field set to a file
  * descriptor open in the current address space.  This file descriptor
  * can then be passed to another process.  The corresponding opaque handle can
- * be retrieved via ION_IOC_IMPORT.
+ * be retrieved via ION_IOC_IMPORT.  Sharing a buffer again returns another
+ * descriptor for the same file, and any process can mmap it, whether it
+ * has opened /dev/ion or not.
  */
 #define ION_IOC_SHARE		_IOWR(ION_IOC_MAGIC, 4, struct ion_fd_data)
 
@@ -385,4 +449,11 @@ struct ion_cached_user_buf_data {
 #define ION_IOC_MAP_GRALLOC	_IOWR(ION_IOC_MAGIC, 9, \
 				struct ion_map_gralloc_to_ionhandle_data)
 
+/**
+ * DOC: ION_IOC_SYNC - syncs a range of a buffer for the cpu or for devices
+ *
+ * Takes an ion_sync_data struct, see there.
+ */
+#define ION_IOC_SYNC		_IOWR(ION_IOC_MAGIC, 10, struct ion_sync_data)
+
 #endif /* _LINUX_ION_H */
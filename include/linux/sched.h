@@ -1280,6 +1280,9 @@ struct task_struct {
 #ifdef CONFIG_SMP
 	struct plist_node pushable_tasks;
 #endif
+#ifdef CONFIG_ANDROID_LOW_MEMORY_KILLER
+	struct hlist_node lowmem_node;	/* lowmemorykiller oom_adj bucket */
+#endif
 
 	struct mm_struct *mm, *active_mm;
 #ifdef CONFIG_COMPAT_BRK
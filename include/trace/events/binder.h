@@ -0,0 +1,93 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM binder
+
+#if !defined(_TRACE_BINDER_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _TRACE_BINDER_H
+
+#include <linux/tracepoint.h>
+
+TRACE_EVENT(binder_transaction,
+	    TP_PROTO(int debug_id, int reply, int target_node,
+		     int to_proc, int to_thread, unsigned int code,
+		     unsigned int flags),
+	    TP_ARGS(debug_id, reply, target_node, to_proc, to_thread, code,
+		    flags),
+
+	    TP_STRUCT__entry(
+		    __field(int, debug_id)
+		    __field(int, reply)
+		    __field(int, target_node)
+		    __field(int, to_proc)
+		    __field(int, to_thread)
+		    __field(unsigned int, code)
+		    __field(unsigned int, flags)
+	    ),
+
+	    TP_fast_assign(
+		    __entry->debug_id = debug_id;
+		    __entry->reply = reply;
+		    __entry->target_node = target_node;
+		    __entry->to_proc = to_proc;
+		    __entry->to_thread = to_thread;
+		    __entry->code = code;
+		    __entry->flags = flags;
+	    ),
+
+	    TP_printk("transaction=%d dest_node=%d dest_proc=%d dest_thread=%d "
+		      "reply=%d flags=0x%x code=0x%x",
+		      __entry->debug_id, __entry->target_node,
+		      __entry->to_proc, __entry->to_thread,
+		      __entry->reply, __entry->flags, __entry->code)
+);
+
+TRACE_EVENT(binder_transaction_received,
+	    TP_PROTO(int debug_id, int proc, int thread),
+	    TP_ARGS(debug_id, proc, thread),
+
+	    TP_STRUCT__entry(
+		    __field(int, debug_id)
+		    __field(int, proc)
+		    __field(int, thread)
+	    ),
+
+	    TP_fast_assign(
+		    __entry->debug_id = debug_id;
+		    __entry->proc = proc;
+		    __entry->thread = thread;
+	    ),
+
+	    TP_printk("transaction=%d proc=%d thread=%d",
+		      __entry->debug_id, __entry->proc, __entry->thread)
+);
+
+TRACE_EVENT(binder_transaction_latency,
+	    TP_PROTO(int debug_id, int node, int stage, unsigned int usecs),
+	    TP_ARGS(debug_id, node, stage, usecs),
+
+	    TP_STRUCT__entry(
+		    __field(int, debug_id)
+		    __field(int, node)
+		    __field(int, stage)
+		    __field(unsigned int, usecs)
+	    ),
+
+	    TP_fast_assign(
+		    __entry->debug_id = debug_id;
+		    __entry->node = node;
+		    __entry->stage = stage;
+		    __entry->usecs = usecs;
+	    ),
+
+	    TP_printk("transaction=%d node=%d stage=%s usecs=%u",
+		      __entry->debug_id, __entry->node,
+		      __print_symbolic(__entry->stage,
+				       { 0, "queue" },
+				       { 1, "service" },
+				       { 2, "round_trip" }),
+		      __entry->usecs)
+);
+
+#endif /* _TRACE_BINDER_H */
+
+/* This part must be outside protection */
+#include <trace/define_trace.h>
@@ -0,0 +1,138 @@
+/*
+ *  LZ4 Compressor
+ *
+ *  Single pass greedy compressor producing the LZ4 block format,
+ *  using a 4-byte hash of the input to find match candidates.
+ *
+ *  Copyright (C) 2026 LG Electronics, Inc.
+ *
+ *  The LZ4 format was designed by Yann Collet:
+ *  http://code.google.com/p/lz4/
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <linux/lz4.h>
+#include <asm/unaligned.h>
+#include "lz4defs.h"
+
+static inline u32 lz4_read32(const unsigned char *p)
+{
+	return get_unaligned((const u32 *)p);
+}
+
+static inline unsigned char *lz4_put_length(unsigned char *op, size_t len)
+{
+	for (; len >= 255; len -= 255)
+		*op++ = 255;
+	*op++ = (unsigned char)len;
+
+	return op;
+}
+
+int lz4_compress(const unsigned char *src, size_t src_len,
+			unsigned char *dst, size_t *dst_len, void *wrkmem)
+{
+	const unsigned char * const iend = src + src_len;
+	const unsigned char * const mflimit = iend - MFLIMIT;
+	const unsigned char * const matchlimit = iend - LASTLITERALS;
+	const unsigned char *ip = src, *anchor = src, *ref;
+	unsigned char *op = dst, *token;
+	u32 *table = wrkmem;
+	size_t len;
+
+	memset(table, 0, LZ4_MEM_COMPRESS);
+
+	if (src_len < MINLENGTH)
+		goto last_literals;
+
+	table[LZ4_HASH(lz4_read32(ip))] = 0;
+	ip++;
+
+	for (;;) {
+		/* Find a match candidate */
+		do {
+			u32 h;
+
+			if (ip > mflimit)
+				goto last_literals;
+
+			h = LZ4_HASH(lz4_read32(ip));
+			ref = src + table[h];
+			table[h] = ip - src;
+			if (ip - ref <= MAX_DISTANCE &&
+					lz4_read32(ref) == lz4_read32(ip))
+				break;
+			ip++;
+		} while (1);
+
+		/* Extend the match backwards over pending literals */
+		while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+			ip--;
+			ref--;
+		}
+
+		/* Literal run */
+		len = ip - anchor;
+		token = op++;
+		if (len >= RUN_MASK) {
+			*token = RUN_MASK << ML_BITS;
+			op = lz4_put_length(op, len - RUN_MASK);
+		} else {
+			*token = len << ML_BITS;
+		}
+		memcpy(op, anchor, len);
+		op += len;
+
+		/* Match offset */
+		put_unaligned_le16(ip - ref, op);
+		op += 2;
+
+		/* Match length */
+		ip += MINMATCH;
+		ref += MINMATCH;
+		anchor = ip;
+		while (ip < matchlimit && *ip == *ref) {
+			ip++;
+			ref++;
+		}
+		len = ip - anchor;
+		if (len >= ML_MASK) {
+			*token += ML_MASK;
+			op = lz4_put_length(op, len - ML_MASK);
+		} else {
+			*token += len;
+		}
+		anchor = ip;
+
+		if (ip > mflimit)
+			break;
+
+		/* Seed the table with a position inside the match */
+		table[LZ4_HASH(lz4_read32(ip - 2))] = ip - 2 - src;
+	}
+
+last_literals:
+	len = iend - anchor;
+	token = op++;
+	if (len >= RUN_MASK) {
+		*token = RUN_MASK << ML_BITS;
+		op = lz4_put_length(op, len - RUN_MASK);
+	} else {
+		*token = len << ML_BITS;
+	}
+	memcpy(op, anchor, len);
+	op += len;
+
+	*dst_len = op - dst;
+	return LZ4_E_OK;
+}
+EXPORT_SYMBOL_GPL(lz4_compress);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("LZ4 Compressor");
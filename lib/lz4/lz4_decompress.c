@@ -0,0 +1,116 @@
+/*
+ *  LZ4 Decompressor
+ *
+ *  Safe decompressor for the LZ4 block format: every length and
+ *  offset read from the input is checked against both buffers.
+ *
+ *  Copyright (C) 2026 LG Electronics, Inc.
+ *
+ *  The LZ4 format was designed by Yann Collet:
+ *  http://code.google.com/p/lz4/
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ */
+
+#ifndef STATIC
+#include <linux/module.h>
+#include <linux/kernel.h>
+#endif
+
+#include <linux/string.h>
+#include <linux/lz4.h>
+#include <asm/unaligned.h>
+#include "lz4defs.h"
+
+static inline int lz4_get_length(const unsigned char **ip,
+			const unsigned char *iend, size_t *len)
+{
+	unsigned char s;
+
+	do {
+		if (*ip >= iend)
+			return LZ4_E_INPUT_OVERRUN;
+		s = *(*ip)++;
+		*len += s;
+	} while (s == 255);
+
+	return LZ4_E_OK;
+}
+
+int lz4_decompress_unknownoutputsize(const unsigned char *src,
+			size_t src_len, unsigned char *dst, size_t *dst_len)
+{
+	const unsigned char * const iend = src + src_len;
+	unsigned char * const oend = dst + *dst_len;
+	const unsigned char *ip = src;
+	unsigned char *op = dst;
+	const unsigned char *ref;
+	unsigned int token;
+	size_t len, offset;
+
+	while (ip < iend) {
+		token = *ip++;
+
+		/* Literal run */
+		len = token >> ML_BITS;
+		if (len == RUN_MASK && lz4_get_length(&ip, iend, &len))
+			goto input_overrun;
+		if (len > (size_t)(iend - ip))
+			goto input_overrun;
+		if (len > (size_t)(oend - op))
+			goto output_overrun;
+		memcpy(op, ip, len);
+		ip += len;
+		op += len;
+
+		/* The last sequence carries literals only */
+		if (ip == iend)
+			break;
+
+		if (iend - ip < 2)
+			goto input_overrun;
+		offset = get_unaligned_le16(ip);
+		ip += 2;
+		if (!offset || offset > (size_t)(op - dst))
+			goto lookbehind_overrun;
+		ref = op - offset;
+
+		/* Match copy; source and destination may overlap */
+		len = token & ML_MASK;
+		if (len == ML_MASK && lz4_get_length(&ip, iend, &len))
+			goto input_overrun;
+		len += MINMATCH;
+		if (len > (size_t)(oend - op))
+			goto output_overrun;
+		if (offset >= len) {
+			memcpy(op, ref, len);
+			op += len;
+		} else {
+			while (len--)
+				*op++ = *ref++;
+		}
+	}
+
+	*dst_len = op - dst;
+	return LZ4_E_OK;
+
+input_overrun:
+	*dst_len = op - dst;
+	return LZ4_E_INPUT_OVERRUN;
+
+output_overrun:
+	*dst_len = op - dst;
+	return LZ4_E_OUTPUT_OVERRUN;
+
+lookbehind_overrun:
+	*dst_len = op - dst;
+	return LZ4_E_LOOKBEHIND_OVERRUN;
+}
+#ifndef STATIC
+EXPORT_SYMBOL_GPL(lz4_decompress_unknownoutputsize);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("LZ4 Decompressor");
+#endif
@@ -0,0 +1,33 @@
+/*
+ *  lz4defs.h -- LZ4 block format constants
+ *
+ *  A sequence is a token byte (literal length in the high nibble,
+ *  match length - MINMATCH in the low nibble), optional literal
+ *  length bytes, the literals, a 16-bit little endian match offset
+ *  and optional match length bytes. Lengths of 15 or more continue
+ *  in following bytes, each adding up to 255.
+ *
+ *  Copyright (C) 2026 LG Electronics, Inc.
+ *
+ *  The LZ4 format was designed by Yann Collet:
+ *  http://code.google.com/p/lz4/
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ */
+
+#define MINMATCH	4
+#define LASTLITERALS	5	/* last bytes of input are always literals */
+#define MFLIMIT		12	/* no match may start within this many
+				 * bytes of the end of input */
+#define MINLENGTH	(MFLIMIT + 1)
+
+#define MAX_DISTANCE	0xffff
+
+#define ML_BITS		4
+#define ML_MASK		((1U << ML_BITS) - 1)
+#define RUN_BITS	(8 - ML_BITS)
+#define RUN_MASK	((1U << RUN_BITS) - 1)
+
+#define LZ4_HASH(v)	(((v) * 2654435761U) >> (32 - LZ4_HASH_LOG))
@@ -27,6 +27,9 @@
 #include <linux/personality.h>
 #include <linux/bitops.h>
 #include <linux/mutex.h>
+#include <linux/percpu.h>
+#include <linux/rbtree.h>
+#include <linux/spinlock.h>
 #include <linux/shmem_fs.h>
 #include <linux/ashmem.h>
 
@@ -37,12 +40,13 @@
 /*
  * ashmem_area - anonymous shared memory area
  * Lifecycle: From our parent file's open() until its release()
- * Locking: Protected by `ashmem_mutex'
+ * Locking: Protected by its own `mutex'
  * Big Note: Mappings do NOT pin this structure; it dies on close()
  */
 struct ashmem_area {
 	char name[ASHMEM_FULL_NAME_LEN];/* optional name for /proc/pid/maps */
-	struct list_head unpinned_list;	/* list of all ashmem areas */
+	struct rb_root unpinned;	/* unpinned ranges, by page */
+	struct mutex mutex;		/* protects the area and its ranges */
 	struct file *file;		/* the shmem-based backing file */
 	size_t size;			/* size of the mapping, in bytes */
 	unsigned long prot_mask;	/* allowed prot bits, as vm_flags */
@@ -51,29 +55,45 @@ struct ashmem_area {
 /*
  * ashmem_range - represents an interval of unpinned (evictable) pages
  * Lifecycle: From unpin to pin
- * Locking: Protected by `ashmem_mutex'
+ * Locking: Protected by its area's `mutex', and `lru' also by the lock of
+ * the ashmem_lru it is on
+ *
+ * The ranges of an area never overlap, so ordering them by their first page
+ * orders them by their last page too and the first range that ends at or
+ * after a page is found in one walk down the tree.
  */
 struct ashmem_range {
 	struct list_head lru;		/* entry in LRU list */
-	struct list_head unpinned;	/* entry in its area's unpinned list */
+	struct rb_node node;		/* entry in its area's unpinned tree */
 	struct ashmem_area *asma;	/* associated area */
 	size_t pgstart;			/* starting page, inclusive */
 	size_t pgend;			/* ending page, inclusive */
 	unsigned int purged;		/* ASHMEM_NOT or ASHMEM_WAS_PURGED */
+	int lru_cpu;			/* ashmem_lru the range is on */
 };
 
-/* LRU list of unpinned pages, protected by ashmem_mutex */
-static LIST_HEAD(ashmem_lru_list);
+/*
+ * ashmem_lru - LRU list of unpinned pages
+ *
+ * Ranges go on the list of the CPU that unpinned them, so unpinning on
+ * different CPUs does not contend. The shrinker takes the oldest range of
+ * each list in turn.
+ */
+struct ashmem_lru {
+	spinlock_t lock;		/* protects the list and count */
+	struct list_head list;		/* least recently unpinned first */
+	unsigned long count;		/* pages on the list */
+};
 
-/* Count of pages on our LRU list, protected by ashmem_mutex */
-static unsigned long lru_count;
+static DEFINE_PER_CPU(struct ashmem_lru, ashmem_lru);
 
 /*
- * ashmem_mutex - protects the list of and each individual ashmem_area
+ * Lock Ordering: asma->mutex -> ashmem_lru.lock
+ *		  asma->mutex -> i_mutex -> i_alloc_sem
  *
- * Lock Ordering: ashmex_mutex -> i_mutex -> i_alloc_sem
+ * The shrinker walks an ashmem_lru with its lock held and so only ever
+ * trylocks an area's mutex; areas that are busy are skipped.
  */
-static DEFINE_MUTEX(ashmem_mutex);
 
 static struct kmem_cache *ashmem_area_cachep __read_mostly;
 static struct kmem_cache *ashmem_range_cachep __read_mostly;
@@ -90,45 +110,96 @@ static struct kmem_cache *ashmem_range_cachep __read_mostly;
 #define page_range_subsumed_by_range(range, start, end) \
   (((range)->pgstart <= (start)) && ((range)->pgend >= (end)))
 
-#define page_in_range(range, page) \
- (((range)->pgstart <= (page)) && ((range)->pgend >= (page)))
+#define PROT_MASK		(PROT_EXEC | PROT_READ | PROT_WRITE)
 
-#define page_range_in_range(range, start, end) \
-  (page_in_range(range, start) || page_in_range(range, end) || \
-   page_range_subsumes_range(range, start, end))
+static inline void lru_add(struct ashmem_range *range)
+{
+	struct ashmem_lru *lru;
 
-#define range_before_page(range, page) \
-  ((range)->pgend < (page))
+	range->lru_cpu = raw_smp_processor_id();
+	lru = &per_cpu(ashmem_lru, range->lru_cpu);
 
-#define PROT_MASK		(PROT_EXEC | PROT_READ | PROT_WRITE)
+	spin_lock(&lru->lock);
+	list_add_tail(&range->lru, &lru->list);
+	lru->count += range_size(range);
+	spin_unlock(&lru->lock);
+}
 
-static inline void lru_add(struct ashmem_range *range)
+static inline void __lru_del(struct ashmem_lru *lru,
+			     struct ashmem_range *range)
 {
-	list_add_tail(&range->lru, &ashmem_lru_list);
-	lru_count += range_size(range);
+	list_del(&range->lru);
+	lru->count -= range_size(range);
 }
 
 static inline void lru_del(struct ashmem_range *range)
 {
-	list_del(&range->lru);
-	lru_count -= range_size(range);
+	struct ashmem_lru *lru = &per_cpu(ashmem_lru, range->lru_cpu);
+
+	spin_lock(&lru->lock);
+	__lru_del(lru, range);
+	spin_unlock(&lru->lock);
+}
+
+/* lru_count - pages on all the LRU lists, only a hint */
+static unsigned long lru_count(void)
+{
+	unsigned long count = 0;
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		count += ACCESS_ONCE(per_cpu(ashmem_lru, cpu).count);
+
+	return count;
+}
+
+/*
+ * range_first - returns the first range of 'asma' that ends at or after page
+ * 'pgstart', or NULL.
+ *
+ * Caller must hold asma->mutex.
+ */
+static struct ashmem_range *range_first(struct ashmem_area *asma,
+					size_t pgstart)
+{
+	struct rb_node *n = asma->unpinned.rb_node;
+	struct ashmem_range *range, *first = NULL;
+
+	while (n) {
+		range = rb_entry(n, struct ashmem_range, node);
+		if (range->pgend < pgstart)
+			n = n->rb_right;
+		else {
+			first = range;
+			n = n->rb_left;
+		}
+	}
+
+	return first;
+}
+
+static inline struct ashmem_range *range_next(struct ashmem_range *range)
+{
+	struct rb_node *n = rb_next(&range->node);
+
+	return n ? rb_entry(n, struct ashmem_range, node) : NULL;
 }
 
 /*
  * range_alloc - allocate and initialize a new ashmem_range structure
  *
  * 'asma' - associated ashmem_area
- * 'prev_range' - the previous ashmem_range in the sorted asma->unpinned list
  * 'purged' - initial purge value (ASMEM_NOT_PURGED or ASHMEM_WAS_PURGED)
  * 'start' - starting page, inclusive
  * 'end' - ending page, inclusive
  *
- * Caller must hold ashmem_mutex.
+ * Caller must hold asma->mutex.
  */
-static int range_alloc(struct ashmem_area *asma,
-		       struct ashmem_range *prev_range, unsigned int purged,
+static int range_alloc(struct ashmem_area *asma, unsigned int purged,
 		       size_t start, size_t end)
 {
+	struct rb_node **p = &asma->unpinned.rb_node;
+	struct rb_node *parent = NULL;
 	struct ashmem_range *range;
 
 	range = kmem_cache_zalloc(ashmem_range_cachep, GFP_KERNEL);
@@ -140,7 +211,15 @@ static int range_alloc(struct ashmem_area *asma,
 	range->pgend = end;
 	range->purged = purged;
 
-	list_add_tail(&range->unpinned, &prev_range->unpinned);
+	while (*p) {
+		parent = *p;
+		if (start < rb_entry(parent, struct ashmem_range, node)->pgstart)
+			p = &parent->rb_left;
+		else
+			p = &parent->rb_right;
+	}
+	rb_link_node(&range->node, parent, p);
+	rb_insert_color(&range->node, &asma->unpinned);
 
 	if (range_on_lru(range))
 		lru_add(range);
@@ -150,7 +229,7 @@ static int range_alloc(struct ashmem_area *asma,
 
 static void range_del(struct ashmem_range *range)
 {
-	list_del(&range->unpinned);
+	rb_erase(&range->node, &range->asma->unpinned);
 	if (range_on_lru(range))
 		lru_del(range);
 	kmem_cache_free(ashmem_range_cachep, range);
@@ -159,18 +238,25 @@ static void range_del(struct ashmem_range *range)
 /*
  * range_shrink - shrinks a range
  *
- * Caller must hold ashmem_mutex.
+ * Caller must hold asma->mutex.
  */
 static inline void range_shrink(struct ashmem_range *range,
 				size_t start, size_t end)
 {
 	size_t pre = range_size(range);
 
-	range->pgstart = start;
-	range->pgend = end;
+	if (range_on_lru(range)) {
+		struct ashmem_lru *lru = &per_cpu(ashmem_lru, range->lru_cpu);
 
-	if (range_on_lru(range))
-		lru_count -= pre - range_size(range);
+		spin_lock(&lru->lock);
+		range->pgstart = start;
+		range->pgend = end;
+		lru->count -= pre - range_size(range);
+		spin_unlock(&lru->lock);
+	} else {
+		range->pgstart = start;
+		range->pgend = end;
+	}
 }
 
 static int ashmem_open(struct inode *inode, struct file *file)
@@ -186,7 +272,8 @@ static int ashmem_open(struct inode *inode, struct file *file)
 	if (unlikely(!asma))
 		return -ENOMEM;
 
-	INIT_LIST_HEAD(&asma->unpinned_list);
+	asma->unpinned = RB_ROOT;
+	mutex_init(&asma->mutex);
 	memcpy(asma->name, ASHMEM_NAME_PREFIX, ASHMEM_NAME_PREFIX_LEN);
 	asma->prot_mask = PROT_MASK;
 	file->private_data = asma;
@@ -197,12 +284,12 @@ static int ashmem_open(struct inode *inode, struct file *file)
 static int ashmem_release(struct inode *ignored, struct file *file)
 {
 	struct ashmem_area *asma = file->private_data;
-	struct ashmem_range *range, *next;
+	struct rb_node *n;
 
-	mutex_lock(&ashmem_mutex);
-	list_for_each_entry_safe(range, next, &asma->unpinned_list, unpinned)
-		range_del(range);
-	mutex_unlock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
+	while ((n = rb_first(&asma->unpinned)))
+		range_del(rb_entry(n, struct ashmem_range, node));
+	mutex_unlock(&asma->mutex);
 
 	if (asma->file)
 		fput(asma->file);
@@ -217,7 +304,7 @@ static ssize_t ashmem_read(struct file *file, char __user *buf,
 	struct ashmem_area *asma = file->private_data;
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 
 	/* If size is not set, or set to 0, always return EOF. */
 	if (asma->size == 0) {
@@ -238,7 +325,7 @@ static ssize_t ashmem_read(struct file *file, char __user *buf,
 	asma->file->f_pos = *pos;
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 	return ret;
 }
 
@@ -247,7 +334,7 @@ static loff_t ashmem_llseek(struct file *file, loff_t offset, int origin)
 	struct ashmem_area *asma = file->private_data;
 	int ret;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 
 	if (asma->size == 0) {
 		ret = -EINVAL;
@@ -268,7 +355,7 @@ static loff_t ashmem_llseek(struct file *file, loff_t offset, int origin)
 	file->f_pos = asma->file->f_pos;
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 	return ret;
 }
 
@@ -285,7 +372,7 @@ static int ashmem_mmap(struct file *file, struct vm_area_struct *vma)
 	struct ashmem_area *asma = file->private_data;
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 
 	/* user needs to SET_SIZE before mapping */
 	if (unlikely(!asma->size)) {
@@ -328,10 +415,31 @@ static int ashmem_mmap(struct file *file, struct vm_area_struct *vma)
 	vma->vm_flags |= VM_CAN_NONLINEAR;
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 	return ret;
 }
 
+/*
+ * lru_isolate - takes the least recently unpinned range off 'lru' whose area
+ * is not busy, and returns it with its area's mutex held, or NULL.
+ */
+static struct ashmem_range *lru_isolate(struct ashmem_lru *lru)
+{
+	struct ashmem_range *range;
+
+	spin_lock(&lru->lock);
+	list_for_each_entry(range, &lru->list, lru) {
+		if (mutex_trylock(&range->asma->mutex)) {
+			__lru_del(lru, range);
+			spin_unlock(&lru->lock);
+			return range;
+		}
+	}
+	spin_unlock(&lru->lock);
+
+	return NULL;
+}
+
 /*
  * ashmem_shrink - our cache shrinker, called from mm/vmscan.c :: shrink_slab
  *
@@ -345,35 +453,50 @@ out:
  *
  * We approximate LRU via least-recently-unpinned, jettisoning unpinned partial
  * chunks of ashmem regions LRU-wise one-at-a-time until we hit 'nr_to_scan'
- * pages freed.
+ * pages freed. Areas that are being pinned or unpinned right now are left
+ * alone rather than waited for.
  */
 static int ashmem_shrink(struct shrinker *s, struct shrink_control *sc)
 {
-	struct ashmem_range *range, *next;
+	long nr_to_scan = sc->nr_to_scan;
+	int cpu, progress;
 
 	/* We might recurse into filesystem code, so bail out if necessary */
-	if (sc->nr_to_scan && !(sc->gfp_mask & __GFP_FS))
+	if (nr_to_scan && !(sc->gfp_mask & __GFP_FS))
 		return -1;
-	if (!sc->nr_to_scan)
-		return lru_count;
+	if (!nr_to_scan)
+		return lru_count();
+
+	do {
+		progress = 0;
+		for_each_possible_cpu(cpu) {
+			struct ashmem_range *range;
+			struct ashmem_area *asma;
+			struct inode *inode;
+			loff_t start, end;
+
+			range = lru_isolate(&per_cpu(ashmem_lru, cpu));
+			if (!range)
+				continue;
 
-	mutex_lock(&ashmem_mutex);
-	list_for_each_entry_safe(range, next, &ashmem_lru_list, lru) {
-		struct inode *inode = range->asma->file->f_dentry->d_inode;
-		loff_t start = range->pgstart * PAGE_SIZE;
-		loff_t end = (range->pgend + 1) * PAGE_SIZE - 1;
+			asma = range->asma;
+			inode = asma->file->f_dentry->d_inode;
+			start = range->pgstart * PAGE_SIZE;
+			end = (range->pgend + 1) * PAGE_SIZE - 1;
 
-		vmtruncate_range(inode, start, end);
-		range->purged = ASHMEM_WAS_PURGED;
-		lru_del(range);
+			vmtruncate_range(inode, start, end);
+			range->purged = ASHMEM_WAS_PURGED;
+			nr_to_scan -= range_size(range);
+			mutex_unlock(&asma->mutex);
 
-		sc->nr_to_scan -= range_size(range);
-		if (sc->nr_to_scan <= 0)
-			break;
-	}
-	mutex_unlock(&ashmem_mutex);
+			progress = 1;
+			if (nr_to_scan <= 0)
+				goto out;
+		}
+	} while (progress);
 
-	return lru_count;
+out:
+	return lru_count();
 }
 
 static struct shrinker ashmem_shrinker = {
@@ -385,7 +508,7 @@ static int set_prot_mask(struct ashmem_area *asma, unsigned long prot)
 {
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 
 	/* the user can only remove, not add, protection bits */
 	if (unlikely((asma->prot_mask & prot) != prot)) {
@@ -400,7 +523,7 @@ static int set_prot_mask(struct ashmem_area *asma, unsigned long prot)
 	asma->prot_mask = prot;
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 	return ret;
 }
 
@@ -408,7 +531,7 @@ static int set_name(struct ashmem_area *asma, void __user *name)
 {
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 
 	/* cannot change an existing mapping's name */
 	if (unlikely(asma->file)) {
@@ -422,7 +545,7 @@ static int set_name(struct ashmem_area *asma, void __user *name)
 	asma->name[ASHMEM_FULL_NAME_LEN-1] = '\0';
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 
 	return ret;
 }
@@ -431,7 +554,7 @@ static int get_name(struct ashmem_area *asma, void __user *name)
 {
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 	if (asma->name[ASHMEM_NAME_PREFIX_LEN] != '\0') {
 		size_t len;
 
@@ -448,7 +571,7 @@ static int get_name(struct ashmem_area *asma, void __user *name)
 					  sizeof(ASHMEM_NAME_DEF))))
 			ret = -EFAULT;
 	}
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 
 	return ret;
 }
@@ -457,17 +580,17 @@ static int get_name(struct ashmem_area *asma, void __user *name)
  * ashmem_pin - pin the given ashmem region, returning whether it was
  * previously purged (ASHMEM_WAS_PURGED) or not (ASHMEM_NOT_PURGED).
  *
- * Caller must hold ashmem_mutex.
+ * Caller must hold asma->mutex.
  */
 static int ashmem_pin(struct ashmem_area *asma, size_t pgstart, size_t pgend)
 {
 	struct ashmem_range *range, *next;
 	int ret = ASHMEM_NOT_PURGED;
 
-	list_for_each_entry_safe(range, next, &asma->unpinned_list, unpinned) {
-		/* moved past last applicable page; we can short circuit */
-		if (range_before_page(range, pgstart))
-			break;
+	for (range = range_first(asma, pgstart);
+	     range && range->pgstart <= pgend; range = next) {
+		next = range_next(range);
+		ret |= range->purged;
 
 		/*
 		 * The user can ask us to pin pages that span multiple ranges,
@@ -484,37 +607,33 @@ static int ashmem_pin(struct ashmem_area *asma, size_t pgstart, size_t pgend)
 		 *    so we have to update one side of the range and then
 		 *    create a new range for the other side.
 		 */
-		if (page_range_in_range(range, pgstart, pgend)) {
-			ret |= range->purged;
 
-			/* Case #1: Easy. Just nuke the whole thing. */
-			if (page_range_subsumes_range(range, pgstart, pgend)) {
-				range_del(range);
-				continue;
-			}
+		/* Case #1: Easy. Just nuke the whole thing. */
+		if (page_range_subsumes_range(range, pgstart, pgend)) {
+			range_del(range);
+			continue;
+		}
 
-			/* Case #2: We overlap from the start, so adjust it */
-			if (range->pgstart >= pgstart) {
-				range_shrink(range, pgend + 1, range->pgend);
-				continue;
-			}
+		/* Case #2: We overlap from the start, so adjust it */
+		if (range->pgstart >= pgstart) {
+			range_shrink(range, pgend + 1, range->pgend);
+			continue;
+		}
 
-			/* Case #3: We overlap from the rear, so adjust it */
-			if (range->pgend <= pgend) {
-				range_shrink(range, range->pgstart, pgstart-1);
-				continue;
-			}
-
-			/*
-			 * Case #4: We eat a chunk out of the middle. A bit
-			 * more complicated, we allocate a new range for the
-			 * second half and adjust the first chunk's endpoint.
-			 */
-			range_alloc(asma, range, range->purged,
-				    pgend + 1, range->pgend);
+		/* Case #3: We overlap from the rear, so adjust it */
+		if (range->pgend <= pgend) {
 			range_shrink(range, range->pgstart, pgstart - 1);
-			break;
+			continue;
 		}
+
+		/*
+		 * Case #4: We eat a chunk out of the middle. A bit more
+		 * complicated, we allocate a new range for the second half
+		 * and adjust the first chunk's endpoint.
+		 */
+		range_alloc(asma, range->purged, pgend + 1, range->pgend);
+		range_shrink(range, range->pgstart, pgstart - 1);
+		break;
 	}
 
 	return ret;
@@ -523,59 +642,49 @@ static int ashmem_pin(struct ashmem_area *asma, size_t pgstart, size_t pgend)
 /*
  * ashmem_unpin - unpin the given range of pages. Returns zero on success.
  *
- * Caller must hold ashmem_mutex.
+ * Caller must hold asma->mutex.
  */
 static int ashmem_unpin(struct ashmem_area *asma, size_t pgstart, size_t pgend)
 {
 	struct ashmem_range *range, *next;
 	unsigned int purged = ASHMEM_NOT_PURGED;
 
-restart:
-	list_for_each_entry_safe(range, next, &asma->unpinned_list, unpinned) {
-		/* short circuit: this is our insertion point */
-		if (range_before_page(range, pgstart))
-			break;
-
-		/*
-		 * The user can ask us to unpin pages that are already entirely
-		 * or partially pinned. We handle those two cases here.
-		 */
+	/*
+	 * The user can ask us to unpin pages that are already entirely or
+	 * partially unpinned. We merge any overlapping ranges into the new
+	 * one. Ranges never overlap each other, so every one that overlaps
+	 * the request follows range_first() in the tree.
+	 */
+	for (range = range_first(asma, pgstart);
+	     range && range->pgstart <= pgend; range = next) {
 		if (page_range_subsumed_by_range(range, pgstart, pgend))
 			return 0;
-		if (page_range_in_range(range, pgstart, pgend)) {
-			pgstart = min_t(size_t, range->pgstart, pgstart),
-			pgend = max_t(size_t, range->pgend, pgend);
-			purged |= range->purged;
-			range_del(range);
-			goto restart;
-		}
+
+		next = range_next(range);
+		pgstart = min_t(size_t, range->pgstart, pgstart);
+		pgend = max_t(size_t, range->pgend, pgend);
+		purged |= range->purged;
+		range_del(range);
 	}
 
-	return range_alloc(asma, range, purged, pgstart, pgend);
+	return range_alloc(asma, purged, pgstart, pgend);
 }
 
 /*
  * ashmem_get_pin_status - Returns ASHMEM_IS_UNPINNED if _any_ pages in the
  * given interval are unpinned and ASHMEM_IS_PINNED otherwise.
  *
- * Caller must hold ashmem_mutex.
+ * Caller must hold asma->mutex.
  */
 static int ashmem_get_pin_status(struct ashmem_area *asma, size_t pgstart,
 				 size_t pgend)
 {
-	struct ashmem_range *range;
-	int ret = ASHMEM_IS_PINNED;
-
-	list_for_each_entry(range, &asma->unpinned_list, unpinned) {
-		if (range_before_page(range, pgstart))
-			break;
-		if (page_range_in_range(range, pgstart, pgend)) {
-			ret = ASHMEM_IS_UNPINNED;
-			break;
-		}
-	}
+	struct ashmem_range *range = range_first(asma, pgstart);
 
-	return ret;
+	if (range && range->pgstart <= pgend)
+		return ASHMEM_IS_UNPINNED;
+
+	return ASHMEM_IS_PINNED;
 }
 
 static int ashmem_pin_unpin(struct ashmem_area *asma, unsigned long cmd,
@@ -607,7 +716,7 @@ static int ashmem_pin_unpin(struct ashmem_area *asma, unsigned long cmd,
 	pgstart = pin.offset / PAGE_SIZE;
 	pgend = pgstart + (pin.len / PAGE_SIZE) - 1;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 
 	switch (cmd) {
 	case ASHMEM_PIN:
@@ -621,7 +730,7 @@ static int ashmem_pin_unpin(struct ashmem_area *asma, unsigned long cmd,
 		break;
 	}
 
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 
 	return ret;
 }
@@ -695,7 +804,14 @@ static struct miscdevice ashmem_misc = {
 
 static int __init ashmem_init(void)
 {
-	int ret;
+	int ret, cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct ashmem_lru *lru = &per_cpu(ashmem_lru, cpu);
+
+		spin_lock_init(&lru->lock);
+		INIT_LIST_HEAD(&lru->list);
+	}
 
 	ashmem_area_cachep = kmem_cache_create("ashmem_area_cache",
 					  sizeof(struct ashmem_area),
@@ -0,0 +1,529 @@
+/*
+ * binder-stress.c -- many client/server pairs calling through binder
+ *
+ * Copyright (C) 2026 LG Electronics, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * Forks a number of server processes and as many clients, and has every
+ * client make synchronous calls to its own server as fast as it can. The
+ * pairs share nothing but the driver, so the aggregate call rate should
+ * grow with the number of pairs up to the number of CPUs; run it with
+ * -p 1, 2, 4 and 8 to see how it scales. Every call carries a payload that
+ * the server echoes back, and any call that fails or does not get its own
+ * data back is counted as an error.
+ *
+ * The parent becomes the context manager to hand the servers' objects to
+ * the clients, so servicemanager must not be running.
+ *
+ *   binder-stress [-d /dev/binder] [-p pairs] [-n calls] [-s size]
+ */
+
+/*
+ * $(CROSS_COMPILE)cc -Wall -Wextra -O2 -I../../drivers/staging/android \
+ *	-o binder-stress binder-stress.c -lpthread
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "binder.h"
+
+#define MAP_SIZE	(128 * 1024)
+#define MAX_PAYLOAD	(16 * 1024)
+
+/* transaction codes understood by the manager and the servers */
+enum {
+	CMD_REGISTER = 1,	/* server to manager: struct msg */
+	CMD_LOOKUP,		/* client to manager: index, reply struct msg */
+	CMD_ECHO,		/* client to server: payload, echoed back */
+	CMD_QUIT,		/* client to server */
+};
+
+struct msg {
+	int32_t index;
+	struct flat_binder_object obj;
+};
+
+struct binder {
+	int fd;
+	void *map;
+	/* commands queued for the next BINDER_WRITE_READ */
+	char out[256];
+	size_t out_len;
+	/* returns of the last read not handled yet */
+	uint32_t in[64];
+	size_t in_pos, in_len;
+};
+
+struct result {
+	unsigned long calls;
+	unsigned long errors;
+	unsigned long long start_ns, end_ns;
+	unsigned long long total_ns, max_ns;
+};
+
+static const char *dev = "/dev/binder";
+static int nr_pairs = 4;
+static int nr_calls = 10000;
+static int msg_size = 64;
+
+/* handle of every registered server, only touched by the manager thread */
+static uint32_t *handles;
+static int server_object;
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void binder_open(struct binder *b)
+{
+	memset(b, 0, sizeof(*b));
+	b->fd = open(dev, O_RDWR);
+	if (b->fd < 0) {
+		perror(dev);
+		exit(1);
+	}
+	b->map = mmap(NULL, MAP_SIZE, PROT_READ, MAP_PRIVATE, b->fd, 0);
+	if (b->map == MAP_FAILED) {
+		perror("mmap");
+		exit(1);
+	}
+}
+
+static void binder_put(struct binder *b, const void *data, size_t len)
+{
+	if (b->out_len + len > sizeof(b->out)) {
+		fprintf(stderr, "binder-stress: command buffer full\n");
+		exit(1);
+	}
+	memcpy(b->out + b->out_len, data, len);
+	b->out_len += len;
+}
+
+static void binder_put32(struct binder *b, uint32_t val)
+{
+	binder_put(b, &val, sizeof(val));
+}
+
+/*
+ * Writes the queued commands and, if all returns of the last read have
+ * been handled, reads new ones in the same call, like libbinder does.
+ */
+static void binder_flush(struct binder *b, int do_read)
+{
+	struct binder_write_read bwr;
+
+	memset(&bwr, 0, sizeof(bwr));
+	bwr.write_size = b->out_len;
+	bwr.write_buffer = (unsigned long)b->out;
+	if (do_read) {
+		bwr.read_size = sizeof(b->in);
+		bwr.read_buffer = (unsigned long)b->in;
+	}
+	/* the driver resumes from write_consumed after a signal */
+	while (ioctl(b->fd, BINDER_WRITE_READ, &bwr) < 0) {
+		if (errno != EINTR) {
+			perror("BINDER_WRITE_READ");
+			exit(1);
+		}
+	}
+	b->out_len = 0;
+	if (do_read) {
+		b->in_pos = 0;
+		b->in_len = bwr.read_consumed;
+	}
+}
+
+static void binder_get(struct binder *b, void *data, size_t len)
+{
+	if (b->in_pos + len > b->in_len) {
+		fprintf(stderr, "binder-stress: short read from driver\n");
+		exit(1);
+	}
+	memcpy(data, (char *)b->in + b->in_pos, len);
+	b->in_pos += len;
+}
+
+static void binder_send(struct binder *b, uint32_t cmd, uint32_t handle,
+			uint32_t code, const void *data, size_t size,
+			const size_t *offsets, size_t offsets_size)
+{
+	struct binder_transaction_data tr;
+
+	memset(&tr, 0, sizeof(tr));
+	tr.target.handle = handle;
+	tr.code = code;
+	tr.data_size = size;
+	tr.offsets_size = offsets_size;
+	tr.data.ptr.buffer = data;
+	tr.data.ptr.offsets = offsets;
+	binder_put32(b, cmd);
+	binder_put(b, &tr, sizeof(tr));
+}
+
+/* queued, so it goes to the driver with the next call or reply */
+static void binder_free_buffer(struct binder *b, const void *buffer)
+{
+	binder_put32(b, BC_FREE_BUFFER);
+	binder_put(b, &buffer, sizeof(buffer));
+}
+
+/*
+ * Flushes the queued commands and reads until a transaction, a reply or a
+ * failed call comes in, answering the reference counting requests of the
+ * driver on the way. Returns the command, with the transaction in *tr.
+ */
+static uint32_t binder_wait(struct binder *b,
+			    struct binder_transaction_data *tr)
+{
+	struct binder_ptr_cookie pc;
+	uint32_t cmd;
+
+	for (;;) {
+		if (b->in_pos == b->in_len)
+			binder_flush(b, 1);
+		binder_get(b, &cmd, sizeof(cmd));
+
+		switch (cmd) {
+		case BR_NOOP:
+		case BR_SPAWN_LOOPER:
+		case BR_TRANSACTION_COMPLETE:
+			break;
+		case BR_INCREFS:
+		case BR_ACQUIRE:
+			binder_get(b, &pc, sizeof(pc));
+			binder_put32(b, cmd == BR_INCREFS ?
+				     BC_INCREFS_DONE : BC_ACQUIRE_DONE);
+			binder_put(b, &pc, sizeof(pc));
+			break;
+		case BR_RELEASE:
+		case BR_DECREFS:
+			binder_get(b, &pc, sizeof(pc));
+			break;
+		case BR_TRANSACTION:
+		case BR_REPLY:
+			binder_get(b, tr, sizeof(*tr));
+			return cmd;
+		case BR_DEAD_REPLY:
+		case BR_FAILED_REPLY:
+			return cmd;
+		default:
+			fprintf(stderr, "binder-stress: unexpected return "
+				"%#x\n", cmd);
+			exit(1);
+		}
+	}
+}
+
+static void *manager(void *arg)
+{
+	struct binder *b = arg;
+	struct binder_transaction_data tr;
+	struct msg m;
+	size_t offset = offsetof(struct msg, obj);
+
+	binder_put32(b, BC_ENTER_LOOPER);
+	for (;;) {
+		if (binder_wait(b, &tr) != BR_TRANSACTION) {
+			fprintf(stderr, "binder-stress: manager got a "
+				"reply\n");
+			exit(1);
+		}
+		memset(&m, 0, sizeof(m));
+		m.index = -1;
+		if (tr.data_size >= sizeof(m.index))
+			memcpy(&m.index, tr.data.ptr.buffer, sizeof(m.index));
+		if (m.index < 0 || m.index >= nr_pairs) {
+			m.index = -1;
+			binder_send(b, BC_REPLY, 0, 0, &m.index,
+				    sizeof(m.index), NULL, 0);
+		} else if (tr.code == CMD_REGISTER &&
+			   tr.data_size >= sizeof(m) &&
+			   tr.offsets_size == sizeof(offset)) {
+			memcpy(&m, tr.data.ptr.buffer, sizeof(m));
+			handles[m.index] = m.obj.handle;
+			/* keep the ref once the buffer is freed */
+			binder_put32(b, BC_ACQUIRE);
+			binder_put32(b, m.obj.handle);
+			binder_send(b, BC_REPLY, 0, 0, NULL, 0, NULL, 0);
+		} else if (tr.code == CMD_LOOKUP && handles[m.index]) {
+			m.obj.type = BINDER_TYPE_HANDLE;
+			m.obj.handle = handles[m.index];
+			binder_send(b, BC_REPLY, 0, 0, &m, sizeof(m),
+				    &offset, sizeof(offset));
+		} else {
+			/* not registered yet */
+			m.index = -1;
+			binder_send(b, BC_REPLY, 0, 0, &m.index,
+				    sizeof(m.index), NULL, 0);
+		}
+		binder_free_buffer(b, tr.data.ptr.buffer);
+	}
+	return NULL;
+}
+
+static void server(int index)
+{
+	struct binder b;
+	struct binder_transaction_data tr;
+	struct msg m;
+	size_t offset = offsetof(struct msg, obj);
+
+	binder_open(&b);
+
+	memset(&m, 0, sizeof(m));
+	m.index = index;
+	m.obj.type = BINDER_TYPE_BINDER;
+	m.obj.binder = &server_object;
+	binder_send(&b, BC_TRANSACTION, 0, CMD_REGISTER, &m, sizeof(m),
+		    &offset, sizeof(offset));
+	if (binder_wait(&b, &tr) != BR_REPLY) {
+		fprintf(stderr, "binder-stress: server %d could not "
+			"register\n", index);
+		exit(1);
+	}
+	binder_free_buffer(&b, tr.data.ptr.buffer);
+
+	binder_put32(&b, BC_ENTER_LOOPER);
+	for (;;) {
+		if (binder_wait(&b, &tr) != BR_TRANSACTION) {
+			fprintf(stderr, "binder-stress: server %d got a "
+				"reply\n", index);
+			exit(1);
+		}
+		/* the reply is copied before the buffer is freed */
+		binder_send(&b, BC_REPLY, 0, 0, tr.data.ptr.buffer,
+			    tr.data_size, NULL, 0);
+		binder_free_buffer(&b, tr.data.ptr.buffer);
+		if (tr.code == CMD_QUIT)
+			break;
+	}
+	binder_flush(&b, 0);
+}
+
+static void client(int index, int out)
+{
+	struct binder b;
+	struct binder_transaction_data tr;
+	struct result r;
+	struct msg m;
+	uint32_t handle, cmd;
+	char *payload;
+	int i;
+
+	payload = malloc(msg_size);
+	if (!payload)
+		exit(1);
+	memset(payload, 'a' + index % 26, msg_size);
+	memset(&r, 0, sizeof(r));
+
+	binder_open(&b);
+
+	/* the server may not have registered yet */
+	for (;;) {
+		m.index = index;
+		binder_send(&b, BC_TRANSACTION, 0, CMD_LOOKUP, &m.index,
+			    sizeof(m.index), NULL, 0);
+		if (binder_wait(&b, &tr) != BR_REPLY) {
+			fprintf(stderr, "binder-stress: client %d lookup "
+				"failed\n", index);
+			exit(1);
+		}
+		if (tr.data_size >= sizeof(m) && tr.offsets_size) {
+			memcpy(&m, tr.data.ptr.buffer, sizeof(m));
+			handle = m.obj.handle;
+			binder_put32(&b, BC_ACQUIRE);
+			binder_put32(&b, handle);
+			binder_free_buffer(&b, tr.data.ptr.buffer);
+			break;
+		}
+		binder_free_buffer(&b, tr.data.ptr.buffer);
+		usleep(1000);
+	}
+
+	r.start_ns = now_ns();
+	for (i = 0; i < nr_calls; i++) {
+		unsigned long long t = now_ns();
+
+		memcpy(payload, &i, msg_size < (int)sizeof(i) ?
+		       msg_size : (int)sizeof(i));
+		binder_send(&b, BC_TRANSACTION, handle, CMD_ECHO, payload,
+			    msg_size, NULL, 0);
+		cmd = binder_wait(&b, &tr);
+
+		t = now_ns() - t;
+		r.calls++;
+		r.total_ns += t;
+		if (t > r.max_ns)
+			r.max_ns = t;
+
+		if (cmd != BR_REPLY) {
+			r.errors++;
+			continue;
+		}
+		if (tr.data_size != (size_t)msg_size ||
+		    memcmp(tr.data.ptr.buffer, payload, msg_size))
+			r.errors++;
+		binder_free_buffer(&b, tr.data.ptr.buffer);
+	}
+	r.end_ns = now_ns();
+
+	binder_send(&b, BC_TRANSACTION, handle, CMD_QUIT, NULL, 0, NULL, 0);
+	if (binder_wait(&b, &tr) == BR_REPLY)
+		binder_free_buffer(&b, tr.data.ptr.buffer);
+	binder_flush(&b, 0);
+
+	if (write(out, &r, sizeof(r)) != sizeof(r))
+		exit(1);
+	free(payload);
+}
+
+/* children block here until the parent is context manager */
+static pid_t spawn(int go, int results, int index, int is_server)
+{
+	pid_t pid = fork();
+	char c;
+
+	if (pid != 0)
+		return pid;
+
+	while (read(go, &c, 1) < 0 && errno == EINTR)
+		;
+	if (is_server) {
+		close(results);
+		server(index);
+	} else
+		client(index, results);
+	_exit(0);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-d device] [-p pairs] [-n calls] "
+		"[-s size]\n", prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	struct binder mgr;
+	struct result r;
+	pthread_t thread;
+	pid_t *pids;
+	int go[2], results[2];
+	unsigned long long start = ~0ULL, end = 0, total_ns = 0, max_ns = 0;
+	unsigned long calls = 0, errors = 0;
+	int opt, i, done = 0;
+
+	while ((opt = getopt(argc, argv, "d:p:n:s:")) != -1) {
+		switch (opt) {
+		case 'd':
+			dev = optarg;
+			break;
+		case 'p':
+			nr_pairs = atoi(optarg);
+			break;
+		case 'n':
+			nr_calls = atoi(optarg);
+			break;
+		case 's':
+			msg_size = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (nr_pairs < 1 || nr_calls < 1 || msg_size < 1 ||
+	    msg_size > MAX_PAYLOAD)
+		usage(argv[0]);
+
+	handles = calloc(nr_pairs, sizeof(*handles));
+	pids = calloc(2 * nr_pairs, sizeof(*pids));
+	if (!handles || !pids)
+		return 1;
+	if (pipe(go) < 0 || pipe(results) < 0) {
+		perror("pipe");
+		return 1;
+	}
+
+	/* fork before opening the device, each child gets its own proc */
+	for (i = 0; i < nr_pairs; i++) {
+		pids[2 * i] = spawn(go[0], results[1], i, 1);
+		pids[2 * i + 1] = spawn(go[0], results[1], i, 0);
+		if (pids[2 * i] < 0 || pids[2 * i + 1] < 0) {
+			perror("fork");
+			return 1;
+		}
+	}
+	close(go[0]);
+	close(results[1]);
+
+	binder_open(&mgr);
+	if (ioctl(mgr.fd, BINDER_SET_CONTEXT_MGR, 0) < 0) {
+		perror("BINDER_SET_CONTEXT_MGR (is servicemanager running?)");
+		for (i = 0; i < 2 * nr_pairs; i++)
+			kill(pids[i], SIGKILL);
+		return 1;
+	}
+	if (pthread_create(&thread, NULL, manager, &mgr)) {
+		fprintf(stderr, "binder-stress: no manager thread\n");
+		return 1;
+	}
+	close(go[1]);
+
+	/* EOF once every client has exited */
+	while (read(results[0], &r, sizeof(r)) == sizeof(r)) {
+		done++;
+		calls += r.calls;
+		errors += r.errors;
+		total_ns += r.total_ns;
+		if (r.max_ns > max_ns)
+			max_ns = r.max_ns;
+		if (r.start_ns < start)
+			start = r.start_ns;
+		if (r.end_ns > end)
+			end = r.end_ns;
+	}
+
+	/* servers whose client died never get CMD_QUIT */
+	for (i = 0; i < 2 * nr_pairs; i++) {
+		if (done < nr_pairs)
+			kill(pids[i], SIGKILL);
+		waitpid(pids[i], NULL, 0);
+	}
+	if (done < nr_pairs) {
+		fprintf(stderr, "binder-stress: %d of %d clients failed\n",
+			nr_pairs - done, nr_pairs);
+		return 1;
+	}
+
+	printf("%d pairs x %d calls of %d bytes: %.3f s, %.0f calls/s, "
+	       "avg %llu us, slowest call %llu us, %lu errors\n",
+	       nr_pairs, nr_calls, msg_size, (end - start) / 1e9,
+	       (double)calls * 1e9 / (end - start),
+	       total_ns / calls / 1000, max_ns / 1000, errors);
+
+	free(pids);
+	free(handles);
+	return errors ? 2 : 0;
+}
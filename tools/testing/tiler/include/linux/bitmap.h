@@ -0,0 +1,80 @@
+/*
+ * The bitmap helpers used by tcm-bita.c, with the semantics of
+ * lib/find_next_bit.c and lib/bitmap.c.  The searches skip whole words
+ * so that timings stay comparable to the kernel versions.
+ */
+#ifndef _SHIM_LINUX_BITMAP_H
+#define _SHIM_LINUX_BITMAP_H
+
+#include <linux/kernel.h>
+
+#define BIT_WORD(nr)		((nr) / BITS_PER_LONG)
+#define BIT_MASK(nr)		(1UL << ((nr) % BITS_PER_LONG))
+
+static inline unsigned long __find_next(const unsigned long *addr,
+					unsigned long size,
+					unsigned long offset,
+					unsigned long invert)
+{
+	unsigned long word;
+
+	if (offset >= size)
+		return size;
+
+	word = (addr[BIT_WORD(offset)] ^ invert) &
+	       (~0UL << (offset % BITS_PER_LONG));
+	offset -= offset % BITS_PER_LONG;
+
+	while (!word) {
+		offset += BITS_PER_LONG;
+		if (offset >= size)
+			return size;
+		word = addr[BIT_WORD(offset)] ^ invert;
+	}
+
+	offset += __builtin_ctzl(word);
+	return offset < size ? offset : size;
+}
+
+static inline unsigned long find_next_bit(const unsigned long *addr,
+					  unsigned long size,
+					  unsigned long offset)
+{
+	return __find_next(addr, size, offset, 0);
+}
+
+static inline unsigned long find_next_zero_bit(const unsigned long *addr,
+					       unsigned long size,
+					       unsigned long offset)
+{
+	return __find_next(addr, size, offset, ~0UL);
+}
+
+static inline void bitmap_set(unsigned long *map, int start, int nr)
+{
+	for (; nr > 0; start++, nr--)
+		map[BIT_WORD(start)] |= BIT_MASK(start);
+}
+
+static inline void bitmap_clear(unsigned long *map, int start, int nr)
+{
+	for (; nr > 0; start++, nr--)
+		map[BIT_WORD(start)] &= ~BIT_MASK(start);
+}
+
+static inline void bitmap_copy(unsigned long *dst, const unsigned long *src,
+			       int nbits)
+{
+	memcpy(dst, src, BITS_TO_LONGS(nbits) * sizeof(unsigned long));
+}
+
+static inline void bitmap_or(unsigned long *dst, const unsigned long *src1,
+			     const unsigned long *src2, int nbits)
+{
+	int k;
+
+	for (k = 0; k < BITS_TO_LONGS(nbits); k++)
+		dst[k] = src1[k] | src2[k];
+}
+
+#endif
@@ -0,0 +1,60 @@
+/*
+ * Minimal kernel environment for building the TILER container managers
+ * in userspace.  Only what tcm-sita.c and tcm-bita.c use is provided.
+ */
+#ifndef _SHIM_LINUX_KERNEL_H
+#define _SHIM_LINUX_KERNEL_H
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef int16_t s16;
+typedef int32_t s32;
+
+#define BITS_PER_LONG		(8 * __SIZEOF_LONG__)
+#define BITS_TO_LONGS(nr)	(((nr) + BITS_PER_LONG - 1) / BITS_PER_LONG)
+
+#define ALIGN(x, a)	(((x) + ((typeof(x))(a) - 1)) & ~((typeof(x))(a) - 1))
+
+#define KERN_NOTICE	""
+#define KERN_INFO	""
+#define KERN_DEBUG	""
+#define printk		printf
+
+/* number of WARN_ON()s hit, checked by the harness after every call */
+extern int tcm_warnings;
+
+#define WARN_ON(cond) ({						\
+	int __ret = !!(cond);						\
+	if (__ret) {							\
+		fprintf(stderr, "WARNING at %s:%d\n", __FILE__, __LINE__); \
+		tcm_warnings++;						\
+	}								\
+	__ret;								\
+})
+
+#define BUG_ON(cond) do {						\
+	if (cond) {							\
+		fprintf(stderr, "BUG at %s:%d\n", __FILE__, __LINE__);	\
+		abort();						\
+	}								\
+} while (0)
+
+/* the harness is single threaded, so only check for unbalanced use */
+struct mutex {
+	int locked;
+};
+
+#define mutex_init(m)		((m)->locked = 0)
+#define mutex_destroy(m)	BUG_ON((m)->locked)
+#define mutex_lock(m)		do { BUG_ON((m)->locked); (m)->locked = 1; } while (0)
+#define mutex_unlock(m)		do { BUG_ON(!(m)->locked); (m)->locked = 0; } while (0)
+
+#endif
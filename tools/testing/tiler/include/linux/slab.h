@@ -0,0 +1,12 @@
+#ifndef _SHIM_LINUX_SLAB_H
+#define _SHIM_LINUX_SLAB_H
+
+#include <linux/kernel.h>
+
+#define GFP_KERNEL	0
+
+#define kmalloc(size, flags)	malloc(size)
+#define kzalloc(size, flags)	calloc(1, size)
+#define kfree(ptr)		free(ptr)
+
+#endif
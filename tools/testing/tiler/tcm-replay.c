@@ -0,0 +1,376 @@
+/*
+ * tcm-replay.c -- replay TILER container allocation traces against SiTA
+ * and BiTA
+ *
+ * Copyright (C) 2026 LG Electronics, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * Builds tcm-sita.c and tcm-bita.c from the kernel tree against the shim
+ * headers in include/, runs the same sequence of reservations and frees
+ * through both, and checks every returned area against a shadow map of
+ * the container: it must be valid, of the requested size and alignment,
+ * and must not overlap any live area.  Reservations that succeed with one
+ * manager but fail with the other are counted, as is the time spent in
+ * each manager.
+ *
+ * A trace has one operation per line:
+ *
+ *   2 <id> <width> <height> <align>	reserve a 2D area
+ *   1 <id> <slots>			reserve a 1D area
+ *   f <id>				free the area
+ *
+ * Without a trace file a random one is generated from the seed; -g prints
+ * it instead of replaying it, so a failing run can be saved and reduced.
+ *
+ *   tcm-replay [-s seed] [-n ops] [-g] [trace]
+ */
+
+#include <linux/kernel.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "tcm-sita.h"
+#include "tcm-bita.h"
+
+/* OMAP4 container, shared by all formats */
+#define TCM_WIDTH	256
+#define TCM_HEIGHT	128
+
+/* keep the container fairly full, as a running device does */
+#define MAX_LIVE	96
+
+int tcm_warnings;
+
+struct op {
+	char type;		/* '1', '2' or 'f' */
+	int id;
+	u16 w, h;
+	u8 align;
+	u32 slots;
+};
+
+struct mgr {
+	const char *name;
+	struct tcm *tcm;
+	struct tcm_area *areas;	/* by id */
+	bool *live;		/* by id */
+	int *owner;		/* shadow map, id + 1 of the owner of a slot */
+	bool *ok;		/* by op, whether the reservation succeeded */
+	unsigned long reserved, failed, errors;
+	unsigned long long ns;
+};
+
+static struct op *ops;
+static int nr_ops, nr_ids;
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void add_op(struct op *op)
+{
+	static int size;
+
+	if (nr_ops == size) {
+		size = size ? size * 2 : 1024;
+		ops = realloc(ops, size * sizeof(*ops));
+		if (!ops) {
+			perror("realloc");
+			exit(1);
+		}
+	}
+	ops[nr_ops++] = *op;
+	if (op->id >= nr_ids)
+		nr_ids = op->id + 1;
+}
+
+static void read_trace(FILE *f)
+{
+	char line[128];
+	struct op op;
+	unsigned int w, h, align;
+	int lineno = 0;
+
+	while (fgets(line, sizeof(line), f)) {
+		lineno++;
+		memset(&op, 0, sizeof(op));
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+		if (sscanf(line, "2 %d %u %u %u", &op.id, &w, &h, &align) == 4) {
+			op.type = '2';
+			op.w = w;
+			op.h = h;
+			op.align = align;
+		} else if (sscanf(line, "1 %d %u", &op.id, &op.slots) == 2) {
+			op.type = '1';
+		} else if (sscanf(line, "f %d", &op.id) == 1) {
+			op.type = 'f';
+		} else {
+			fprintf(stderr, "line %d: bad operation\n", lineno);
+			exit(1);
+		}
+		if (op.id < 0) {
+			fprintf(stderr, "line %d: bad id\n", lineno);
+			exit(1);
+		}
+		add_op(&op);
+	}
+}
+
+/* a mix of aligned 2D buffers, unaligned 2D buffers and 1D buffers */
+static void gen_trace(unsigned int seed, int n)
+{
+	static const u8 aligns[] = { 0, 1, 32, 64 };
+	int live[MAX_LIVE], nr_live = 0, id = 0, i;
+	struct op op;
+
+	srand(seed);
+	while (nr_ops < n) {
+		memset(&op, 0, sizeof(op));
+		if (nr_live && (nr_live == MAX_LIVE || rand() % 100 < 40)) {
+			i = rand() % nr_live;
+			op.type = 'f';
+			op.id = live[i];
+			live[i] = live[--nr_live];
+		} else {
+			op.id = id++;
+			live[nr_live++] = op.id;
+			if (rand() % 2) {
+				op.type = '2';
+				op.w = 1 + rand() % 48;
+				op.h = 1 + rand() % 24;
+				op.align = aligns[rand() % 4];
+			} else {
+				op.type = '1';
+				op.slots = 1 + rand() % 2048;
+			}
+		}
+		add_op(&op);
+	}
+}
+
+static void print_trace(void)
+{
+	int i;
+
+	for (i = 0; i < nr_ops; i++) {
+		struct op *op = &ops[i];
+
+		if (op->type == '2')
+			printf("2 %d %u %u %u\n", op->id, op->w, op->h,
+			       op->align);
+		else if (op->type == '1')
+			printf("1 %d %u\n", op->id, op->slots);
+		else
+			printf("f %d\n", op->id);
+	}
+}
+
+static void error(struct mgr *m, int i, const char *msg, struct tcm_area *a)
+{
+	fprintf(stderr, "%s: op %d (id %d): %s (%d,%d)-(%d,%d)\n", m->name,
+		i, ops[i].id, msg, a->p0.x, a->p0.y, a->p1.x, a->p1.y);
+	m->errors++;
+}
+
+/*
+ * Calls fn for every slot of an area, stopping at the first non-zero
+ * return.
+ */
+static int for_each_slot(struct tcm_area *a, int (*fn)(struct mgr *, int,
+						       int), struct mgr *m,
+			 int arg)
+{
+	int x, y, i, ret;
+
+	if (a->is2d) {
+		for (y = a->p0.y; y <= a->p1.y; y++)
+			for (x = a->p0.x; x <= a->p1.x; x++) {
+				ret = fn(m, y * TCM_WIDTH + x, arg);
+				if (ret)
+					return ret;
+			}
+	} else {
+		for (i = a->p0.y * TCM_WIDTH + a->p0.x;
+		     i <= a->p1.y * TCM_WIDTH + a->p1.x; i++) {
+			ret = fn(m, i, arg);
+			if (ret)
+				return ret;
+		}
+	}
+	return 0;
+}
+
+static int slot_busy(struct mgr *m, int slot, int unused)
+{
+	return m->owner[slot] != 0;
+}
+
+static int slot_set(struct mgr *m, int slot, int owner)
+{
+	m->owner[slot] = owner;
+	return 0;
+}
+
+static void check_area(struct mgr *m, int i)
+{
+	struct op *op = &ops[i];
+	struct tcm_area *a = &m->areas[op->id];
+
+	if (!tcm_area_is_valid(a) || a->is2d != (op->type == '2')) {
+		error(m, i, "invalid area", a);
+		return;
+	}
+
+	if (op->type == '2') {
+		if (tcm_awidth(*a) != op->w || tcm_aheight(*a) != op->h)
+			error(m, i, "wrong size", a);
+		if (op->align > 1 && a->p0.x % op->align)
+			error(m, i, "misaligned", a);
+	} else if (tcm_sizeof(*a) != op->slots) {
+		error(m, i, "wrong size", a);
+	}
+
+	if (for_each_slot(a, slot_busy, m, 0))
+		error(m, i, "overlaps a live area", a);
+}
+
+static void replay(struct mgr *m)
+{
+	struct tcm_pt div_pt = { TCM_WIDTH, (3 * TCM_HEIGHT) / 4 };
+	unsigned long long t;
+	int i, ret;
+
+	/* the same divider point as tiler-main.c */
+	if (m->name[0] == 'b')
+		m->tcm = bita_init(TCM_WIDTH, TCM_HEIGHT, &div_pt);
+	else
+		m->tcm = sita_init(TCM_WIDTH, TCM_HEIGHT, &div_pt);
+	m->areas = calloc(nr_ids, sizeof(*m->areas));
+	m->live = calloc(nr_ids, sizeof(*m->live));
+	m->owner = calloc(TCM_WIDTH * TCM_HEIGHT, sizeof(*m->owner));
+	m->ok = calloc(nr_ops, sizeof(*m->ok));
+	if (!m->tcm || !m->areas || !m->live || !m->owner || !m->ok) {
+		fprintf(stderr, "%s: out of memory\n", m->name);
+		exit(1);
+	}
+
+	for (i = 0; i < nr_ops; i++) {
+		struct op *op = &ops[i];
+		struct tcm_area *a = &m->areas[op->id];
+
+		if (op->type == 'f') {
+			/* the reservation may have failed */
+			if (!m->live[op->id])
+				continue;
+			for_each_slot(a, slot_set, m, 0);
+			t = now_ns();
+			ret = tcm_free(a);
+			m->ns += now_ns() - t;
+			if (ret)
+				error(m, i, "free failed", a);
+			m->live[op->id] = false;
+			continue;
+		}
+
+		if (m->live[op->id]) {
+			fprintf(stderr, "op %d: id %d is already live\n", i,
+				op->id);
+			exit(1);
+		}
+
+		t = now_ns();
+		if (op->type == '2')
+			ret = tcm_reserve_2d(m->tcm, op->w, op->h, op->align,
+					     a);
+		else
+			ret = tcm_reserve_1d(m->tcm, op->slots, a);
+		m->ns += now_ns() - t;
+
+		if (ret) {
+			m->failed++;
+			continue;
+		}
+
+		check_area(m, i);
+		for_each_slot(a, slot_set, m, op->id + 1);
+		m->live[op->id] = true;
+		m->ok[i] = true;
+		m->reserved++;
+	}
+
+	m->errors += tcm_warnings;
+	tcm_warnings = 0;
+	tcm_deinit(m->tcm);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-s seed] [-n ops] [-g] [trace]\n", prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	struct mgr mgrs[] = { { .name = "sita" }, { .name = "bita" } };
+	unsigned int seed = 1;
+	int n = 100000, gen_only = 0, opt, i;
+	unsigned long diverged = 0, errors = 0;
+
+	while ((opt = getopt(argc, argv, "s:n:g")) != -1) {
+		switch (opt) {
+		case 's':
+			seed = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			n = atoi(optarg);
+			break;
+		case 'g':
+			gen_only = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (optind < argc) {
+		FILE *f = fopen(argv[optind], "r");
+
+		if (!f) {
+			perror(argv[optind]);
+			return 1;
+		}
+		read_trace(f);
+		fclose(f);
+	} else {
+		gen_trace(seed, n);
+	}
+
+	if (gen_only) {
+		print_trace();
+		return 0;
+	}
+
+	for (i = 0; i < 2; i++) {
+		replay(&mgrs[i]);
+		printf("%s: %lu reserved, %lu failed, %lu errors, %.3f ms\n",
+		       mgrs[i].name, mgrs[i].reserved, mgrs[i].failed,
+		       mgrs[i].errors, mgrs[i].ns / 1e6);
+		errors += mgrs[i].errors;
+	}
+
+	for (i = 0; i < nr_ops; i++)
+		if (ops[i].type != 'f' && mgrs[0].ok[i] != mgrs[1].ok[i])
+			diverged++;
+	printf("%lu of %d operations succeeded with only one manager\n",
+	       diverged, nr_ops);
+
+	return errors ? 2 : 0;
+}